@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "DeviceDispatch.h"
+#include "TimelineScheduler.h"
+
+/**
+ * Compute work submitted once per frame, either on its own compute queue or inline on the graphics queue.
+ *
+ * On the compute queue every <submit> signals the next value of that queue's timeline in the scheduler. Graphics
+ * work that consumes the results waits on <getTimeline> for that value at the stage that reads them, so the
+ * compute work only delays the passes that need it and otherwise fills shader cores the raster passes leave idle.
+ *
+ * Resources shared with graphics are expected to use concurrent sharing across both families, so no ownership
+ * transfers are needed in either direction. Without timeline semaphores the work always runs on the graphics queue
+ * and the callback has to end with a barrier to its consumer.
+ */
+class AsyncCompute
+{
+public:
+    /**
+     * Record the compute work of one frame into <cmdBuffer>. <onGraphicsQueue> tells whether the buffer goes to
+     * the graphics queue, where the work has to make its results visible with a barrier itself.
+     */
+    using RecordCallback = std::function<void(VkCommandBuffer cmdBuffer, bool onGraphicsQueue)>;
+
+    /**
+     * Create <slotCount> command buffers for each queue. <computeTimeline> may equal <graphicsTimeline>,
+     * then the work is never async. Returns false if any Vulkan call failed.
+     */
+    bool create(VkDevice computeDevice,
+                const DeviceDispatch *deviceDispatch,
+                const VkAllocationCallbacks *hostAllocator,
+                TimelineScheduler *timelineScheduler,
+                TimelineScheduler::QueueHandle asyncComputeTimeline,
+                uint32_t asyncComputeFamily,
+                TimelineScheduler::QueueHandle computeGraphicsTimeline,
+                uint32_t computeGraphicsFamily,
+                uint32_t slotCount)
+    {
+        device = computeDevice;
+        dispatch = deviceDispatch;
+        allocator = hostAllocator;
+        scheduler = timelineScheduler;
+        computeTimeline = asyncComputeTimeline;
+        computeFamily = asyncComputeFamily;
+        graphicsTimeline = computeGraphicsTimeline;
+        graphicsFamily = computeGraphicsFamily;
+
+        return createSlots(graphicsFamily, graphicsCmdPool, graphicsCmdBuffers, slotCount) &&
+               (!isAvailable() || createSlots(computeFamily, computeCmdPool, computeCmdBuffers, slotCount));
+    }
+
+    void destroy()
+    {
+        dispatch->vkDestroyCommandPool(device, graphicsCmdPool, allocator);
+        dispatch->vkDestroyCommandPool(device, computeCmdPool, allocator);
+        graphicsCmdPool = VK_NULL_HANDLE;
+        computeCmdPool = VK_NULL_HANDLE;
+    }
+
+    /**
+     * True if there is a separate compute queue and a timeline semaphore to synchronize with it
+     */
+    bool isAvailable() const
+    {
+        return scheduler->hasTimelines() && computeTimeline != graphicsTimeline;
+    }
+
+    /**
+     * Run the work on the compute queue (if available) or inline on the graphics queue
+     */
+    void setAsync(bool enabled)
+    {
+        async = enabled;
+    }
+
+    bool isAsync() const
+    {
+        return async && isAvailable();
+    }
+
+    /**
+     * Record the work of frame slot <slot> with <record> and submit it. The slot's previous submission must have
+     * completed. Returns the value of <getTimeline> graphics has to wait for, 0 if the work ran on the graphics
+     * queue and needs no wait.
+     */
+    uint64_t submit(uint32_t slot, const RecordCallback &record)
+    {
+        bool onGraphicsQueue = !isAsync();
+        VkCommandBuffer cmdBuffer = onGraphicsQueue ? graphicsCmdBuffers[slot] : computeCmdBuffers[slot];
+
+        dispatch->vkResetCommandBuffer(cmdBuffer, 0);
+
+        VkCommandBufferBeginInfo bufferBeginInfo{};
+        bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        dispatch->vkBeginCommandBuffer(cmdBuffer, &bufferBeginInfo);
+        record(cmdBuffer, onGraphicsQueue);
+        dispatch->vkEndCommandBuffer(cmdBuffer);
+
+        uint64_t value = scheduler->submit(onGraphicsQueue ? graphicsTimeline : computeTimeline,
+                                           1,
+                                           &cmdBuffer,
+                                           0,
+                                           nullptr);
+
+        return onGraphicsQueue ? 0 : value;
+    }
+
+    /**
+     * Timeline semaphore of the compute queue, what graphics waits on for the value <submit> returned
+     */
+    VkSemaphore getTimeline() const
+    {
+        return scheduler->getSemaphore(computeTimeline);
+    }
+
+    uint32_t getComputeFamily() const
+    {
+        return computeFamily;
+    }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    const DeviceDispatch *dispatch = nullptr;
+    const VkAllocationCallbacks *allocator = nullptr;
+
+    TimelineScheduler *scheduler = nullptr;
+    TimelineScheduler::QueueHandle computeTimeline = 0;
+    uint32_t computeFamily = 0;
+    TimelineScheduler::QueueHandle graphicsTimeline = 0;
+    uint32_t graphicsFamily = 0;
+
+    bool async = true;
+
+    // One command buffer per frame slot on each queue, reset and re-recorded every frame
+    VkCommandPool graphicsCmdPool = VK_NULL_HANDLE;
+    VkCommandPool computeCmdPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> graphicsCmdBuffers{};
+    std::vector<VkCommandBuffer> computeCmdBuffers{};
+
+    bool createSlots(uint32_t queueFamilyIndex,
+                     VkCommandPool &cmdPool,
+                     std::vector<VkCommandBuffer> &cmdBuffers,
+                     uint32_t slotCount)
+    {
+        VkCommandPoolCreateInfo cmdPoolCreateInfo{};
+        cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
+                                  VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        cmdPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+
+        if (dispatch->vkCreateCommandPool(device, &cmdPoolCreateInfo, allocator, &cmdPool) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        cmdBuffers.resize(slotCount);
+
+        VkCommandBufferAllocateInfo cmdBufferAllocateInfo{};
+        cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufferAllocateInfo.commandPool = cmdPool;
+        cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdBufferAllocateInfo.commandBufferCount = slotCount;
+
+        return dispatch->vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, cmdBuffers.data()) == VK_SUCCESS;
+    }
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+
+/**
+ * Destruction deferred until the GPU is done with an object.
+ *
+ * Every entry is tagged with the frame (or timeline) value of the last submission that may use the object.
+ * <collect> runs the destroy callbacks of all entries whose value the GPU has completed. Values only ever grow,
+ * so the queue stays sorted and collection stops at the first entry that is still in flight.
+ */
+class DeletionQueue
+{
+public:
+    using Destroyer = std::function<void()>;
+
+    /**
+     * Destroy with <destroyer> once <completedValue> passed to <collect> reaches <lastUseValue>
+     */
+    void push(uint64_t lastUseValue, Destroyer destroyer)
+    {
+        // Keep the order even if a caller tags with an older value than the newest entry
+        if (!entries.empty() && lastUseValue < entries.back().lastUseValue)
+        {
+            lastUseValue = entries.back().lastUseValue;
+        }
+        entries.push_back({lastUseValue, std::move(destroyer)});
+    }
+
+    /**
+     * Run every destroyer whose value is not above <completedValue>. Returns how many ran.
+     */
+    std::size_t collect(uint64_t completedValue)
+    {
+        std::size_t destroyedCount = 0;
+        while (!entries.empty() && entries.front().lastUseValue <= completedValue)
+        {
+            // Pop first, a destroyer may push new entries
+            Destroyer destroyer = std::move(entries.front().destroyer);
+            entries.pop_front();
+            destroyer();
+            destroyedCount++;
+        }
+        return destroyedCount;
+    }
+
+    /**
+     * Run every destroyer regardless of its value. Only valid once the device is idle.
+     */
+    std::size_t flush()
+    {
+        return collect(UINT64_MAX);
+    }
+
+    std::size_t size() const
+    {
+        return entries.size();
+    }
+
+    bool empty() const
+    {
+        return entries.empty();
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t lastUseValue;
+        Destroyer destroyer;
+    };
+
+    std::deque<Entry> entries{};
+};
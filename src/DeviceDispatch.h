@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/**
+ * Device level commands used on the per-frame paths. Core 1.0 commands are always present.
+ */
+#define DEVICE_DISPATCH_CORE_COMMANDS(COMMAND) \
+    COMMAND(vkGetDeviceQueue)                  \
+    COMMAND(vkDeviceWaitIdle)                  \
+    COMMAND(vkQueueSubmit)                     \
+    COMMAND(vkQueueWaitIdle)                   \
+    COMMAND(vkWaitForFences)                   \
+    COMMAND(vkResetFences)                     \
+    COMMAND(vkGetFenceStatus)                  \
+    COMMAND(vkCreateCommandPool)               \
+    COMMAND(vkDestroyCommandPool)              \
+    COMMAND(vkResetCommandPool)                \
+    COMMAND(vkAllocateCommandBuffers)          \
+    COMMAND(vkFreeCommandBuffers)              \
+    COMMAND(vkBeginCommandBuffer)              \
+    COMMAND(vkEndCommandBuffer)                \
+    COMMAND(vkResetCommandBuffer)              \
+    COMMAND(vkCmdBeginRenderPass)              \
+    COMMAND(vkCmdEndRenderPass)                \
+    COMMAND(vkCmdBindPipeline)                 \
+    COMMAND(vkCmdBindDescriptorSets)           \
+    COMMAND(vkCmdPushConstants)                \
+    COMMAND(vkCmdSetViewport)                  \
+    COMMAND(vkCmdSetScissor)                   \
+    COMMAND(vkCmdBindVertexBuffers)            \
+    COMMAND(vkCmdDraw)                         \
+    COMMAND(vkCmdDispatch)                     \
+    COMMAND(vkCmdCopyBuffer)                   \
+    COMMAND(vkCmdBlitImage)                    \
+    COMMAND(vkCmdCopyImageToBuffer)            \
+    COMMAND(vkCmdPipelineBarrier)              \
+    COMMAND(vkCmdResetQueryPool)               \
+    COMMAND(vkCmdWriteTimestamp)               \
+    COMMAND(vkGetQueryPoolResults)
+
+/**
+ * Device level commands that come from an extension. They stay null unless their extension was enabled.
+ */
+#define DEVICE_DISPATCH_EXTENSION_COMMANDS(COMMAND)                                     \
+    COMMAND(vkAcquireNextImageKHR, VK_KHR_SWAPCHAIN_EXTENSION_NAME)                     \
+    COMMAND(vkQueuePresentKHR, VK_KHR_SWAPCHAIN_EXTENSION_NAME)                         \
+    COMMAND(vkCmdSetCullModeEXT, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)          \
+    COMMAND(vkCmdSetFrontFaceEXT, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)         \
+    COMMAND(vkCmdSetPrimitiveTopologyEXT, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME) \
+    COMMAND(vkCmdSetViewportWithCountEXT, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME) \
+    COMMAND(vkCmdSetScissorWithCountEXT, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)  \
+    COMMAND(vkCmdBeginRenderingKHR, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)            \
+    COMMAND(vkCmdEndRenderingKHR, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)              \
+    COMMAND(vkCmdPipelineBarrier2KHR, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)          \
+    COMMAND(vkWaitForPresentKHR, VK_KHR_PRESENT_WAIT_EXTENSION_NAME)
+
+/**
+ * Device level commands promoted to core. Resolved by their core name from <version> on, by their extension
+ * name before that if the extension was enabled, otherwise null.
+ */
+#define DEVICE_DISPATCH_PROMOTED_COMMANDS(COMMAND)    \
+    COMMAND(vkWaitSemaphores,                         \
+            vkWaitSemaphoresKHR,                      \
+            VK_API_VERSION_1_2,                       \
+            VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) \
+    COMMAND(vkGetSemaphoreCounterValue,               \
+            vkGetSemaphoreCounterValueKHR,            \
+            VK_API_VERSION_1_2,                       \
+            VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)
+
+/**
+ * Per-device function table. Commands fetched from <vkGetDeviceProcAddr> point straight into the driver,
+ * while the exported <vkCmd*> / <vkQueue*> symbols of the loader first go through a trampoline that looks up
+ * the dispatch table of the handle. Fill it once after <vkCreateDevice> and call through it on hot paths.
+ */
+struct DeviceDispatch
+{
+#define DEVICE_DISPATCH_DECLARE_CORE(name) PFN_##name name = nullptr;
+#define DEVICE_DISPATCH_DECLARE_EXTENSION(name, extension) PFN_##name name = nullptr;
+#define DEVICE_DISPATCH_DECLARE_PROMOTED(name, extensionName, version, extension) PFN_##name name = nullptr;
+    DEVICE_DISPATCH_CORE_COMMANDS(DEVICE_DISPATCH_DECLARE_CORE)
+    DEVICE_DISPATCH_EXTENSION_COMMANDS(DEVICE_DISPATCH_DECLARE_EXTENSION)
+    DEVICE_DISPATCH_PROMOTED_COMMANDS(DEVICE_DISPATCH_DECLARE_PROMOTED)
+#undef DEVICE_DISPATCH_DECLARE_CORE
+#undef DEVICE_DISPATCH_DECLARE_EXTENSION
+#undef DEVICE_DISPATCH_DECLARE_PROMOTED
+
+    /**
+     * Resolve every command for <device> created with <apiVersion>. Extension commands are only resolved if
+     * their extension is in <enabledExtensions>. Returns <false> if a core command is missing.
+     */
+    bool load(VkDevice device, uint32_t apiVersion, const std::vector<const char *> &enabledExtensions)
+    {
+        auto extensionEnabled = [&enabledExtensions](const char *extensionName)
+        {
+            for (const char *enabledExtension: enabledExtensions)
+            {
+                if (strcmp(enabledExtension, extensionName) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        bool complete = true;
+
+#define DEVICE_DISPATCH_LOAD_CORE(name)                         \
+        name = (PFN_##name) vkGetDeviceProcAddr(device, #name); \
+        complete = complete && name != nullptr;
+#define DEVICE_DISPATCH_LOAD_EXTENSION(name, extension) \
+        name = extensionEnabled(extension) ? (PFN_##name) vkGetDeviceProcAddr(device, #name) : nullptr;
+#define DEVICE_DISPATCH_LOAD_PROMOTED(name, extensionName, version, extension)                        \
+        name = apiVersion >= (version) ? (PFN_##name) vkGetDeviceProcAddr(device, #name)              \
+             : extensionEnabled(extension) ? (PFN_##name) vkGetDeviceProcAddr(device, #extensionName) \
+             : nullptr;
+        DEVICE_DISPATCH_CORE_COMMANDS(DEVICE_DISPATCH_LOAD_CORE)
+        DEVICE_DISPATCH_EXTENSION_COMMANDS(DEVICE_DISPATCH_LOAD_EXTENSION)
+        DEVICE_DISPATCH_PROMOTED_COMMANDS(DEVICE_DISPATCH_LOAD_PROMOTED)
+#undef DEVICE_DISPATCH_LOAD_CORE
+#undef DEVICE_DISPATCH_LOAD_EXTENSION
+#undef DEVICE_DISPATCH_LOAD_PROMOTED
+
+        return complete;
+    }
+};
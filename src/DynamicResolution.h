@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/**
+ * Picks the fraction of the output resolution the scene is rendered at, so the GPU time of a frame stays within a
+ * budget. Fed with one measured GPU frame time per frame.
+ *
+ * The cost of a fill-rate-bound frame follows the pixel count, the square of the scale. Going down reacts within a
+ * few frames and jumps straight to the scale predicted to fit the budget. Going up waits for a long run of frames
+ * well under the budget and moves a single step, and only if the step is predicted to stay under it. Frame times
+ * between the two thresholds change nothing, so the scale does not flip back and forth around the budget.
+ */
+class DynamicResolution
+{
+public:
+    static constexpr double minimumScale = 0.5;
+
+    // Scales are multiples of this, a change smaller than a step is not worth re-recording for
+    static constexpr double scaleStep = 0.05;
+
+    /**
+     * Start over at full resolution with a budget of <budgetMilliseconds> per frame
+     */
+    void setBudget(double budgetMilliseconds)
+    {
+        budget = budgetMilliseconds;
+        scale = 1.0;
+        averageTime = 0.0;
+        overBudgetCount = 0;
+        underBudgetCount = 0;
+    }
+
+    double getScale() const
+    {
+        return scale;
+    }
+
+    /**
+     * Smoothed GPU time in milliseconds of the frames rendered at the current scale
+     */
+    double getAverageTime() const
+    {
+        return averageTime;
+    }
+
+    /**
+     * Add the GPU time of a frame rendered at the current scale. Returns true if the scale changed.
+     */
+    bool addFrameTime(double milliseconds)
+    {
+        averageTime = averageTime == 0.0 ? milliseconds : averageTime + (milliseconds - averageTime) / 8.0;
+
+        if (averageTime > budget)
+        {
+            underBudgetCount = 0;
+            if (++overBudgetCount < overBudgetFrames || scale <= minimumScale)
+            {
+                return false;
+            }
+            double fittingScale = scale * std::sqrt(budget * targetLoad / averageTime);
+            return changeScale(std::min(quantize(fittingScale), scale - scaleStep));
+        }
+
+        overBudgetCount = 0;
+        if (averageTime < budget * lowerThreshold)
+        {
+            if (++underBudgetCount < underBudgetFrames || scale >= 1.0)
+            {
+                return false;
+            }
+            double nextScale = std::min(1.0, scale + scaleStep);
+            double predictedTime = averageTime * (nextScale * nextScale) / (scale * scale);
+            if (predictedTime > budget * targetLoad)
+            {
+                underBudgetCount = 0;
+                return false;
+            }
+            return changeScale(nextScale);
+        }
+
+        underBudgetCount = 0;
+        return false;
+    }
+
+private:
+    // Frame times in a row needed before the scale goes down or up
+    static constexpr uint32_t overBudgetFrames = 3;
+    static constexpr uint32_t underBudgetFrames = 60;
+
+    // Fraction of the budget a new scale aims for, and below which the scale may go up
+    static constexpr double targetLoad = 0.9;
+    static constexpr double lowerThreshold = 0.75;
+
+    double budget = 0.0;
+    double scale = 1.0;
+    double averageTime = 0.0;
+    uint32_t overBudgetCount = 0;
+    uint32_t underBudgetCount = 0;
+
+    static double quantize(double value)
+    {
+        return std::floor(value / scaleStep + 1e-6) * scaleStep;
+    }
+
+    bool changeScale(double newScale)
+    {
+        newScale = std::clamp(newScale, minimumScale, 1.0);
+        overBudgetCount = 0;
+        underBudgetCount = 0;
+        if (std::abs(newScale - scale) < scaleStep / 2.0)
+        {
+            return false;
+        }
+
+        // Carry the average over as predicted for the new pixel count instead of starting over
+        averageTime = averageTime * (newScale * newScale) / (scale * scale);
+        scale = newScale;
+        return true;
+    }
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+/**
+ * Frame rate limiter that hands frames to the GPU at a fixed interval.
+ *
+ * Each frame has a deadline, one interval after the previous one, by which its CPU work should be submitted.
+ * <waitForFrameStart> blocks until the frame may start: with late input sampling that is the deadline minus the
+ * predicted CPU time of a frame, so input read right after it is as fresh as possible at submission. Without it
+ * frames start as soon as their interval begins, like a plain limiter.
+ *
+ * Waiting sleeps while the deadline is far away and spins for the last stretch. The spin margin follows how much
+ * the OS oversleeps, so the wait ends within a few microseconds without burning a core for the whole interval.
+ */
+class FramePacer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Intervals between submissions since the last <takeReport>, in milliseconds
+     */
+    struct Report
+    {
+        uint32_t frameCount = 0;
+        double meanInterval = 0.0;
+        // Standard deviation of the interval
+        double jitter = 0.0;
+        // Largest distance of one interval from the target
+        double maxDeviation = 0.0;
+        // CPU time of a frame as predicted for late input sampling
+        double predictedWork = 0.0;
+    };
+
+    void setTarget(double framesPerSecond, bool lateInputSampling)
+    {
+        interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond));
+        lateInput = lateInputSampling;
+        nextDeadline = Clock::now() + interval;
+
+        // Start pessimistic, the first frames are the slowest and an overrun costs a whole interval
+        averageWork = 0.5 / framesPerSecond;
+        averageWorkDeviation = 0.0;
+    }
+
+    /**
+     * Block until the CPU work of the next frame should start
+     */
+    void waitForFrameStart()
+    {
+        Clock::time_point now = Clock::now();
+
+        // Fell behind by more than a frame, start over from now instead of rushing to catch up
+        if (now > nextDeadline)
+        {
+            nextDeadline = now + (lateInput ? predictedWork() : interval);
+        }
+
+        Clock::time_point start = lateInput ? nextDeadline - predictedWork() : nextDeadline - interval;
+        waitUntil(start);
+        frameStart = Clock::now();
+    }
+
+    /**
+     * The frame was submitted, called once per <waitForFrameStart>
+     */
+    void endFrameWork()
+    {
+        Clock::time_point end = Clock::now();
+
+        // Mean and mean deviation of the work time, like a TCP retransmission timer
+        double work = std::chrono::duration<double>(end - frameStart).count();
+        double error = work - averageWork;
+        averageWork += error / 8.0;
+        averageWorkDeviation += (std::abs(error) - averageWorkDeviation) / 4.0;
+
+        if (lastSubmission != Clock::time_point{})
+        {
+            double submissionInterval = std::chrono::duration<double, std::milli>(end - lastSubmission).count();
+            double target = std::chrono::duration<double, std::milli>(interval).count();
+            intervalCount++;
+            intervalSum += submissionInterval;
+            intervalSquareSum += submissionInterval * submissionInterval;
+            maxDeviation = std::max(maxDeviation, std::abs(submissionInterval - target));
+        }
+        lastSubmission = end;
+        nextDeadline += interval;
+    }
+
+    /**
+     * Fill <report> and start over. Returns false if fewer than <minimumFrameCount> intervals were measured.
+     */
+    bool takeReport(Report &report, uint32_t minimumFrameCount)
+    {
+        if (intervalCount < minimumFrameCount || intervalCount == 0)
+        {
+            return false;
+        }
+
+        report.frameCount = intervalCount;
+        report.meanInterval = intervalSum / intervalCount;
+        report.jitter = std::sqrt(std::max(0.0, intervalSquareSum / intervalCount -
+                                                report.meanInterval * report.meanInterval));
+        report.maxDeviation = maxDeviation;
+        report.predictedWork = std::chrono::duration<double, std::milli>(predictedWork()).count();
+
+        intervalCount = 0;
+        intervalSum = 0.0;
+        intervalSquareSum = 0.0;
+        maxDeviation = 0.0;
+        return true;
+    }
+
+private:
+    Clock::duration interval{};
+    bool lateInput = true;
+
+    Clock::time_point nextDeadline{};
+    Clock::time_point frameStart{};
+    Clock::time_point lastSubmission{};
+
+    // Seconds
+    double averageWork = 0.0;
+    double averageWorkDeviation = 0.0;
+
+    // How much a sleep overshoots its wake time, decays slowly after outliers
+    Clock::duration spinMargin = std::chrono::microseconds(1000);
+
+    uint32_t intervalCount = 0;
+    double intervalSum = 0.0;
+    double intervalSquareSum = 0.0;
+    double maxDeviation = 0.0;
+
+    /**
+     * Work time plus four deviations, capped at one interval
+     */
+    Clock::duration predictedWork() const
+    {
+        auto predicted = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(averageWork + 4.0 * averageWorkDeviation));
+        return std::min(predicted, interval);
+    }
+
+    void waitUntil(Clock::time_point deadline)
+    {
+        Clock::time_point now = Clock::now();
+        if (deadline - now > spinMargin)
+        {
+            Clock::time_point wake = deadline - spinMargin;
+            std::this_thread::sleep_until(wake);
+
+            // Widen the margin at once on an oversleep, narrow it slowly otherwise
+            Clock::duration oversleep = Clock::now() - wake;
+            Clock::duration wantedMargin = std::max<Clock::duration>(oversleep * 2, std::chrono::microseconds(100));
+            spinMargin = wantedMargin > spinMargin ? wantedMargin : spinMargin - (spinMargin - wantedMargin) / 16;
+        }
+
+        while (Clock::now() < deadline)
+        {
+            std::this_thread::yield();
+        }
+    }
+};
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/**
+ * Host memory handed to the Vulkan implementation through <VkAllocationCallbacks>.
+ *
+ * Every allocation is accounted per <VkSystemAllocationScope>, so the report shows what the driver keeps alive and
+ * whether anything outlives <vkDestroyInstance>. In <Mode::Pool> small COMMAND and OBJECT scope allocations, which
+ * are created and freed at a high rate while recording and rebuilding objects, come from size class free lists
+ * carved out of large chunks instead of going to malloc one by one.
+ *
+ * The callbacks may be called from any thread that calls into Vulkan, all state is behind one mutex.
+ */
+class HostAllocator
+{
+public:
+    enum class Mode
+    {
+        // No callbacks, the driver uses its own allocator
+        System,
+        // malloc backed, with accounting
+        Tracking,
+        // Tracking plus size class pools for COMMAND and OBJECT scopes
+        Pool,
+    };
+
+    /**
+     * Counters of one allocation scope
+     */
+    struct ScopeStats
+    {
+        std::size_t currentBytes = 0;
+        std::size_t peakBytes = 0;
+        uint64_t allocationCount = 0;
+        uint64_t freeCount = 0;
+        // Memory the driver allocated itself and only reported through the internal notifications
+        std::size_t internalBytes = 0;
+    };
+
+    explicit HostAllocator(Mode allocatorMode = Mode::Tracking) : mode(allocatorMode)
+    {
+        callbacks.pUserData = this;
+        callbacks.pfnAllocation = allocationCallback;
+        callbacks.pfnReallocation = reallocationCallback;
+        callbacks.pfnFree = freeCallback;
+        callbacks.pfnInternalAllocation = internalAllocationCallback;
+        callbacks.pfnInternalFree = internalFreeCallback;
+    }
+
+    HostAllocator(const HostAllocator &) = delete;
+    HostAllocator &operator=(const HostAllocator &) = delete;
+
+    ~HostAllocator()
+    {
+        for (void *chunk: chunks)
+        {
+            free(chunk);
+        }
+    }
+
+    /**
+     * Callbacks to pass as <pAllocator>, null in <Mode::System>.
+     * The same pointer has to be used to destroy every object created with it.
+     */
+    const VkAllocationCallbacks *getCallbacks() const
+    {
+        return mode == Mode::System ? nullptr : &callbacks;
+    }
+
+    Mode getMode() const
+    {
+        return mode;
+    }
+
+    ScopeStats getScopeStats(VkSystemAllocationScope scope) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return scopeStats[scope];
+    }
+
+    /**
+     * True if any scope still has bytes allocated
+     */
+    bool hasLeaks() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const ScopeStats &stats: scopeStats)
+        {
+            if (stats.currentBytes != 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Print bytes per scope and how many allocations were served without calling malloc
+     */
+    void writeReport(std::ostream &out) const
+    {
+        if (mode == Mode::System)
+        {
+            return;
+        }
+
+        static const char *scopeNames[scopeCount] = {"command", "object", "cache", "device", "instance"};
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        uint64_t allocationCount = 0;
+        out << "Host allocations (" << (mode == Mode::Pool ? "pool" : "tracking") << "):" << std::endl;
+        for (uint32_t scope = 0; scope < scopeCount; scope++)
+        {
+            const ScopeStats &stats = scopeStats[scope];
+            allocationCount += stats.allocationCount;
+            out << "  " << scopeNames[scope] << ": "
+                << stats.allocationCount << " alloc, " << stats.freeCount << " free, "
+                << stats.peakBytes << " bytes peak, " << stats.currentBytes << " bytes live";
+            if (stats.internalBytes != 0)
+            {
+                out << ", " << stats.internalBytes << " bytes internal";
+            }
+            out << std::endl;
+        }
+
+        out << "  malloc calls: " << mallocCount << " for " << allocationCount << " allocation(s)";
+        if (mode == Mode::Pool)
+        {
+            out << ", " << pooledCount << " pooled, " << chunks.size() << " chunk(s) of " << chunkSize << " bytes";
+        }
+        out << std::endl;
+    }
+
+private:
+    static constexpr uint32_t scopeCount = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+    // Size classes are powers of two from <minClassSize> to <maxClassSize>, blocks are cut from <chunkSize> chunks
+    static constexpr std::size_t minClassSize = 64;
+    static constexpr std::size_t maxClassSize = 4096;
+    static constexpr uint32_t classCount = 7;
+    static constexpr std::size_t chunkSize = 64 * 1024;
+
+    // Smallest alignment handed out, also keeps the header in front of each allocation aligned
+    static constexpr std::size_t minAlignment = 16;
+
+    static constexpr int32_t unpooled = -1;
+
+    /**
+     * Stored right in front of every pointer returned to the driver
+     */
+    struct Header
+    {
+        // Start of the malloc block or pool block the allocation lives in
+        void *block;
+        std::size_t size;
+        uint32_t scope;
+        int32_t sizeClass;
+    };
+
+    Mode mode;
+    VkAllocationCallbacks callbacks{};
+
+    mutable std::mutex mutex;
+    ScopeStats scopeStats[scopeCount]{};
+    uint64_t mallocCount = 0;
+    uint64_t pooledCount = 0;
+
+    std::vector<void *> chunks{};
+    std::vector<void *> freeBlocks[classCount]{};
+
+    static HostAllocator &self(void *pUserData)
+    {
+        return *static_cast<HostAllocator *>(pUserData);
+    }
+
+    static VKAPI_ATTR void *VKAPI_CALL allocationCallback(void *pUserData,
+                                                         size_t size,
+                                                         size_t alignment,
+                                                         VkSystemAllocationScope allocationScope)
+    {
+        return self(pUserData).allocate(size, alignment, allocationScope);
+    }
+
+    static VKAPI_ATTR void *VKAPI_CALL reallocationCallback(void *pUserData,
+                                                           void *pOriginal,
+                                                           size_t size,
+                                                           size_t alignment,
+                                                           VkSystemAllocationScope allocationScope)
+    {
+        HostAllocator &allocator = self(pUserData);
+
+        if (pOriginal == nullptr)
+        {
+            return allocator.allocate(size, alignment, allocationScope);
+        }
+        if (size == 0)
+        {
+            allocator.release(pOriginal);
+            return nullptr;
+        }
+
+        // The spec keeps the scope of the original allocation on reallocation
+        const Header *original = header(pOriginal);
+        void *memory = allocator.allocate(size, alignment, (VkSystemAllocationScope) original->scope);
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+
+        memcpy(memory, pOriginal, original->size < size ? original->size : size);
+        allocator.release(pOriginal);
+        return memory;
+    }
+
+    static VKAPI_ATTR void VKAPI_CALL freeCallback(void *pUserData, void *pMemory)
+    {
+        if (pMemory != nullptr)
+        {
+            self(pUserData).release(pMemory);
+        }
+    }
+
+    static VKAPI_ATTR void VKAPI_CALL internalAllocationCallback(void *pUserData,
+                                                                size_t size,
+                                                                VkInternalAllocationType,
+                                                                VkSystemAllocationScope allocationScope)
+    {
+        HostAllocator &allocator = self(pUserData);
+        std::lock_guard<std::mutex> lock(allocator.mutex);
+        allocator.scopeStats[allocationScope].internalBytes += size;
+    }
+
+    static VKAPI_ATTR void VKAPI_CALL internalFreeCallback(void *pUserData,
+                                                          size_t size,
+                                                          VkInternalAllocationType,
+                                                          VkSystemAllocationScope allocationScope)
+    {
+        HostAllocator &allocator = self(pUserData);
+        std::lock_guard<std::mutex> lock(allocator.mutex);
+        allocator.scopeStats[allocationScope].internalBytes -= size;
+    }
+
+    static Header *header(void *memory)
+    {
+        return reinterpret_cast<Header *>(static_cast<char *>(memory) - sizeof(Header));
+    }
+
+    /**
+     * Size class whose blocks fit <blockSize> bytes, or <unpooled>
+     */
+    static int32_t sizeClassOf(std::size_t blockSize)
+    {
+        std::size_t classSize = minClassSize;
+        for (int32_t sizeClass = 0; sizeClass < (int32_t) classCount; sizeClass++, classSize *= 2)
+        {
+            if (blockSize <= classSize)
+            {
+                return sizeClass;
+            }
+        }
+        return unpooled;
+    }
+
+    void *allocate(std::size_t size, std::size_t alignment, VkSystemAllocationScope scope)
+    {
+        if (size == 0)
+        {
+            return nullptr;
+        }
+
+        alignment = alignment < minAlignment ? minAlignment : alignment;
+
+        // Enough room to push the pointer past the header and up to the next <alignment> boundary
+        std::size_t blockSize = size + sizeof(Header) + alignment;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        bool poolable = mode == Mode::Pool &&
+                        (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND || scope == VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+        int32_t sizeClass = poolable ? sizeClassOf(blockSize) : unpooled;
+
+        void *block = sizeClass == unpooled ? mallocBlock(blockSize) : poolBlock(sizeClass);
+        if (block == nullptr)
+        {
+            return nullptr;
+        }
+
+        uintptr_t address = reinterpret_cast<uintptr_t>(block) + sizeof(Header);
+        address = (address + alignment - 1) & ~(uintptr_t) (alignment - 1);
+        void *memory = reinterpret_cast<void *>(address);
+
+        Header *memoryHeader = header(memory);
+        memoryHeader->block = block;
+        memoryHeader->size = size;
+        memoryHeader->scope = scope;
+        memoryHeader->sizeClass = sizeClass;
+
+        ScopeStats &stats = scopeStats[scope];
+        stats.currentBytes += size;
+        stats.allocationCount++;
+        if (stats.currentBytes > stats.peakBytes)
+        {
+            stats.peakBytes = stats.currentBytes;
+        }
+
+        return memory;
+    }
+
+    void release(void *memory)
+    {
+        const Header *memoryHeader = header(memory);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        ScopeStats &stats = scopeStats[memoryHeader->scope];
+        stats.currentBytes -= memoryHeader->size;
+        stats.freeCount++;
+
+        if (memoryHeader->sizeClass == unpooled)
+        {
+            free(memoryHeader->block);
+        } else
+        {
+            freeBlocks[memoryHeader->sizeClass].push_back(memoryHeader->block);
+        }
+    }
+
+    void *mallocBlock(std::size_t blockSize)
+    {
+        mallocCount++;
+        return malloc(blockSize);
+    }
+
+    /**
+     * Pop a free block of <sizeClass>, cutting a new chunk into blocks when the list is empty
+     */
+    void *poolBlock(int32_t sizeClass)
+    {
+        std::vector<void *> &classBlocks = freeBlocks[sizeClass];
+
+        if (classBlocks.empty())
+        {
+            char *chunk = static_cast<char *>(mallocBlock(chunkSize));
+            if (chunk == nullptr)
+            {
+                return nullptr;
+            }
+            chunks.push_back(chunk);
+
+            std::size_t classSize = minClassSize << sizeClass;
+            for (std::size_t offset = 0; offset + classSize <= chunkSize; offset += classSize)
+            {
+                classBlocks.push_back(chunk + offset);
+            }
+        }
+
+        pooledCount++;
+        void *block = classBlocks.back();
+        classBlocks.pop_back();
+        return block;
+    }
+};
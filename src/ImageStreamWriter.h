@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Writes an RGB24 image to a file a band of rows at a time, so an image far larger than memory can be written while
+ * it is rendered. Rows have to arrive top to bottom.
+ *
+ * PNG output is stored without compression: every band becomes one IDAT chunk of uncompressed deflate blocks, which
+ * keeps the writer free of a zlib dependency and its cost linear and small. PPM is a binary P6 file, raw output is
+ * the packed rows only.
+ */
+class ImageStreamWriter
+{
+public:
+    enum class Format
+    {
+        Png,
+        Ppm,
+        Raw,
+    };
+
+    /**
+     * PNG for ".png", PPM for ".ppm", raw for every other name
+     */
+    static Format formatOf(const std::string &path)
+    {
+        auto endsWith = [&path](const std::string &suffix)
+        {
+            return path.size() >= suffix.size() &&
+                   path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+        if (endsWith(".png"))
+        {
+            return Format::Png;
+        }
+        return endsWith(".ppm") ? Format::Ppm : Format::Raw;
+    }
+
+    /**
+     * Largest width and height <imageFormat> can store. PNG keeps both below 2^31, PPM and raw have no limit.
+     */
+    static uint32_t maxDimension(Format imageFormat)
+    {
+        return imageFormat == Format::Png ? 0x7fffffffu : UINT32_MAX;
+    }
+
+    /**
+     * Open <path> and write the header of a <imageWidth> x <imageHeight> image. Returns false if that failed.
+     */
+    bool start(const std::string &path, Format imageFormat, uint32_t imageWidth, uint32_t imageHeight)
+    {
+        format = imageFormat;
+        width = imageWidth;
+        height = imageHeight;
+        rowsWritten = 0;
+        failed = false;
+
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        if (format == Format::Ppm)
+        {
+            failed = std::fprintf(file, "P6\n%u %u\n255\n", width, height) < 0;
+        } else if (format == Format::Png)
+        {
+            static const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+            write(signature, sizeof(signature));
+
+            std::vector<uint8_t> header{};
+            appendBigEndian(header, width);
+            appendBigEndian(header, height);
+            // 8 bits per channel, RGB, deflate, adaptive filtering, no interlace
+            header.insert(header.end(), {8, 2, 0, 0, 0});
+            writeChunk("IHDR", header);
+
+            deflateRemaining = ((uint64_t) 3 * width + 1) * height;
+            blockRemaining = 0;
+            adlerLow = 1;
+            adlerHigh = 0;
+        }
+
+        if (failed)
+        {
+            std::fclose(file);
+            file = nullptr;
+        }
+        return !failed;
+    }
+
+    /**
+     * Append <rowCount> rows of packed RGB24 pixels. Returns false once any write failed.
+     */
+    bool writeRows(const uint8_t *rows, uint32_t rowCount)
+    {
+        rowCount = std::min(rowCount, height - rowsWritten);
+        std::size_t rowSize = (std::size_t) 3 * width;
+
+        if (format != Format::Png)
+        {
+            write(rows, rowSize * rowCount);
+        } else
+        {
+            std::vector<uint8_t> chunk{};
+            chunk.reserve((rowSize + 1) * rowCount + 64);
+            if (rowsWritten == 0)
+            {
+                // zlib header: deflate with a 32K window, no preset dictionary, fastest level
+                chunk.insert(chunk.end(), {0x78, 0x01});
+            }
+
+            const uint8_t noFilter = 0;
+            for (uint32_t row = 0; row < rowCount; row++)
+            {
+                appendDeflated(chunk, &noFilter, 1);
+                appendDeflated(chunk, rows + row * rowSize, rowSize);
+            }
+            if (rowsWritten + rowCount == height)
+            {
+                appendBigEndian(chunk, (adlerHigh << 16) | adlerLow);
+            }
+            writeChunk("IDAT", chunk);
+        }
+
+        rowsWritten += rowCount;
+        return !failed;
+    }
+
+    /**
+     * Close the file. Returns false if any write failed or rows are missing.
+     */
+    bool finish()
+    {
+        if (format == Format::Png && !failed)
+        {
+            writeChunk("IEND", {});
+        }
+        if (std::fclose(file) != 0)
+        {
+            failed = true;
+        }
+        file = nullptr;
+        return !failed && rowsWritten == height;
+    }
+
+private:
+    // Largest stored deflate block
+    static constexpr uint32_t maxBlockSize = 65535;
+
+    Format format = Format::Raw;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t rowsWritten = 0;
+    std::FILE *file = nullptr;
+    bool failed = false;
+
+    // PNG: uncompressed bytes still to come in total and in the current stored block, and the running Adler-32
+    uint64_t deflateRemaining = 0;
+    uint32_t blockRemaining = 0;
+    uint32_t adlerLow = 1;
+    uint32_t adlerHigh = 0;
+
+    void write(const void *data, std::size_t size)
+    {
+        if (!failed && size != 0 && std::fwrite(data, size, 1, file) != 1)
+        {
+            failed = true;
+        }
+    }
+
+    /**
+     * Append <size> bytes of the zlib stream's uncompressed data, opening stored blocks as needed. The total is
+     * known up front, so the block holding the last byte is marked final.
+     */
+    void appendDeflated(std::vector<uint8_t> &chunk, const uint8_t *data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            if (blockRemaining == 0)
+            {
+                blockRemaining = (uint32_t) std::min<uint64_t>(maxBlockSize, deflateRemaining);
+                uint16_t length = (uint16_t) blockRemaining;
+                uint16_t inverseLength = (uint16_t) ~length;
+                chunk.push_back(blockRemaining == deflateRemaining ? 1 : 0);
+                chunk.push_back((uint8_t) length);
+                chunk.push_back((uint8_t) (length >> 8));
+                chunk.push_back((uint8_t) inverseLength);
+                chunk.push_back((uint8_t) (inverseLength >> 8));
+            }
+
+            std::size_t count = std::min<std::size_t>(size, blockRemaining);
+            chunk.insert(chunk.end(), data, data + count);
+            updateAdler(data, count);
+            blockRemaining -= (uint32_t) count;
+            deflateRemaining -= count;
+            data += count;
+            size -= count;
+        }
+    }
+
+    void updateAdler(const uint8_t *data, std::size_t size)
+    {
+        const uint32_t modulus = 65521;
+        while (size > 0)
+        {
+            // Largest run before the sums can overflow 32 bits
+            std::size_t count = std::min<std::size_t>(size, 5552);
+            for (std::size_t i = 0; i < count; i++)
+            {
+                adlerLow += data[i];
+                adlerHigh += adlerLow;
+            }
+            adlerLow %= modulus;
+            adlerHigh %= modulus;
+            data += count;
+            size -= count;
+        }
+    }
+
+    void writeChunk(const char *type, const std::vector<uint8_t> &data)
+    {
+        std::vector<uint8_t> header{};
+        appendBigEndian(header, (uint32_t) data.size());
+        header.insert(header.end(), type, type + 4);
+        write(header.data(), header.size());
+        write(data.data(), data.size());
+
+        uint32_t crc = updateCrc(0xffffffffu, (const uint8_t *) type, 4);
+        crc = updateCrc(crc, data.data(), data.size()) ^ 0xffffffffu;
+        std::vector<uint8_t> trailer{};
+        appendBigEndian(trailer, crc);
+        write(trailer.data(), trailer.size());
+    }
+
+    static uint32_t updateCrc(uint32_t crc, const uint8_t *data, std::size_t size)
+    {
+        static const std::vector<uint32_t> table = []()
+        {
+            std::vector<uint32_t> entries(256);
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t value = i;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    value = (value & 1) ? 0xedb88320u ^ (value >> 1) : value >> 1;
+                }
+                entries[i] = value;
+            }
+            return entries;
+        }();
+
+        for (std::size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    static void appendBigEndian(std::vector<uint8_t> &bytes, uint32_t value)
+    {
+        bytes.push_back((uint8_t) (value >> 24));
+        bytes.push_back((uint8_t) (value >> 16));
+        bytes.push_back((uint8_t) (value >> 8));
+        bytes.push_back((uint8_t) value);
+    }
+};
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "WorkStealingDeque.h"
+
+/**
+ * Jobs still running under a counter. Whoever started them waits with <JobSystem::wait>, which is also how a job
+ * depends on other jobs: it waits on their counter and runs other work meanwhile.
+ */
+class JobCounter
+{
+public:
+    bool isDone() const
+    {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<uint32_t> pending{0};
+};
+
+/**
+ * Work-stealing thread pool shared by everything that runs in parallel.
+ *
+ * Every worker owns a <WorkStealingDeque>. Jobs started on a worker go to its own deque and it runs them newest
+ * first, idle workers steal the oldest jobs of the others, which for <parallelFor> are the biggest ranges. Threads
+ * that are not workers, like the main and the render thread, start jobs through a locked queue and help running
+ * them while they <wait>. Workers with nothing to do sleep on a condition variable.
+ *
+ * Jobs must not call GLFW, most of it is main thread only. They hand such calls to <runOnMainThread> instead, the
+ * main thread runs them from <runMainThreadJobs> after <mainThreadWake> woke it up.
+ */
+class JobSystem
+{
+public:
+    using Job = std::function<void()>;
+
+    /**
+     * Start <workerCount> workers, 0 runs every job on the threads that wait for it
+     */
+    void start(uint32_t workerCount)
+    {
+        stopping = false;
+        workers.clear();
+        for (uint32_t i = 0; i < workerCount; i++)
+        {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (uint32_t i = 0; i < workerCount; i++)
+        {
+            workers[i]->thread = std::thread([this, i]()
+                                             {
+                                                 workerLoop(i);
+                                             });
+        }
+    }
+
+    /**
+     * Join the workers. Jobs still queued are dropped, wait for their counters first.
+     */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        sleepCondition.notify_all();
+        for (std::unique_ptr<Worker> &worker: workers)
+        {
+            worker->thread.join();
+        }
+        workers.clear();
+    }
+
+    uint32_t getWorkerCount() const
+    {
+        return (uint32_t) workers.size();
+    }
+
+    /**
+     * Run <job> on any thread, <counter> stays busy until it finished
+     */
+    void run(JobCounter &counter, Job job)
+    {
+        counter.pending.fetch_add(1, std::memory_order_relaxed);
+        push(new PendingJob{std::move(job), &counter});
+    }
+
+    /**
+     * Run other jobs until every job started under <counter> finished
+     */
+    void wait(const JobCounter &counter)
+    {
+        while (!counter.isDone())
+        {
+            PendingJob *job = findJob(currentWorkerIndex());
+            if (job != nullptr)
+            {
+                execute(job);
+            } else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /**
+     * Call <body>(first, last) for disjoint ranges covering [<begin>, <end>), none larger than <grainSize>, and
+     * return once all of them finished. Ranges are split in halves, so a stolen job takes half the remaining work.
+     */
+    void parallelFor(uint32_t begin,
+                     uint32_t end,
+                     uint32_t grainSize,
+                     const std::function<void(uint32_t, uint32_t)> &body)
+    {
+        JobCounter counter{};
+        splitRange(counter, begin, end, std::max(grainSize, 1u), body);
+        wait(counter);
+    }
+
+    /**
+     * Called after <runOnMainThread> queued a job, has to make the main thread call <runMainThreadJobs> soon
+     */
+    void setMainThreadWake(std::function<void()> wake)
+    {
+        mainThreadWake = std::move(wake);
+    }
+
+    /**
+     * Run <job> on the main thread, from any thread
+     */
+    void runOnMainThread(Job job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mainThreadMutex);
+            mainThreadJobs.push_back(std::move(job));
+        }
+        if (mainThreadWake)
+        {
+            mainThreadWake();
+        }
+    }
+
+    /**
+     * Main thread only. Run the jobs <runOnMainThread> queued so far.
+     */
+    void runMainThreadJobs()
+    {
+        std::vector<Job> jobs{};
+        {
+            std::lock_guard<std::mutex> lock(mainThreadMutex);
+            jobs.swap(mainThreadJobs);
+        }
+        for (Job &job: jobs)
+        {
+            job();
+        }
+    }
+
+private:
+    struct PendingJob
+    {
+        Job job;
+        JobCounter *counter;
+    };
+
+    struct Worker
+    {
+        WorkStealingDeque<PendingJob, 4096> deque{};
+        std::thread thread{};
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers{};
+
+    // Jobs started by threads that are not workers
+    std::mutex injectMutex{};
+    std::deque<PendingJob *> injectedJobs{};
+
+    // Jobs waiting in any queue, workers only sleep while this is 0
+    std::atomic<uint32_t> queuedJobCount{0};
+    std::atomic<uint32_t> sleepingWorkerCount{0};
+    std::mutex sleepMutex{};
+    std::condition_variable sleepCondition{};
+    bool stopping = false;
+
+    std::mutex mainThreadMutex{};
+    std::vector<Job> mainThreadJobs{};
+    std::function<void()> mainThreadWake{};
+
+    // Worker index of this thread in <currentSystem>, -1 on other threads
+    static inline thread_local JobSystem *currentSystem = nullptr;
+    static inline thread_local int currentWorker = -1;
+
+    int currentWorkerIndex() const
+    {
+        return currentSystem == this ? currentWorker : -1;
+    }
+
+    void push(PendingJob *job)
+    {
+        int workerIndex = currentWorkerIndex();
+        queuedJobCount.fetch_add(1, std::memory_order_seq_cst);
+
+        if (workerIndex >= 0)
+        {
+            if (!workers[workerIndex]->deque.push(job))
+            {
+                // Deque full, run it right here instead
+                queuedJobCount.fetch_sub(1, std::memory_order_relaxed);
+                execute(job);
+                return;
+            }
+        } else
+        {
+            std::lock_guard<std::mutex> lock(injectMutex);
+            injectedJobs.push_back(job);
+        }
+
+        if (sleepingWorkerCount.load(std::memory_order_seq_cst) != 0)
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            sleepCondition.notify_one();
+        }
+    }
+
+    /**
+     * Own deque first, then the injected jobs, then steal from the other workers
+     */
+    PendingJob *findJob(int workerIndex)
+    {
+        PendingJob *job = nullptr;
+        if (workerIndex >= 0)
+        {
+            job = workers[workerIndex]->deque.pop();
+        }
+
+        if (job == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(injectMutex);
+            if (!injectedJobs.empty())
+            {
+                job = injectedJobs.front();
+                injectedJobs.pop_front();
+            }
+        }
+
+        // Start at the next worker so thieves spread over the victims
+        uint32_t workerCount = (uint32_t) workers.size();
+        for (uint32_t i = 1; job == nullptr && i <= workerCount; i++)
+        {
+            uint32_t victim = (uint32_t) (workerIndex + i) % workerCount;
+            if ((int) victim != workerIndex)
+            {
+                job = workers[victim]->deque.steal();
+            }
+        }
+
+        if (job != nullptr)
+        {
+            queuedJobCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    static void execute(PendingJob *job)
+    {
+        job->job();
+        job->counter->pending.fetch_sub(1, std::memory_order_release);
+        delete job;
+    }
+
+    void workerLoop(uint32_t workerIndex)
+    {
+        currentSystem = this;
+        currentWorker = (int) workerIndex;
+
+        while (true)
+        {
+            PendingJob *job = findJob((int) workerIndex);
+            if (job != nullptr)
+            {
+                execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepingWorkerCount.fetch_add(1, std::memory_order_seq_cst);
+            sleepCondition.wait(lock, [this]()
+            {
+                return stopping || queuedJobCount.load(std::memory_order_seq_cst) != 0;
+            });
+            sleepingWorkerCount.fetch_sub(1, std::memory_order_relaxed);
+            if (stopping)
+            {
+                break;
+            }
+        }
+
+        currentSystem = nullptr;
+        currentWorker = -1;
+    }
+
+    void splitRange(JobCounter &counter,
+                    uint32_t begin,
+                    uint32_t end,
+                    uint32_t grainSize,
+                    const std::function<void(uint32_t, uint32_t)> &body)
+    {
+        // Hand off the upper half, keep splitting the lower one
+        while (end - begin > grainSize)
+        {
+            uint32_t middle = begin + (end - begin) / 2;
+            run(counter, [this, &counter, middle, end, grainSize, &body]()
+            {
+                splitRange(counter, middle, end, grainSize, body);
+            });
+            end = middle;
+        }
+        if (begin < end)
+        {
+            body(begin, end);
+        }
+    }
+};
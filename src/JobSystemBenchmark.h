@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "JobSystem.h"
+
+/**
+ * CPU only benchmark of <JobSystem> (--bench=jobs). Needs no window or device, so it runs before either exists.
+ */
+class JobSystemBenchmark
+{
+public:
+    /**
+     * Run the same CPU particle integration and a flood of empty jobs on job systems of 1, 2, 4 ... threads up to
+     * the hardware thread count, and report time and speedup over one thread for both. <computeLoad> is the
+     * iteration count of the integration, as for the GPU particles.
+     */
+    static void run(uint32_t computeLoad)
+    {
+        const uint32_t particleCount = 1u << 20;
+        const uint32_t grainSize = 1024;
+        const uint32_t emptyJobCount = 100000;
+        const int roundCount = 10;
+
+        std::vector<float> positions(particleCount * 2);
+        auto integrate = [computeLoad, &positions](uint32_t first, uint32_t last)
+        {
+            // CPU twin of particles.comp
+            for (uint32_t particle = first; particle < last; particle++)
+            {
+                float seed = (float) particle * 0.618034f;
+                float x = std::cos(seed * 6.283185f) * 0.6f;
+                float y = std::sin(seed * 6.283185f) * 0.6f;
+                for (uint32_t i = 0; i < computeLoad; i++)
+                {
+                    float nextX = x + 0.0001f * std::sin(y * 17.0f + (float) i);
+                    y += 0.0001f * std::cos(x * 17.0f - (float) i);
+                    x = nextX;
+                }
+                positions[particle * 2] = x;
+                positions[particle * 2 + 1] = y;
+            }
+        };
+
+        uint32_t hardwareThreadCount = std::max(1u, std::thread::hardware_concurrency());
+        std::cout << "Job system, " << particleCount << " particle(s) with compute load " << computeLoad
+                  << " in ranges of " << grainSize << ", " << emptyJobCount << " empty jobs, best of "
+                  << roundCount << " rounds" << std::endl;
+
+        double singleThreadParallelFor = 0.0;
+        double singleThreadEmptyJobs = 0.0;
+        for (uint32_t threadCount = 1; threadCount <= hardwareThreadCount; threadCount *= 2)
+        {
+            // The benchmarking thread helps while it waits, so it counts as one of the threads
+            JobSystem jobs{};
+            jobs.start(threadCount - 1);
+
+            double parallelForMilliseconds = 1e300;
+            double emptyJobMilliseconds = 1e300;
+            for (int round = 0; round < roundCount; round++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                jobs.parallelFor(0, particleCount, grainSize, integrate);
+                auto end = std::chrono::steady_clock::now();
+                parallelForMilliseconds = std::min(parallelForMilliseconds,
+                                                   std::chrono::duration<double, std::milli>(end - start).count());
+
+                start = std::chrono::steady_clock::now();
+                JobCounter counter{};
+                for (uint32_t job = 0; job < emptyJobCount; job++)
+                {
+                    jobs.run(counter, []()
+                    {
+                    });
+                }
+                jobs.wait(counter);
+                end = std::chrono::steady_clock::now();
+                emptyJobMilliseconds = std::min(emptyJobMilliseconds,
+                                                std::chrono::duration<double, std::milli>(end - start).count());
+            }
+            jobs.stop();
+
+            if (threadCount == 1)
+            {
+                singleThreadParallelFor = parallelForMilliseconds;
+                singleThreadEmptyJobs = emptyJobMilliseconds;
+            }
+            std::cout << "  " << threadCount << " thread(s): parallel for " << parallelForMilliseconds << " ms ("
+                      << singleThreadParallelFor / parallelForMilliseconds << "x), empty jobs "
+                      << 1e6 * emptyJobMilliseconds / emptyJobCount << " ns/job ("
+                      << singleThreadEmptyJobs / emptyJobMilliseconds << "x)" << std::endl;
+        }
+    }
+};
@@ -0,0 +1,411 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vulkan/vulkan.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define PIXEL_CONVERSION_X86
+#endif
+
+/**
+ * Conversion of 8-bit four channel pixels read back from the GPU into the layouts files and encoders expect.
+ *
+ * Swapchains are mostly BGRA, so most conversions swap red and blue and may drop alpha. On x86 the 16 pixel
+ * loops use SSSE3 byte shuffles when the CPU has them, checked once at run time so the build needs no extra flags,
+ * and SSE2 otherwise. On ARM they use NEON structure loads and stores. Remaining pixels go through scalar code.
+ *
+ * <toYuv420> produces the planar BT.601 limited range 4:2:0 frames video encoders take. Its integer math matches
+ * the scalar formulas exactly, on x86 with SSE2 16-bit lanes for eight pixels at a time.
+ */
+class PixelConversion
+{
+public:
+    /**
+     * Bytes per pixel of the formats the conversions handle, 0 for every other format
+     */
+    static uint32_t bytesPerPixel(VkFormat format)
+    {
+        switch (format)
+        {
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+            case VK_FORMAT_B8G8R8A8_UNORM:
+            case VK_FORMAT_B8G8R8A8_SRGB:
+                return 4;
+            default:
+                return 0;
+        }
+    }
+
+    static bool isBgra(VkFormat format)
+    {
+        return format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+    }
+
+    /**
+     * Copy <pixelCount> four channel pixels from <src> to <dst>, swapping the first and third channel if
+     * <swapRedBlue>. <src> and <dst> may be the same buffer.
+     */
+    static void convert4To4(const uint8_t *src, uint8_t *dst, std::size_t pixelCount, bool swapRedBlue)
+    {
+        std::size_t i = 0;
+#if defined(__ARM_NEON)
+        for (; i + 16 <= pixelCount; i += 16)
+        {
+            uint8x16x4_t pixels = vld4q_u8(src + 4 * i);
+            if (swapRedBlue)
+            {
+                uint8x16_t red = pixels.val[2];
+                pixels.val[2] = pixels.val[0];
+                pixels.val[0] = red;
+            }
+            vst4q_u8(dst + 4 * i, pixels);
+        }
+#elif defined(PIXEL_CONVERSION_X86)
+        i = hasSsse3() ? shuffle4To4Ssse3(src, dst, pixelCount, swapRedBlue)
+                       : swapRedBlue ? swapRedBlueSse2(src, dst, pixelCount) : 0;
+#endif
+        for (; i < pixelCount; i++)
+        {
+            uint8_t first = src[4 * i];
+            uint8_t third = src[4 * i + 2];
+            dst[4 * i] = swapRedBlue ? third : first;
+            dst[4 * i + 1] = src[4 * i + 1];
+            dst[4 * i + 2] = swapRedBlue ? first : third;
+            dst[4 * i + 3] = src[4 * i + 3];
+        }
+    }
+
+    /**
+     * Pack <pixelCount> four channel pixels from <src> into three channel pixels in <dst>, dropping the fourth
+     * channel and swapping the first and third if <swapRedBlue>
+     */
+    static void convert4To3(const uint8_t *src, uint8_t *dst, std::size_t pixelCount, bool swapRedBlue)
+    {
+        std::size_t i = 0;
+#if defined(__ARM_NEON)
+        for (; i + 16 <= pixelCount; i += 16)
+        {
+            uint8x16x4_t pixels = vld4q_u8(src + 4 * i);
+            uint8x16x3_t packed{};
+            packed.val[0] = swapRedBlue ? pixels.val[2] : pixels.val[0];
+            packed.val[1] = pixels.val[1];
+            packed.val[2] = swapRedBlue ? pixels.val[0] : pixels.val[2];
+            vst3q_u8(dst + 3 * i, packed);
+        }
+#elif defined(PIXEL_CONVERSION_X86)
+        if (hasSsse3())
+        {
+            i = shuffle4To3Ssse3(src, dst, pixelCount, swapRedBlue);
+        }
+#endif
+        for (; i < pixelCount; i++)
+        {
+            dst[3 * i] = src[4 * i + (swapRedBlue ? 2 : 0)];
+            dst[3 * i + 1] = src[4 * i + 1];
+            dst[3 * i + 2] = src[4 * i + (swapRedBlue ? 0 : 2)];
+        }
+    }
+
+    /**
+     * <pixelCount> pixels of <format> into RGBA
+     */
+    static void toRgba(VkFormat format, const uint8_t *src, uint8_t *dst, std::size_t pixelCount)
+    {
+        convert4To4(src, dst, pixelCount, isBgra(format));
+    }
+
+    /**
+     * <pixelCount> pixels of <format> into RGB, alpha dropped
+     */
+    static void toRgb(VkFormat format, const uint8_t *src, uint8_t *dst, std::size_t pixelCount)
+    {
+        convert4To3(src, dst, pixelCount, isBgra(format));
+    }
+
+    /**
+     * Rows [2 * <firstRowPair>, 2 * <lastRowPair>) of a <width> x <height> image of <format> into the Y, U and V
+     * planes of a 4:2:0 frame. Chroma planes are (<width> + 1) / 2 wide, an odd last row or column is averaged with
+     * itself. Row pairs are independent, so a frame can be split over threads.
+     */
+    static void toYuv420(VkFormat format,
+                         const uint8_t *pixels,
+                         std::size_t rowPitch,
+                         uint32_t width,
+                         uint32_t height,
+                         uint32_t firstRowPair,
+                         uint32_t lastRowPair,
+                         uint8_t *yPlane,
+                         uint8_t *uPlane,
+                         uint8_t *vPlane)
+    {
+        bool swapRedBlue = isBgra(format);
+        std::size_t chromaWidth = (width + 1) / 2;
+        for (uint32_t rowPair = firstRowPair; rowPair < lastRowPair; rowPair++)
+        {
+            uint32_t row = 2 * rowPair;
+            uint32_t nextRow = row + 1 < height ? row + 1 : row;
+            rowPairToYuv420(pixels + row * rowPitch,
+                            pixels + nextRow * rowPitch,
+                            width,
+                            swapRedBlue,
+                            yPlane + (std::size_t) row * width,
+                            nextRow != row ? yPlane + (std::size_t) nextRow * width : nullptr,
+                            uPlane + rowPair * chromaWidth,
+                            vPlane + rowPair * chromaWidth);
+        }
+    }
+
+private:
+    // BT.601 limited range in 8.8 fixed point, the offsets include the rounding term
+    static uint8_t lumaOf(int red, int green, int blue)
+    {
+        return (uint8_t) ((66 * red + 129 * green + 25 * blue + 4224) >> 8);
+    }
+
+    static uint8_t blueDifferenceOf(int red, int green, int blue)
+    {
+        return (uint8_t) ((112 * blue - 38 * red - 74 * green + 32896) >> 8);
+    }
+
+    static uint8_t redDifferenceOf(int red, int green, int blue)
+    {
+        return (uint8_t) ((112 * red - 94 * green - 18 * blue + 32896) >> 8);
+    }
+
+    /**
+     * Luma of both rows, null <yOut1> skips the second one, and chroma of their 2x2 averages
+     */
+    static void rowPairToYuv420(const uint8_t *row0,
+                                const uint8_t *row1,
+                                uint32_t width,
+                                bool swapRedBlue,
+                                uint8_t *yOut0,
+                                uint8_t *yOut1,
+                                uint8_t *uOut,
+                                uint8_t *vOut)
+    {
+        uint32_t x = 0;
+#if defined(PIXEL_CONVERSION_X86)
+        x = rowPairToYuv420Sse2(row0, row1, width, swapRedBlue, yOut0, yOut1, uOut, vOut);
+#endif
+        int redIndex = swapRedBlue ? 2 : 0;
+        int blueIndex = swapRedBlue ? 0 : 2;
+        for (; x < width; x += 2)
+        {
+            uint32_t x1 = x + 1 < width ? x + 1 : x;
+            int redSum = 0;
+            int greenSum = 0;
+            int blueSum = 0;
+            for (const uint8_t *row: {row0, row1})
+            {
+                for (uint32_t column: {x, x1})
+                {
+                    const uint8_t *pixel = row + 4 * column;
+                    redSum += pixel[redIndex];
+                    greenSum += pixel[1];
+                    blueSum += pixel[blueIndex];
+                }
+            }
+
+            for (uint32_t column: {x, x1})
+            {
+                const uint8_t *pixel0 = row0 + 4 * column;
+                yOut0[column] = lumaOf(pixel0[redIndex], pixel0[1], pixel0[blueIndex]);
+                if (yOut1 != nullptr)
+                {
+                    const uint8_t *pixel1 = row1 + 4 * column;
+                    yOut1[column] = lumaOf(pixel1[redIndex], pixel1[1], pixel1[blueIndex]);
+                }
+            }
+
+            int red = (redSum + 2) >> 2;
+            int green = (greenSum + 2) >> 2;
+            int blue = (blueSum + 2) >> 2;
+            uOut[x / 2] = blueDifferenceOf(red, green, blue);
+            vOut[x / 2] = redDifferenceOf(red, green, blue);
+        }
+    }
+
+#if defined(PIXEL_CONVERSION_X86)
+    /**
+     * Eight pixels of both rows per iteration, returns how many columns it converted.
+     *
+     * Channels are unpacked into the low half of 32-bit lanes, where 16-bit multiplies and adds are exact: every
+     * sum stays within 0..65535 once its offset is added first, even if an intermediate wraps.
+     */
+    static uint32_t rowPairToYuv420Sse2(const uint8_t *row0,
+                                        const uint8_t *row1,
+                                        uint32_t width,
+                                        bool swapRedBlue,
+                                        uint8_t *yOut0,
+                                        uint8_t *yOut1,
+                                        uint8_t *uOut,
+                                        uint8_t *vOut)
+    {
+        const __m128i lowByte = _mm_set1_epi32(0xFF);
+        auto channel = [&lowByte](__m128i pixels, int index)
+        {
+            return _mm_and_si128(_mm_srli_epi32(pixels, 8 * index), lowByte);
+        };
+        int redIndex = swapRedBlue ? 2 : 0;
+        int blueIndex = swapRedBlue ? 0 : 2;
+
+        auto luma = [](__m128i red, __m128i green, __m128i blue)
+        {
+            __m128i sum = _mm_add_epi16(_mm_mullo_epi16(red, _mm_set1_epi32(66)), _mm_set1_epi32(4224));
+            sum = _mm_add_epi16(sum, _mm_mullo_epi16(green, _mm_set1_epi32(129)));
+            sum = _mm_add_epi16(sum, _mm_mullo_epi16(blue, _mm_set1_epi32(25)));
+            return _mm_srli_epi16(sum, 8);
+        };
+        auto difference = [](__m128i positive, __m128i first, int firstWeight, __m128i second, int secondWeight)
+        {
+            __m128i sum = _mm_add_epi16(_mm_mullo_epi16(positive, _mm_set1_epi32(112)), _mm_set1_epi32(32896));
+            sum = _mm_sub_epi16(sum, _mm_mullo_epi16(first, _mm_set1_epi32(firstWeight)));
+            sum = _mm_sub_epi16(sum, _mm_mullo_epi16(second, _mm_set1_epi32(secondWeight)));
+            return _mm_srli_epi16(sum, 8);
+        };
+        auto storeBytes8 = [](uint8_t *out, __m128i low, __m128i high)
+        {
+            __m128i words = _mm_packs_epi32(low, high);
+            _mm_storel_epi64((__m128i *) out, _mm_packus_epi16(words, words));
+        };
+        // Lanes 0 and 2 of both inputs, each the sum of a horizontal pixel pair
+        auto pairSums = [](__m128i low, __m128i high)
+        {
+            low = _mm_add_epi32(low, _mm_srli_si128(low, 4));
+            high = _mm_add_epi32(high, _mm_srli_si128(high, 4));
+            return _mm_unpacklo_epi64(_mm_shuffle_epi32(low, _MM_SHUFFLE(3, 1, 2, 0)),
+                                      _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 1, 2, 0)));
+        };
+
+        uint32_t x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i pixels[2][2] = {{_mm_loadu_si128((const __m128i *) (row0 + 4 * x)),
+                                     _mm_loadu_si128((const __m128i *) (row0 + 4 * x + 16))},
+                                    {_mm_loadu_si128((const __m128i *) (row1 + 4 * x)),
+                                     _mm_loadu_si128((const __m128i *) (row1 + 4 * x + 16))}};
+
+            __m128i channelSums[3][2]{};
+            for (int row = 0; row < 2; row++)
+            {
+                __m128i lumas[2];
+                for (int half = 0; half < 2; half++)
+                {
+                    __m128i red = channel(pixels[row][half], redIndex);
+                    __m128i green = channel(pixels[row][half], 1);
+                    __m128i blue = channel(pixels[row][half], blueIndex);
+                    lumas[half] = luma(red, green, blue);
+                    channelSums[0][half] = _mm_add_epi32(channelSums[0][half], red);
+                    channelSums[1][half] = _mm_add_epi32(channelSums[1][half], green);
+                    channelSums[2][half] = _mm_add_epi32(channelSums[2][half], blue);
+                }
+                uint8_t *yOut = row == 0 ? yOut0 : yOut1;
+                if (yOut != nullptr)
+                {
+                    storeBytes8(yOut + x, lumas[0], lumas[1]);
+                }
+            }
+
+            // Averages of the four 2x2 blocks
+            const __m128i rounding = _mm_set1_epi32(2);
+            __m128i red = _mm_srli_epi32(_mm_add_epi32(pairSums(channelSums[0][0], channelSums[0][1]), rounding), 2);
+            __m128i green = _mm_srli_epi32(_mm_add_epi32(pairSums(channelSums[1][0], channelSums[1][1]), rounding), 2);
+            __m128i blue = _mm_srli_epi32(_mm_add_epi32(pairSums(channelSums[2][0], channelSums[2][1]), rounding), 2);
+
+            __m128i u = difference(blue, red, 38, green, 74);
+            __m128i v = difference(red, green, 94, blue, 18);
+            __m128i chroma = _mm_packus_epi16(_mm_packs_epi32(u, v), _mm_setzero_si128());
+            int32_t uBytes = _mm_cvtsi128_si32(chroma);
+            int32_t vBytes = _mm_cvtsi128_si32(_mm_srli_si128(chroma, 4));
+            memcpy(uOut + x / 2, &uBytes, 4);
+            memcpy(vOut + x / 2, &vBytes, 4);
+        }
+        return x;
+    }
+
+    static bool hasSsse3()
+    {
+        static const bool supported = __builtin_cpu_supports("ssse3");
+        return supported;
+    }
+
+    /**
+     * 16 pixels per iteration, returns how many pixels it converted
+     */
+    __attribute__((target("ssse3"))) static std::size_t shuffle4To4Ssse3(const uint8_t *src,
+                                                                         uint8_t *dst,
+                                                                         std::size_t pixelCount,
+                                                                         bool swapRedBlue)
+    {
+        const __m128i shuffle = swapRedBlue
+                                ? _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)
+                                : _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        std::size_t i = 0;
+        for (; i + 16 <= pixelCount; i += 16)
+        {
+            for (std::size_t block = 0; block < 4; block++)
+            {
+                __m128i pixels = _mm_loadu_si128((const __m128i *) (src + 4 * i + 16 * block));
+                _mm_storeu_si128((__m128i *) (dst + 4 * i + 16 * block), _mm_shuffle_epi8(pixels, shuffle));
+            }
+        }
+        return i;
+    }
+
+    /**
+     * 16 pixels per iteration, four shuffled 12 byte groups merged into three stores
+     */
+    __attribute__((target("ssse3"))) static std::size_t shuffle4To3Ssse3(const uint8_t *src,
+                                                                         uint8_t *dst,
+                                                                         std::size_t pixelCount,
+                                                                         bool swapRedBlue)
+    {
+        const __m128i shuffle = swapRedBlue
+                                ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+                                : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        std::size_t i = 0;
+        for (; i + 16 <= pixelCount; i += 16)
+        {
+            __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 4 * i)), shuffle);
+            __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 4 * i + 16)), shuffle);
+            __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 4 * i + 32)), shuffle);
+            __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (src + 4 * i + 48)), shuffle);
+
+            // 12 valid bytes each: a | b << 12, b >> 4 | c << 8, c >> 8 | d << 4
+            _mm_storeu_si128((__m128i *) (dst + 3 * i), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+            _mm_storeu_si128((__m128i *) (dst + 3 * i + 16),
+                             _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+            _mm_storeu_si128((__m128i *) (dst + 3 * i + 32),
+                             _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+        }
+        return i;
+    }
+
+    /**
+     * Red and blue swap with plain SSE2 masks and shifts, 4 pixels per iteration
+     */
+    static std::size_t swapRedBlueSse2(const uint8_t *src, uint8_t *dst, std::size_t pixelCount)
+    {
+        const __m128i greenAlpha = _mm_set1_epi32((int) 0xFF00FF00);
+        const __m128i lowByte = _mm_set1_epi32(0x000000FF);
+        std::size_t i = 0;
+        for (; i + 4 <= pixelCount; i += 4)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i *) (src + 4 * i));
+            __m128i swapped = _mm_or_si128(_mm_and_si128(pixels, greenAlpha),
+                                           _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 16), lowByte),
+                                                        _mm_slli_epi32(_mm_and_si128(pixels, lowByte), 16)));
+            _mm_storeu_si128((__m128i *) (dst + 4 * i), swapped);
+        }
+        return i;
+    }
+#endif
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "DeviceDispatch.h"
+#include "SpscQueue.h"
+
+/**
+ * Thread that waits for tagged presents with VK_KHR_present_wait and measures when each frame reached the screen,
+ * against the CPU start of the frame and the newest input event the frame consumed.
+ *
+ * The render thread hands over every present id with <track>. Presents of one swapchain complete in order, so the
+ * watcher only ever waits for the oldest one. vkWaitForPresentKHR needs the swapchain exclusively, like acquire and
+ * present, so it polls with a zero timeout under the swapchain mutex instead of blocking them for a whole frame.
+ * That limits the resolution to the poll interval.
+ *
+ * <setSwapchain> starts a new generation. Presents of an older swapchain are dropped without touching it again, so
+ * the old swapchain can be destroyed while ids of it are still queued.
+ */
+class PresentWatcher
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void start(VkDevice watchedDevice, const DeviceDispatch *deviceDispatch, std::mutex *presentSwapchainMutex)
+    {
+        device = watchedDevice;
+        dispatch = deviceDispatch;
+        swapchainMutex = presentSwapchainMutex;
+        stopping = false;
+        thread = std::thread([this]()
+                             {
+                                 run();
+                             });
+    }
+
+    /**
+     * Join the thread, presents still pending are not measured
+     */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wakeCondition.notify_one();
+        thread.join();
+    }
+
+    /**
+     * Render thread, holding the swapchain mutex. Presents from now on go to <swapchain>.
+     */
+    void setSwapchain(VkSwapchainKHR swapchain)
+    {
+        currentSwapchain = swapchain;
+        generation++;
+    }
+
+    /**
+     * Render thread. Measure the present tagged <presentId> against <frameStart>, and against <inputTime> unless
+     * it is the epoch because the frame consumed no new input.
+     */
+    void track(uint64_t presentId, Clock::time_point frameStart, Clock::time_point inputTime)
+    {
+        TrackedPresent present{presentId, generation, frameStart, inputTime};
+        while (!tracked.tryPush(present))
+        {
+            std::this_thread::yield();
+        }
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+        }
+        wakeCondition.notify_one();
+    }
+
+    /**
+     * Percentiles of both latencies, only valid after <stop>
+     */
+    void writeReport(std::ostream &stream) const
+    {
+        std::vector<double> frameLatencies{};
+        std::vector<double> inputLatencies{};
+        for (const Sample &sample: samples)
+        {
+            frameLatencies.push_back(sample.frameToPresent);
+            if (sample.inputToPresent >= 0.0)
+            {
+                inputLatencies.push_back(sample.inputToPresent);
+            }
+        }
+
+        stream << "Present timing, " << samples.size() << " present(s) measured, " << droppedCount
+               << " dropped" << std::endl;
+        writeDistribution(stream, "  frame start to present", frameLatencies);
+        writeDistribution(stream, "  input to present      ", inputLatencies);
+    }
+
+    /**
+     * One line per measured present, only valid after <stop>. Returns false if the file could not be written.
+     */
+    bool writeCsv(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+        {
+            return false;
+        }
+
+        file << "present_id,frame_to_present_ms,input_to_present_ms" << std::endl;
+        for (const Sample &sample: samples)
+        {
+            file << sample.presentId << "," << sample.frameToPresent << ",";
+            if (sample.inputToPresent >= 0.0)
+            {
+                file << sample.inputToPresent;
+            }
+            file << std::endl;
+        }
+        return (bool) file;
+    }
+
+private:
+    struct TrackedPresent
+    {
+        uint64_t presentId;
+        uint64_t generation;
+        Clock::time_point frameStart;
+        Clock::time_point inputTime;
+    };
+
+    /**
+     * Milliseconds, <inputToPresent> is negative if the frame consumed no input
+     */
+    struct Sample
+    {
+        uint64_t presentId;
+        double frameToPresent;
+        double inputToPresent;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    const DeviceDispatch *dispatch = nullptr;
+    std::thread thread{};
+
+    // Guarded by <swapchainMutex>, the generation is also read without it on the render thread that writes it
+    std::mutex *swapchainMutex = nullptr;
+    VkSwapchainKHR currentSwapchain = VK_NULL_HANDLE;
+    uint64_t generation = 0;
+
+    SpscQueue<TrackedPresent, 64> tracked{};
+
+    std::mutex wakeMutex{};
+    std::condition_variable wakeCondition{};
+    bool stopping = false;
+
+    // Watcher thread only until <stop>
+    std::vector<Sample> samples{};
+    uint64_t droppedCount = 0;
+
+    void run()
+    {
+        const std::chrono::microseconds pollInterval(200);
+        std::deque<TrackedPresent> pending{};
+
+        while (true)
+        {
+            TrackedPresent present{};
+            while (tracked.tryPop(present))
+            {
+                pending.push_back(present);
+            }
+
+            if (pending.empty())
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wakeCondition.wait(lock, [this]()
+                {
+                    return stopping || !tracked.isEmpty();
+                });
+                if (stopping)
+                {
+                    return;
+                }
+                continue;
+            }
+
+            const TrackedPresent &oldest = pending.front();
+            VkResult result;
+            {
+                std::lock_guard<std::mutex> lock(*swapchainMutex);
+                result = oldest.generation == generation
+                         ? dispatch->vkWaitForPresentKHR(device, currentSwapchain, oldest.presentId, 0)
+                         : VK_ERROR_OUT_OF_DATE_KHR;
+            }
+            Clock::time_point now = Clock::now();
+
+            if (result == VK_TIMEOUT)
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                if (wakeCondition.wait_for(lock, pollInterval, [this]()
+                {
+                    return stopping;
+                }))
+                {
+                    return;
+                }
+                continue;
+            }
+
+            if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR)
+            {
+                Sample sample{};
+                sample.presentId = oldest.presentId;
+                sample.frameToPresent = std::chrono::duration<double, std::milli>(now - oldest.frameStart).count();
+                sample.inputToPresent = oldest.inputTime == Clock::time_point{}
+                                        ? -1.0
+                                        : std::chrono::duration<double, std::milli>(now - oldest.inputTime).count();
+                samples.push_back(sample);
+            } else
+            {
+                // Swapchain replaced or lost, this present will never be reported
+                droppedCount++;
+            }
+            pending.pop_front();
+        }
+    }
+
+    static void writeDistribution(std::ostream &stream, const char *name, std::vector<double> latencies)
+    {
+        if (latencies.empty())
+        {
+            stream << name << ": no samples" << std::endl;
+            return;
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double fraction)
+        {
+            return latencies[std::min(latencies.size() - 1, (std::size_t) (fraction * latencies.size()))];
+        };
+        stream << name << ": min " << latencies.front() << " ms, p50 " << percentile(0.5) << " ms, p90 "
+               << percentile(0.9) << " ms, p99 " << percentile(0.99) << " ms, max " << latencies.back() << " ms ("
+               << latencies.size() << " sample(s))" << std::endl;
+    }
+};
@@ -0,0 +1,471 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "DeviceDispatch.h"
+#include "PixelConversion.h"
+#include "TimelineScheduler.h"
+
+/**
+ * Asynchronous readback of rendered images into host memory.
+ *
+ * <recordCopy> records a vkCmdCopyImageToBuffer of the image into the next free slot of a ring of persistently
+ * mapped buffers. The caller submits that command buffer right after the frame and hands its timeline value to
+ * <submitted>. The slot is delivered to the consumer from the scheduler's <poll> once the graphics timeline passed
+ * that value, a few frames later, so nothing ever waits for the copy. If every slot is still in flight the frame is
+ * dropped instead, or with <setDropWhenFull> off the oldest copy is waited for, when every frame has to arrive.
+ *
+ * The buffers prefer host cached memory, reading uncached write-combined memory from the CPU is very slow. The
+ * consumer gets the mapped pointer itself and must be done with it when it returns.
+ */
+class ReadbackRing
+{
+public:
+    /**
+     * One image read back, valid during the consumer call only
+     */
+    struct Frame
+    {
+        const uint8_t *pixels = nullptr;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // Bytes from one row to the next, rows are tightly packed
+        uint32_t rowPitch = 0;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        // Counts every <recordCopy> that returned a command buffer
+        uint64_t copyNumber = 0;
+    };
+
+    using Consumer = std::function<void(const Frame &)>;
+
+    /**
+     * Create <slotCount> command buffers on <graphicsFamily> whose submissions <graphicsTimeline> tracks.
+     * Buffers come with <resize>. Returns false if any Vulkan call failed.
+     */
+    bool create(VkDevice readbackDevice,
+                const DeviceDispatch *deviceDispatch,
+                const VkAllocationCallbacks *hostAllocator,
+                const VkPhysicalDeviceMemoryProperties &deviceMemoryProperties,
+                TimelineScheduler *timelineScheduler,
+                TimelineScheduler::QueueHandle readbackGraphicsTimeline,
+                uint32_t graphicsFamily,
+                uint32_t slotCount,
+                Consumer frameConsumer)
+    {
+        device = readbackDevice;
+        dispatch = deviceDispatch;
+        allocator = hostAllocator;
+        memoryProperties = deviceMemoryProperties;
+        scheduler = timelineScheduler;
+        graphicsTimeline = readbackGraphicsTimeline;
+        consumer = std::move(frameConsumer);
+
+        VkCommandPoolCreateInfo cmdPoolCreateInfo{};
+        cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        cmdPoolCreateInfo.queueFamilyIndex = graphicsFamily;
+        if (dispatch->vkCreateCommandPool(device, &cmdPoolCreateInfo, allocator, &cmdPool) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        slots.resize(slotCount);
+        std::vector<VkCommandBuffer> cmdBuffers(slotCount);
+
+        VkCommandBufferAllocateInfo cmdBufferAllocateInfo{};
+        cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufferAllocateInfo.commandPool = cmdPool;
+        cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdBufferAllocateInfo.commandBufferCount = slotCount;
+        if (dispatch->vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, cmdBuffers.data()) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < slotCount; i++)
+        {
+            slots[i].cmdBuffer = cmdBuffers[i];
+        }
+        return true;
+    }
+
+    /**
+     * Free everything. The scheduler has to be flushed first, that delivers the copies still in flight.
+     */
+    void destroy()
+    {
+        releaseBuffers();
+        dispatch->vkDestroyCommandPool(device, cmdPool, allocator);
+        cmdPool = VK_NULL_HANDLE;
+        slots.clear();
+    }
+
+    /**
+     * (Re)create the buffers for <width> x <height> images of <format>. Copies still in flight are waited for and
+     * delivered first. Returns false if the format is not supported or any Vulkan call failed.
+     */
+    bool resize(uint32_t width, uint32_t height, VkFormat format)
+    {
+        uint64_t newestValue = 0;
+        for (const Slot &slot: slots)
+        {
+            if (slot.state == SlotState::InFlight)
+            {
+                newestValue = std::max(newestValue, slot.timelineValue);
+            }
+        }
+        scheduler->waitUntil(graphicsTimeline, newestValue);
+        releaseBuffers();
+
+        uint32_t bytesPerPixel = PixelConversion::bytesPerPixel(format);
+        if (bytesPerPixel == 0)
+        {
+            return false;
+        }
+
+        imageWidth = width;
+        imageHeight = height;
+        imageFormat = format;
+        rowPitch = width * bytesPerPixel;
+        VkDeviceSize size = (VkDeviceSize) rowPitch * height;
+
+        for (Slot &slot: slots)
+        {
+            if (!createBuffer(slot, size))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Whether <recordCopy> drops the frame while every slot is in flight, the default, or waits for the oldest copy
+     */
+    void setDropWhenFull(bool drop)
+    {
+        dropWhenFull = drop;
+    }
+
+    /**
+     * Record a copy of <image>, in <layout> and last written in <writeStageMask> with <writeAccessMask>, into the
+     * next free slot. The image is back in <layout> afterwards. The returned command buffer has to be submitted on
+     * the graphics timeline after the commands writing the image, followed by <submitted>. Returns null, dropping
+     * the frame, if every slot is in flight and the ring drops when full.
+     */
+    VkCommandBuffer recordCopy(VkImage image,
+                               VkImageLayout layout,
+                               VkPipelineStageFlags writeStageMask,
+                               VkAccessFlags writeAccessMask)
+    {
+        // Pick up copies completed since the last frame before declaring the ring full
+        scheduler->poll(graphicsTimeline);
+
+        Slot *slot = findFreeSlot();
+        if (slot == nullptr && !dropWhenFull)
+        {
+            // Delivering the oldest copy frees its slot
+            uint64_t oldestValue = UINT64_MAX;
+            for (const Slot &candidate: slots)
+            {
+                if (candidate.state == SlotState::InFlight)
+                {
+                    oldestValue = std::min(oldestValue, candidate.timelineValue);
+                }
+            }
+            if (oldestValue != UINT64_MAX)
+            {
+                scheduler->waitUntil(graphicsTimeline, oldestValue);
+                slot = findFreeSlot();
+            }
+        }
+        if (slot == nullptr)
+        {
+            droppedCount++;
+            return VK_NULL_HANDLE;
+        }
+
+        VkCommandBufferBeginInfo bufferBeginInfo{};
+        bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (dispatch->vkBeginCommandBuffer(slot->cmdBuffer, &bufferBeginInfo) != VK_SUCCESS)
+        {
+            return VK_NULL_HANDLE;
+        }
+
+        VkImageMemoryBarrier imageBarrier{};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.srcAccessMask = writeAccessMask;
+        imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        imageBarrier.oldLayout = layout;
+        imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = image;
+        imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        dispatch->vkCmdPipelineBarrier(slot->cmdBuffer,
+                                       writeStageMask,
+                                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                       0,
+                                       0, nullptr,
+                                       0, nullptr,
+                                       1, &imageBarrier);
+
+        VkBufferImageCopy region{};
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageExtent = {imageWidth, imageHeight, 1};
+        dispatch->vkCmdCopyImageToBuffer(slot->cmdBuffer,
+                                         image,
+                                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                         slot->buffer,
+                                         1,
+                                         &region);
+
+        // Back to where the caller left it, and the copy made visible to host reads after the timeline wait
+        imageBarrier.srcAccessMask = 0;
+        imageBarrier.dstAccessMask = 0;
+        imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        imageBarrier.newLayout = layout;
+
+        VkBufferMemoryBarrier bufferBarrier{};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = slot->buffer;
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+
+        dispatch->vkCmdPipelineBarrier(slot->cmdBuffer,
+                                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                                       0,
+                                       0, nullptr,
+                                       1, &bufferBarrier,
+                                       1, &imageBarrier);
+
+        if (dispatch->vkEndCommandBuffer(slot->cmdBuffer) != VK_SUCCESS)
+        {
+            return VK_NULL_HANDLE;
+        }
+
+        slot->state = SlotState::Recorded;
+        slot->copyNumber = copyCount++;
+        recordedSlot = (std::size_t) (slot - slots.data());
+        nextSlot = (recordedSlot + 1) % slots.size();
+        return slot->cmdBuffer;
+    }
+
+    /**
+     * The command buffer of the last <recordCopy> was submitted and completes with <timelineValue>
+     */
+    void submitted(uint64_t timelineValue)
+    {
+        std::size_t slotIndex = recordedSlot;
+        Slot &slot = slots[slotIndex];
+        slot.state = SlotState::InFlight;
+        slot.timelineValue = timelineValue;
+
+        scheduler->onComplete(graphicsTimeline,
+                              timelineValue,
+                              [this, slotIndex]()
+                              {
+                                  deliver(slots[slotIndex]);
+                              });
+    }
+
+    uint64_t getCopyCount() const
+    {
+        return copyCount;
+    }
+
+    uint64_t getDeliveredCount() const
+    {
+        return deliveredCount;
+    }
+
+    uint64_t getDroppedCount() const
+    {
+        return droppedCount;
+    }
+
+    /**
+     * True if the buffers are host cached, false if reads go to uncached memory
+     */
+    bool isHostCached() const
+    {
+        return hostCached;
+    }
+
+private:
+    enum class SlotState
+    {
+        Free,
+        Recorded,
+        InFlight,
+    };
+
+    struct Slot
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        const uint8_t *mapped = nullptr;
+        VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+        SlotState state = SlotState::Free;
+        uint64_t timelineValue = 0;
+        uint64_t copyNumber = 0;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    const DeviceDispatch *dispatch = nullptr;
+    const VkAllocationCallbacks *allocator = nullptr;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    TimelineScheduler *scheduler = nullptr;
+    TimelineScheduler::QueueHandle graphicsTimeline = 0;
+    Consumer consumer{};
+
+    VkCommandPool cmdPool = VK_NULL_HANDLE;
+    std::vector<Slot> slots{};
+    std::size_t nextSlot = 0;
+    std::size_t recordedSlot = 0;
+
+    uint32_t imageWidth = 0;
+    uint32_t imageHeight = 0;
+    VkFormat imageFormat = VK_FORMAT_UNDEFINED;
+    uint32_t rowPitch = 0;
+    bool hostCached = false;
+    bool hostCoherent = false;
+    bool dropWhenFull = true;
+
+    uint64_t copyCount = 0;
+    uint64_t deliveredCount = 0;
+    uint64_t droppedCount = 0;
+
+    Slot *findFreeSlot()
+    {
+        for (std::size_t i = 0; i < slots.size(); i++)
+        {
+            Slot &candidate = slots[(nextSlot + i) % slots.size()];
+            if (candidate.state == SlotState::Free && candidate.buffer != VK_NULL_HANDLE)
+            {
+                return &candidate;
+            }
+        }
+        return nullptr;
+    }
+
+    void deliver(Slot &slot)
+    {
+        // Non-coherent memory needs the CPU caches invalidated before reading what the GPU wrote
+        if (!hostCoherent)
+        {
+            VkMappedMemoryRange range{};
+            range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+            range.memory = slot.memory;
+            range.offset = 0;
+            range.size = VK_WHOLE_SIZE;
+            vkInvalidateMappedMemoryRanges(device, 1, &range);
+        }
+
+        Frame frame{};
+        frame.pixels = slot.mapped;
+        frame.width = imageWidth;
+        frame.height = imageHeight;
+        frame.rowPitch = rowPitch;
+        frame.format = imageFormat;
+        frame.copyNumber = slot.copyNumber;
+        if (consumer)
+        {
+            consumer(frame);
+        }
+
+        slot.state = SlotState::Free;
+        deliveredCount++;
+    }
+
+    /**
+     * Host visible memory type for <memoryTypeBits>, cached if possible. Returns false if there is none.
+     */
+    bool chooseMemoryType(uint32_t memoryTypeBits, uint32_t &memoryTypeIndex) const
+    {
+        const VkMemoryPropertyFlags candidates[] =
+                {
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                };
+
+        for (VkMemoryPropertyFlags properties: candidates)
+        {
+            for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+            {
+                if ((memoryTypeBits & (1u << i)) &&
+                    (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+                {
+                    memoryTypeIndex = i;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool createBuffer(Slot &slot, VkDeviceSize size)
+    {
+        VkBufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.size = size;
+        bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferCreateInfo, allocator, &slot.buffer) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        VkMemoryRequirements memoryRequirements{};
+        vkGetBufferMemoryRequirements(device, slot.buffer, &memoryRequirements);
+
+        VkMemoryAllocateInfo memoryAllocateInfo{};
+        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocateInfo.allocationSize = memoryRequirements.size;
+        if (!chooseMemoryType(memoryRequirements.memoryTypeBits, memoryAllocateInfo.memoryTypeIndex))
+        {
+            return false;
+        }
+
+        VkMemoryPropertyFlags propertyFlags =
+                memoryProperties.memoryTypes[memoryAllocateInfo.memoryTypeIndex].propertyFlags;
+        hostCached = (propertyFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0;
+        hostCoherent = (propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+        void *mapped = nullptr;
+        if (vkAllocateMemory(device, &memoryAllocateInfo, allocator, &slot.memory) != VK_SUCCESS ||
+            vkBindBufferMemory(device, slot.buffer, slot.memory, 0) != VK_SUCCESS ||
+            vkMapMemory(device, slot.memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+        {
+            return false;
+        }
+        slot.mapped = (const uint8_t *) mapped;
+        return true;
+    }
+
+    void releaseBuffers()
+    {
+        for (Slot &slot: slots)
+        {
+            // Freeing mapped memory unmaps it
+            vkDestroyBuffer(device, slot.buffer, allocator);
+            vkFreeMemory(device, slot.memory, allocator);
+            slot.buffer = VK_NULL_HANDLE;
+            slot.memory = VK_NULL_HANDLE;
+            slot.mapped = nullptr;
+            slot.state = SlotState::Free;
+        }
+    }
+};
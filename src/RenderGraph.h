@@ -0,0 +1,1327 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "DeviceDispatch.h"
+
+/**
+ * How a pass touches a resource. Every usage maps to the pipeline stages, access mask and image layout it needs,
+ * see <RenderGraph::usageState>.
+ */
+enum class ResourceUsage
+{
+    ColorAttachmentWrite,
+    DepthStencilAttachmentWrite,
+    DepthStencilAttachmentRead,
+    FragmentShaderRead,
+    ComputeShaderRead,
+    ComputeShaderWrite,
+    TransferRead,
+    TransferWrite,
+    VertexBufferRead,
+    IndirectBufferRead,
+    Present,
+};
+
+/**
+ * A frame graph. Passes declare which images and buffers they read and write, <compile> then culls passes whose
+ * outputs are never consumed, orders the remaining ones and derives the minimal set of pipeline barriers between
+ * them. Compilation never touches the GPU, only <allocateTransients> and <record> do.
+ *
+ * Transient resources (<createImage>, <createBuffer>) are owned by the graph. <planMemory> places transients whose
+ * lifetimes do not overlap into the same memory range and adds the aliasing barriers that hand the memory over.
+ */
+class RenderGraph
+{
+public:
+    using ResourceHandle = uint32_t;
+    using PassHandle = uint32_t;
+
+    /**
+     * Synchronization scope of a single <ResourceUsage>.
+     * Only stage and access bits shared by synchronization2 and the legacy flags are used,
+     * so the masks can be narrowed to 32 bits for <vkCmdPipelineBarrier>.
+     */
+    struct UsageState
+    {
+        VkPipelineStageFlags2KHR stageMask = 0;
+        VkAccessFlags2KHR accessMask = 0;
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        bool write = false;
+    };
+
+    /**
+     * A barrier on one resource, placed in front of a pass or at the end of the graph
+     */
+    struct Barrier
+    {
+        ResourceHandle resource = 0;
+
+        // Set if the barrier also orders against other transients sharing this resource's memory
+        bool aliasing = false;
+
+        VkPipelineStageFlags2KHR srcStageMask = 0;
+        VkAccessFlags2KHR srcAccessMask = 0;
+        VkPipelineStageFlags2KHR dstStageMask = 0;
+        VkAccessFlags2KHR dstAccessMask = 0;
+        VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkImageLayout newLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    };
+
+    /**
+     * A scheduled pass together with the batch of barriers recorded right before it
+     */
+    struct CompiledPass
+    {
+        PassHandle pass = 0;
+        std::vector<Barrier> barriers{};
+    };
+
+    /**
+     * Where <planMemory> put a transient resource
+     */
+    struct MemoryPlacement
+    {
+        uint32_t memoryTypeIndex = 0;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+    };
+
+    /**
+     * Memory used by the transient resources of this frame configuration
+     */
+    struct MemoryReport
+    {
+        // Every transient in its own allocation
+        VkDeviceSize naiveBytes = 0;
+
+        // Transients with disjoint lifetimes sharing memory
+        VkDeviceSize aliasedBytes = 0;
+
+        std::size_t transientCount = 0;
+        std::size_t aliasingBarrierCount = 0;
+    };
+
+    using PassCallback = std::function<void(VkCommandBuffer, const RenderGraph &)>;
+
+    static UsageState usageState(ResourceUsage usage)
+    {
+        switch (usage)
+        {
+            case ResourceUsage::ColorAttachmentWrite:
+                return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+                        VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR,
+                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                        true};
+            case ResourceUsage::DepthStencilAttachmentWrite:
+                return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR |
+                        VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR,
+                        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR |
+                        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR,
+                        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                        true};
+            case ResourceUsage::DepthStencilAttachmentRead:
+                return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR |
+                        VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR,
+                        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR,
+                        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                        false};
+            case ResourceUsage::FragmentShaderRead:
+                return {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR,
+                        VK_ACCESS_2_SHADER_READ_BIT_KHR,
+                        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        false};
+            case ResourceUsage::ComputeShaderRead:
+                return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+                        VK_ACCESS_2_SHADER_READ_BIT_KHR,
+                        VK_IMAGE_LAYOUT_GENERAL,
+                        false};
+            case ResourceUsage::ComputeShaderWrite:
+                return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+                        VK_ACCESS_2_SHADER_READ_BIT_KHR | VK_ACCESS_2_SHADER_WRITE_BIT_KHR,
+                        VK_IMAGE_LAYOUT_GENERAL,
+                        true};
+            case ResourceUsage::TransferRead:
+                return {VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+                        VK_ACCESS_2_TRANSFER_READ_BIT_KHR,
+                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        false};
+            case ResourceUsage::TransferWrite:
+                return {VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+                        VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        true};
+            case ResourceUsage::VertexBufferRead:
+                return {VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR,
+                        VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT_KHR,
+                        VK_IMAGE_LAYOUT_UNDEFINED,
+                        false};
+            case ResourceUsage::IndirectBufferRead:
+                return {VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR,
+                        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR,
+                        VK_IMAGE_LAYOUT_UNDEFINED,
+                        false};
+            case ResourceUsage::Present:
+                return {VK_PIPELINE_STAGE_2_NONE_KHR,
+                        VK_ACCESS_2_NONE_KHR,
+                        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                        false};
+        }
+
+        return {};
+    }
+
+    /**
+     * Import an image owned outside the graph, e.g. a swapchain image.
+     * <initialStageMask> is the stage the image is known to be available at, for a swapchain image this
+     * is the wait stage of the acquire semaphore.
+     */
+    ResourceHandle importImage(const std::string &name,
+                               VkImage image,
+                               VkImageView imageView,
+                               VkImageAspectFlags aspectMask,
+                               VkImageLayout initialLayout,
+                               VkPipelineStageFlags2KHR initialStageMask)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.isImage = true;
+        resource.imported = true;
+        resource.image = image;
+        resource.imageView = imageView;
+        resource.aspectMask = aspectMask;
+        resource.initialLayout = initialLayout;
+        resource.initialStageMask = initialStageMask;
+        resources.push_back(resource);
+        return (ResourceHandle) (resources.size() - 1);
+    }
+
+    /**
+     * Import a buffer owned outside the graph
+     */
+    ResourceHandle importBuffer(const std::string &name,
+                                VkBuffer buffer,
+                                VkPipelineStageFlags2KHR initialStageMask)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.isImage = false;
+        resource.imported = true;
+        resource.buffer = buffer;
+        resource.initialStageMask = initialStageMask;
+        resources.push_back(resource);
+        return (ResourceHandle) (resources.size() - 1);
+    }
+
+    /**
+     * Declare a transient image. It is created, placed in memory and destroyed by the graph,
+     * and its contents do not survive from one frame to the next.
+     * <createInfo.usage> has to cover every usage the passes declare.
+     */
+    ResourceHandle createImage(const std::string &name,
+                               const VkImageCreateInfo &createInfo,
+                               VkImageAspectFlags aspectMask)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.isImage = true;
+        resource.imageCreateInfo = createInfo;
+        resource.aspectMask = aspectMask;
+        resources.push_back(resource);
+        return (ResourceHandle) (resources.size() - 1);
+    }
+
+    /**
+     * Declare a transient buffer, see <createImage>
+     */
+    ResourceHandle createBuffer(const std::string &name, const VkBufferCreateInfo &createInfo)
+    {
+        Resource resource{};
+        resource.name = name;
+        resource.isImage = false;
+        resource.bufferCreateInfo = createInfo;
+        resources.push_back(resource);
+        return (ResourceHandle) (resources.size() - 1);
+    }
+
+    /**
+     * Replace the image behind an imported <resource>. The compiled schedule stays valid,
+     * so one compiled graph can be recorded for every swapchain image.
+     */
+    void bindImage(ResourceHandle resource, VkImage image, VkImageView imageView)
+    {
+        resources[resource].image = image;
+        resources[resource].imageView = imageView;
+    }
+
+    void bindBuffer(ResourceHandle resource, VkBuffer buffer)
+    {
+        resources[resource].buffer = buffer;
+    }
+
+    VkImage getImage(ResourceHandle resource) const
+    {
+        return resources[resource].image;
+    }
+
+    VkImageView getImageView(ResourceHandle resource) const
+    {
+        return resources[resource].imageView;
+    }
+
+    VkBuffer getBuffer(ResourceHandle resource) const
+    {
+        return resources[resource].buffer;
+    }
+
+    /**
+     * The resource leaves the graph in the state of <usage>, e.g. <ResourceUsage::Present>.
+     * This also marks it as an output, so the passes producing it are never culled.
+     */
+    void setFinalUsage(ResourceHandle resource, ResourceUsage usage)
+    {
+        resources[resource].hasFinalUsage = true;
+        resources[resource].finalUsage = usage;
+        resources[resource].output = true;
+    }
+
+    /**
+     * Mark a resource as consumed outside the graph without a final transition
+     */
+    void markOutput(ResourceHandle resource)
+    {
+        resources[resource].output = true;
+    }
+
+    /**
+     * Add a pass. <execute> records its commands and looks up resource handles through the graph,
+     * barriers are recorded by the graph.
+     */
+    PassHandle addPass(const std::string &name, PassCallback execute)
+    {
+        Pass pass{};
+        pass.name = name;
+        pass.execute = std::move(execute);
+        passes.push_back(pass);
+        return (PassHandle) (passes.size() - 1);
+    }
+
+    void reads(PassHandle pass, ResourceHandle resource, ResourceUsage usage)
+    {
+        passes[pass].accesses.push_back({resource, usage, false});
+    }
+
+    void writes(PassHandle pass, ResourceHandle resource, ResourceUsage usage)
+    {
+        passes[pass].accesses.push_back({resource, usage, true});
+    }
+
+    /**
+     * A pass with side effects outside the graph (e.g. a readback) is never culled
+     */
+    void setSideEffects(PassHandle pass)
+    {
+        passes[pass].sideEffects = true;
+    }
+
+    /**
+     * Cull, order and derive barriers. Has to be called again after passes or resources are added.
+     */
+    void compile()
+    {
+        cullPasses();
+        schedulePasses();
+        computeLifetimes();
+        generateBarriers();
+    }
+
+    /**
+     * Record the memory requirements of transient <resource> and the memory type it has to live in
+     */
+    void setMemoryRequirements(ResourceHandle resource,
+                               const VkMemoryRequirements &memoryRequirements,
+                               uint32_t memoryTypeIndex)
+    {
+        resources[resource].memoryRequirements = memoryRequirements;
+        resources[resource].placement.memoryTypeIndex = memoryTypeIndex;
+        resources[resource].placement.size = memoryRequirements.size;
+    }
+
+    /**
+     * <VkPhysicalDeviceLimits::bufferImageGranularity> of the device the transients are allocated on, <planMemory>
+     * keeps linear and optimal tiling resources that are alive at the same time on separate pages of that size
+     */
+    void setBufferImageGranularity(VkDeviceSize granularity)
+    {
+        bufferImageGranularity = std::max<VkDeviceSize>(granularity, 1);
+    }
+
+    /**
+     * Place the transients of the compiled graph into one memory block per memory type.
+     * Largest first, each transient takes the lowest aligned offset that does not collide with a transient whose
+     * lifetime overlaps its own. Barriers are regenerated so the first use of a transient also waits for every
+     * other transient sharing its memory. Needs <compile> and <setMemoryRequirements> first, never touches the GPU.
+     */
+    void planMemory()
+    {
+        memoryBlockSizes.clear();
+        memoryReport = MemoryReport{};
+
+        std::vector<ResourceHandle> transients{};
+        for (ResourceHandle resource = 0; resource < resources.size(); resource++)
+        {
+            if (isLiveTransient(resource))
+            {
+                transients.push_back(resource);
+                memoryReport.naiveBytes += resources[resource].memoryRequirements.size;
+            }
+        }
+        memoryReport.transientCount = transients.size();
+
+        std::stable_sort(transients.begin(),
+                         transients.end(),
+                         [this](ResourceHandle a, ResourceHandle b)
+                         {
+                             return resources[a].memoryRequirements.size > resources[b].memoryRequirements.size;
+                         });
+
+        std::vector<ResourceHandle> placed{};
+        for (ResourceHandle resource: transients)
+        {
+            Resource &current = resources[resource];
+            VkDeviceSize alignment = std::max<VkDeviceSize>(current.memoryRequirements.alignment, 1);
+
+            // Candidate offsets are the start of the block and the end of every colliding placement
+            std::vector<VkDeviceSize> candidates{0};
+            for (ResourceHandle other: placed)
+            {
+                if (sharesMemoryType(resource, other) && lifetimesOverlap(resource, other))
+                {
+                    const MemoryPlacement &otherPlacement = resources[other].placement;
+                    VkDeviceSize end = otherPlacement.offset + otherPlacement.size;
+                    if (isLinear(resource) != isLinear(other))
+                    {
+                        end = alignUp(end, bufferImageGranularity);
+                    }
+                    candidates.push_back(alignUp(end, alignment));
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+
+            for (VkDeviceSize candidate: candidates)
+            {
+                bool collides = false;
+                for (ResourceHandle other: placed)
+                {
+                    if (sharesMemoryType(resource, other) && lifetimesOverlap(resource, other) &&
+                        placementCollides(resource, candidate, other))
+                    {
+                        collides = true;
+                        break;
+                    }
+                }
+
+                if (!collides)
+                {
+                    current.placement.offset = candidate;
+                    break;
+                }
+            }
+
+            VkDeviceSize &blockSize = memoryBlockSizes[current.placement.memoryTypeIndex];
+            blockSize = std::max(blockSize, current.placement.offset + current.placement.size);
+            placed.push_back(resource);
+        }
+
+        for (const auto &block: memoryBlockSizes)
+        {
+            memoryReport.aliasedBytes += block.second;
+        }
+
+        // Every transient waits for the stages of everything that shares its memory, including the other
+        // transients of the previous frame, before its first use
+        for (ResourceHandle resource: transients)
+        {
+            Resource &current = resources[resource];
+            current.aliasStageMask = current.usageStageMask;
+            current.aliasAccessMask = current.usageWriteAccessMask;
+            current.aliased = false;
+
+            for (ResourceHandle other: transients)
+            {
+                if (other != resource && memoryOverlaps(resource, other))
+                {
+                    current.aliasStageMask |= resources[other].usageStageMask;
+                    current.aliasAccessMask |= resources[other].usageWriteAccessMask;
+                    current.aliased = true;
+                }
+            }
+        }
+
+        generateBarriers();
+
+        for (const CompiledPass &compiledPass: schedule)
+        {
+            memoryReport.aliasingBarrierCount += std::count_if(compiledPass.barriers.begin(),
+                                                               compiledPass.barriers.end(),
+                                                               [](const Barrier &barrier)
+                                                               {
+                                                                   return barrier.aliasing;
+                                                               });
+        }
+    }
+
+    /**
+     * Create the transient resources, place them with <planMemory>, then allocate one memory block per memory type,
+     * bind and create image views. <chooseMemoryType> maps the memory requirements of a resource to a memory type.
+     * <allocator> is used for every object and allocation, <releaseTransients> must get the same one.
+     * Returns false if any Vulkan call failed.
+     */
+    bool allocateTransients(VkDevice device,
+                            const VkAllocationCallbacks *allocator,
+                            const std::function<uint32_t(const VkMemoryRequirements &)> &chooseMemoryType)
+    {
+        for (ResourceHandle resource = 0; resource < resources.size(); resource++)
+        {
+            if (!isLiveTransient(resource))
+            {
+                continue;
+            }
+
+            Resource &current = resources[resource];
+            VkMemoryRequirements memoryRequirements{};
+
+            if (current.isImage)
+            {
+                if (vkCreateImage(device, &current.imageCreateInfo, allocator, &current.image) != VK_SUCCESS)
+                {
+                    return false;
+                }
+                vkGetImageMemoryRequirements(device, current.image, &memoryRequirements);
+            } else
+            {
+                if (vkCreateBuffer(device, &current.bufferCreateInfo, allocator, &current.buffer) != VK_SUCCESS)
+                {
+                    return false;
+                }
+                vkGetBufferMemoryRequirements(device, current.buffer, &memoryRequirements);
+            }
+
+            setMemoryRequirements(resource, memoryRequirements, chooseMemoryType(memoryRequirements));
+        }
+
+        planMemory();
+
+        for (const auto &block: memoryBlockSizes)
+        {
+            VkMemoryAllocateInfo memoryAllocateInfo{};
+            memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            memoryAllocateInfo.allocationSize = block.second;
+            memoryAllocateInfo.memoryTypeIndex = block.first;
+
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            if (vkAllocateMemory(device, &memoryAllocateInfo, allocator, &memory) != VK_SUCCESS)
+            {
+                return false;
+            }
+            memoryBlocks[block.first] = memory;
+        }
+
+        for (ResourceHandle resource = 0; resource < resources.size(); resource++)
+        {
+            if (!isLiveTransient(resource))
+            {
+                continue;
+            }
+
+            Resource &current = resources[resource];
+            VkDeviceMemory memory = memoryBlocks[current.placement.memoryTypeIndex];
+
+            if (current.isImage)
+            {
+                if (vkBindImageMemory(device, current.image, memory, current.placement.offset) != VK_SUCCESS)
+                {
+                    return false;
+                }
+
+                VkImageViewCreateInfo imageViewCreateInfo{};
+                imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+                imageViewCreateInfo.image = current.image;
+                imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+                imageViewCreateInfo.format = current.imageCreateInfo.format;
+                imageViewCreateInfo.subresourceRange = {current.aspectMask, 0, VK_REMAINING_MIP_LEVELS,
+                                                        0, VK_REMAINING_ARRAY_LAYERS};
+
+                if (vkCreateImageView(device, &imageViewCreateInfo, allocator, &current.imageView) != VK_SUCCESS)
+                {
+                    return false;
+                }
+            } else
+            {
+                if (vkBindBufferMemory(device, current.buffer, memory, current.placement.offset) != VK_SUCCESS)
+                {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Destroy transient resources and free their memory. The GPU must be done with them.
+     */
+    void releaseTransients(VkDevice device, const VkAllocationCallbacks *allocator)
+    {
+        for (Resource &resource: resources)
+        {
+            if (resource.imported)
+            {
+                continue;
+            }
+
+            vkDestroyImageView(device, resource.imageView, allocator);
+            vkDestroyImage(device, resource.image, allocator);
+            vkDestroyBuffer(device, resource.buffer, allocator);
+            resource.imageView = VK_NULL_HANDLE;
+            resource.image = VK_NULL_HANDLE;
+            resource.buffer = VK_NULL_HANDLE;
+        }
+
+        for (const auto &block: memoryBlocks)
+        {
+            vkFreeMemory(device, block.second, allocator);
+        }
+        memoryBlocks.clear();
+    }
+
+    const MemoryReport &getMemoryReport() const
+    {
+        return memoryReport;
+    }
+
+    const MemoryPlacement &getPlacement(ResourceHandle resource) const
+    {
+        return resources[resource].placement;
+    }
+
+    /**
+     * Record barriers and passes in schedule order. If <dispatch> has synchronization2 every batch is one
+     * <vkCmdPipelineBarrier2KHR>, otherwise the batch is narrowed to one legacy <vkCmdPipelineBarrier>.
+     */
+    void record(VkCommandBuffer cmdBuffer, const DeviceDispatch &dispatch) const
+    {
+        for (const CompiledPass &compiledPass: schedule)
+        {
+            recordBarriers(cmdBuffer, compiledPass.barriers, dispatch);
+            passes[compiledPass.pass].execute(cmdBuffer, *this);
+        }
+
+        recordBarriers(cmdBuffer, finalBarriers, dispatch);
+    }
+
+    const std::vector<CompiledPass> &getSchedule() const
+    {
+        return schedule;
+    }
+
+    const std::vector<Barrier> &getFinalBarriers() const
+    {
+        return finalBarriers;
+    }
+
+    bool isCulled(PassHandle pass) const
+    {
+        return passes[pass].culled;
+    }
+
+    const std::string &getPassName(PassHandle pass) const
+    {
+        return passes[pass].name;
+    }
+
+    const std::string &getResourceName(ResourceHandle resource) const
+    {
+        return resources[resource].name;
+    }
+
+    std::size_t getBarrierCount() const
+    {
+        std::size_t barrierCount = finalBarriers.size();
+        for (const CompiledPass &compiledPass: schedule)
+        {
+            barrierCount += compiledPass.barriers.size();
+        }
+        return barrierCount;
+    }
+
+    /**
+     * Dump the compiled graph in Graphviz DOT format. Passes are boxes labelled with their schedule position
+     * and barrier count, culled passes are dashed. Resources are ellipses, outputs are drawn bold.
+     */
+    void writeDot(std::ostream &out) const
+    {
+        out << "digraph RenderGraph\n{\n";
+        out << "    rankdir=LR;\n";
+
+        for (std::size_t resourceIndex = 0; resourceIndex < resources.size(); resourceIndex++)
+        {
+            const Resource &resource = resources[resourceIndex];
+            out << "    r" << resourceIndex << " [shape=ellipse, label=\"" << escapeDot(resource.name)
+                << (resource.isImage ? "\\nimage" : "\\nbuffer") << (resource.imported ? " (imported)" : "");
+
+            if (isLiveTransient((ResourceHandle) resourceIndex) && resource.placement.size != 0)
+            {
+                out << "\\ntype " << resource.placement.memoryTypeIndex
+                    << " @" << resource.placement.offset << " +" << resource.placement.size
+                    << (resource.aliased ? " (aliased)" : "");
+            }
+
+            out << "\"" << (resource.output ? ", style=bold" : "") << "];\n";
+        }
+
+        for (std::size_t passIndex = 0; passIndex < passes.size(); passIndex++)
+        {
+            const Pass &pass = passes[passIndex];
+            out << "    p" << passIndex << " [shape=box, label=\"" << escapeDot(pass.name);
+
+            if (pass.culled)
+            {
+                out << "\\nculled\", style=dashed, color=gray];\n";
+            } else
+            {
+                auto scheduled = std::find_if(schedule.begin(),
+                                              schedule.end(),
+                                              [passIndex](const CompiledPass &compiledPass)
+                                              {
+                                                  return compiledPass.pass == passIndex;
+                                              });
+                out << "\\n#" << (scheduled - schedule.begin())
+                    << ", " << scheduled->barriers.size() << " barrier(s)\"];\n";
+            }
+
+            for (const Access &access: pass.accesses)
+            {
+                if (access.write)
+                {
+                    out << "    p" << passIndex << " -> r" << access.resource << ";\n";
+                } else
+                {
+                    out << "    r" << access.resource << " -> p" << passIndex << ";\n";
+                }
+            }
+        }
+
+        out << "}\n";
+    }
+
+private:
+    struct Resource
+    {
+        std::string name{};
+        bool isImage = true;
+        bool imported = false;
+        bool output = false;
+
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView imageView = VK_NULL_HANDLE;
+        VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkPipelineStageFlags2KHR initialStageMask = VK_PIPELINE_STAGE_2_NONE_KHR;
+
+        bool hasFinalUsage = false;
+        ResourceUsage finalUsage = ResourceUsage::Present;
+
+        // Transient resources only
+        VkImageCreateInfo imageCreateInfo{};
+        VkBufferCreateInfo bufferCreateInfo{};
+        VkMemoryRequirements memoryRequirements{};
+        MemoryPlacement placement{};
+
+        // Lifetime as first and last position in the schedule, <firstUse> is UINT32_MAX if unused
+        uint32_t firstUse = UINT32_MAX;
+        uint32_t lastUse = 0;
+
+        // Stages and write accesses of all uses, and the same including everything aliasing the memory
+        VkPipelineStageFlags2KHR usageStageMask = 0;
+        VkAccessFlags2KHR usageWriteAccessMask = 0;
+        VkPipelineStageFlags2KHR aliasStageMask = 0;
+        VkAccessFlags2KHR aliasAccessMask = 0;
+        bool aliased = false;
+    };
+
+    struct Access
+    {
+        ResourceHandle resource;
+        ResourceUsage usage;
+        bool write;
+    };
+
+    struct Pass
+    {
+        std::string name{};
+        std::vector<Access> accesses{};
+        PassCallback execute{};
+        bool sideEffects = false;
+        bool culled = false;
+    };
+
+    /**
+     * Synchronization state of one resource while walking the schedule
+     */
+    struct ResourceState
+    {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        // Last write (or layout transition) that later accesses have to wait for
+        VkPipelineStageFlags2KHR writeStageMask = 0;
+        VkAccessFlags2KHR writeAccessMask = 0;
+
+        // Stages and accesses the last write has already been made visible to
+        VkPipelineStageFlags2KHR visibleStageMask = 0;
+        VkAccessFlags2KHR visibleAccessMask = 0;
+
+        // Readers since the last write, a following write has to wait for them
+        VkPipelineStageFlags2KHR readStageMask = 0;
+
+        // False until the first access in the schedule
+        bool used = false;
+    };
+
+    std::vector<Resource> resources{};
+    std::vector<Pass> passes{};
+    std::vector<CompiledPass> schedule{};
+    std::vector<Barrier> finalBarriers{};
+
+    // Size and allocation of the shared memory block of every memory type used by transients
+    std::map<uint32_t, VkDeviceSize> memoryBlockSizes{};
+    std::map<uint32_t, VkDeviceMemory> memoryBlocks{};
+    MemoryReport memoryReport{};
+    VkDeviceSize bufferImageGranularity = 1;
+
+    /**
+     * <text> as the inside of a quoted DOT string
+     */
+    static std::string escapeDot(const std::string &text)
+    {
+        std::string escaped{};
+        for (char character: text)
+        {
+            if (character == '"' || character == '\\')
+            {
+                escaped += '\\';
+            }
+            escaped += character;
+        }
+        return escaped;
+    }
+
+    static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    bool isLiveTransient(ResourceHandle resource) const
+    {
+        return !resources[resource].imported && resources[resource].firstUse != UINT32_MAX;
+    }
+
+    bool lifetimesOverlap(ResourceHandle a, ResourceHandle b) const
+    {
+        return !(resources[a].lastUse < resources[b].firstUse || resources[b].lastUse < resources[a].firstUse);
+    }
+
+    bool sharesMemoryType(ResourceHandle a, ResourceHandle b) const
+    {
+        return resources[a].placement.memoryTypeIndex == resources[b].placement.memoryTypeIndex;
+    }
+
+    /**
+     * Buffers and linear images, <bufferImageGranularity> only separates them from optimal tiling images
+     */
+    bool isLinear(ResourceHandle resource) const
+    {
+        return !resources[resource].isImage || resources[resource].imageCreateInfo.tiling == VK_IMAGE_TILING_LINEAR;
+    }
+
+    /**
+     * Whether <resource> placed at <offset> would share memory with placed <other>. A linear and a non-linear
+     * resource must not even share a page of <bufferImageGranularity>.
+     */
+    bool placementCollides(ResourceHandle resource, VkDeviceSize offset, ResourceHandle other) const
+    {
+        VkDeviceSize start = offset;
+        VkDeviceSize end = offset + resources[resource].placement.size;
+        VkDeviceSize otherStart = resources[other].placement.offset;
+        VkDeviceSize otherEnd = otherStart + resources[other].placement.size;
+
+        if (isLinear(resource) != isLinear(other))
+        {
+            start = start / bufferImageGranularity * bufferImageGranularity;
+            end = alignUp(end, bufferImageGranularity);
+            otherStart = otherStart / bufferImageGranularity * bufferImageGranularity;
+            otherEnd = alignUp(otherEnd, bufferImageGranularity);
+        }
+        return start < otherEnd && otherStart < end;
+    }
+
+    bool memoryOverlaps(ResourceHandle a, ResourceHandle b) const
+    {
+        const MemoryPlacement &placementA = resources[a].placement;
+        const MemoryPlacement &placementB = resources[b].placement;
+        return sharesMemoryType(a, b) &&
+               placementA.offset < placementB.offset + placementB.size &&
+               placementB.offset < placementA.offset + placementA.size;
+    }
+
+    /**
+     * Find first and last use of every resource in the schedule. Until memory is planned a transient only
+     * waits for its own uses in the previous frame.
+     */
+    void computeLifetimes()
+    {
+        for (Resource &resource: resources)
+        {
+            resource.firstUse = UINT32_MAX;
+            resource.lastUse = 0;
+            resource.usageStageMask = 0;
+            resource.usageWriteAccessMask = 0;
+        }
+
+        for (uint32_t position = 0; position < schedule.size(); position++)
+        {
+            for (const Access &access: passes[schedule[position].pass].accesses)
+            {
+                Resource &resource = resources[access.resource];
+                UsageState usage = usageState(access.usage);
+
+                resource.firstUse = std::min(resource.firstUse, position);
+                resource.lastUse = std::max(resource.lastUse, position);
+                resource.usageStageMask |= usage.stageMask;
+                if (usage.write || access.write)
+                {
+                    resource.usageWriteAccessMask |= usage.accessMask;
+                }
+            }
+        }
+
+        for (Resource &resource: resources)
+        {
+            resource.aliasStageMask = resource.usageStageMask;
+            resource.aliasAccessMask = resource.usageWriteAccessMask;
+            resource.aliased = false;
+        }
+    }
+
+    /**
+     * Walk the passes backwards from the outputs. A pass survives if it has side effects or writes a resource
+     * somebody still needs, and everything it reads becomes needed in turn.
+     */
+    void cullPasses()
+    {
+        std::vector<bool> needed(resources.size(), false);
+        for (std::size_t resourceIndex = 0; resourceIndex < resources.size(); resourceIndex++)
+        {
+            needed[resourceIndex] = resources[resourceIndex].output;
+        }
+
+        for (std::size_t passIndex = passes.size(); passIndex-- > 0;)
+        {
+            Pass &pass = passes[passIndex];
+
+            bool live = pass.sideEffects;
+            for (const Access &access: pass.accesses)
+            {
+                if (access.write && needed[access.resource])
+                {
+                    live = true;
+                }
+            }
+
+            pass.culled = !live;
+            if (!live)
+            {
+                continue;
+            }
+
+            for (const Access &access: pass.accesses)
+            {
+                needed[access.resource] = true;
+            }
+        }
+    }
+
+    /**
+     * Topologically sort the surviving passes. Dependencies come from declaration order (read after write,
+     * write after write and write after read). Among the ready passes, one that does not depend on the pass just
+     * scheduled is preferred, so independent work lands between a producer and its consumer and the GPU can
+     * overlap them instead of draining at every barrier.
+     */
+    void schedulePasses()
+    {
+        std::vector<std::vector<PassHandle>> dependents(passes.size());
+        std::vector<std::vector<PassHandle>> dependencies(passes.size());
+        std::vector<uint32_t> pendingDependencyCount(passes.size(), 0);
+
+        auto addDependency = [&](PassHandle from, PassHandle to)
+        {
+            if (from == to ||
+                std::find(dependencies[to].begin(), dependencies[to].end(), from) != dependencies[to].end())
+            {
+                return;
+            }
+            dependencies[to].push_back(from);
+            dependents[from].push_back(to);
+            pendingDependencyCount[to]++;
+        };
+
+        const PassHandle noPass = UINT32_MAX;
+        std::vector<PassHandle> lastWriter(resources.size(), noPass);
+        std::vector<std::vector<PassHandle>> readersSinceWrite(resources.size());
+
+        for (PassHandle passIndex = 0; passIndex < passes.size(); passIndex++)
+        {
+            if (passes[passIndex].culled)
+            {
+                continue;
+            }
+
+            for (const Access &access: passes[passIndex].accesses)
+            {
+                if (lastWriter[access.resource] != noPass)
+                {
+                    addDependency(lastWriter[access.resource], passIndex);
+                }
+
+                if (access.write)
+                {
+                    for (PassHandle reader: readersSinceWrite[access.resource])
+                    {
+                        addDependency(reader, passIndex);
+                    }
+                }
+            }
+
+            // Update after all accesses, a pass reading and writing the same resource must not depend on itself
+            for (const Access &access: passes[passIndex].accesses)
+            {
+                if (access.write)
+                {
+                    lastWriter[access.resource] = passIndex;
+                    readersSinceWrite[access.resource].clear();
+                } else
+                {
+                    readersSinceWrite[access.resource].push_back(passIndex);
+                }
+            }
+        }
+
+        std::vector<PassHandle> ready{};
+        for (PassHandle passIndex = 0; passIndex < passes.size(); passIndex++)
+        {
+            if (!passes[passIndex].culled && pendingDependencyCount[passIndex] == 0)
+            {
+                ready.push_back(passIndex);
+            }
+        }
+
+        schedule.clear();
+        PassHandle previous = noPass;
+
+        while (!ready.empty())
+        {
+            // <ready> is kept in declaration order, take the first one that is independent of <previous>
+            auto chosen = ready.begin();
+            if (previous != noPass)
+            {
+                auto independent = std::find_if(ready.begin(),
+                                                ready.end(),
+                                                [&](PassHandle candidate)
+                                                {
+                                                    return std::find(dependencies[candidate].begin(),
+                                                                     dependencies[candidate].end(),
+                                                                     previous) == dependencies[candidate].end();
+                                                });
+                if (independent != ready.end())
+                {
+                    chosen = independent;
+                }
+            }
+
+            PassHandle passIndex = *chosen;
+            ready.erase(chosen);
+
+            CompiledPass compiledPass{};
+            compiledPass.pass = passIndex;
+            schedule.push_back(compiledPass);
+            previous = passIndex;
+
+            for (PassHandle dependent: dependents[passIndex])
+            {
+                if (--pendingDependencyCount[dependent] == 0)
+                {
+                    ready.insert(std::upper_bound(ready.begin(), ready.end(), dependent), dependent);
+                }
+            }
+        }
+    }
+
+    /**
+     * Walk the schedule tracking every resource and emit a barrier only where an access is not already
+     * covered: layout changes, reads of unseen writes and writes after reads or writes.
+     */
+    void generateBarriers()
+    {
+        std::vector<ResourceState> states(resources.size());
+        for (std::size_t resourceIndex = 0; resourceIndex < resources.size(); resourceIndex++)
+        {
+            const Resource &resource = resources[resourceIndex];
+            states[resourceIndex].layout = resource.initialLayout;
+
+            if (resource.imported)
+            {
+                states[resourceIndex].writeStageMask = resource.initialStageMask;
+            } else
+            {
+                // Transients start undefined and wait for the previous users of their memory
+                states[resourceIndex].writeStageMask = resource.aliasStageMask;
+                states[resourceIndex].writeAccessMask = resource.aliasAccessMask;
+            }
+        }
+
+        for (CompiledPass &compiledPass: schedule)
+        {
+            compiledPass.barriers.clear();
+
+            // Merge all accesses of one pass to the same resource into a single usage
+            std::vector<std::pair<ResourceHandle, UsageState>> mergedUsages{};
+            for (const Access &access: passes[compiledPass.pass].accesses)
+            {
+                UsageState usage = usageState(access.usage);
+                usage.write = usage.write || access.write;
+
+                auto merged = std::find_if(mergedUsages.begin(),
+                                           mergedUsages.end(),
+                                           [&](const std::pair<ResourceHandle, UsageState> &entry)
+                                           {
+                                               return entry.first == access.resource;
+                                           });
+                if (merged == mergedUsages.end())
+                {
+                    mergedUsages.emplace_back(access.resource, usage);
+                } else
+                {
+                    merged->second.stageMask |= usage.stageMask;
+                    merged->second.accessMask |= usage.accessMask;
+                    merged->second.write = merged->second.write || usage.write;
+                    if (merged->second.layout != usage.layout)
+                    {
+                        merged->second.layout = VK_IMAGE_LAYOUT_GENERAL;
+                    }
+                }
+            }
+
+            for (const auto &[resource, usage]: mergedUsages)
+            {
+                transition(resource, usage, states[resource], compiledPass.barriers);
+            }
+        }
+
+        finalBarriers.clear();
+        for (ResourceHandle resource = 0; resource < resources.size(); resource++)
+        {
+            if (resources[resource].hasFinalUsage)
+            {
+                transition(resource, usageState(resources[resource].finalUsage), states[resource], finalBarriers);
+            }
+        }
+    }
+
+    void transition(ResourceHandle resource,
+                    const UsageState &usage,
+                    ResourceState &state,
+                    std::vector<Barrier> &barriers) const
+    {
+        bool layoutChange = resources[resource].isImage && state.layout != usage.layout;
+        bool needsBarrier;
+
+        if (layoutChange || usage.write)
+        {
+            // Layout transitions and writes wait for the last write and for every reader since
+            needsBarrier = layoutChange || state.writeStageMask != 0 || state.readStageMask != 0;
+        } else
+        {
+            // Reads only wait if the last write is not yet visible to this stage and access
+            needsBarrier = state.writeStageMask != 0 &&
+                           ((usage.stageMask & ~state.visibleStageMask) != 0 ||
+                            (usage.accessMask & ~state.visibleAccessMask) != 0);
+        }
+
+        if (needsBarrier)
+        {
+            Barrier barrier{};
+            barrier.resource = resource;
+            barrier.aliasing = resources[resource].aliased && !state.used;
+            barrier.srcStageMask = state.writeStageMask | state.readStageMask;
+            barrier.srcAccessMask = state.writeAccessMask;
+            barrier.dstStageMask = usage.stageMask;
+            barrier.dstAccessMask = usage.accessMask;
+            barrier.oldLayout = resources[resource].isImage ? state.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = resources[resource].isImage ? usage.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers.push_back(barrier);
+        }
+
+        if (usage.write || layoutChange)
+        {
+            // A layout transition counts as a write the next accesses have to see
+            state.writeStageMask = usage.stageMask;
+            state.writeAccessMask = usage.write ? usage.accessMask : 0;
+            state.visibleStageMask = usage.write ? 0 : usage.stageMask;
+            state.visibleAccessMask = usage.write ? 0 : usage.accessMask;
+            state.readStageMask = usage.write ? 0 : usage.stageMask;
+            state.layout = usage.layout;
+        } else
+        {
+            if (needsBarrier)
+            {
+                state.visibleStageMask |= usage.stageMask;
+                state.visibleAccessMask |= usage.accessMask;
+            }
+            state.readStageMask |= usage.stageMask;
+        }
+
+        state.used = true;
+    }
+
+    void recordBarriers(VkCommandBuffer cmdBuffer,
+                        const std::vector<Barrier> &barriers,
+                        const DeviceDispatch &dispatch) const
+    {
+        if (barriers.empty())
+        {
+            return;
+        }
+
+        if (dispatch.vkCmdPipelineBarrier2KHR != nullptr)
+        {
+            std::vector<VkImageMemoryBarrier2KHR> imageBarriers{};
+            std::vector<VkBufferMemoryBarrier2KHR> bufferBarriers{};
+
+            for (const Barrier &barrier: barriers)
+            {
+                const Resource &resource = resources[barrier.resource];
+                if (resource.isImage)
+                {
+                    VkImageMemoryBarrier2KHR imageBarrier{};
+                    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+                    imageBarrier.srcStageMask = barrier.srcStageMask;
+                    imageBarrier.srcAccessMask = barrier.srcAccessMask;
+                    imageBarrier.dstStageMask = barrier.dstStageMask;
+                    imageBarrier.dstAccessMask = barrier.dstAccessMask;
+                    imageBarrier.oldLayout = barrier.oldLayout;
+                    imageBarrier.newLayout = barrier.newLayout;
+                    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    imageBarrier.image = resource.image;
+                    imageBarrier.subresourceRange = {resource.aspectMask, 0, VK_REMAINING_MIP_LEVELS,
+                                                     0, VK_REMAINING_ARRAY_LAYERS};
+                    imageBarriers.push_back(imageBarrier);
+                } else
+                {
+                    VkBufferMemoryBarrier2KHR bufferBarrier{};
+                    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+                    bufferBarrier.srcStageMask = barrier.srcStageMask;
+                    bufferBarrier.srcAccessMask = barrier.srcAccessMask;
+                    bufferBarrier.dstStageMask = barrier.dstStageMask;
+                    bufferBarrier.dstAccessMask = barrier.dstAccessMask;
+                    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                    bufferBarrier.buffer = resource.buffer;
+                    bufferBarrier.offset = 0;
+                    bufferBarrier.size = VK_WHOLE_SIZE;
+                    bufferBarriers.push_back(bufferBarrier);
+                }
+            }
+
+            VkDependencyInfoKHR dependencyInfo{};
+            dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+            dependencyInfo.bufferMemoryBarrierCount = (uint32_t) bufferBarriers.size();
+            dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+            dependencyInfo.imageMemoryBarrierCount = (uint32_t) imageBarriers.size();
+            dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+
+            dispatch.vkCmdPipelineBarrier2KHR(cmdBuffer, &dependencyInfo);
+            return;
+        }
+
+        // Legacy barriers share one stage mask pair for the whole batch
+        VkPipelineStageFlags srcStageMask = 0;
+        VkPipelineStageFlags dstStageMask = 0;
+        std::vector<VkImageMemoryBarrier> imageBarriers{};
+        std::vector<VkBufferMemoryBarrier> bufferBarriers{};
+
+        for (const Barrier &barrier: barriers)
+        {
+            const Resource &resource = resources[barrier.resource];
+            srcStageMask |= (VkPipelineStageFlags) barrier.srcStageMask;
+            dstStageMask |= (VkPipelineStageFlags) barrier.dstStageMask;
+
+            if (resource.isImage)
+            {
+                VkImageMemoryBarrier imageBarrier{};
+                imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                imageBarrier.srcAccessMask = (VkAccessFlags) barrier.srcAccessMask;
+                imageBarrier.dstAccessMask = (VkAccessFlags) barrier.dstAccessMask;
+                imageBarrier.oldLayout = barrier.oldLayout;
+                imageBarrier.newLayout = barrier.newLayout;
+                imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                imageBarrier.image = resource.image;
+                imageBarrier.subresourceRange = {resource.aspectMask, 0, VK_REMAINING_MIP_LEVELS,
+                                                 0, VK_REMAINING_ARRAY_LAYERS};
+                imageBarriers.push_back(imageBarrier);
+            } else
+            {
+                VkBufferMemoryBarrier bufferBarrier{};
+                bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                bufferBarrier.srcAccessMask = (VkAccessFlags) barrier.srcAccessMask;
+                bufferBarrier.dstAccessMask = (VkAccessFlags) barrier.dstAccessMask;
+                bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                bufferBarrier.buffer = resource.buffer;
+                bufferBarrier.offset = 0;
+                bufferBarrier.size = VK_WHOLE_SIZE;
+                bufferBarriers.push_back(bufferBarrier);
+            }
+        }
+
+        // Stage masks of zero are only valid with synchronization2
+        if (srcStageMask == 0)
+        {
+            srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        }
+        if (dstStageMask == 0)
+        {
+            dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        }
+
+        dispatch.vkCmdPipelineBarrier(cmdBuffer,
+                                      srcStageMask,
+                                      dstStageMask,
+                                      0,
+                                      0,
+                                      nullptr,
+                                      (uint32_t) bufferBarriers.size(),
+                                      bufferBarriers.data(),
+                                      (uint32_t) imageBarriers.size(),
+                                      imageBarriers.data());
+    }
+};
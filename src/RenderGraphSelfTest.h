@@ -0,0 +1,310 @@
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "RenderGraph.h"
+
+/**
+ * Checks of the CPU side of <RenderGraph>: culling, barrier derivation and memory aliasing. Builds a few small
+ * graphs with null handles, never touches a device, so it runs without a GPU.
+ */
+class RenderGraphSelfTest
+{
+public:
+    /**
+     * Run every check and report failures. Returns true if all of them passed.
+     */
+    static bool run()
+    {
+        RenderGraphSelfTest selfTest{};
+        selfTest.checkCulling();
+        selfTest.checkBarriers();
+        selfTest.checkAliasing();
+        selfTest.checkGranularity();
+        selfTest.checkDotEscaping();
+
+        std::cout << "Render graph self test: " << selfTest.checkCount - selfTest.failureCount << " of "
+                  << selfTest.checkCount << " check(s) passed" << std::endl;
+        return selfTest.failureCount == 0;
+    }
+
+private:
+    uint32_t checkCount = 0;
+    uint32_t failureCount = 0;
+
+    void expect(bool condition, const std::string &description)
+    {
+        checkCount++;
+        if (!condition)
+        {
+            failureCount++;
+            std::cout << "Render graph self test: " << description << " failed" << std::endl;
+        }
+    }
+
+    static RenderGraph::PassCallback noCommands()
+    {
+        return [](VkCommandBuffer, const RenderGraph &)
+        {
+        };
+    }
+
+    static VkImageCreateInfo colorImageInfo()
+    {
+        VkImageCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        createInfo.imageType = VK_IMAGE_TYPE_2D;
+        createInfo.format = VK_FORMAT_B8G8R8A8_UNORM;
+        createInfo.extent = {64, 64, 1};
+        createInfo.mipLevels = 1;
+        createInfo.arrayLayers = 1;
+        createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        createInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        return createInfo;
+    }
+
+    static RenderGraph::ResourceHandle importBackbuffer(RenderGraph &graph)
+    {
+        RenderGraph::ResourceHandle backbuffer = graph.importImage("backbuffer",
+                                                                   VK_NULL_HANDLE,
+                                                                   VK_NULL_HANDLE,
+                                                                   VK_IMAGE_ASPECT_COLOR_BIT,
+                                                                   VK_IMAGE_LAYOUT_UNDEFINED,
+                                                                   VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR);
+        graph.setFinalUsage(backbuffer, ResourceUsage::Present);
+        return backbuffer;
+    }
+
+    /**
+     * The barriers recorded in front of <pass> on <resource>
+     */
+    static std::vector<RenderGraph::Barrier> barriersBefore(const RenderGraph &graph,
+                                                            RenderGraph::PassHandle pass,
+                                                            RenderGraph::ResourceHandle resource)
+    {
+        std::vector<RenderGraph::Barrier> found{};
+        for (const RenderGraph::CompiledPass &compiledPass: graph.getSchedule())
+        {
+            if (compiledPass.pass != pass)
+            {
+                continue;
+            }
+            for (const RenderGraph::Barrier &barrier: compiledPass.barriers)
+            {
+                if (barrier.resource == resource)
+                {
+                    found.push_back(barrier);
+                }
+            }
+        }
+        return found;
+    }
+
+    /**
+     * A pass writing an image nobody reads is culled, the passes leading to the output and a pass with side
+     * effects are kept
+     */
+    void checkCulling()
+    {
+        RenderGraph graph{};
+        RenderGraph::ResourceHandle backbuffer = importBackbuffer(graph);
+        RenderGraph::ResourceHandle scratch = graph.createImage("scratch", colorImageInfo(), VK_IMAGE_ASPECT_COLOR_BIT);
+        RenderGraph::ResourceHandle readback = graph.createImage("readback", colorImageInfo(),
+                                                                 VK_IMAGE_ASPECT_COLOR_BIT);
+
+        RenderGraph::PassHandle draw = graph.addPass("draw", noCommands());
+        graph.writes(draw, backbuffer, ResourceUsage::ColorAttachmentWrite);
+
+        RenderGraph::PassHandle unused = graph.addPass("unused", noCommands());
+        graph.writes(unused, scratch, ResourceUsage::ColorAttachmentWrite);
+
+        RenderGraph::PassHandle copy = graph.addPass("copy", noCommands());
+        graph.writes(copy, readback, ResourceUsage::TransferWrite);
+        graph.setSideEffects(copy);
+
+        graph.compile();
+
+        expect(!graph.isCulled(draw), "culling: pass writing the output kept");
+        expect(graph.isCulled(unused), "culling: pass without consumers culled");
+        expect(!graph.isCulled(copy), "culling: pass with side effects kept");
+        expect(graph.getSchedule().size() == 2, "culling: culled pass left out of the schedule");
+    }
+
+    /**
+     * A color attachment sampled by the next pass gets one transition with the attachment write as source, a
+     * second reader of the same stage needs no barrier, and the output ends in the present layout
+     */
+    void checkBarriers()
+    {
+        RenderGraph graph{};
+        RenderGraph::ResourceHandle backbuffer = importBackbuffer(graph);
+        RenderGraph::ResourceHandle scene = graph.createImage("scene", colorImageInfo(), VK_IMAGE_ASPECT_COLOR_BIT);
+        RenderGraph::ResourceHandle bloom = graph.createImage("bloom", colorImageInfo(), VK_IMAGE_ASPECT_COLOR_BIT);
+
+        RenderGraph::PassHandle draw = graph.addPass("draw", noCommands());
+        graph.writes(draw, scene, ResourceUsage::ColorAttachmentWrite);
+
+        RenderGraph::PassHandle composite = graph.addPass("composite", noCommands());
+        graph.reads(composite, scene, ResourceUsage::FragmentShaderRead);
+        graph.writes(composite, backbuffer, ResourceUsage::ColorAttachmentWrite);
+
+        RenderGraph::PassHandle blur = graph.addPass("blur", noCommands());
+        graph.reads(blur, scene, ResourceUsage::FragmentShaderRead);
+        graph.writes(blur, bloom, ResourceUsage::ColorAttachmentWrite);
+        graph.markOutput(bloom);
+
+        graph.compile();
+
+        std::vector<RenderGraph::Barrier> drawBarriers = barriersBefore(graph, draw, scene);
+        expect(drawBarriers.size() == 1 &&
+               drawBarriers[0].oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
+               drawBarriers[0].newLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+               "barriers: transient moved into the attachment layout before its first write");
+
+        std::vector<RenderGraph::Barrier> sampleBarriers = barriersBefore(graph, composite, scene);
+        expect(sampleBarriers.size() == 1, "barriers: one barrier before the first read");
+        if (sampleBarriers.size() == 1)
+        {
+            const RenderGraph::Barrier &barrier = sampleBarriers[0];
+            expect(barrier.oldLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL &&
+                   barrier.newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                   "barriers: attachment to shader read layout");
+            expect(barrier.srcStageMask == VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR &&
+                   (barrier.srcAccessMask & VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR) != 0,
+                   "barriers: source is the attachment write");
+            expect(barrier.dstStageMask == VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR &&
+                   barrier.dstAccessMask == VK_ACCESS_2_SHADER_READ_BIT_KHR,
+                   "barriers: destination is the fragment shader read");
+        }
+
+        expect(barriersBefore(graph, blur, scene).empty(), "barriers: no barrier for a read already made visible");
+
+        const std::vector<RenderGraph::Barrier> &finalBarriers = graph.getFinalBarriers();
+        expect(finalBarriers.size() == 1 &&
+               finalBarriers[0].resource == backbuffer &&
+               finalBarriers[0].oldLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL &&
+               finalBarriers[0].newLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+               "barriers: output transitioned to the present layout at the end");
+    }
+
+    /**
+     * In a chain first -> second -> third the first and the third transient never live at the same time, so they
+     * share memory while the second one gets its own range. The third one waits for the first before its first use.
+     */
+    void checkAliasing()
+    {
+        RenderGraph graph{};
+        RenderGraph::ResourceHandle backbuffer = importBackbuffer(graph);
+        RenderGraph::ResourceHandle transients[3]{};
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            transients[i] = graph.createImage("transient " + std::to_string(i), colorImageInfo(),
+                                              VK_IMAGE_ASPECT_COLOR_BIT);
+        }
+
+        RenderGraph::PassHandle first = graph.addPass("first", noCommands());
+        graph.writes(first, transients[0], ResourceUsage::ColorAttachmentWrite);
+        RenderGraph::PassHandle second = graph.addPass("second", noCommands());
+        graph.reads(second, transients[0], ResourceUsage::FragmentShaderRead);
+        graph.writes(second, transients[1], ResourceUsage::ColorAttachmentWrite);
+        RenderGraph::PassHandle third = graph.addPass("third", noCommands());
+        graph.reads(third, transients[1], ResourceUsage::FragmentShaderRead);
+        graph.writes(third, transients[2], ResourceUsage::ColorAttachmentWrite);
+        RenderGraph::PassHandle resolve = graph.addPass("resolve", noCommands());
+        graph.reads(resolve, transients[2], ResourceUsage::FragmentShaderRead);
+        graph.writes(resolve, backbuffer, ResourceUsage::ColorAttachmentWrite);
+
+        graph.compile();
+
+        VkMemoryRequirements memoryRequirements{};
+        memoryRequirements.size = 1024;
+        memoryRequirements.alignment = 256;
+        memoryRequirements.memoryTypeBits = 1;
+        for (RenderGraph::ResourceHandle transient: transients)
+        {
+            graph.setMemoryRequirements(transient, memoryRequirements, 0);
+        }
+        graph.planMemory();
+
+        const RenderGraph::MemoryPlacement &firstPlacement = graph.getPlacement(transients[0]);
+        const RenderGraph::MemoryPlacement &secondPlacement = graph.getPlacement(transients[1]);
+        const RenderGraph::MemoryPlacement &thirdPlacement = graph.getPlacement(transients[2]);
+        expect(firstPlacement.offset == thirdPlacement.offset,
+               "aliasing: transients with disjoint lifetimes share memory");
+        expect(secondPlacement.offset + secondPlacement.size <= firstPlacement.offset ||
+               firstPlacement.offset + firstPlacement.size <= secondPlacement.offset,
+               "aliasing: transients with overlapping lifetimes get separate memory");
+
+        const RenderGraph::MemoryReport &report = graph.getMemoryReport();
+        expect(report.transientCount == 3 && report.naiveBytes == 3072 && report.aliasedBytes == 2048,
+               "aliasing: two of three transients worth of memory");
+
+        std::vector<RenderGraph::Barrier> thirdBarriers = barriersBefore(graph, third, transients[2]);
+        expect(thirdBarriers.size() == 1 && thirdBarriers[0].aliasing &&
+               (thirdBarriers[0].srcStageMask & VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR) != 0,
+               "aliasing: first use waits for the previous user of the memory");
+    }
+
+    /**
+     * A buffer and an optimal tiling image alive at the same time never share a page of bufferImageGranularity,
+     * even when their own alignment would let them sit next to each other
+     */
+    void checkGranularity()
+    {
+        RenderGraph graph{};
+        RenderGraph::ResourceHandle backbuffer = importBackbuffer(graph);
+        RenderGraph::ResourceHandle image = graph.createImage("image", colorImageInfo(), VK_IMAGE_ASPECT_COLOR_BIT);
+
+        VkBufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.size = 1024;
+        bufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        RenderGraph::ResourceHandle buffer = graph.createBuffer("buffer", bufferCreateInfo);
+
+        RenderGraph::PassHandle upload = graph.addPass("upload", noCommands());
+        graph.writes(upload, buffer, ResourceUsage::TransferWrite);
+        graph.writes(upload, image, ResourceUsage::ColorAttachmentWrite);
+        RenderGraph::PassHandle draw = graph.addPass("draw", noCommands());
+        graph.reads(draw, buffer, ResourceUsage::VertexBufferRead);
+        graph.reads(draw, image, ResourceUsage::FragmentShaderRead);
+        graph.writes(draw, backbuffer, ResourceUsage::ColorAttachmentWrite);
+
+        graph.compile();
+
+        VkMemoryRequirements memoryRequirements{};
+        memoryRequirements.size = 1024;
+        memoryRequirements.alignment = 256;
+        memoryRequirements.memoryTypeBits = 1;
+        graph.setMemoryRequirements(image, memoryRequirements, 0);
+        graph.setMemoryRequirements(buffer, memoryRequirements, 0);
+        graph.setBufferImageGranularity(4096);
+        graph.planMemory();
+
+        const RenderGraph::MemoryPlacement &imagePlacement = graph.getPlacement(image);
+        const RenderGraph::MemoryPlacement &bufferPlacement = graph.getPlacement(buffer);
+        expect(imagePlacement.offset / 4096 != bufferPlacement.offset / 4096 &&
+               imagePlacement.offset % 256 == 0 && bufferPlacement.offset % 256 == 0,
+               "granularity: buffer and image on separate pages");
+    }
+
+    /**
+     * Quotes and backslashes in names are escaped, so the DOT output stays parseable
+     */
+    void checkDotEscaping()
+    {
+        RenderGraph graph{};
+        RenderGraph::ResourceHandle backbuffer = importBackbuffer(graph);
+        RenderGraph::PassHandle draw = graph.addPass("say \"hi\" \\", noCommands());
+        graph.writes(draw, backbuffer, ResourceUsage::ColorAttachmentWrite);
+        graph.compile();
+
+        std::ostringstream dot{};
+        graph.writeDot(dot);
+        expect(dot.str().find("label=\"say \\\"hi\\\" \\\\\\n#0") != std::string::npos,
+               "dot: quotes and backslashes in names escaped");
+    }
+};
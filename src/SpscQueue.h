@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Bounded lock-free queue with exactly one producer thread and one consumer thread.
+ *
+ * The producer only writes <writeIndex> and the consumer only writes <readIndex>, each publishing with a release
+ * store that the other side picks up with an acquire load. Both keep a cached copy of the other side's index and
+ * only reload it when the queue looks full or empty, so in the common case neither touches the other's cache line.
+ */
+template<typename T, std::size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    /**
+     * Producer only. Returns false without blocking if the queue is full.
+     */
+    bool tryPush(const T &value)
+    {
+        std::size_t write = writeIndex.load(std::memory_order_relaxed);
+        if (write - cachedReadIndex == Capacity)
+        {
+            cachedReadIndex = readIndex.load(std::memory_order_acquire);
+            if (write - cachedReadIndex == Capacity)
+            {
+                return false;
+            }
+        }
+
+        slots[write & (Capacity - 1)] = value;
+        writeIndex.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer only. Returns false without blocking if the queue is empty.
+     */
+    bool tryPop(T &value)
+    {
+        std::size_t read = readIndex.load(std::memory_order_relaxed);
+        if (read == cachedWriteIndex)
+        {
+            cachedWriteIndex = writeIndex.load(std::memory_order_acquire);
+            if (read == cachedWriteIndex)
+            {
+                return false;
+            }
+        }
+
+        value = slots[read & (Capacity - 1)];
+        readIndex.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer only. True if nothing was pushed since the last <tryPop>.
+     */
+    bool isEmpty()
+    {
+        cachedWriteIndex = writeIndex.load(std::memory_order_acquire);
+        return readIndex.load(std::memory_order_relaxed) == cachedWriteIndex;
+    }
+
+private:
+    static constexpr std::size_t cacheLineSize = 64;
+
+    // Producer side
+    alignas(cacheLineSize) std::atomic<std::size_t> writeIndex{0};
+    std::size_t cachedReadIndex = 0;
+
+    // Consumer side
+    alignas(cacheLineSize) std::atomic<std::size_t> readIndex{0};
+    std::size_t cachedWriteIndex = 0;
+
+    alignas(cacheLineSize) T slots[Capacity]{};
+};
@@ -0,0 +1,368 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "DeviceDispatch.h"
+#include "SpscQueue.h"
+
+/**
+ * Thread that makes every vkQueueSubmit and vkQueuePresentKHR call, so the thread recording frames never blocks
+ * inside the driver.
+ *
+ * The recording thread collects the submissions of a frame with <enqueue> and closes the batch with <present>
+ * or <flush>. Batches travel through a lock-free queue, the submit thread only sleeps on a condition variable
+ * while the queue is empty. Consecutive submissions to the same queue go out as a single vkQueueSubmit, so a
+ * frame costs one call per queue. A submission with a fence ends its call, there is only one fence per call.
+ *
+ * A present may cover several swapchains, they all go out in one vkQueuePresentKHR. Present results come back per
+ * swapchain through <takeOutOfDate>, one frame late. Presents hold the swapchain mutex passed to <start>,
+ * everything else that uses a presented swapchain, like acquiring an image, has to hold it as well. Nobody may
+ * block on the swapchain while holding it: an acquire waiting for a present queued here would never return, so
+ * acquires wait with a finite timeout and release the mutex between attempts.
+ */
+class SubmitThread
+{
+public:
+    static constexpr uint32_t maxCmdBuffers = 8;
+    static constexpr uint32_t maxWaits = 8;
+    static constexpr uint32_t maxSignals = 2;
+    static constexpr uint32_t maxSwapchains = 4;
+
+    /**
+     * Everything of one VkSubmitInfo by value, it outlives the caller's arrays
+     */
+    struct Submission
+    {
+        VkQueue queue = VK_NULL_HANDLE;
+
+        uint32_t cmdBufferCount = 0;
+        VkCommandBuffer cmdBuffers[maxCmdBuffers]{};
+
+        uint32_t waitCount = 0;
+        VkSemaphore waitSemaphores[maxWaits]{};
+        uint64_t waitValues[maxWaits]{};
+        VkPipelineStageFlags waitStages[maxWaits]{};
+
+        uint32_t signalCount = 0;
+        VkSemaphore signalSemaphores[maxSignals]{};
+        uint64_t signalValues[maxSignals]{};
+
+        // Chain a VkTimelineSemaphoreSubmitInfo with the values above
+        bool timelineValues = false;
+
+        // Signaled once this and every earlier submission to <queue> completed
+        VkFence fence = VK_NULL_HANDLE;
+    };
+
+    void start(const DeviceDispatch *deviceDispatch, std::mutex *presentSwapchainMutex)
+    {
+        dispatch = deviceDispatch;
+        swapchainMutex = presentSwapchainMutex;
+        stopping = false;
+        thread = std::thread([this]()
+                             {
+                                 run();
+                             });
+    }
+
+    /**
+     * Submit everything queued so far and join the thread
+     */
+    void stop()
+    {
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wakeCondition.notify_one();
+        thread.join();
+    }
+
+    /**
+     * Add <submission> to the open batch
+     */
+    void enqueue(const Submission &submission)
+    {
+        if (openBatch.submissionCount == maxSubmissions)
+        {
+            flush();
+        }
+        openBatch.submissions[openBatch.submissionCount++] = submission;
+    }
+
+    /**
+     * Present <imageIndices> of the <swapchainCount> <swapchains> on <queue> after the open batch, then hand the
+     * batch over. Nonzero <presentIds> are attached with VK_KHR_present_id.
+     */
+    void present(VkQueue queue,
+                 uint32_t swapchainCount,
+                 const VkSwapchainKHR *swapchains,
+                 const uint32_t *imageIndices,
+                 VkSemaphore waitSemaphore,
+                 const uint64_t *presentIds)
+    {
+        openBatch.presentQueue = queue;
+        openBatch.swapchainCount = swapchainCount;
+        for (uint32_t i = 0; i < swapchainCount; i++)
+        {
+            openBatch.swapchains[i] = swapchains[i];
+            openBatch.imageIndices[i] = imageIndices[i];
+            openBatch.presentIds[i] = presentIds[i];
+        }
+        openBatch.presentWaitSemaphore = waitSemaphore;
+        flush();
+    }
+
+    /**
+     * Hand the open batch to the submit thread. Only waits if the thread is a full queue behind.
+     */
+    void flush()
+    {
+        if (openBatch.submissionCount == 0 && openBatch.swapchainCount == 0)
+        {
+            return;
+        }
+
+        while (!batches.tryPush(openBatch))
+        {
+            std::this_thread::yield();
+        }
+        pushedBatchCount++;
+        openBatch = Batch{};
+
+        // Taking the mutex orders the push before the consumer's check, the wakeup cannot get lost
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+        }
+        wakeCondition.notify_one();
+    }
+
+    /**
+     * Flush and wait until the submit thread made every call, for example before the swapchain is replaced
+     */
+    void waitIdle()
+    {
+        flush();
+        while (processedBatchCount.load(std::memory_order_acquire) != pushedBatchCount)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * True if a present since the last call for <swapchain> reported it out of date or suboptimal
+     */
+    bool takeOutOfDate(VkSwapchainKHR swapchain)
+    {
+        std::lock_guard<std::mutex> lock(outOfDateMutex);
+        auto found = std::find(outOfDateSwapchains.begin(), outOfDateSwapchains.end(), swapchain);
+        if (found == outOfDateSwapchains.end())
+        {
+            return false;
+        }
+        outOfDateSwapchains.erase(found);
+        return true;
+    }
+
+    /**
+     * Make the calls for <submissions>, one vkQueueSubmit per run of submissions to the same queue.
+     * Also used directly when no submit thread runs.
+     */
+    static VkResult execute(const DeviceDispatch *dispatch, uint32_t submissionCount, const Submission *submissions)
+    {
+        VkSubmitInfo submitInfos[maxSubmissions]{};
+        VkTimelineSemaphoreSubmitInfo timelineSubmitInfos[maxSubmissions]{};
+
+        uint32_t first = 0;
+        while (first < submissionCount)
+        {
+            uint32_t count = 0;
+            VkFence fence = VK_NULL_HANDLE;
+            while (first + count < submissionCount && count < maxSubmissions &&
+                   submissions[first + count].queue == submissions[first].queue && fence == VK_NULL_HANDLE)
+            {
+                const Submission &submission = submissions[first + count];
+                VkSubmitInfo &submitInfo = submitInfos[count];
+                submitInfo = VkSubmitInfo{};
+                submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+                submitInfo.waitSemaphoreCount = submission.waitCount;
+                submitInfo.pWaitSemaphores = submission.waitSemaphores;
+                submitInfo.pWaitDstStageMask = submission.waitStages;
+                submitInfo.commandBufferCount = submission.cmdBufferCount;
+                submitInfo.pCommandBuffers = submission.cmdBuffers;
+                submitInfo.signalSemaphoreCount = submission.signalCount;
+                submitInfo.pSignalSemaphores = submission.signalSemaphores;
+
+                if (submission.timelineValues)
+                {
+                    VkTimelineSemaphoreSubmitInfo &timelineSubmitInfo = timelineSubmitInfos[count];
+                    timelineSubmitInfo = VkTimelineSemaphoreSubmitInfo{};
+                    timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+                    timelineSubmitInfo.waitSemaphoreValueCount = submission.waitCount;
+                    timelineSubmitInfo.pWaitSemaphoreValues = submission.waitValues;
+                    timelineSubmitInfo.signalSemaphoreValueCount = submission.signalCount;
+                    timelineSubmitInfo.pSignalSemaphoreValues = submission.signalValues;
+                    submitInfo.pNext = &timelineSubmitInfo;
+                }
+
+                fence = submission.fence;
+                count++;
+            }
+
+            VkResult result = dispatch->vkQueueSubmit(submissions[first].queue, count, submitInfos, fence);
+            if (result != VK_SUCCESS)
+            {
+                return result;
+            }
+            first += count;
+        }
+        return VK_SUCCESS;
+    }
+
+    /**
+     * Present <imageIndices> of the <swapchainCount> <swapchains> in a single vkQueuePresentKHR, with
+     * VK_KHR_present_id if any of <presentIds> is nonzero. <results> receives the result of every swapchain.
+     * Also used directly when no submit thread runs.
+     */
+    static VkResult presentSwapchains(const DeviceDispatch *dispatch,
+                                      VkQueue queue,
+                                      uint32_t swapchainCount,
+                                      const VkSwapchainKHR *swapchains,
+                                      const uint32_t *imageIndices,
+                                      VkSemaphore waitSemaphore,
+                                      const uint64_t *presentIds,
+                                      VkResult *results)
+    {
+        VkPresentInfoKHR presentInfo{};
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores = &waitSemaphore;
+        presentInfo.swapchainCount = swapchainCount;
+        presentInfo.pSwapchains = swapchains;
+        presentInfo.pImageIndices = imageIndices;
+        presentInfo.pResults = results;
+
+        // Swapchains with a 0 id are presented without one
+        VkPresentIdKHR presentIdInfo{};
+        presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+        presentIdInfo.swapchainCount = swapchainCount;
+        presentIdInfo.pPresentIds = presentIds;
+        if (std::any_of(presentIds, presentIds + swapchainCount, [](uint64_t presentId)
+        {
+            return presentId != 0;
+        }))
+        {
+            presentInfo.pNext = &presentIdInfo;
+        }
+        return dispatch->vkQueuePresentKHR(queue, &presentInfo);
+    }
+
+private:
+    static constexpr uint32_t maxSubmissions = 8;
+
+    /**
+     * Submissions of one frame followed by an optional present
+     */
+    struct Batch
+    {
+        uint32_t submissionCount = 0;
+        Submission submissions[maxSubmissions]{};
+
+        // 0 if the batch does not present
+        uint32_t swapchainCount = 0;
+        VkSwapchainKHR swapchains[maxSwapchains]{};
+        uint32_t imageIndices[maxSwapchains]{};
+        uint64_t presentIds[maxSwapchains]{};
+        VkQueue presentQueue = VK_NULL_HANDLE;
+        VkSemaphore presentWaitSemaphore = VK_NULL_HANDLE;
+    };
+
+    const DeviceDispatch *dispatch = nullptr;
+    std::thread thread{};
+
+    SpscQueue<Batch, 8> batches{};
+
+    // Recording thread only
+    Batch openBatch{};
+    uint64_t pushedBatchCount = 0;
+
+    std::atomic<uint64_t> processedBatchCount{0};
+
+    // Swapchains a present found out of date or suboptimal, until <takeOutOfDate> reads them
+    std::mutex outOfDateMutex{};
+    std::vector<VkSwapchainKHR> outOfDateSwapchains{};
+
+    // Only used to sleep while <batches> is empty
+    std::mutex wakeMutex{};
+    std::condition_variable wakeCondition{};
+    bool stopping = false;
+
+    // Presenting and acquiring both need the swapchain exclusively
+    std::mutex *swapchainMutex = nullptr;
+
+    void run()
+    {
+        Batch batch{};
+        while (true)
+        {
+            if (!batches.tryPop(batch))
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wakeCondition.wait(lock, [this]()
+                {
+                    return stopping || !batches.isEmpty();
+                });
+                if (stopping && batches.isEmpty())
+                {
+                    return;
+                }
+                continue;
+            }
+
+            if (execute(dispatch, batch.submissionCount, batch.submissions) != VK_SUCCESS)
+            {
+                // Values were handed out for these submissions already, nothing would ever signal them
+                std::cout << "Failed to submit frame" << std::endl;
+                exit(-1);
+            }
+
+            if (batch.swapchainCount != 0)
+            {
+                VkResult results[maxSwapchains]{};
+                {
+                    std::lock_guard<std::mutex> lock(*swapchainMutex);
+                    presentSwapchains(dispatch,
+                                      batch.presentQueue,
+                                      batch.swapchainCount,
+                                      batch.swapchains,
+                                      batch.imageIndices,
+                                      batch.presentWaitSemaphore,
+                                      batch.presentIds,
+                                      results);
+                }
+
+                std::lock_guard<std::mutex> lock(outOfDateMutex);
+                for (uint32_t i = 0; i < batch.swapchainCount; i++)
+                {
+                    if ((results[i] == VK_ERROR_OUT_OF_DATE_KHR || results[i] == VK_SUBOPTIMAL_KHR) &&
+                        std::find(outOfDateSwapchains.begin(), outOfDateSwapchains.end(), batch.swapchains[i]) ==
+                        outOfDateSwapchains.end())
+                    {
+                        outOfDateSwapchains.push_back(batch.swapchains[i]);
+                    }
+                }
+            }
+
+            processedBatchCount.fetch_add(1, std::memory_order_release);
+        }
+    }
+};
@@ -0,0 +1,471 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "DeletionQueue.h"
+#include "DeviceDispatch.h"
+#include "SubmitThread.h"
+
+/**
+ * GPU progress of every queue as one monotonically increasing value per queue.
+ *
+ * Each submission through <submit> signals the next value of its queue's timeline semaphore. The CPU waits with
+ * <waitUntil>, checks with <isComplete>, and hooks work onto a value with <onComplete>: deferred destruction,
+ * freeing staging memory and reading back queries all run from <poll> once the GPU passed their value. Other
+ * queues wait for a value with <getSemaphore> as a timeline wait.
+ *
+ * Without timeline semaphores every submission carries a fence from a recycled pool instead. The values and
+ * callbacks work the same, only cross queue waits on a value are not possible.
+ *
+ * With <setSubmitThread> the calls themselves move to a submit thread. Values are still handed out right away,
+ * only the vkQueueSubmit happens later, and <waitUntil> flushes the open batch so it never waits on a value that
+ * was not submitted.
+ */
+class TimelineScheduler
+{
+public:
+    using QueueHandle = uint32_t;
+    using Callback = DeletionQueue::Destroyer;
+
+    /**
+     * A semaphore a submission waits on. <value> is ignored for binary semaphores.
+     */
+    struct Wait
+    {
+        VkSemaphore semaphore;
+        uint64_t value;
+        VkPipelineStageFlags stageMask;
+    };
+
+    static constexpr uint32_t maxWaits = SubmitThread::maxWaits;
+
+    void create(VkDevice schedulerDevice,
+                const DeviceDispatch *deviceDispatch,
+                const VkAllocationCallbacks *hostAllocator,
+                bool timelineSemaphoreSupported)
+    {
+        device = schedulerDevice;
+        dispatch = deviceDispatch;
+        allocator = hostAllocator;
+        useTimelines = timelineSemaphoreSupported;
+    }
+
+    /**
+     * Track submissions to <queue>. Adding the same queue twice gives two timelines that must not be used for
+     * ordering against each other. Returns false if the timeline semaphore could not be created.
+     */
+    bool addQueue(VkQueue queue, QueueHandle &handle)
+    {
+        QueueTimeline timeline{};
+        timeline.queue = queue;
+
+        if (useTimelines)
+        {
+            VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo{};
+            semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+            semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+            semaphoreTypeCreateInfo.initialValue = 0;
+
+            VkSemaphoreCreateInfo semaphoreCreateInfo{};
+            semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+
+            if (vkCreateSemaphore(device, &semaphoreCreateInfo, allocator, &timeline.semaphore) != VK_SUCCESS)
+            {
+                return false;
+            }
+        }
+
+        handle = (QueueHandle) timelines.size();
+        timelines.push_back(std::move(timeline));
+        return true;
+    }
+
+    /**
+     * Make queue calls on <thread> from now on, submit directly again if null
+     */
+    void setSubmitThread(SubmitThread *thread)
+    {
+        submitThread = thread;
+    }
+
+    /**
+     * Run every remaining callback. Only valid once the device is idle.
+     */
+    void flush()
+    {
+        for (QueueTimeline &timeline: timelines)
+        {
+            timeline.completedValue = timeline.submittedValue;
+            timeline.callbacks.flush();
+        }
+    }
+
+    /**
+     * Destroy the semaphores and fences, <flush> first
+     */
+    void destroy()
+    {
+        for (QueueTimeline &timeline: timelines)
+        {
+            vkDestroySemaphore(device, timeline.semaphore, allocator);
+            for (const PendingFence &pendingFence: timeline.pendingFences)
+            {
+                vkDestroyFence(device, pendingFence.fence, allocator);
+            }
+        }
+        for (VkFence fence: freeFences)
+        {
+            vkDestroyFence(device, fence, allocator);
+        }
+        timelines.clear();
+        freeFences.clear();
+    }
+
+    /**
+     * True if values are signaled with timeline semaphores, which other queues can wait on
+     */
+    bool hasTimelines() const
+    {
+        return useTimelines;
+    }
+
+    /**
+     * Timeline semaphore of <queue> for waits from other queues, null without timeline semaphores
+     */
+    VkSemaphore getSemaphore(QueueHandle queue) const
+    {
+        return timelines[queue].semaphore;
+    }
+
+    /**
+     * Value of the newest submission to <queue>, 0 before the first one
+     */
+    uint64_t getSubmittedValue(QueueHandle queue) const
+    {
+        return timelines[queue].submittedValue;
+    }
+
+    /**
+     * Newest value of <queue> known to be complete as of the last <poll>
+     */
+    uint64_t getCompletedValue(QueueHandle queue) const
+    {
+        return timelines[queue].completedValue;
+    }
+
+    /**
+     * Submit <cmdBuffers> to <queue> after <waits>, signal its next value and <binarySignal> if not null.
+     * Returns the signaled value, 0 if the submission failed or has more than <SubmitThread::maxCmdBuffers>.
+     */
+    uint64_t submit(QueueHandle queue,
+                    uint32_t cmdBufferCount,
+                    const VkCommandBuffer *cmdBuffers,
+                    uint32_t waitCount,
+                    const Wait *waits,
+                    VkSemaphore binarySignal = VK_NULL_HANDLE)
+    {
+        QueueTimeline &timeline = timelines[queue];
+        uint64_t value = timeline.submittedValue + 1;
+
+        SubmitThread::Submission submission{};
+        if (!fillSubmission(submission, timeline.queue, cmdBufferCount, cmdBuffers, binarySignal))
+        {
+            return 0;
+        }
+        submission.waitCount = waitCount;
+        for (uint32_t i = 0; i < waitCount; i++)
+        {
+            submission.waitSemaphores[i] = waits[i].semaphore;
+            submission.waitValues[i] = waits[i].value;
+            submission.waitStages[i] = waits[i].stageMask;
+        }
+
+        if (useTimelines)
+        {
+            submission.signalSemaphores[submission.signalCount] = timeline.semaphore;
+            submission.signalValues[submission.signalCount++] = value;
+            submission.timelineValues = true;
+        } else if (!acquireFence(submission.fence))
+        {
+            return 0;
+        }
+
+        if (submitThread != nullptr)
+        {
+            submitThread->enqueue(submission);
+        } else if (SubmitThread::execute(dispatch, 1, &submission) != VK_SUCCESS)
+        {
+            if (submission.fence != VK_NULL_HANDLE)
+            {
+                freeFences.push_back(submission.fence);
+            }
+            return 0;
+        }
+
+        if (submission.fence != VK_NULL_HANDLE)
+        {
+            timeline.pendingFences.push_back({value, submission.fence});
+        }
+        timeline.submittedValue = value;
+        return value;
+    }
+
+    /**
+     * Submit <cmdBuffers> to a queue without a timeline, only signaling <binarySignal>. Keeps the order with the
+     * other submissions when those go through the submit thread. Returns false if the submission failed.
+     */
+    bool submitUntracked(VkQueue queue,
+                         uint32_t cmdBufferCount,
+                         const VkCommandBuffer *cmdBuffers,
+                         VkSemaphore binarySignal)
+    {
+        SubmitThread::Submission submission{};
+        if (!fillSubmission(submission, queue, cmdBufferCount, cmdBuffers, binarySignal))
+        {
+            return false;
+        }
+
+        if (submitThread != nullptr)
+        {
+            submitThread->enqueue(submission);
+            return true;
+        }
+        return SubmitThread::execute(dispatch, 1, &submission) == VK_SUCCESS;
+    }
+
+    /**
+     * Present <imageIndex> of <swapchain> on the queue of <queue> once <waitSemaphore> is signaled, tagged with
+     * <presentId> unless it is 0. Through the submit thread this returns VK_ERROR_OUT_OF_DATE_KHR if an earlier
+     * present found the swapchain out of date.
+     */
+    VkResult present(QueueHandle queue,
+                     VkSwapchainKHR swapchain,
+                     uint32_t imageIndex,
+                     VkSemaphore waitSemaphore,
+                     uint64_t presentId = 0)
+    {
+        VkResult result = VK_SUCCESS;
+        present(queue, 1, &swapchain, &imageIndex, waitSemaphore, &presentId, &result);
+        return result;
+    }
+
+    /**
+     * Present the <swapchainCount> <swapchains> with a single vkQueuePresentKHR on the queue of <queue> once
+     * <waitSemaphore> is signaled, each at its entry of <imageIndices> and <presentIds>. <results> receives the
+     * result of every swapchain, through the submit thread VK_ERROR_OUT_OF_DATE_KHR if an earlier present found
+     * that swapchain out of date. Returns the result of the call, or through the submit thread
+     * VK_ERROR_OUT_OF_DATE_KHR if any swapchain was.
+     */
+    VkResult present(QueueHandle queue,
+                     uint32_t swapchainCount,
+                     const VkSwapchainKHR *swapchains,
+                     const uint32_t *imageIndices,
+                     VkSemaphore waitSemaphore,
+                     const uint64_t *presentIds,
+                     VkResult *results)
+    {
+        if (submitThread == nullptr)
+        {
+            return SubmitThread::presentSwapchains(dispatch,
+                                                   timelines[queue].queue,
+                                                   swapchainCount,
+                                                   swapchains,
+                                                   imageIndices,
+                                                   waitSemaphore,
+                                                   presentIds,
+                                                   results);
+        }
+
+        submitThread->present(timelines[queue].queue,
+                              swapchainCount,
+                              swapchains,
+                              imageIndices,
+                              waitSemaphore,
+                              presentIds);
+        VkResult callResult = VK_SUCCESS;
+        for (uint32_t i = 0; i < swapchainCount; i++)
+        {
+            results[i] = submitThread->takeOutOfDate(swapchains[i]) ? VK_ERROR_OUT_OF_DATE_KHR : VK_SUCCESS;
+            if (results[i] != VK_SUCCESS)
+            {
+                callResult = results[i];
+            }
+        }
+        return callResult;
+    }
+
+    /**
+     * Refresh the completed value of <queue> and run the callbacks it reached. Returns the completed value.
+     */
+    uint64_t poll(QueueHandle queue)
+    {
+        QueueTimeline &timeline = timelines[queue];
+
+        if (useTimelines)
+        {
+            uint64_t counterValue = 0;
+            if (dispatch->vkGetSemaphoreCounterValue(device, timeline.semaphore, &counterValue) == VK_SUCCESS)
+            {
+                timeline.completedValue = std::max(timeline.completedValue, counterValue);
+            }
+        } else
+        {
+            // One queue completes in submission order, stop at the first fence still pending
+            while (!timeline.pendingFences.empty() &&
+                   dispatch->vkGetFenceStatus(device, timeline.pendingFences.front().fence) == VK_SUCCESS)
+            {
+                timeline.completedValue = timeline.pendingFences.front().value;
+                recycleFence(timeline.pendingFences.front().fence);
+                timeline.pendingFences.pop_front();
+            }
+        }
+
+        timeline.callbacks.collect(timeline.completedValue);
+        return timeline.completedValue;
+    }
+
+    /**
+     * Poll every queue
+     */
+    void poll()
+    {
+        for (QueueHandle queue = 0; queue < (QueueHandle) timelines.size(); queue++)
+        {
+            poll(queue);
+        }
+    }
+
+    bool isComplete(QueueHandle queue, uint64_t value)
+    {
+        return value <= timelines[queue].completedValue || poll(queue) >= value;
+    }
+
+    /**
+     * Block until <queue> reached <value>, then poll it
+     */
+    void waitUntil(QueueHandle queue, uint64_t value)
+    {
+        if (isComplete(queue, value))
+        {
+            return;
+        }
+        if (submitThread != nullptr)
+        {
+            submitThread->flush();
+        }
+
+        QueueTimeline &timeline = timelines[queue];
+        if (useTimelines)
+        {
+            VkSemaphoreWaitInfo waitInfo{};
+            waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+            waitInfo.semaphoreCount = 1;
+            waitInfo.pSemaphores = &timeline.semaphore;
+            waitInfo.pValues = &value;
+            dispatch->vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+        } else
+        {
+            for (const PendingFence &pendingFence: timeline.pendingFences)
+            {
+                if (pendingFence.value >= value)
+                {
+                    dispatch->vkWaitForFences(device, 1, &pendingFence.fence, VK_TRUE, UINT64_MAX);
+                    break;
+                }
+            }
+        }
+
+        poll(queue);
+    }
+
+    /**
+     * Run <callback> from <poll> once <queue> reached <value>, right away if it already did
+     */
+    void onComplete(QueueHandle queue, uint64_t value, Callback callback)
+    {
+        QueueTimeline &timeline = timelines[queue];
+        if (value <= timeline.completedValue && timeline.callbacks.empty())
+        {
+            callback();
+            return;
+        }
+        timeline.callbacks.push(value, std::move(callback));
+    }
+
+private:
+    struct PendingFence
+    {
+        uint64_t value;
+        VkFence fence;
+    };
+
+    struct QueueTimeline
+    {
+        VkQueue queue = VK_NULL_HANDLE;
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+        uint64_t submittedValue = 0;
+        uint64_t completedValue = 0;
+        DeletionQueue callbacks{};
+
+        // Fence fallback only, oldest submission first
+        std::deque<PendingFence> pendingFences{};
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    const DeviceDispatch *dispatch = nullptr;
+    const VkAllocationCallbacks *allocator = nullptr;
+    bool useTimelines = false;
+    SubmitThread *submitThread = nullptr;
+
+    std::vector<QueueTimeline> timelines{};
+
+    // Unsignaled fences ready for the next submission of the fence fallback
+    std::vector<VkFence> freeFences{};
+
+    static bool fillSubmission(SubmitThread::Submission &submission,
+                               VkQueue queue,
+                               uint32_t cmdBufferCount,
+                               const VkCommandBuffer *cmdBuffers,
+                               VkSemaphore binarySignal)
+    {
+        if (cmdBufferCount > SubmitThread::maxCmdBuffers)
+        {
+            return false;
+        }
+
+        submission.queue = queue;
+        submission.cmdBufferCount = cmdBufferCount;
+        std::copy(cmdBuffers, cmdBuffers + cmdBufferCount, submission.cmdBuffers);
+        if (binarySignal != VK_NULL_HANDLE)
+        {
+            submission.signalSemaphores[submission.signalCount++] = binarySignal;
+        }
+        return true;
+    }
+
+    bool acquireFence(VkFence &fence)
+    {
+        if (!freeFences.empty())
+        {
+            fence = freeFences.back();
+            freeFences.pop_back();
+            return true;
+        }
+
+        VkFenceCreateInfo fenceCreateInfo{};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        return vkCreateFence(device, &fenceCreateInfo, allocator, &fence) == VK_SUCCESS;
+    }
+
+    void recycleFence(VkFence fence)
+    {
+        dispatch->vkResetFences(device, 1, &fence);
+        freeFences.push_back(fence);
+    }
+};
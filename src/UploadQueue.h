@@ -0,0 +1,373 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "DeviceDispatch.h"
+#include "TimelineScheduler.h"
+
+/**
+ * Staging uploads into device local buffers.
+ *
+ * With a dedicated transfer queue family the copy runs on the transfer queue and overlaps rendering. The buffer is
+ * then released by the transfer queue and acquired by the graphics queue (a queue family ownership transfer), a
+ * semaphore orders the acquire after the copy. Without one the copy and a plain barrier go to the graphics queue.
+ *
+ * Uploads never block the CPU. The acquire submission is queued on the graphics queue right away, so every later
+ * graphics submission sees the data. It goes through the scheduler, which frees the staging memory once the
+ * graphics timeline passed it.
+ */
+class UploadQueue
+{
+public:
+    using ChooseMemoryType = std::function<uint32_t(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties)>;
+
+    /**
+     * Create the command pools. <transferQueue> may be the queue of <graphicsTimeline>, in which case no ownership
+     * transfer happens. Returns false if any Vulkan call failed.
+     */
+    bool create(VkDevice uploadDevice,
+                const DeviceDispatch *deviceDispatch,
+                const VkAllocationCallbacks *hostAllocator,
+                TimelineScheduler *timelineScheduler,
+                VkQueue uploadTransferQueue,
+                uint32_t uploadTransferFamily,
+                TimelineScheduler::QueueHandle uploadGraphicsTimeline,
+                uint32_t uploadGraphicsFamily,
+                ChooseMemoryType chooseMemory)
+    {
+        device = uploadDevice;
+        dispatch = deviceDispatch;
+        allocator = hostAllocator;
+        scheduler = timelineScheduler;
+        transferQueue = uploadTransferQueue;
+        transferFamily = uploadTransferFamily;
+        graphicsTimeline = uploadGraphicsTimeline;
+        graphicsFamily = uploadGraphicsFamily;
+        chooseMemoryType = std::move(chooseMemory);
+
+        VkCommandPoolCreateInfo cmdPoolCreateInfo{};
+        cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+        cmdPoolCreateInfo.queueFamilyIndex = transferFamily;
+        if (dispatch->vkCreateCommandPool(device, &cmdPoolCreateInfo, allocator, &transferCmdPool) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        if (isDedicated())
+        {
+            cmdPoolCreateInfo.queueFamilyIndex = graphicsFamily;
+            if (dispatch->vkCreateCommandPool(device, &cmdPoolCreateInfo, allocator, &graphicsCmdPool) != VK_SUCCESS)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Destroy the command pools. The scheduler has to be flushed first, that releases the pending uploads.
+     */
+    void destroy()
+    {
+        dispatch->vkDestroyCommandPool(device, transferCmdPool, allocator);
+        dispatch->vkDestroyCommandPool(device, graphicsCmdPool, allocator);
+        transferCmdPool = VK_NULL_HANDLE;
+        graphicsCmdPool = VK_NULL_HANDLE;
+    }
+
+    /**
+     * True if uploads run on their own queue family
+     */
+    bool isDedicated() const
+    {
+        return transferFamily != graphicsFamily;
+    }
+
+    /**
+     * Copy <size> bytes of <data> into <dstBuffer> at offset 0. The buffer must have TRANSFER_DST usage and
+     * exclusive sharing. Graphics work touching it in <dstStageMask> with <dstAccessMask> may be submitted
+     * right after this returns. Returns false if any Vulkan call failed.
+     */
+    bool uploadBuffer(VkBuffer dstBuffer,
+                      const void *data,
+                      VkDeviceSize size,
+                      VkPipelineStageFlags dstStageMask,
+                      VkAccessFlags dstAccessMask)
+    {
+        PendingUpload upload{};
+
+        if (!createStagingBuffer(upload, data, size))
+        {
+            release(upload);
+            return false;
+        }
+
+        upload.transferCmdBuffer = beginOneTimeCommands(transferCmdPool);
+        if (upload.transferCmdBuffer == VK_NULL_HANDLE)
+        {
+            release(upload);
+            return false;
+        }
+
+        VkBufferCopy copyRegion{};
+        copyRegion.size = size;
+        dispatch->vkCmdCopyBuffer(upload.transferCmdBuffer, upload.stagingBuffer, dstBuffer, 1, &copyRegion);
+
+        VkBufferMemoryBarrier bufferBarrier{};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.buffer = dstBuffer;
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+
+        if (!isDedicated())
+        {
+            // Same queue, a plain barrier makes the copy visible to the consumer
+            bufferBarrier.dstAccessMask = dstAccessMask;
+            bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            dispatch->vkCmdPipelineBarrier(upload.transferCmdBuffer,
+                                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                           dstStageMask,
+                                           0,
+                                           0, nullptr,
+                                           1, &bufferBarrier,
+                                           0, nullptr);
+
+            return submitSingleQueue(upload);
+        }
+
+        // Release half of the ownership transfer. Its destination access is ignored, the acquire provides it
+        bufferBarrier.dstAccessMask = 0;
+        bufferBarrier.srcQueueFamilyIndex = transferFamily;
+        bufferBarrier.dstQueueFamilyIndex = graphicsFamily;
+        dispatch->vkCmdPipelineBarrier(upload.transferCmdBuffer,
+                                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                       0,
+                                       0, nullptr,
+                                       1, &bufferBarrier,
+                                       0, nullptr);
+
+        upload.graphicsCmdBuffer = beginOneTimeCommands(graphicsCmdPool);
+        if (upload.graphicsCmdBuffer == VK_NULL_HANDLE)
+        {
+            release(upload);
+            return false;
+        }
+
+        // Acquire half, the semaphore wait blocks <dstStageMask> and the barrier chains off the same stages
+        bufferBarrier.srcAccessMask = 0;
+        bufferBarrier.dstAccessMask = dstAccessMask;
+        dispatch->vkCmdPipelineBarrier(upload.graphicsCmdBuffer,
+                                       dstStageMask,
+                                       dstStageMask,
+                                       0,
+                                       0, nullptr,
+                                       1, &bufferBarrier,
+                                       0, nullptr);
+
+        return submitOwnershipTransfer(upload, dstStageMask);
+    }
+
+    std::size_t getPendingCount() const
+    {
+        return pendingCount;
+    }
+
+    VkDeviceSize getUploadedBytes() const
+    {
+        return uploadedBytes;
+    }
+
+private:
+    /**
+     * Everything one upload owns until the graphics timeline passes it
+     */
+    struct PendingUpload
+    {
+        VkBuffer stagingBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+        VkCommandBuffer transferCmdBuffer = VK_NULL_HANDLE;
+        VkCommandBuffer graphicsCmdBuffer = VK_NULL_HANDLE;
+        VkSemaphore transferDoneSemaphore = VK_NULL_HANDLE;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    const DeviceDispatch *dispatch = nullptr;
+    const VkAllocationCallbacks *allocator = nullptr;
+
+    TimelineScheduler *scheduler = nullptr;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    uint32_t transferFamily = 0;
+    TimelineScheduler::QueueHandle graphicsTimeline = 0;
+    uint32_t graphicsFamily = 0;
+
+    ChooseMemoryType chooseMemoryType{};
+
+    VkCommandPool transferCmdPool = VK_NULL_HANDLE;
+    VkCommandPool graphicsCmdPool = VK_NULL_HANDLE;
+
+    std::size_t pendingCount = 0;
+    VkDeviceSize uploadedBytes = 0;
+
+    bool createStagingBuffer(PendingUpload &upload, const void *data, VkDeviceSize size)
+    {
+        VkBufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.size = size;
+        bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        if (vkCreateBuffer(device, &bufferCreateInfo, allocator, &upload.stagingBuffer) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        VkMemoryRequirements memoryRequirements{};
+        vkGetBufferMemoryRequirements(device, upload.stagingBuffer, &memoryRequirements);
+
+        VkMemoryAllocateInfo memoryAllocateInfo{};
+        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocateInfo.allocationSize = memoryRequirements.size;
+        memoryAllocateInfo.memoryTypeIndex = chooseMemoryType(memoryRequirements.memoryTypeBits,
+                                                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+        if (vkAllocateMemory(device, &memoryAllocateInfo, allocator, &upload.stagingMemory) != VK_SUCCESS ||
+            vkBindBufferMemory(device, upload.stagingBuffer, upload.stagingMemory, 0) != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        void *mapped = nullptr;
+        if (vkMapMemory(device, upload.stagingMemory, 0, size, 0, &mapped) != VK_SUCCESS)
+        {
+            return false;
+        }
+        memcpy(mapped, data, (size_t) size);
+        vkUnmapMemory(device, upload.stagingMemory);
+
+        uploadedBytes += size;
+        return true;
+    }
+
+    VkCommandBuffer beginOneTimeCommands(VkCommandPool cmdPool)
+    {
+        VkCommandBufferAllocateInfo cmdBufferAllocateInfo{};
+        cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufferAllocateInfo.commandPool = cmdPool;
+        cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdBufferAllocateInfo.commandBufferCount = 1;
+
+        VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+        if (dispatch->vkAllocateCommandBuffers(device, &cmdBufferAllocateInfo, &cmdBuffer) != VK_SUCCESS)
+        {
+            return VK_NULL_HANDLE;
+        }
+
+        VkCommandBufferBeginInfo bufferBeginInfo{};
+        bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if (dispatch->vkBeginCommandBuffer(cmdBuffer, &bufferBeginInfo) != VK_SUCCESS)
+        {
+            dispatch->vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuffer);
+            return VK_NULL_HANDLE;
+        }
+
+        return cmdBuffer;
+    }
+
+    bool submitSingleQueue(PendingUpload &upload)
+    {
+        if (dispatch->vkEndCommandBuffer(upload.transferCmdBuffer) != VK_SUCCESS)
+        {
+            release(upload);
+            return false;
+        }
+
+        // The transfer queue is the graphics queue here
+        uint64_t value = scheduler->submit(graphicsTimeline, 1, &upload.transferCmdBuffer, 0, nullptr);
+        if (value == 0)
+        {
+            release(upload);
+            return false;
+        }
+
+        releaseAfter(value, upload);
+        return true;
+    }
+
+    bool submitOwnershipTransfer(PendingUpload &upload, VkPipelineStageFlags dstStageMask)
+    {
+        VkSemaphoreCreateInfo semaphoreCreateInfo{};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        if (dispatch->vkEndCommandBuffer(upload.transferCmdBuffer) != VK_SUCCESS ||
+            dispatch->vkEndCommandBuffer(upload.graphicsCmdBuffer) != VK_SUCCESS ||
+            vkCreateSemaphore(device, &semaphoreCreateInfo, allocator, &upload.transferDoneSemaphore) != VK_SUCCESS)
+        {
+            release(upload);
+            return false;
+        }
+
+        if (!scheduler->submitUntracked(transferQueue, 1, &upload.transferCmdBuffer, upload.transferDoneSemaphore))
+        {
+            release(upload);
+            return false;
+        }
+
+        // The acquire completes after the copy, so its timeline value covers the whole upload
+        TimelineScheduler::Wait transferDone{upload.transferDoneSemaphore, 0, dstStageMask};
+        uint64_t value = scheduler->submit(graphicsTimeline, 1, &upload.graphicsCmdBuffer, 1, &transferDone);
+        if (value == 0)
+        {
+            // The copy is already queued, wait for it before freeing what it uses
+            dispatch->vkQueueWaitIdle(transferQueue);
+            release(upload);
+            return false;
+        }
+
+        releaseAfter(value, upload);
+        return true;
+    }
+
+    /**
+     * Hand <upload> to the scheduler, it is released once the graphics timeline reaches <value>
+     */
+    void releaseAfter(uint64_t value, const PendingUpload &upload)
+    {
+        pendingCount++;
+        scheduler->onComplete(graphicsTimeline,
+                              value,
+                              [this, pendingUpload = upload]() mutable
+                              {
+                                  release(pendingUpload);
+                                  pendingCount--;
+                              });
+    }
+
+    void release(PendingUpload &upload)
+    {
+        if (upload.transferCmdBuffer != VK_NULL_HANDLE)
+        {
+            dispatch->vkFreeCommandBuffers(device, transferCmdPool, 1, &upload.transferCmdBuffer);
+        }
+        if (upload.graphicsCmdBuffer != VK_NULL_HANDLE)
+        {
+            dispatch->vkFreeCommandBuffers(device, graphicsCmdPool, 1, &upload.graphicsCmdBuffer);
+        }
+        vkDestroySemaphore(device, upload.transferDoneSemaphore, allocator);
+        vkDestroyBuffer(device, upload.stagingBuffer, allocator);
+        vkFreeMemory(device, upload.stagingMemory, allocator);
+        upload = PendingUpload{};
+    }
+};
@@ -0,0 +1,268 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Writes frames of uncompressed video from a thread of its own, so file or pipe I/O never runs on the thread
+ * producing the frames.
+ *
+ * The producer fills one of a fixed number of frame buffers between <beginFrame> and <endFrame>, the writer thread
+ * writes filled buffers in order and hands them back. Memory stays at <queueDepth> frames. If the output cannot
+ * keep up, <beginFrame> blocks until a buffer is written, so no frame is lost, and the time spent blocked is
+ * counted.
+ *
+ * Y4M frames hold the Y, U and V planes of 4:2:0 with chroma (<width> + 1) / 2 wide and (<height> + 1) / 2 high,
+ * which ffmpeg and most players read directly. Raw RGB24 frames are packed rows without any header.
+ */
+class VideoWriter
+{
+public:
+    enum class Format
+    {
+        Y4m,
+        Rgb24,
+    };
+
+    /**
+     * Open <path>, "-" for standard output, and start the writer thread. Returns false if the file cannot be
+     * opened or its header cannot be written.
+     */
+    bool start(const std::string &path,
+               Format videoFormat,
+               uint32_t videoWidth,
+               uint32_t videoHeight,
+               double frameRate,
+               uint32_t queueDepth)
+    {
+        format = videoFormat;
+        width = videoWidth;
+        height = videoHeight;
+
+        closeFile = path != "-";
+        file = closeFile ? std::fopen(path.c_str(), "wb") : stdout;
+        if (file == nullptr)
+        {
+            return false;
+        }
+
+        if (format == Format::Y4m)
+        {
+            // Fractional rates as thousandths, 29.97 becomes 29970:1000
+            uint64_t rateNumerator = (uint64_t) std::llround(frameRate * 1000.0);
+            uint64_t rateDenominator = 1000;
+            if (rateNumerator % 1000 == 0)
+            {
+                rateNumerator /= 1000;
+                rateDenominator = 1;
+            }
+            if (std::fprintf(file,
+                             "YUV4MPEG2 W%u H%u F%llu:%llu Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+                             width,
+                             height,
+                             (unsigned long long) rateNumerator,
+                             (unsigned long long) rateDenominator) < 0)
+            {
+                closeOutput();
+                return false;
+            }
+        }
+
+        frameSize = format == Format::Y4m
+                    ? (std::size_t) width * height + 2 * (std::size_t) ((width + 1) / 2) * ((height + 1) / 2)
+                    : (std::size_t) 3 * width * height;
+        buffers.assign(queueDepth, std::vector<uint8_t>(frameSize));
+        freeBuffers.clear();
+        filledBuffers.clear();
+        for (uint32_t i = 0; i < queueDepth; i++)
+        {
+            freeBuffers.push_back(i);
+        }
+
+        stopping = false;
+        failed = false;
+        writtenCount = 0;
+        stallTime = 0.0;
+        thread = std::thread([this]()
+                             {
+                                 run();
+                             });
+        return true;
+    }
+
+    /**
+     * Write every queued frame, join the thread and close the file. Returns false if any write failed.
+     */
+    bool stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        filledCondition.notify_one();
+        thread.join();
+
+        if (!closeOutput())
+        {
+            failed = true;
+        }
+        buffers.clear();
+        return !failed;
+    }
+
+    /**
+     * Producer: the buffer to fill with the next frame, <getFrameSize> bytes laid out for <getFormat>. Blocks while
+     * every buffer is queued for writing.
+     */
+    uint8_t *beginFrame()
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        if (freeBuffers.empty())
+        {
+            auto stallStart = std::chrono::steady_clock::now();
+            freeCondition.wait(lock, [this]()
+            {
+                return !freeBuffers.empty();
+            });
+            stallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - stallStart).count();
+        }
+        currentBuffer = freeBuffers.front();
+        freeBuffers.pop_front();
+        return buffers[currentBuffer].data();
+    }
+
+    /**
+     * Producer: the buffer of the last <beginFrame> is complete, queue it for writing
+     */
+    void endFrame()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            filledBuffers.push_back(currentBuffer);
+        }
+        filledCondition.notify_one();
+    }
+
+    Format getFormat() const
+    {
+        return format;
+    }
+
+    uint32_t getWidth() const
+    {
+        return width;
+    }
+
+    uint32_t getHeight() const
+    {
+        return height;
+    }
+
+    std::size_t getFrameSize() const
+    {
+        return frameSize;
+    }
+
+    /**
+     * Frames written so far, only exact after <stop>
+     */
+    uint64_t getWrittenCount() const
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        return writtenCount;
+    }
+
+    /**
+     * Seconds the producer blocked in <beginFrame> because the output fell behind
+     */
+    double getStallTime() const
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        return stallTime;
+    }
+
+private:
+    Format format = Format::Y4m;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::size_t frameSize = 0;
+
+    std::FILE *file = nullptr;
+    // False for standard output, which stays open
+    bool closeFile = false;
+    std::thread thread{};
+
+    std::vector<std::vector<uint8_t>> buffers{};
+    // Producer only
+    uint32_t currentBuffer = 0;
+
+    // Indices into <buffers>, free ones for the producer and filled ones in frame order for the writer
+    mutable std::mutex queueMutex{};
+    std::condition_variable freeCondition{};
+    std::condition_variable filledCondition{};
+    std::deque<uint32_t> freeBuffers{};
+    std::deque<uint32_t> filledBuffers{};
+    bool stopping = false;
+    uint64_t writtenCount = 0;
+    double stallTime = 0.0;
+
+    // Writer thread only until <stop>
+    bool failed = false;
+
+    void run()
+    {
+        while (true)
+        {
+            uint32_t buffer;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                filledCondition.wait(lock, [this]()
+                {
+                    return stopping || !filledBuffers.empty();
+                });
+                if (filledBuffers.empty())
+                {
+                    return;
+                }
+                buffer = filledBuffers.front();
+                filledBuffers.pop_front();
+            }
+
+            // After a failed write the frames are still taken and handed back, so the producer never blocks
+            if (!failed)
+            {
+                static const char frameHeader[] = "FRAME\n";
+                if ((format == Format::Y4m && std::fwrite(frameHeader, sizeof(frameHeader) - 1, 1, file) != 1) ||
+                    std::fwrite(buffers[buffer].data(), frameSize, 1, file) != 1)
+                {
+                    failed = true;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                freeBuffers.push_back(buffer);
+                if (!failed)
+                {
+                    writtenCount++;
+                }
+            }
+            freeCondition.notify_one();
+        }
+    }
+
+    bool closeOutput()
+    {
+        bool closed = closeFile ? std::fclose(file) == 0 : std::fflush(file) == 0;
+        file = nullptr;
+        return closed;
+    }
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bounded Chase-Lev deque of pointers. The owner thread pushes and pops at the bottom like a stack, any other
+ * thread steals from the top. Owner and thieves only contend when one element is left.
+ *
+ * Follows the C11 formulation of Lê, Pop, Cohen and Zappa Nardelli, with sequentially consistent accesses to the
+ * indices in place of its standalone fences. The array does not grow, <push> returns false when it is full and the
+ * caller runs the work itself.
+ */
+template<typename T, std::size_t Capacity>
+class WorkStealingDeque
+{
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    /**
+     * Owner only
+     */
+    bool push(T *value)
+    {
+        int64_t bottomIndex = bottom.load(std::memory_order_relaxed);
+        int64_t topIndex = top.load(std::memory_order_acquire);
+        if (bottomIndex - topIndex >= (int64_t) Capacity)
+        {
+            return false;
+        }
+
+        slots[bottomIndex & (Capacity - 1)].store(value, std::memory_order_relaxed);
+        bottom.store(bottomIndex + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Owner only. Returns the newest element, null if the deque is empty or a thief took the last one.
+     */
+    T *pop()
+    {
+        int64_t bottomIndex = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(bottomIndex, std::memory_order_seq_cst);
+        int64_t topIndex = top.load(std::memory_order_seq_cst);
+
+        if (topIndex > bottomIndex)
+        {
+            bottom.store(bottomIndex + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        T *value = slots[bottomIndex & (Capacity - 1)].load(std::memory_order_relaxed);
+        if (topIndex == bottomIndex)
+        {
+            // Last element, race the thieves for it
+            if (!top.compare_exchange_strong(topIndex,
+                                             topIndex + 1,
+                                             std::memory_order_seq_cst,
+                                             std::memory_order_relaxed))
+            {
+                value = nullptr;
+            }
+            bottom.store(bottomIndex + 1, std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+    /**
+     * Any thread. Returns the oldest element, null if the deque is empty or another thread won the race.
+     */
+    T *steal()
+    {
+        int64_t topIndex = top.load(std::memory_order_seq_cst);
+        int64_t bottomIndex = bottom.load(std::memory_order_seq_cst);
+
+        if (topIndex >= bottomIndex)
+        {
+            return nullptr;
+        }
+
+        T *value = slots[topIndex & (Capacity - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(topIndex,
+                                         topIndex + 1,
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        return value;
+    }
+
+private:
+    static constexpr std::size_t cacheLineSize = 64;
+
+    // Thieves advance <top>, the owner moves <bottom>
+    alignas(cacheLineSize) std::atomic<int64_t> top{0};
+    alignas(cacheLineSize) std::atomic<int64_t> bottom{0};
+
+    alignas(cacheLineSize) std::atomic<T *> slots[Capacity]{};
+};
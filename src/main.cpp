@@ -1,13 +1,47 @@
 #define GLFW_INCLUDE_VULKAN
 
 #include "GLFW/glfw3.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <condition_variable>
 #include <cstring>
+#include <filesystem>
+#include <ctime>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <cstdlib>
 #include <vector>
 #include <fstream>
+#include <string>
+#include <thread>
 #include <vulkan/vulkan.h>
 
+#include "AsyncCompute.h"
+#include "DeviceDispatch.h"
+#include "DynamicResolution.h"
+#include "FramePacer.h"
+#include "HostAllocator.h"
+#include "ImageStreamWriter.h"
+#include "JobSystem.h"
+#include "JobSystemBenchmark.h"
+#include "PixelConversion.h"
+#include "PresentWatcher.h"
+#include "ReadbackRing.h"
+#include "RenderGraph.h"
+#include "RenderGraphSelfTest.h"
+#include "SpscQueue.h"
+#include "SubmitThread.h"
+#include "TimelineScheduler.h"
+#include "UploadQueue.h"
+#include "VideoWriter.h"
+
 /**
  * @brief
  * @param vulkanInstance
@@ -46,10 +80,160 @@ VkResult createDebugUtilsMessenger(VkInstance vulkanInstance,
     }
 }
 
+/**
+ * Vertex layout of the vertex buffer, matches the inputs of vert.vert
+ */
+struct Vertex
+{
+    float position[2];
+    float color[3];
+};
+
+/**
+ * The triangle, uploaded once into a device local vertex buffer
+ */
+static const Vertex triangleVertices[3] =
+        {
+                {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+                {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
+                {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+        };
+
+/**
+ * Push constants of particles.comp
+ */
+struct ParticleParameters
+{
+    float time;
+    uint32_t particleCount;
+    uint32_t iterations;
+};
+
+/**
+ * Push constants of vert.vert, a clip space scale and offset applied to every vertex. The identity draws the whole
+ * frame, others draw one tile of a larger image.
+ */
+struct SceneTransform
+{
+    float scale[2];
+    float offset[2];
+};
+
+/**
+ * Options parsed from the command line
+ */
+struct ProgramOptions
+{
+    // Use the legacy VkRenderPass/VkFramebuffer path even if dynamic rendering is available
+    bool forceRenderPass = false;
+
+    // If set, the compiled frame graph is written to this file in DOT format
+    std::string graphDumpPath{};
+
+    // Requested MSAA sample count, 1 renders straight into the swapchain image
+    uint32_t msaaSamples = 4;
+
+    // Physical device override, an index, a device name (substring) or a device UUID
+    std::string gpuSelection{};
+
+    // If set, run this microbenchmark after setup instead of the render loop
+    std::string benchmark{};
+
+    // Host allocator passed as <pAllocator> to every create and destroy call
+    HostAllocator::Mode hostAllocatorMode = HostAllocator::Mode::Tracking;
+
+    // Run the particle update on a compute only queue when the GPU has one
+    bool asyncCompute = true;
+
+    // Particles simulated by the compute pass, each drawn as a small triangle
+    uint32_t particleCount = 16384;
+
+    // Extra integration steps per particle, scales the compute load
+    uint32_t computeLoad = 64;
+
+    // Make queue submissions and presents on a submit thread instead of the render thread
+    bool submitThread = true;
+
+    // Only draw a frame after a resize, an expose or a state change instead of continuously
+    bool onDemand = false;
+
+    // Frames per second the frame pacer submits at, 0 renders as fast as the present mode allows
+    double targetFrameRate = 0.0;
+
+    // Delay the start of paced frames so input is read as late as possible before submission
+    bool lateInputSampling = true;
+
+    // If set, the latency of every timed present is written to this file in CSV format
+    std::string latencyCsvPath{};
+
+    // GPU time per frame in milliseconds the render resolution adapts to, 0 always renders at the swapchain extent
+    double frameBudget = 0.0;
+
+    // Copy every frame back into host memory a few frames after it was rendered
+    bool readback = false;
+
+    // If set, every frame is read back and written to this file as uncompressed video, "-" writes to standard
+    // output. Raw RGB24 if the name ends in ".rgb", Y4M otherwise.
+    std::string recordPath{};
+
+    // If set, render one image of <posterWidth> x <posterHeight> tile by tile into this file instead of the render
+    // loop. PNG or PPM by the name's extension, raw RGB24 otherwise.
+    std::string posterPath{};
+    uint32_t posterWidth = 0;
+    uint32_t posterHeight = 0;
+
+    // If set, serve render jobs dropped into this spool directory instead of running the render loop
+    std::string servePath{};
+
+    // Windows the render loop shows the scene in, each with a swapchain of its own. All of them are rendered in
+    // one submission and presented in one call.
+    uint32_t windowCount = 1;
+};
+
+/**
+ * What the device was created with. Filled in by <createDevice> so the renderer can pick fast paths at run time
+ * instead of assuming a plain Vulkan 1.0 device
+ */
+struct DeviceCapabilities
+{
+    // Effective API version, the lower of what the instance requested and what the device reports
+    uint32_t apiVersion = VK_API_VERSION_1_0;
+
+    // Core in 1.2, VK_KHR_timeline_semaphore before that
+    bool timelineSemaphore = false;
+
+    // Runtime sized, partially bound, non-uniformly indexed sampled image arrays (1.2 only)
+    bool descriptorIndexing = false;
+
+    // vkGetBufferDeviceAddress and raw pointers in shaders (1.2 only)
+    bool bufferDeviceAddress = false;
+
+    // vkCmdDrawIndirectCount, core in 1.2, VK_KHR_draw_indirect_count before that
+    bool drawIndirectCount = false;
+
+    // VK_KHR_synchronization2
+    bool synchronization2 = false;
+
+    // VK_KHR_dynamic_rendering
+    bool dynamicRendering = false;
+
+    // VK_EXT_extended_dynamic_state
+    bool extendedDynamicState = false;
+
+    // VK_KHR_present_id and VK_KHR_present_wait, presents are only timed with both
+    bool presentWait = false;
+};
+
 class VulkanProgram
 {
 public:
 
+    explicit VulkanProgram(ProgramOptions programOptions) : options(programOptions),
+                                                            hostAllocator(programOptions.hostAllocatorMode)
+    {
+        vulkanProgramInfo.allocator = hostAllocator.getCallbacks();
+    }
+
     /**
      * Run the main Vulkan program
      */
@@ -57,28 +241,195 @@ public:
     {
         // Setup phase
         createGLFWWindow();
+        startJobSystem();
         createVulkanInstance();
         surfaceVulkanAndWindow();
 
         createDevice();
+        createTimelineScheduler();
+        chooseAttachmentFormats();
+        chooseDynamicResolution();
         createSwapchain();
-        createGraphicsPipeline();
+        createAttachments();
+        // Dynamic rendering begins rendering directly on image views,
+        // render pass and framebuffers only exist on the legacy path
+        if (!vulkanProgramInfo.capabilities.dynamicRendering)
+        {
+            createGraphicsPipeline();
+        }
         createShaderPipeline();
-        createFramebuffer();
+        createParticlePipeline();
+        createParticleBuffers();
+        if (!vulkanProgramInfo.capabilities.dynamicRendering)
+        {
+            createFramebuffer();
+        } else
+        {
+            buildFrameGraph();
+        }
+        createVertexBuffer();
         createCmdPool();
 
-        createSemaphores();
+        createFrameSyncObjects();
+        createExtraWindows();
+        createAsyncCompute();
+        createReadback();
+        startRecording();
+
+        if (!options.graphDumpPath.empty())
+        {
+            dumpFrameGraph();
+        }
 
-        // Running phase
+        // Running phase, either the render loop or the benchmark
         vulkanProgramLoop();
 
         // Terminating phase
         cleanup();
     }
 
+    /**
+     * Why a <width> x <height> image can not be rendered tile by tile into <path>, empty if it can
+     */
+    static std::string checkTiledImageSize(const std::string &path, uint32_t width, uint32_t height)
+    {
+        if (width == 0 || height == 0)
+        {
+            return "width and height have to be positive";
+        }
+        uint32_t formatLimit = ImageStreamWriter::maxDimension(ImageStreamWriter::formatOf(path));
+        if (width > formatLimit || height > formatLimit)
+        {
+            return "width and height are limited to " + std::to_string(formatLimit) + " by the file format";
+        }
+        if (width > maxTiledImageDimension || height > maxTiledImageDimension)
+        {
+            return "width and height are limited to " + std::to_string(maxTiledImageDimension);
+        }
+        if ((uint64_t) width * height > maxTiledImagePixels)
+        {
+            return "images are limited to " + std::to_string(maxTiledImagePixels) + " pixels";
+        }
+        return {};
+    }
+
 private:
+    ProgramOptions options;
+
+    // Owns the host memory the driver allocates through <vulkanProgramInfo.allocator>
+    HostAllocator hostAllocator;
+
     GLFWwindow *window = nullptr;
 
+    /**
+     * An image with its own memory and view, used for render targets sized by the swapchain
+     */
+    struct AttachmentImage
+    {
+        VkImage image = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkImageView imageView = VK_NULL_HANDLE;
+
+        // Size the image would occupy if it was fully backed by memory
+        VkDeviceSize size = 0;
+        bool lazilyAllocated = false;
+    };
+
+    // Frames the CPU may queue ahead of the GPU
+    static constexpr uint32_t maxFramesInFlight = 2;
+
+    // Longest single wait of an acquire in nanoseconds, the swapchain mutex is released between attempts
+    static constexpr uint64_t acquireTimeout = 1000000;
+
+    // Attempts before the primary window gives up on an acquire and skips the frame, about 100 ms
+    static constexpr uint32_t acquireAttempts = 100;
+
+    // Attempts before an extra window is left out of the frame, short so a stalled one barely delays the others
+    static constexpr uint32_t extraAcquireAttempts = 2;
+
+    // Recorded frames converted but not yet written, before rendering waits for the output
+    static constexpr uint32_t recordQueueDepth = 8;
+
+    // Largest tile of tiled rendering. Wide and short, since a whole row of tiles is kept in host memory until it is
+    // written.
+    static constexpr uint32_t posterTileWidth = 4096;
+    static constexpr uint32_t posterTileHeight = 256;
+
+    // Largest side of a tiled image, keeps its row of tiles below 1 GiB of RGB
+    static constexpr uint32_t maxTiledImageDimension = 1u << 20;
+
+    // Largest tiled image, 16 gigapixels or 48 GB of RGB
+    static constexpr uint64_t maxTiledImagePixels = 1ull << 34;
+
+    /**
+     * Render target of tiled rendering: the single sampled color image tiles are read back from, with MSAA the
+     * multisampled image resolved into it, and depth
+     */
+    struct TileTarget
+    {
+        VkExtent2D extent{};
+        AttachmentImage color{};
+        AttachmentImage msaaColor{};
+        AttachmentImage depth{};
+    };
+
+    /**
+     * The image tiled rendering is streaming to a file
+     */
+    struct TiledImage
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        VkExtent2D tileExtent{};
+        uint32_t columnCount = 0;
+        // Readback copy number of the first tile
+        uint64_t firstCopy = 0;
+        // The row of tiles being assembled, RGB
+        std::vector<uint8_t> band{};
+        ImageStreamWriter writer{};
+        bool written = false;
+    };
+
+    /**
+     * A window besides the primary one. It shows the same scene, <drawFrame> renders it in the submission of the
+     * primary window and presents it in the same call.
+     */
+    struct ExtraWindow
+    {
+        GLFWwindow *window = nullptr;
+        VkSurfaceKHR surface = VK_NULL_HANDLE;
+        VkColorSpaceKHR colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+
+        // Null while the window is minimized before its first frame
+        VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+        VkExtent2D extent{};
+        std::vector<VkImage> images{};
+        std::vector<VkImageView> imageViews{};
+        AttachmentImage msaaColor{};
+        AttachmentImage depth{};
+
+        // Per frame in flight, the command buffer is recorded again every frame
+        VkCommandBuffer cmdBuffers[maxFramesInFlight]{};
+        VkSemaphore imageAvailableSemaphores[maxFramesInFlight]{};
+
+        // Render thread only, updated from <renderEvents>
+        int framebufferWidth = 0;
+        int framebufferHeight = 0;
+        bool resized = false;
+    };
+
+    /**
+     * Synchronization of one frame in flight
+     */
+    struct FrameSync
+    {
+        VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
+        VkSemaphore renderFinishedSemaphore = VK_NULL_HANDLE;
+
+        // Graphics timeline value of the frame last submitted with this slot, 0 before the first submission
+        uint64_t timelineValue = 0;
+    };
+
     /**
      * A structure contains all the objects that are needed for a vulkan program
      */
@@ -87,6 +438,9 @@ private:
         // Vulkan instance where the whole program begins
         VkInstance vulkanInstance = VK_NULL_HANDLE;
 
+        // Host allocation callbacks for every create and destroy call, null with the system allocator
+        const VkAllocationCallbacks *allocator = nullptr;
+
         // The logical device that abstract the chosen GPU
         VkDevice GPUDevice = VK_NULL_HANDLE;
 
@@ -142,12 +496,196 @@ private:
 		VkPipeline graphicsPipeline{};
 		std::vector<VkFramebuffer> swapchainFramebuffers{};
 
-        VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
-        VkSemaphore renderFinishedSemaphore = VK_NULL_HANDLE;
         VkQueue presentAndGraphicsQueue = VK_NULL_HANDLE;
 
+        // Queue staging uploads run on, a transfer only family if the GPU has one, otherwise the graphics queue
+        VkQueue transferQueue = VK_NULL_HANDLE;
+        uint32_t transferQueueFamilyIndex{};
+        UploadQueue uploadQueue{};
+
+        // Device local vertex buffer of <triangleVertices>
+        VkBuffer vertexBuffer = VK_NULL_HANDLE;
+        VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
+
+        // Queue the particle update runs on, a compute only family if the GPU has one, otherwise the graphics queue
+        VkQueue computeQueue = VK_NULL_HANDLE;
+        uint32_t computeQueueFamilyIndex{};
+        AsyncCompute asyncCompute{};
+
+        // Particle update pipeline. It writes <Vertex> triangles into one storage buffer per swapchain image,
+        // which the graphics pipeline then reads as a vertex buffer.
+        VkDescriptorSetLayout particleSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout particlePipelineLayout = VK_NULL_HANDLE;
+        VkPipeline particlePipeline = VK_NULL_HANDLE;
+        VkDescriptorPool particleDescriptorPool = VK_NULL_HANDLE;
+        std::vector<VkBuffer> particleBuffers{};
+        std::vector<VkDeviceMemory> particleBufferMemories{};
+        std::vector<VkDescriptorSet> particleDescriptorSets{};
+        RenderGraph::ResourceHandle particleResource{};
+        std::chrono::steady_clock::time_point startTime{};
+
+        // Frames in flight, <currentFrame> is the slot the next frame uses
+        std::vector<FrameSync> frames{};
+        uint32_t currentFrame = 0;
+
+        // Graphics timeline value of the frame that last submitted the command buffer of each swapchain image
+        std::vector<uint64_t> imageTimelineValues{};
+
+        // GPU progress of the graphics queue and the async compute queue (the same handle without one).
+        // Objects retired while frames may still use them are destroyed from its graphics timeline callbacks.
+        TimelineScheduler scheduler{};
+        TimelineScheduler::QueueHandle graphicsTimeline{};
+        TimelineScheduler::QueueHandle computeTimeline{};
+
+        // Makes the scheduler's queue calls while the render loop runs, if enabled
+        SubmitThread submitThread{};
+
+        // Held by every thread that acquires from, presents to, waits on or replaces the swapchain
+        std::mutex swapchainMutex{};
+
+        // Times presents while the render loop runs, if the device supports it
+        PresentWatcher presentWatcher{};
+        uint64_t nextPresentId = 1;
+
+        // Worker pool for CPU work that can run in parallel, one worker per core besides the calling thread
+        JobSystem jobs{};
+
+        // Optional instance extensions, enabled only when the loader exposes them
+        std::vector<const char *> optionalInstanceExtensions
+                {
+                        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+                };
+
+        // API version the instance was created with, at most 1.2
+        uint32_t instanceApiVersion = VK_API_VERSION_1_0;
+
+        // Features negotiated in <createDevice>
+        DeviceCapabilities capabilities{};
+
+        // Device commands resolved through <vkGetDeviceProcAddr>, used for everything recorded or submitted per frame.
+        // Extension commands (extended dynamic state, dynamic rendering, synchronization2) are null unless
+        // the matching capability is enabled.
+        DeviceDispatch dispatch{};
+
+        // Frame graph of the dynamic rendering path and the swapchain image imported into it
+        RenderGraph frameGraph{};
+        RenderGraph::ResourceHandle backbufferResource{};
+
+        // Memory heaps and types of the chosen GPU
+        VkPhysicalDeviceMemoryProperties memoryProperties{};
+
+        // Multisampled color and depth attachments. Both are transient: they are cleared on load, never stored
+        // and resolved into the swapchain image inside the subpass, so on tilers they live in tile memory only.
+        VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+        VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+        AttachmentImage msaaColorAttachment{};
+        AttachmentImage depthAttachment{};
+        RenderGraph::ResourceHandle msaaColorResource{};
+        RenderGraph::ResourceHandle depthResource{};
+
+        // Extent viewport, scissor and render area of the command buffer being recorded cover
+        VkExtent2D renderExtent{};
+
+        // Dynamic resolution: the scene is rendered into <sceneResource>, sized like the swapchain, at a fraction
+        // of its extent picked by <resolutionScaler> and then blitted to the swapchain image
+        bool dynamicResolution = false;
+        DynamicResolution resolutionScaler{};
+        RenderGraph::ResourceHandle sceneResource{};
+        VkFilter upscaleFilter = VK_FILTER_LINEAR;
+
+        // Timestamps around the command buffer of each swapchain image, and the scale each one was recorded at
+        VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+        double timestampPeriod = 0.0;
+        uint64_t timestampMask = 0;
+        std::vector<double> recordedScales{};
+
+        // Readback: every swapchain image is copied into <readbackRing> after rendering, if the swapchain allows it
+        bool readback = false;
+        ReadbackRing readbackRing{};
+
+        // Recording: every frame read back is converted and queued on <videoWriter>
+        bool recording = false;
+        VideoWriter videoWriter{};
+
     } vulkanProgramInfo;
 
+    /**
+     * Window input and state changes, produced by the GLFW callbacks on the main thread
+     */
+    struct RenderEvent
+    {
+        enum class Type
+        {
+            FramebufferResize,
+            KeyPress,
+            // The window system lost the window contents and needs a new frame
+            Expose,
+            Quit,
+        };
+
+        Type type = Type::Quit;
+
+        // FramebufferResize, new size in pixels
+        int width = 0;
+        int height = 0;
+
+        // KeyPress, GLFW key code
+        int key = 0;
+
+        // FramebufferResize, 0 for the primary window, otherwise 1 + the index into <extraWindows>
+        uint32_t windowIndex = 0;
+
+        // When the main thread received the event
+        std::chrono::steady_clock::time_point time{};
+    };
+
+    // Main thread to render thread
+    SpscQueue<RenderEvent, 256> renderEvents{};
+
+    // Only used to sleep while <renderEvents> is empty
+    std::mutex renderWakeMutex{};
+    std::condition_variable renderWakeCondition{};
+
+    // Readback statistics since the last report, and the RGB pixels of the newest frame read back
+    std::vector<uint8_t> readbackPixels{};
+    std::chrono::steady_clock::time_point readbackReportStart{};
+    uint64_t readbackFrameCount = 0;
+    uint64_t readbackBytes = 0;
+    double readbackConversionTime = 0.0;
+    uint64_t readbackLatencyFrames = 0;
+
+    // Frames read back at a size other than the recording's, after the window was resized
+    uint64_t recordSkippedCount = 0;
+
+    // Tiled rendering, render thread only. Everything but <tiledImage> is kept from one image to the next.
+    TileTarget tileTarget{};
+    ReadbackRing tileReadback{};
+    VkExtent2D tileReadbackExtent{};
+    VkCommandPool tileCmdPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> tileCmdBuffers{};
+    std::vector<uint64_t> tileValues{};
+    TiledImage tiledImage{};
+
+    // Windows besides <window>. The vector is filled before the render thread starts and keeps its size, the main
+    // thread only reads the GLFW windows.
+    std::vector<ExtraWindow> extraWindows{};
+    VkCommandPool extraCmdPool = VK_NULL_HANDLE;
+
+    // Owned by the render thread once it runs, updated from <renderEvents>
+    int framebufferWidth = 0;
+    int framebufferHeight = 0;
+    bool framebufferResized = false;
+    bool quitRequested = false;
+
+    // The presented image is out of date, <renderLoop> only draws while this is set in on demand mode
+    bool frameDirty = true;
+
+    // Receive time of the newest input no presented frame reflects yet, the epoch if there is none
+    std::chrono::steady_clock::time_point unpresentedInputTime{};
+
+    // Render thread only, used if <options.targetFrameRate> is set
+    FramePacer framePacer{};
+
     VkResult vkResult{};
 
     /**
@@ -161,8 +699,10 @@ private:
             exit(-1);
         }
 
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        // The batch service renders offscreen, its window only provides the surface the device is chosen for
+        glfwWindowHint(GLFW_VISIBLE, options.servePath.empty() ? GLFW_TRUE : GLFW_FALSE);
 
         window = glfwCreateWindow(800, 500, "Vulkan Program", nullptr, nullptr);
 
@@ -172,6 +712,32 @@ private:
             exit(-1);
         }
 
+        glfwSetWindowUserPointer(window, this);
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+        glfwSetKeyCallback(window, keyCallback);
+        glfwSetWindowRefreshCallback(window, windowRefreshCallback);
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+
+        extraWindows.resize(options.windowCount - 1);
+        for (std::size_t i = 0; i < extraWindows.size(); i++)
+        {
+            ExtraWindow &extra = extraWindows[i];
+            std::string title = "Vulkan Program (window " + std::to_string(i + 2) + ")";
+            extra.window = glfwCreateWindow(800, 500, title.c_str(), nullptr, nullptr);
+            if (!extra.window)
+            {
+                std::cout << "Failed to create window" << std::endl;
+                exit(-1);
+            }
+
+            glfwSetWindowUserPointer(extra.window, this);
+            glfwSetFramebufferSizeCallback(extra.window, framebufferResizeCallback);
+            glfwSetKeyCallback(extra.window, keyCallback);
+            glfwSetWindowRefreshCallback(extra.window, windowRefreshCallback);
+            glfwSetWindowCloseCallback(extra.window, extraWindowCloseCallback);
+            glfwGetFramebufferSize(extra.window, &extra.framebufferWidth, &extra.framebufferHeight);
+        }
+
         uint32_t glfwExtensionCount = 0;
         const char **extensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
@@ -183,602 +749,4665 @@ private:
     }
 
     /**
-     * Main loop of this program
+     * Main loop of this program. The main thread only waits for window events and forwards them through
+     * <renderEvents>, a render thread owns every Vulkan submission until it is joined. Slow event handling no
+     * longer delays frames and a blocking acquire or present no longer delays input.
      */
     void vulkanProgramLoop()
     {
+        if (options.submitThread)
+        {
+            vulkanProgramInfo.submitThread.start(&vulkanProgramInfo.dispatch, &vulkanProgramInfo.swapchainMutex);
+            vulkanProgramInfo.scheduler.setSubmitThread(&vulkanProgramInfo.submitThread);
+        }
+        if (vulkanProgramInfo.capabilities.presentWait)
+        {
+            vulkanProgramInfo.presentWatcher.start(vulkanProgramInfo.GPUDevice,
+                                                   &vulkanProgramInfo.dispatch,
+                                                   &vulkanProgramInfo.swapchainMutex);
+        }
+
+        std::thread renderThread([this]()
+                                 {
+                                     if (!options.servePath.empty())
+                                     {
+                                         runBatchService();
+                                     } else if (!options.posterPath.empty())
+                                     {
+                                         renderPoster();
+                                     } else if (options.benchmark.empty())
+                                     {
+                                         renderLoop();
+                                     } else
+                                     {
+                                         runBenchmark();
+                                     }
+
+                                     // Wake the main thread if rendering ended on its own
+                                     glfwSetWindowShouldClose(window, GLFW_TRUE);
+                                     glfwPostEmptyEvent();
+                                 });
+
         while (!glfwWindowShouldClose(window))
         {
-            glfwPollEvents();
-            drawFrame();
+            glfwWaitEvents();
+            vulkanProgramInfo.jobs.runMainThreadJobs();
+        }
+
+        pushRenderEvent({RenderEvent::Type::Quit});
+        renderThread.join();
+
+        if (options.submitThread)
+        {
+            vulkanProgramInfo.scheduler.setSubmitThread(nullptr);
+            vulkanProgramInfo.submitThread.stop();
+        }
+        if (vulkanProgramInfo.capabilities.presentWait)
+        {
+            vulkanProgramInfo.presentWatcher.stop();
+            reportPresentTiming();
         }
+
         vkDeviceWaitIdle(vulkanProgramInfo.GPUDevice);
     }
 
-    void createSemaphores()
+    /**
+     * Start one worker per hardware thread besides the calling one. Jobs that need GLFW wake the main thread
+     * out of glfwWaitEvents, which then runs them.
+     */
+    void startJobSystem()
     {
-        VkSemaphoreCreateInfo imageAvailableSemaphoreCreateInfo{};
-        VkSemaphoreCreateInfo renderFinishedSemaphoreCreateInfo{};
+        uint32_t hardwareThreadCount = std::max(1u, std::thread::hardware_concurrency());
+        vulkanProgramInfo.jobs.start(hardwareThreadCount - 1);
+        vulkanProgramInfo.jobs.setMainThreadWake([]()
+                                                 {
+                                                     glfwPostEmptyEvent();
+                                                 });
+    }
 
-        imageAvailableSemaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-        renderFinishedSemaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    /**
+     * Render thread: draw until the main thread asks to quit. In on demand mode frames are only drawn while
+     * <frameDirty> is set, otherwise the thread sleeps until the next event and no acquire, submit or present
+     * happens at all.
+     */
+    void renderLoop()
+    {
+        if (!options.onDemand && options.targetFrameRate > 0.0)
+        {
+            renderPacedLoop();
+            return;
+        }
+        if (!options.onDemand)
+        {
+            while (processRenderEvents())
+            {
+                drawFrame();
+            }
+            return;
+        }
 
-        vkResult = vkCreateSemaphore(vulkanProgramInfo.GPUDevice,
-                                     &imageAvailableSemaphoreCreateInfo,
-                                     nullptr,
-                                     &vulkanProgramInfo.imageAvailableSemaphore);
+        const std::chrono::seconds reportInterval(5);
+        auto reportStart = std::chrono::steady_clock::now();
+        std::clock_t reportStartCpu = std::clock();
+        uint32_t drawnFrameCount = 0;
 
-        if (vkResult != VK_SUCCESS)
+        while (processRenderEvents())
         {
-            std::cout << "Failed to create imageAvailableSemaphore" << std::endl;
-            exit(-1);
+            if (frameDirty)
+            {
+                frameDirty = false;
+                drawFrame();
+                drawnFrameCount++;
+            } else
+            {
+                waitForRenderEvents(reportInterval);
+            }
+
+            // CPU time of the whole process, so the sleeping workers and the submit thread count as well
+            auto now = std::chrono::steady_clock::now();
+            if (now - reportStart >= reportInterval)
+            {
+                std::clock_t nowCpu = std::clock();
+                double seconds = std::chrono::duration<double>(now - reportStart).count();
+                double cpuSeconds = (double) (nowCpu - reportStartCpu) / CLOCKS_PER_SEC;
+                std::cout << "On demand: " << drawnFrameCount << " frame(s) drawn in " << seconds
+                          << " s, CPU " << 100.0 * cpuSeconds / seconds << "% of one core, GPU busy for "
+                          << drawnFrameCount / seconds << " frame(s)/s" << std::endl;
+
+                reportStart = now;
+                reportStartCpu = nowCpu;
+                drawnFrameCount = 0;
+            }
         }
+    }
 
-        vkResult = vkCreateSemaphore(vulkanProgramInfo.GPUDevice,
-                                     &imageAvailableSemaphoreCreateInfo,
-                                     nullptr,
-                                     &vulkanProgramInfo.renderFinishedSemaphore);
+    /**
+     * Render thread: draw at <options.targetFrameRate>. Events are processed after the pacer's wait, so with late
+     * input sampling a frame reflects the input of right before its submission. Reports the jitter of the
+     * submission interval every five seconds.
+     */
+    void renderPacedLoop()
+    {
+        framePacer.setTarget(options.targetFrameRate, options.lateInputSampling);
+        uint32_t reportFrameCount = (uint32_t) std::max(1.0, options.targetFrameRate * 5.0);
 
-        if (vkResult != VK_SUCCESS)
+        while (true)
         {
-            std::cout << "Failed to create renderFinishedSemaphore" << std::endl;
-            exit(-1);
+            framePacer.waitForFrameStart();
+            if (!processRenderEvents())
+            {
+                break;
+            }
+            drawFrame();
+            framePacer.endFrameWork();
+
+            FramePacer::Report report{};
+            if (framePacer.takeReport(report, reportFrameCount))
+            {
+                std::cout << "Frame pacing: " << report.frameCount << " frame(s) at " << options.targetFrameRate
+                          << " fps, interval " << report.meanInterval << " ms, jitter " << report.jitter
+                          << " ms, max deviation " << report.maxDeviation << " ms, predicted work "
+                          << report.predictedWork << " ms" << std::endl;
+            }
         }
     }
 
-    void drawFrame()
+    /**
+     * Main thread: hand <event> to the render thread. Only waits if the render thread is a full queue behind.
+     */
+    void pushRenderEvent(RenderEvent event)
     {
-        uint32_t imageIndex;
-        vkAcquireNextImageKHR(vulkanProgramInfo.GPUDevice,
-                              vulkanProgramInfo.vulkanSwapchain,
-                              UINT64_MAX,
-                              vulkanProgramInfo.imageAvailableSemaphore,
-                              VK_NULL_HANDLE,
-                              &imageIndex);
+        event.time = std::chrono::steady_clock::now();
+        while (!renderEvents.tryPush(event))
+        {
+            std::this_thread::yield();
+        }
 
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        // Taking the mutex orders the push before the render thread's check, the wakeup cannot get lost
+        {
+            std::lock_guard<std::mutex> lock(renderWakeMutex);
+        }
+        renderWakeCondition.notify_one();
+    }
 
-        VkSemaphore waitSemaphores[] = {vulkanProgramInfo.imageAvailableSemaphore};
-        VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    /**
+     * Render thread: sleep until an event is queued or <timeout> passed
+     */
+    void waitForRenderEvents(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(renderWakeMutex);
+        renderWakeCondition.wait_for(lock, timeout, [this]()
+        {
+            return !renderEvents.isEmpty();
+        });
+    }
 
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = waitSemaphores;
-        submitInfo.pWaitDstStageMask = waitStages;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &vulkanProgramInfo.cmdBuffers[imageIndex];
+    /**
+     * Render thread: apply every queued event. Returns false once quitting was requested.
+     */
+    bool processRenderEvents()
+    {
+        RenderEvent event{};
+        while (renderEvents.tryPop(event))
+        {
+            switch (event.type)
+            {
+                case RenderEvent::Type::FramebufferResize:
+                    if (event.windowIndex == 0)
+                    {
+                        framebufferWidth = event.width;
+                        framebufferHeight = event.height;
+                        framebufferResized = true;
+                    } else
+                    {
+                        ExtraWindow &extra = extraWindows[event.windowIndex - 1];
+                        extra.framebufferWidth = event.width;
+                        extra.framebufferHeight = event.height;
+                        extra.resized = true;
+                    }
+                    frameDirty = true;
+                    break;
+                case RenderEvent::Type::KeyPress:
+                    handleKeyPress(event.key);
+                    frameDirty = true;
+                    unpresentedInputTime = event.time;
+                    break;
+                case RenderEvent::Type::Expose:
+                    frameDirty = true;
+                    break;
+                case RenderEvent::Type::Quit:
+                    quitRequested = true;
+                    break;
+            }
+        }
+        return !quitRequested;
+    }
 
-        VkSemaphore signalSemaphores[] = {vulkanProgramInfo.renderFinishedSemaphore};
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = signalSemaphores;
+    /**
+     * Render thread: space moves the particle update between the async compute and the graphics queue
+     */
+    void handleKeyPress(int key)
+    {
+        AsyncCompute &asyncCompute = vulkanProgramInfo.asyncCompute;
+        if (key == GLFW_KEY_SPACE && asyncCompute.isAvailable())
+        {
+            asyncCompute.setAsync(!asyncCompute.isAsync());
+            std::cout << "Particle update on the " << (asyncCompute.isAsync() ? "async compute" : "graphics")
+                      << " queue" << std::endl;
+
+            // Window titles are main thread only
+            bool async = asyncCompute.isAsync();
+            vulkanProgramInfo.jobs.runOnMainThread([this, async]()
+                                                   {
+                                                       glfwSetWindowTitle(window,
+                                                                          async ? "Vulkan Program (async compute)"
+                                                                                : "Vulkan Program");
+                                                   });
+        }
+    }
 
-        vkGetDeviceQueue(vulkanProgramInfo.GPUDevice,
-                         vulkanProgramInfo.graphicsQueueFamilyIndex,
-                         0,
-                         &vulkanProgramInfo.presentAndGraphicsQueue);
+    /**
+     * Create the acquire and present semaphores of every frame in flight
+     */
+    void createFrameSyncObjects()
+    {
+        VkSemaphoreCreateInfo semaphoreCreateInfo{};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-        vkResult = vkQueueSubmit(vulkanProgramInfo.presentAndGraphicsQueue,
-                                 1,
-                                 &submitInfo,
-                                 VK_NULL_HANDLE);
+        vulkanProgramInfo.frames.resize(maxFramesInFlight);
 
-        VkPresentInfoKHR presentInfo{};
-        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        for (FrameSync &frame: vulkanProgramInfo.frames)
+        {
+            vkResult = vkCreateSemaphore(vulkanProgramInfo.GPUDevice,
+                                         &semaphoreCreateInfo,
+                                         vulkanProgramInfo.allocator,
+                                         &frame.imageAvailableSemaphore);
 
-        presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores = signalSemaphores;
+            if (vkResult != VK_SUCCESS)
+            {
+                std::cout << "Failed to create imageAvailableSemaphore" << std::endl;
+                exit(-1);
+            }
 
-        VkSwapchainKHR swapchains[] = {vulkanProgramInfo.vulkanSwapchain};
-        presentInfo.pSwapchains = swapchains;
-        presentInfo.swapchainCount = 1;
-        presentInfo.pImageIndices = &imageIndex;
+            vkResult = vkCreateSemaphore(vulkanProgramInfo.GPUDevice,
+                                         &semaphoreCreateInfo,
+                                         vulkanProgramInfo.allocator,
+                                         &frame.renderFinishedSemaphore);
 
-        vkQueuePresentKHR(vulkanProgramInfo.presentAndGraphicsQueue, &presentInfo);
-        vkQueueWaitIdle(vulkanProgramInfo.presentAndGraphicsQueue);
+            if (vkResult != VK_SUCCESS)
+            {
+                std::cout << "Failed to create renderFinishedSemaphore" << std::endl;
+                exit(-1);
+            }
+        }
     }
 
     /**
-     * Create vulkan swapchain for presentation
+     * Create the scheduler and a timeline for the graphics queue, plus one for the compute queue if it is
+     * a separate queue. Without timeline semaphores the scheduler falls back to fences.
      */
-    void createSwapchain()
+    void createTimelineScheduler()
     {
-        VkSwapchainCreateInfoKHR swapchainCreateInfo{};
-        swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-        swapchainCreateInfo.pNext = nullptr;
-        swapchainCreateInfo.surface = vulkanProgramInfo.vulkanSurface;
+        TimelineScheduler &scheduler = vulkanProgramInfo.scheduler;
+        scheduler.create(vulkanProgramInfo.GPUDevice,
+                         &vulkanProgramInfo.dispatch,
+                         vulkanProgramInfo.allocator,
+                         vulkanProgramInfo.capabilities.timelineSemaphore);
+
+        bool created = scheduler.addQueue(vulkanProgramInfo.presentAndGraphicsQueue,
+                                          vulkanProgramInfo.graphicsTimeline);
+        vulkanProgramInfo.computeTimeline = vulkanProgramInfo.graphicsTimeline;
+        if (created && vulkanProgramInfo.computeQueue != vulkanProgramInfo.presentAndGraphicsQueue)
+        {
+            created = scheduler.addQueue(vulkanProgramInfo.computeQueue, vulkanProgramInfo.computeTimeline);
+        }
 
-        // -------------------------------------------------------------
-        // Get and fill image format and image colorspace information
-        uint32_t formatCount = 0;
-        vkGetPhysicalDeviceSurfaceFormatsKHR(vulkanProgramInfo.chosenGPU,
-                                             vulkanProgramInfo.vulkanSurface,
-                                             &formatCount,
-                                             nullptr);
+        if (!created)
+        {
+            std::cout << "Failed to create timeline semaphores" << std::endl;
+            exit(-1);
+        }
+    }
 
+    /**
+     * Destroy an object with <destroyer> once every frame submitted so far has completed
+     */
+    void retire(TimelineScheduler::Callback destroyer)
+    {
+        TimelineScheduler &scheduler = vulkanProgramInfo.scheduler;
+        scheduler.onComplete(vulkanProgramInfo.graphicsTimeline,
+                             scheduler.getSubmittedValue(vulkanProgramInfo.graphicsTimeline),
+                             std::move(destroyer));
+    }
 
-        std::vector<VkSurfaceFormatKHR> surfaceFormats(formatCount);
-        vkGetPhysicalDeviceSurfaceFormatsKHR(vulkanProgramInfo.chosenGPU,
-                                             vulkanProgramInfo.vulkanSurface,
-                                             &formatCount,
-                                             surfaceFormats.data());
-
-        swapchainCreateInfo.imageFormat = surfaceFormats[0].format;
-        swapchainCreateInfo.imageColorSpace = surfaceFormats[0].colorSpace;
-
-        // Record swapchain format for later use in render pipeline
-        vulkanProgramInfo.vulkanSwapchainFormat = swapchainCreateInfo.imageFormat;
-        // ------------------------------------------
-        // Query for surface capabilities
-        VkSurfaceCapabilitiesKHR surfaceCapabilities{};
-
-        vkResult = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vulkanProgramInfo.chosenGPU,
-                                                             vulkanProgramInfo.vulkanSurface,
-                                                             &surfaceCapabilities);
-        if (vkResult != VK_SUCCESS)
+    /**
+     * Acquire the next image of <swapchain>, signaling <semaphore>. Acquire, present and present waits need the
+     * swapchain exclusively, so every attempt waits at most <acquireTimeout> under the swapchain mutex and releases it
+     * in between. The submit thread can then make the present the acquire may be waiting for.
+     * Returns VK_TIMEOUT after <attemptCount> attempts, e.g. while the presentation engine holds on to every image
+     * of an occluded window. The caller skips the frame, so the render thread still sees a quit request.
+     */
+    VkResult acquireNextImage(VkSwapchainKHR swapchain, VkSemaphore semaphore, uint32_t &imageIndex,
+                              uint32_t attemptCount)
+    {
+        for (uint32_t attempt = 0; attempt < attemptCount; attempt++)
         {
-            std::cout << "Failed to get surface capabilities" << std::endl;
-            exit(-1);
+            VkResult result;
+            {
+                std::lock_guard<std::mutex> swapchainLock(vulkanProgramInfo.swapchainMutex);
+                result = vulkanProgramInfo.dispatch.vkAcquireNextImageKHR(vulkanProgramInfo.GPUDevice,
+                                                                          swapchain,
+                                                                          acquireTimeout,
+                                                                          semaphore,
+                                                                          VK_NULL_HANDLE,
+                                                                          &imageIndex);
+            }
+            if (result != VK_TIMEOUT && result != VK_NOT_READY)
+            {
+                return result;
+            }
         }
+        return VK_TIMEOUT;
+    }
 
-        // NEEDRESEARCH double buffering and triple buffering. Which one is better?
-        swapchainCreateInfo.minImageCount = surfaceCapabilities.minImageCount;
-
-        // Choose the extent of swapchain
-        VkExtent2D swapchainExtent{};
+    void drawFrame()
+    {
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        FrameSync &frame = vulkanProgramInfo.frames[vulkanProgramInfo.currentFrame];
+        TimelineScheduler &scheduler = vulkanProgramInfo.scheduler;
 
-        // Check what is the value of currentExtent
-        // If it is special value, choose any value fit for window
-        if (surfaceCapabilities.currentExtent.width == UINT32_MAX)
-        {
-            swapchainExtent.width = 1600;
-            swapchainExtent.height = 1000;
+        // Wait until the GPU finished the frame this slot submitted last time. This also runs the callbacks
+        // of everything the graphics timeline passed: retired objects and finished uploads.
+        scheduler.waitUntil(vulkanProgramInfo.graphicsTimeline, frame.timelineValue);
 
-            swapchainExtent.width = std::max(surfaceCapabilities.minImageExtent.width,
-                                             std::min(surfaceCapabilities.maxImageExtent.width,
-                                                      swapchainExtent.width));
+        uint32_t imageIndex;
+        vkResult = acquireNextImage(vulkanProgramInfo.vulkanSwapchain,
+                                    frame.imageAvailableSemaphore,
+                                    imageIndex,
+                                    acquireAttempts);
 
-            swapchainExtent.height = std::max(surfaceCapabilities.minImageExtent.height,
-                                              std::min(surfaceCapabilities.maxImageExtent.height,
-                                                       swapchainExtent.height));
-        }
-            // If it is specified, just follow whatever is specified
-        else
+        // Swapchain no longer matches the surface, rebuild it and try again next frame
+        if (vkResult == VK_ERROR_OUT_OF_DATE_KHR)
         {
-            swapchainExtent = surfaceCapabilities.currentExtent;
+            recreateSwapchain();
+            return;
         }
 
-        vulkanProgramInfo.swapchainExtent = swapchainExtent;
-
-        swapchainCreateInfo.imageExtent = swapchainExtent;
-
-        // Other parameters
-        // Number of views
-        swapchainCreateInfo.imageArrayLayers = 1;
-
-        // Usage of images
-        swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-        // Sharing mode
-        swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-        // Orientation
-        swapchainCreateInfo.preTransform = surfaceCapabilities.currentTransform;
+        // No image freed up in time, skip the frame. In on demand mode it is drawn again on the next pass.
+        if (vkResult == VK_TIMEOUT)
+        {
+            frameDirty = true;
+            return;
+        }
 
-        swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-        swapchainCreateInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
-        swapchainCreateInfo.clipped = VK_TRUE;
-        swapchainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+        // Command buffers are recorded per swapchain image, another slot may still be executing this one
+        uint64_t &imageTimelineValue = vulkanProgramInfo.imageTimelineValues[imageIndex];
+        scheduler.waitUntil(vulkanProgramInfo.graphicsTimeline, imageTimelineValue);
 
+        if (vulkanProgramInfo.dynamicResolution)
+        {
+            updateDynamicResolution(imageIndex, imageTimelineValue != 0);
+        }
 
-        // After create info is filled, create swapchain
-        vkResult = vkCreateSwapchainKHR(vulkanProgramInfo.GPUDevice,
-                                        &swapchainCreateInfo,
-                                        nullptr,
-                                        &vulkanProgramInfo.vulkanSwapchain);
+        // Particles of this image. On the async compute queue this overlaps the previous frame's rendering.
+        float time = std::chrono::duration<float>(std::chrono::steady_clock::now() -
+                                                  vulkanProgramInfo.startTime).count();
+        uint64_t particleTimelineValue = submitParticleUpdate(imageIndex, time);
 
-        if (vkResult != VK_SUCCESS)
+        // Only vertex input waits for the particles, clearing and the triangle can start before they are done
+        TimelineScheduler::Wait waits[TimelineScheduler::maxWaits]{};
+        uint32_t waitCount = 0;
+        waits[waitCount++] = {frame.imageAvailableSemaphore, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+        if (particleTimelineValue != 0)
         {
-            std::cout << "Failed to create swapchain" << std::endl;
-            exit(-1);
+            waits[waitCount++] = {vulkanProgramInfo.asyncCompute.getTimeline(),
+                                  particleTimelineValue,
+                                  VK_PIPELINE_STAGE_VERTEX_INPUT_BIT};
         }
 
-        // Get access to vulkan images stored in swapchain
-        uint32_t swapchainImageCount = 0;
-        vkResult = vkGetSwapchainImagesKHR(vulkanProgramInfo.GPUDevice,
-                                           vulkanProgramInfo.vulkanSwapchain,
-                                           &swapchainImageCount,
-                                           nullptr);
+        // The readback copy goes in the same submission, right behind the frame. It is skipped while the ring is full.
+        VkCommandBuffer cmdBuffers[SubmitThread::maxCmdBuffers]{};
+        uint32_t cmdBufferCount = 0;
+        cmdBuffers[cmdBufferCount++] = vulkanProgramInfo.cmdBuffers[imageIndex];
+        VkCommandBuffer readbackCopy = VK_NULL_HANDLE;
+        if (vulkanProgramInfo.readback)
+        {
+            readbackCopy = vulkanProgramInfo.readbackRing.recordCopy(vulkanProgramInfo.swapchainImages[imageIndex],
+                                                                     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                                                                     VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                                                                     VK_ACCESS_MEMORY_WRITE_BIT);
+        }
+        if (readbackCopy != VK_NULL_HANDLE)
+        {
+            cmdBuffers[cmdBufferCount++] = readbackCopy;
+        }
 
-        if (vkResult != VK_SUCCESS)
+        // Extra windows draw the same particles into their own swapchains, in the same submission. Each one adds its
+        // acquire to the waits and its swapchain to the present.
+        uint32_t swapchainCount = 1;
+        VkSwapchainKHR swapchains[SubmitThread::maxSwapchains] = {vulkanProgramInfo.vulkanSwapchain};
+        uint32_t imageIndices[SubmitThread::maxSwapchains] = {imageIndex};
+        ExtraWindow *presentedWindows[SubmitThread::maxSwapchains]{};
+        for (ExtraWindow &extra: extraWindows)
         {
-            std::cout << "Failed to count number of swapchain images" << std::endl;
-            exit(-1);
+            uint32_t extraImageIndex;
+            if (!acquireExtraWindow(extra, extraImageIndex))
+            {
+                continue;
+            }
+            VkCommandBuffer extraCmdBuffer = extra.cmdBuffers[vulkanProgramInfo.currentFrame];
+            recordExtraWindow(extraCmdBuffer, extra, extraImageIndex, vulkanProgramInfo.particleBuffers[imageIndex]);
+
+            waits[waitCount++] = {extra.imageAvailableSemaphores[vulkanProgramInfo.currentFrame],
+                                  0,
+                                  VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+            cmdBuffers[cmdBufferCount++] = extraCmdBuffer;
+            presentedWindows[swapchainCount] = &extra;
+            swapchains[swapchainCount] = extra.swapchain;
+            imageIndices[swapchainCount++] = extraImageIndex;
         }
 
-        vulkanProgramInfo.swapchainImages.resize(swapchainImageCount);
+        frame.timelineValue = scheduler.submit(vulkanProgramInfo.graphicsTimeline,
+                                               cmdBufferCount,
+                                               cmdBuffers,
+                                               waitCount,
+                                               waits,
+                                               frame.renderFinishedSemaphore);
 
-        vkResult = vkGetSwapchainImagesKHR(vulkanProgramInfo.GPUDevice,
-                                           vulkanProgramInfo.vulkanSwapchain,
-                                           &swapchainImageCount,
-                                           vulkanProgramInfo.swapchainImages.data());
-        if (vkResult != VK_SUCCESS)
+        if (frame.timelineValue == 0)
         {
-            std::cout << "Failed to get swapchain images" << std::endl;
+            std::cout << "Failed to submit frame" << std::endl;
             exit(-1);
         }
+        imageTimelineValue = frame.timelineValue;
+        if (readbackCopy != VK_NULL_HANDLE)
+        {
+            vulkanProgramInfo.readbackRing.submitted(frame.timelineValue);
+        }
 
-        // Create image views of images in swapchain
-        VkImageViewCreateInfo imageViewCreateInfo;
-        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        imageViewCreateInfo.format = swapchainCreateInfo.imageFormat;
-        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
-        imageViewCreateInfo.subresourceRange.levelCount = 1;
-        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-        imageViewCreateInfo.subresourceRange.layerCount = 1;
-        imageViewCreateInfo.flags = 0;
-        imageViewCreateInfo.pNext = nullptr;
+        // Only the primary window's presents are timed
+        uint64_t presentIds[SubmitThread::maxSwapchains]{};
+        if (vulkanProgramInfo.capabilities.presentWait)
+        {
+            presentIds[0] = vulkanProgramInfo.nextPresentId++;
+            vulkanProgramInfo.presentWatcher.track(presentIds[0], frameStart, unpresentedInputTime);
+            unpresentedInputTime = {};
+        }
 
-        vulkanProgramInfo.imageViews.resize(vulkanProgramInfo.swapchainImages.size());
-        for (std::size_t i = 0; i < vulkanProgramInfo.imageViews.size(); i++)
+        // With the submit thread this only queues the frame, an out of date swapchain shows up a frame later.
+        // The submit thread takes the swapchain mutex itself, presenting inline has to hold it here.
+        std::unique_lock<std::mutex> swapchainLock(vulkanProgramInfo.swapchainMutex, std::defer_lock);
+        if (!options.submitThread)
         {
-            imageViewCreateInfo.image = vulkanProgramInfo.swapchainImages[i];
-            vkResult = vkCreateImageView(vulkanProgramInfo.GPUDevice,
-                                         &imageViewCreateInfo,
-                                         nullptr,
-                                         &vulkanProgramInfo.imageViews[i]);
+            swapchainLock.lock();
+        }
+        VkResult presentResults[SubmitThread::maxSwapchains]{};
+        scheduler.present(vulkanProgramInfo.graphicsTimeline,
+                          swapchainCount,
+                          swapchains,
+                          imageIndices,
+                          frame.renderFinishedSemaphore,
+                          presentIds,
+                          presentResults);
+        if (swapchainLock.owns_lock())
+        {
+            swapchainLock.unlock();
+        }
 
-            if (vkResult != VK_SUCCESS)
+        // An extra window out of date is rebuilt before its next acquire
+        vkResult = presentResults[0];
+        for (uint32_t i = 1; i < swapchainCount; i++)
+        {
+            if (presentResults[i] == VK_ERROR_OUT_OF_DATE_KHR || presentResults[i] == VK_SUBOPTIMAL_KHR)
             {
-                std::cout << "Failed to create vulkan image view [" << i << "]" << std::endl;
-                exit(-1);
+                presentedWindows[i]->resized = true;
             }
         }
+
+        vulkanProgramInfo.currentFrame = (vulkanProgramInfo.currentFrame + 1) % maxFramesInFlight;
+
+        if (vkResult == VK_ERROR_OUT_OF_DATE_KHR || vkResult == VK_SUBOPTIMAL_KHR || framebufferResized)
+        {
+            framebufferResized = false;
+            recreateSwapchain();
+        }
     }
 
     /**
-     * Create surface between vulkan instance and window created by glfw
+     * Render thread, after the last frame that used the command buffer of <imageIndex> completed. Hand that frame's
+     * GPU time to the scaler if it was rendered at the current scale, then re-record the command buffer if the
+     * scale is not the one it was recorded at.
      */
-    void surfaceVulkanAndWindow()
+    void updateDynamicResolution(uint32_t imageIndex, bool submittedBefore)
     {
-        vkResult = glfwCreateWindowSurface(vulkanProgramInfo.vulkanInstance,
-                                           window,
-                                           nullptr,
-                                           &vulkanProgramInfo.vulkanSurface);
-        if (vkResult != VK_SUCCESS)
+        DynamicResolution &scaler = vulkanProgramInfo.resolutionScaler;
+        double &recordedScale = vulkanProgramInfo.recordedScales[imageIndex];
+
+        uint64_t timestamps[2]{};
+        if (submittedBefore && recordedScale == scaler.getScale() &&
+            vulkanProgramInfo.dispatch.vkGetQueryPoolResults(vulkanProgramInfo.GPUDevice,
+                                                             vulkanProgramInfo.timestampQueryPool,
+                                                             2 * imageIndex,
+                                                             2,
+                                                             sizeof(timestamps),
+                                                             timestamps,
+                                                             sizeof(uint64_t),
+                                                             VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
         {
-            std::cout << "failed to create surface between vulkan instance and glfw window" << std::endl;
-            exit(-1);
+            uint64_t ticks = (timestamps[1] - timestamps[0]) & vulkanProgramInfo.timestampMask;
+            double gpuMilliseconds = (double) ticks * vulkanProgramInfo.timestampPeriod / 1e6;
+            double averageMilliseconds = scaler.getAverageTime();
+
+            if (scaler.addFrameTime(gpuMilliseconds))
+            {
+                VkExtent2D renderExtent = getRenderExtent(scaler.getScale());
+                std::cout << "Dynamic resolution: GPU " << averageMilliseconds << " ms for a " << options.frameBudget
+                          << " ms budget, rendering at " << renderExtent.width << "x" << renderExtent.height
+                          << " (" << 100.0 * scaler.getScale() << "%)" << std::endl;
+            }
+        }
+
+        if (recordedScale != scaler.getScale())
+        {
+            recordCmdBuffer(imageIndex);
         }
     }
 
     /**
-     * Create a vulkan instance to start the whole vulkan program
+     * Rebuild the swapchain and everything sized by it after the window changed.
+     * Viewport and scissor are dynamic states, so the graphics pipeline survives untouched.
+     * Frames still in flight keep using the old objects, they are retired instead of waiting for the device.
      */
-    void createVulkanInstance()
+    void recreateSwapchain()
     {
-        // Get a list of instance layer names for instance
-        //  Standard procedure for getting layer info
-        std::vector<VkLayerProperties> supportedLayers{};
-        uint32_t supportedLayerCount{};
-
-        vkEnumerateInstanceLayerProperties(&supportedLayerCount, nullptr);
-
-        supportedLayers.resize(supportedLayerCount);
-        vkEnumerateInstanceLayerProperties(&supportedLayerCount, supportedLayers.data());
-
-        // Check if required layer list is in the name list
-        if (!enabledLayersSupported(supportedLayers, vulkanProgramInfo.enabledLayers))
+        // A minimized window has a zero sized framebuffer, wait until it comes back
+        while ((framebufferWidth == 0 || framebufferHeight == 0) && !quitRequested)
         {
-            std::cout << "Error: some layers are not supported" << std::endl;
-            exit(-1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            processRenderEvents();
+        }
+        if (quitRequested)
+        {
+            return;
         }
 
-        // Get a list of instance extension names
-        std::vector<VkExtensionProperties> instanceExtensionPropertiesList{};
-        uint32_t instanceExtensionPropertiesCount{};
+        // The old swapchain is handed to <createSwapchain>, nothing may still present to it
+        vulkanProgramInfo.submitThread.waitIdle();
 
-        if (VK_SUCCESS == vkEnumerateInstanceExtensionProperties(nullptr,
-                                                                 &instanceExtensionPropertiesCount,
-                                                                 nullptr))
+        retireSwapchainResources();
+        createSwapchain();
+        resizeReadback();
+        createAttachments();
+        createParticleBuffers();
+        if (!vulkanProgramInfo.capabilities.dynamicRendering)
         {
-            instanceExtensionPropertiesList.resize(instanceExtensionPropertiesCount);
+            createFramebuffer();
         } else
         {
-            std::cout << "Failed to count number of instance extensions" << std::endl;
-            exit(-1);
+            buildFrameGraph();
         }
+        allocateCmdBuffers();
+        createTimestampQueries();
+        recordCmdBuffers();
 
-        if (VK_SUCCESS != vkEnumerateInstanceExtensionProperties(nullptr,
-                                                                 &instanceExtensionPropertiesCount,
-                                                                 instanceExtensionPropertiesList.data()))
+        // Nothing was presented with the new swapchain yet
+        frameDirty = true;
+    }
+
+    /**
+     * Hand command buffers, framebuffers, image views, frame graph transients, attachments and particle buffers
+     * to the deletion queue. The swapchain itself stays, <createSwapchain> passes it as <oldSwapchain> and retires it.
+     */
+    void retireSwapchainResources()
+    {
+        VkDevice device = vulkanProgramInfo.GPUDevice;
+        const VkAllocationCallbacks *allocator = vulkanProgramInfo.allocator;
+
+        std::vector<VkCommandBuffer> cmdBuffers = std::move(vulkanProgramInfo.cmdBuffers);
+        vulkanProgramInfo.cmdBuffers.clear();
+        retire([this, device, cmdBuffers]()
+               {
+                   vulkanProgramInfo.dispatch.vkFreeCommandBuffers(device,
+                                                                   vulkanProgramInfo.cmdPool,
+                                                                   (uint32_t) cmdBuffers.size(),
+                                                                   cmdBuffers.data());
+               });
+
+        for (VkFramebuffer framebuffer: vulkanProgramInfo.swapchainFramebuffers)
         {
-            std::cout << "Failed to get a list of instance extensions" << std::endl;
-            exit(-1);
+            retire([device, framebuffer, allocator]()
+                   {
+                       vkDestroyFramebuffer(device, framebuffer, allocator);
+                   });
         }
+        vulkanProgramInfo.swapchainFramebuffers.clear();
 
-        // Check if every instance extension is supported
-        if (!checkEnabledExtensionsSupported(instanceExtensionPropertiesList,
-                                             vulkanProgramInfo.enabledInstanceExtensions))
+        for (VkImageView imageView: vulkanProgramInfo.imageViews)
         {
-            std::cout << "Not all required instance extensions supported" << std::endl;
-            exit(-1);
+            retire([device, imageView, allocator]()
+                   {
+                       vkDestroyImageView(device, imageView, allocator);
+                   });
         }
-
-        // Create <VkDebugUtilsMessengerCreateInfoEXT>. This one is also going to be chained with instance create
-        // info so debug messenger can detect what is wrong with <VkCreateInstance> and <VkDestroyInstance>
-        VkDebugUtilsMessengerCreateInfoEXT debugMessengerCreateInfo{};
-
-        debugMessengerCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-        debugMessengerCreateInfo.pNext = nullptr;
-        debugMessengerCreateInfo.flags = 0;
-        debugMessengerCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT |
-                                                   VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
-
-        debugMessengerCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-                                               VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-                                               VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-
-        debugMessengerCreateInfo.pfnUserCallback = debugMessengerCallback;
-        debugMessengerCreateInfo.pUserData = nullptr;
-
-        // Now everything is supported and debug messenger is created start by creating <VkInstanceCreateInfo>
-        VkInstanceCreateInfo vulkanInstanceCreateInfo{};
-
-        vulkanInstanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        vulkanInstanceCreateInfo.pNext = &debugMessengerCreateInfo;
-        vulkanInstanceCreateInfo.flags = 0;
-        vulkanInstanceCreateInfo.pApplicationInfo = nullptr;
-        vulkanInstanceCreateInfo.enabledLayerCount = (uint32_t) vulkanProgramInfo.enabledLayers.size();
-        vulkanInstanceCreateInfo.ppEnabledLayerNames = vulkanProgramInfo.enabledLayers.data();
-        vulkanInstanceCreateInfo.enabledExtensionCount = (uint32_t) vulkanProgramInfo.enabledInstanceExtensions.size();
-        vulkanInstanceCreateInfo.ppEnabledExtensionNames = vulkanProgramInfo.enabledInstanceExtensions.data();
-
-        // Create vulkan instance
-        if (VK_SUCCESS != vkCreateInstance(&vulkanInstanceCreateInfo,
-                                           nullptr,
-                                           &vulkanProgramInfo.vulkanInstance))
+        vulkanProgramInfo.imageViews.clear();
+
+        // Transients and attachments are sized by the swapchain extent
+        auto retiredGraph = std::make_shared<RenderGraph>(std::move(vulkanProgramInfo.frameGraph));
+        vulkanProgramInfo.frameGraph = RenderGraph{};
+        retire([device, allocator, retiredGraph]()
+               {
+                   retiredGraph->releaseTransients(device, allocator);
+               });
+
+        for (AttachmentImage *attachment: {&vulkanProgramInfo.msaaColorAttachment,
+                                           &vulkanProgramInfo.depthAttachment})
         {
-            std::cout << "Failed to create vulkan instance" << std::endl;
-            exit(-1);
+            retire([this, retiredAttachment = *attachment]() mutable
+                   {
+                       destroyAttachmentImage(retiredAttachment);
+                   });
+            *attachment = AttachmentImage{};
         }
 
-        if (VK_SUCCESS != createDebugUtilsMessenger(vulkanProgramInfo.vulkanInstance,
-                                                    &debugMessengerCreateInfo,
-                                                    nullptr,
-                                                    &vulkanProgramInfo.debugMessenger))
+        // One particle buffer per swapchain image, the image count may change
+        for (std::size_t i = 0; i < vulkanProgramInfo.particleBuffers.size(); i++)
         {
-            std::cerr << "Failed to create debug utils messenger";
+            VkBuffer particleBuffer = vulkanProgramInfo.particleBuffers[i];
+            VkDeviceMemory particleBufferMemory = vulkanProgramInfo.particleBufferMemories[i];
+            retire([device, particleBuffer, particleBufferMemory, allocator]()
+                   {
+                       vkDestroyBuffer(device, particleBuffer, allocator);
+                       vkFreeMemory(device, particleBufferMemory, allocator);
+                   });
         }
+        vulkanProgramInfo.particleBuffers.clear();
+        vulkanProgramInfo.particleBufferMemories.clear();
+        vulkanProgramInfo.particleDescriptorSets.clear();
+
+        // Destroying the pool frees its descriptor sets
+        VkDescriptorPool particleDescriptorPool = vulkanProgramInfo.particleDescriptorPool;
+        retire([device, particleDescriptorPool, allocator]()
+               {
+                   vkDestroyDescriptorPool(device, particleDescriptorPool, allocator);
+               });
+        vulkanProgramInfo.particleDescriptorPool = VK_NULL_HANDLE;
+
+        // One pair of timestamps per swapchain image as well
+        VkQueryPool timestampQueryPool = vulkanProgramInfo.timestampQueryPool;
+        retire([device, timestampQueryPool, allocator]()
+               {
+                   vkDestroyQueryPool(device, timestampQueryPool, allocator);
+               });
+        vulkanProgramInfo.timestampQueryPool = VK_NULL_HANDLE;
     }
 
     /**
-     * Create Logical device that abstracts chosen GPU device (physical device)
+     * Check that every extra window can show the scene and give it acquire semaphores, command buffers and a
+     * swapchain. Extra windows are drawn with dynamic rendering, without it or on a surface the graphics queue
+     * cannot present to with the primary format they are closed again.
      */
-    void createDevice()
+    void createExtraWindows()
     {
-        uint32_t physicalDeviceNum{};
-        std::vector<VkPhysicalDevice> availablePhysicalDevices{};
-
-        vkResult = vkEnumeratePhysicalDevices(vulkanProgramInfo.vulkanInstance,
-                                              &physicalDeviceNum,
-                                              nullptr);
-        if (vkResult != VK_SUCCESS)
+        if (extraWindows.empty())
         {
-            std::cerr << "Failed to count physical device number" << std::endl;
-            exit(-1);
+            return;
         }
 
-        availablePhysicalDevices.resize(physicalDeviceNum);
+        for (std::size_t i = extraWindows.size(); i-- > 0;)
+        {
+            ExtraWindow &extra = extraWindows[i];
 
-        vkResult = vkEnumeratePhysicalDevices(vulkanProgramInfo.vulkanInstance,
-                                              &physicalDeviceNum,
-                                              availablePhysicalDevices.data());
+            VkBool32 presentSupported = VK_FALSE;
+            vkGetPhysicalDeviceSurfaceSupportKHR(vulkanProgramInfo.chosenGPU,
+                                                 vulkanProgramInfo.graphicsQueueFamilyIndex,
+                                                 extra.surface,
+                                                 &presentSupported);
+
+            uint32_t formatCount = 0;
+            vkGetPhysicalDeviceSurfaceFormatsKHR(vulkanProgramInfo.chosenGPU, extra.surface, &formatCount, nullptr);
+            std::vector<VkSurfaceFormatKHR> surfaceFormats(formatCount);
+            vkGetPhysicalDeviceSurfaceFormatsKHR(vulkanProgramInfo.chosenGPU,
+                                                 extra.surface,
+                                                 &formatCount,
+                                                 surfaceFormats.data());
+            auto surfaceFormat = std::find_if(surfaceFormats.begin(),
+                                              surfaceFormats.end(),
+                                              [this](const VkSurfaceFormatKHR &format)
+                                              {
+                                                  return format.format == vulkanProgramInfo.vulkanSwapchainFormat;
+                                              });
+
+            if (!vulkanProgramInfo.capabilities.dynamicRendering || presentSupported != VK_TRUE ||
+                surfaceFormat == surfaceFormats.end())
+            {
+                std::cout << "Window " << i + 2 << " cannot be presented with the primary window, closing it"
+                          << std::endl;
+                vkDestroySurfaceKHR(vulkanProgramInfo.vulkanInstance, extra.surface, vulkanProgramInfo.allocator);
+                glfwDestroyWindow(extra.window);
+                extraWindows.erase(extraWindows.begin() + (std::ptrdiff_t) i);
+                continue;
+            }
+            extra.colorSpace = surfaceFormat->colorSpace;
+        }
+        if (extraWindows.empty())
+        {
+            return;
+        }
 
-        VkPhysicalDeviceProperties physicalDeviceProperties{};
-        vkGetPhysicalDeviceProperties(availablePhysicalDevices[0],
-                                      &physicalDeviceProperties);
+        VkCommandPoolCreateInfo cmdPoolCreateInfo{};
+        cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        cmdPoolCreateInfo.queueFamilyIndex = vulkanProgramInfo.graphicsQueueFamilyIndex;
+
+        vkResult = vulkanProgramInfo.dispatch.vkCreateCommandPool(vulkanProgramInfo.GPUDevice,
+                                                                  &cmdPoolCreateInfo,
+                                                                  vulkanProgramInfo.allocator,
+                                                                  &extraCmdPool);
         if (vkResult != VK_SUCCESS)
         {
-            std::cerr << "Failed to get a list of physical devices" << std::endl;
+            std::cout << "Failed to create extra window command pool" << std::endl;
             exit(-1);
         }
 
-        // Pick the chosen GPU device
-        vulkanProgramInfo.chosenGPU = availablePhysicalDevices[0];
-
-        // After a physical device is picked, check its queue family information
-        uint32_t queueFamilyCount = 0;
-        std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList{};
-
-        vkGetPhysicalDeviceQueueFamilyProperties(vulkanProgramInfo.chosenGPU,
-                                                 &queueFamilyCount,
-                                                 nullptr);
+        VkSemaphoreCreateInfo semaphoreCreateInfo{};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-        queueFamilyPropertiesList.resize(queueFamilyCount);
+        for (ExtraWindow &extra: extraWindows)
+        {
+            VkCommandBufferAllocateInfo cmdBufferAllocateInfo{};
+            cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            cmdBufferAllocateInfo.commandPool = extraCmdPool;
+            cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            cmdBufferAllocateInfo.commandBufferCount = maxFramesInFlight;
+            vkResult = vulkanProgramInfo.dispatch.vkAllocateCommandBuffers(vulkanProgramInfo.GPUDevice,
+                                                                           &cmdBufferAllocateInfo,
+                                                                           extra.cmdBuffers);
+            if (vkResult != VK_SUCCESS)
+            {
+                std::cout << "Failed to allocate extra window command buffers" << std::endl;
+                exit(-1);
+            }
+
+            for (VkSemaphore &semaphore: extra.imageAvailableSemaphores)
+            {
+                vkResult = vkCreateSemaphore(vulkanProgramInfo.GPUDevice,
+                                             &semaphoreCreateInfo,
+                                             vulkanProgramInfo.allocator,
+                                             &semaphore);
+                if (vkResult != VK_SUCCESS)
+                {
+                    std::cout << "Failed to create extra window semaphore" << std::endl;
+                    exit(-1);
+                }
+            }
+
+            createExtraSwapchain(extra);
+        }
+
+        std::cout << "Windows: " << extraWindows.size() + 1 << " window(s), one submission and one present per frame"
+                  << std::endl;
+    }
+
+    /**
+     * Build the swapchain, image views and attachments of <extra> for the current size of its surface. The old ones
+     * are retired, frames in flight may still use them. A minimized window is left without a swapchain.
+     */
+    void createExtraSwapchain(ExtraWindow &extra)
+    {
+        VkSurfaceCapabilitiesKHR surfaceCapabilities{};
+        vkResult = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vulkanProgramInfo.chosenGPU,
+                                                             extra.surface,
+                                                             &surfaceCapabilities);
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to get surface capabilities" << std::endl;
+            exit(-1);
+        }
+
+        VkExtent2D extent = surfaceCapabilities.currentExtent;
+        if (extent.width == UINT32_MAX)
+        {
+            extent.width = std::max(surfaceCapabilities.minImageExtent.width,
+                                    std::min(surfaceCapabilities.maxImageExtent.width,
+                                             (uint32_t) extra.framebufferWidth));
+            extent.height = std::max(surfaceCapabilities.minImageExtent.height,
+                                     std::min(surfaceCapabilities.maxImageExtent.height,
+                                              (uint32_t) extra.framebufferHeight));
+        }
+
+        // The old swapchain is passed as <oldSwapchain>, nothing may still present to it
+        vulkanProgramInfo.submitThread.waitIdle();
+        retireExtraSwapchainResources(extra);
+        if (extent.width == 0 || extent.height == 0)
+        {
+            return;
+        }
+
+        VkSwapchainCreateInfoKHR swapchainCreateInfo{};
+        swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        swapchainCreateInfo.surface = extra.surface;
+        // Sized like the primary swapchain, so acquire never waits for a present still queued behind it
+        swapchainCreateInfo.minImageCount = surfaceCapabilities.minImageCount + maxFramesInFlight;
+        if (surfaceCapabilities.maxImageCount != 0)
+        {
+            swapchainCreateInfo.minImageCount = std::min(swapchainCreateInfo.minImageCount,
+                                                         surfaceCapabilities.maxImageCount);
+        }
+        swapchainCreateInfo.imageFormat = vulkanProgramInfo.vulkanSwapchainFormat;
+        swapchainCreateInfo.imageColorSpace = extra.colorSpace;
+        swapchainCreateInfo.imageExtent = extent;
+        swapchainCreateInfo.imageArrayLayers = 1;
+        swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        swapchainCreateInfo.preTransform = surfaceCapabilities.currentTransform;
+        swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+        // Same pacing as the primary window, one FIFO swapchain in the present would hold back all of them
+        swapchainCreateInfo.presentMode = options.targetFrameRate > 0.0
+                                          ? chooseUncappedPresentMode(extra.surface, true)
+                                          : VK_PRESENT_MODE_FIFO_KHR;
+        swapchainCreateInfo.clipped = VK_TRUE;
+
+        VkSwapchainKHR oldSwapchain = extra.swapchain;
+        swapchainCreateInfo.oldSwapchain = oldSwapchain;
+
+        {
+            std::lock_guard<std::mutex> swapchainLock(vulkanProgramInfo.swapchainMutex);
+            vkResult = vkCreateSwapchainKHR(vulkanProgramInfo.GPUDevice,
+                                            &swapchainCreateInfo,
+                                            vulkanProgramInfo.allocator,
+                                            &extra.swapchain);
+        }
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create swapchain" << std::endl;
+            exit(-1);
+        }
+        extra.extent = extent;
+
+        if (oldSwapchain != VK_NULL_HANDLE)
+        {
+            // A result still queued for the old swapchain must not match a new one with the same handle
+            vulkanProgramInfo.submitThread.takeOutOfDate(oldSwapchain);
+
+            VkDevice device = vulkanProgramInfo.GPUDevice;
+            const VkAllocationCallbacks *allocator = vulkanProgramInfo.allocator;
+            retire([device, oldSwapchain, allocator]()
+                   {
+                       vkDestroySwapchainKHR(device, oldSwapchain, allocator);
+                   });
+        }
+
+        uint32_t imageCount = 0;
+        vkGetSwapchainImagesKHR(vulkanProgramInfo.GPUDevice, extra.swapchain, &imageCount, nullptr);
+        extra.images.resize(imageCount);
+        vkResult = vkGetSwapchainImagesKHR(vulkanProgramInfo.GPUDevice,
+                                           extra.swapchain,
+                                           &imageCount,
+                                           extra.images.data());
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to get swapchain images" << std::endl;
+            exit(-1);
+        }
+
+        VkImageViewCreateInfo imageViewCreateInfo{};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.format = vulkanProgramInfo.vulkanSwapchainFormat;
+        imageViewCreateInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+        extra.imageViews.resize(imageCount);
+        for (uint32_t i = 0; i < imageCount; i++)
+        {
+            imageViewCreateInfo.image = extra.images[i];
+            vkResult = vkCreateImageView(vulkanProgramInfo.GPUDevice,
+                                         &imageViewCreateInfo,
+                                         vulkanProgramInfo.allocator,
+                                         &extra.imageViews[i]);
+            if (vkResult != VK_SUCCESS)
+            {
+                std::cout << "Failed to create vulkan image view [" << i << "]" << std::endl;
+                exit(-1);
+            }
+        }
+
+        if (vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+        {
+            extra.msaaColor = createAttachmentImage(vulkanProgramInfo.vulkanSwapchainFormat,
+                                                    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                                                    VK_IMAGE_ASPECT_COLOR_BIT,
+                                                    extent,
+                                                    vulkanProgramInfo.msaaSamples);
+        }
+        extra.depth = createAttachmentImage(vulkanProgramInfo.depthFormat,
+                                            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                                            depthAspectMask(),
+                                            extent,
+                                            vulkanProgramInfo.msaaSamples);
+    }
+
+    /**
+     * Hand the image views and attachments of <extra> to the deletion queue. The swapchain stays for
+     * <createExtraSwapchain> to pass as <oldSwapchain>.
+     */
+    void retireExtraSwapchainResources(ExtraWindow &extra)
+    {
+        VkDevice device = vulkanProgramInfo.GPUDevice;
+        const VkAllocationCallbacks *allocator = vulkanProgramInfo.allocator;
+
+        for (VkImageView imageView: extra.imageViews)
+        {
+            retire([device, imageView, allocator]()
+                   {
+                       vkDestroyImageView(device, imageView, allocator);
+                   });
+        }
+        extra.imageViews.clear();
+        extra.images.clear();
+
+        for (AttachmentImage *attachment: {&extra.msaaColor, &extra.depth})
+        {
+            if (attachment->image != VK_NULL_HANDLE)
+            {
+                retire([this, retiredAttachment = *attachment]() mutable
+                       {
+                           destroyAttachmentImage(retiredAttachment);
+                       });
+            }
+            *attachment = AttachmentImage{};
+        }
+        extra.extent = {};
+    }
+
+    /**
+     * Render thread: acquire the next image of <extra> with the semaphore of the current frame slot, after
+     * rebuilding its swapchain if the window changed. Returns false if the window skips this frame, because it is
+     * minimized, its swapchain just went out of date or no image freed up within <extraAcquireAttempts>.
+     */
+    bool acquireExtraWindow(ExtraWindow &extra, uint32_t &imageIndex)
+    {
+        if (extra.framebufferWidth == 0 || extra.framebufferHeight == 0)
+        {
+            return false;
+        }
+        if (extra.resized || extra.extent.width == 0)
+        {
+            extra.resized = false;
+            createExtraSwapchain(extra);
+            if (extra.extent.width == 0)
+            {
+                return false;
+            }
+        }
+
+        VkResult result = acquireNextImage(extra.swapchain,
+                                           extra.imageAvailableSemaphores[vulkanProgramInfo.currentFrame],
+                                           imageIndex,
+                                           extraAcquireAttempts);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            extra.resized = true;
+        }
+        return result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR;
+    }
+
+    /**
+     * Record the scene into image <imageIndex> of <extra>, leaving it ready to present. Recorded every frame, the
+     * command buffer of the current slot is no longer in flight.
+     */
+    void recordExtraWindow(VkCommandBuffer cmdBuffer,
+                           const ExtraWindow &extra,
+                           uint32_t imageIndex,
+                           VkBuffer particleBuffer)
+    {
+        VkCommandBufferBeginInfo bufferBeginInfo{};
+        bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkResult = vulkanProgramInfo.dispatch.vkBeginCommandBuffer(cmdBuffer, &bufferBeginInfo);
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to begin command buffer" << std::endl;
+            exit(-1);
+        }
+
+        discardAttachments(cmdBuffer, extra.images[imageIndex], extra.msaaColor.image, extra.depth.image);
+        beginDynamicRendering(cmdBuffer,
+                              extra.imageViews[imageIndex],
+                              extra.msaaColor.imageView,
+                              extra.depth.imageView,
+                              extra.extent);
+        drawScene(cmdBuffer, particleBuffer, options.particleCount, extra.extent);
+        vulkanProgramInfo.dispatch.vkCmdEndRenderingKHR(cmdBuffer);
+
+        VkImageMemoryBarrier presentBarrier{};
+        presentBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        presentBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        presentBarrier.dstAccessMask = 0;
+        presentBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        presentBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        presentBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        presentBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        presentBarrier.image = extra.images[imageIndex];
+        presentBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        vulkanProgramInfo.dispatch.vkCmdPipelineBarrier(cmdBuffer,
+                                                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                                        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                                        0,
+                                                        0, nullptr,
+                                                        0, nullptr,
+                                                        1, &presentBarrier);
+
+        vkResult = vulkanProgramInfo.dispatch.vkEndCommandBuffer(cmdBuffer);
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to record command buffer" << std::endl;
+            exit(-1);
+        }
+    }
+
+    /**
+     * Destroy the Vulkan objects of every extra window, the device has to be idle. Surfaces and windows are left to
+     * the end of <cleanup>.
+     */
+    void destroyExtraWindows()
+    {
+        for (ExtraWindow &extra: extraWindows)
+        {
+            for (VkImageView imageView: extra.imageViews)
+            {
+                vkDestroyImageView(vulkanProgramInfo.GPUDevice, imageView, vulkanProgramInfo.allocator);
+            }
+            if (extra.msaaColor.image != VK_NULL_HANDLE)
+            {
+                destroyAttachmentImage(extra.msaaColor);
+            }
+            if (extra.depth.image != VK_NULL_HANDLE)
+            {
+                destroyAttachmentImage(extra.depth);
+            }
+            vkDestroySwapchainKHR(vulkanProgramInfo.GPUDevice, extra.swapchain, vulkanProgramInfo.allocator);
+            for (VkSemaphore semaphore: extra.imageAvailableSemaphores)
+            {
+                vkDestroySemaphore(vulkanProgramInfo.GPUDevice, semaphore, vulkanProgramInfo.allocator);
+            }
+        }
+        if (extraCmdPool != VK_NULL_HANDLE)
+        {
+            vulkanProgramInfo.dispatch.vkDestroyCommandPool(vulkanProgramInfo.GPUDevice,
+                                                            extraCmdPool,
+                                                            vulkanProgramInfo.allocator);
+        }
+    }
+
+    /**
+     * Pick the MSAA sample count and the depth format supported by the chosen GPU
+     */
+    void chooseAttachmentFormats()
+    {
+        VkPhysicalDeviceProperties physicalDeviceProperties{};
+        vkGetPhysicalDeviceProperties(vulkanProgramInfo.chosenGPU, &physicalDeviceProperties);
+
+        // Highest supported sample count not above the requested one
+        VkSampleCountFlags supportedSampleCounts = physicalDeviceProperties.limits.framebufferColorSampleCounts &
+                                                   physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+        vulkanProgramInfo.msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+        for (uint32_t sampleCount = VK_SAMPLE_COUNT_64_BIT; sampleCount > VK_SAMPLE_COUNT_1_BIT; sampleCount >>= 1)
+        {
+            if (sampleCount <= options.msaaSamples && (supportedSampleCounts & sampleCount))
+            {
+                vulkanProgramInfo.msaaSamples = (VkSampleCountFlagBits) sampleCount;
+                break;
+            }
+        }
+
+        std::vector<VkFormat> depthFormatCandidates
+                {
+                        VK_FORMAT_D32_SFLOAT,
+                        VK_FORMAT_D24_UNORM_S8_UINT,
+                        VK_FORMAT_D16_UNORM,
+                };
+
+        for (VkFormat depthFormatCandidate: depthFormatCandidates)
+        {
+            VkFormatProperties formatProperties{};
+            vkGetPhysicalDeviceFormatProperties(vulkanProgramInfo.chosenGPU, depthFormatCandidate, &formatProperties);
+
+            if (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+            {
+                vulkanProgramInfo.depthFormat = depthFormatCandidate;
+                break;
+            }
+        }
+
+        if (vulkanProgramInfo.depthFormat == VK_FORMAT_UNDEFINED)
+        {
+            std::cout << "Failed to find a supported depth format" << std::endl;
+            exit(-1);
+        }
+
+        std::cout << "MSAA samples: " << vulkanProgramInfo.msaaSamples << std::endl;
+    }
+
+    /**
+     * Enable dynamic resolution if <options.frameBudget> asks for it and the graphics queue can time frames.
+     * It needs the frame graph of the dynamic rendering path for the offscreen target and the upscale pass.
+     */
+    void chooseDynamicResolution()
+    {
+        if (options.frameBudget <= 0.0)
+        {
+            return;
+        }
+        if (!vulkanProgramInfo.capabilities.dynamicRendering)
+        {
+            std::cout << "Dynamic resolution needs dynamic rendering, rendering at native resolution" << std::endl;
+            return;
+        }
+
+        VkPhysicalDeviceProperties physicalDeviceProperties{};
+        vkGetPhysicalDeviceProperties(vulkanProgramInfo.chosenGPU, &physicalDeviceProperties);
+        uint32_t timestampValidBits = getQueueFamilyProperties(vulkanProgramInfo.chosenGPU)
+                [vulkanProgramInfo.graphicsQueueFamilyIndex].timestampValidBits;
+
+        if (timestampValidBits == 0 || physicalDeviceProperties.limits.timestampPeriod == 0.0f)
+        {
+            std::cout << "Dynamic resolution: the graphics queue has no timestamps, rendering at native resolution"
+                      << std::endl;
+            return;
+        }
+
+        vulkanProgramInfo.timestampPeriod = physicalDeviceProperties.limits.timestampPeriod;
+        vulkanProgramInfo.timestampMask = timestampValidBits >= 64 ? UINT64_MAX
+                                                                   : (uint64_t(1) << timestampValidBits) - 1;
+        vulkanProgramInfo.dynamicResolution = true;
+        vulkanProgramInfo.resolutionScaler.setBudget(options.frameBudget);
+        std::cout << "Dynamic resolution: " << options.frameBudget << " ms GPU budget per frame, scale "
+                  << DynamicResolution::minimumScale << " to 1" << std::endl;
+    }
+
+    /**
+     * Create the transient depth attachment and, with MSAA, the multisampled color attachment.
+     * Both prefer lazily allocated memory so tile-based GPUs never back them with real memory.
+     */
+    void createAttachments()
+    {
+        if (vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+        {
+            vulkanProgramInfo.msaaColorAttachment = createAttachmentImage(vulkanProgramInfo.vulkanSwapchainFormat,
+                                                                          VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                                                                          VK_IMAGE_ASPECT_COLOR_BIT,
+                                                                          vulkanProgramInfo.swapchainExtent,
+                                                                          vulkanProgramInfo.msaaSamples);
+        }
+
+        vulkanProgramInfo.depthAttachment = createAttachmentImage(vulkanProgramInfo.depthFormat,
+                                                                  VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                                                                  depthAspectMask(),
+                                                                  vulkanProgramInfo.swapchainExtent,
+                                                                  vulkanProgramInfo.msaaSamples);
+
+        VkDeviceSize fullSize = vulkanProgramInfo.msaaColorAttachment.size + vulkanProgramInfo.depthAttachment.size;
+        VkDeviceSize backedSize = 0;
+        for (const AttachmentImage *attachment: {&vulkanProgramInfo.msaaColorAttachment,
+                                                 &vulkanProgramInfo.depthAttachment})
+        {
+            if (!attachment->lazilyAllocated)
+            {
+                backedSize += attachment->size;
+            }
+        }
+
+        std::cout << "Transient attachments: " << fullSize << " bytes without lazy allocation, "
+                  << backedSize << " bytes backed up front with lazy allocation" << std::endl;
+    }
+
+    /**
+     * Create one attachment image of <extent> with <samples> samples. It is transient, and may be lazily allocated,
+     * unless <usage> has more than attachment usages.
+     */
+    AttachmentImage createAttachmentImage(VkFormat format,
+                                          VkImageUsageFlags usage,
+                                          VkImageAspectFlags aspectMask,
+                                          VkExtent2D extent,
+                                          VkSampleCountFlagBits samples)
+    {
+        AttachmentImage attachment{};
+
+        VkImageCreateInfo imageCreateInfo{};
+        imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = format;
+        imageCreateInfo.extent = {extent.width, extent.height, 1};
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = samples;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = usage;
+        const VkImageUsageFlags attachmentUsages = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                                   VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+                                                   VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+        if ((usage & ~attachmentUsages) == 0)
+        {
+            imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        }
+        imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        vkResult = vkCreateImage(vulkanProgramInfo.GPUDevice,
+                                 &imageCreateInfo,
+                                 vulkanProgramInfo.allocator,
+                                 &attachment.image);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create attachment image" << std::endl;
+            exit(-1);
+        }
+
+        VkMemoryRequirements memoryRequirements{};
+        vkGetImageMemoryRequirements(vulkanProgramInfo.GPUDevice, attachment.image, &memoryRequirements);
+
+        VkMemoryAllocateInfo memoryAllocateInfo{};
+        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocateInfo.allocationSize = memoryRequirements.size;
+        attachment.size = memoryRequirements.size;
+        attachment.lazilyAllocated = findOptionalMemoryType(memoryRequirements.memoryTypeBits,
+                                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                                                            VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+                                                            memoryAllocateInfo.memoryTypeIndex);
+
+        // Desktop GPUs have no lazily allocated memory, the attachment is then backed like any other image
+        if (!attachment.lazilyAllocated)
+        {
+            memoryAllocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits,
+                                                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        }
+
+        vkResult = vkAllocateMemory(vulkanProgramInfo.GPUDevice,
+                                    &memoryAllocateInfo,
+                                    vulkanProgramInfo.allocator,
+                                    &attachment.memory);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to allocate attachment memory" << std::endl;
+            exit(-1);
+        }
+
+        vkBindImageMemory(vulkanProgramInfo.GPUDevice, attachment.image, attachment.memory, 0);
+
+        VkImageViewCreateInfo imageViewCreateInfo{};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.image = attachment.image;
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.format = format;
+        imageViewCreateInfo.subresourceRange = {aspectMask, 0, 1, 0, 1};
+
+        vkResult = vkCreateImageView(vulkanProgramInfo.GPUDevice,
+                                     &imageViewCreateInfo,
+                                     vulkanProgramInfo.allocator,
+                                     &attachment.imageView);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create attachment image view" << std::endl;
+            exit(-1);
+        }
+
+        return attachment;
+    }
+
+    void destroyAttachmentImage(AttachmentImage &attachment) const
+    {
+        vkDestroyImageView(vulkanProgramInfo.GPUDevice, attachment.imageView, vulkanProgramInfo.allocator);
+        vkDestroyImage(vulkanProgramInfo.GPUDevice, attachment.image, vulkanProgramInfo.allocator);
+        vkFreeMemory(vulkanProgramInfo.GPUDevice, attachment.memory, vulkanProgramInfo.allocator);
+        attachment = AttachmentImage{};
+    }
+
+    /**
+     * Report how much of the transient attachments the driver actually committed.
+     * For lazily allocated memory this shows whether the attachments ever left tile memory.
+     */
+    void reportAttachmentCommitment() const
+    {
+        for (const AttachmentImage *attachment: {&vulkanProgramInfo.msaaColorAttachment,
+                                                 &vulkanProgramInfo.depthAttachment})
+        {
+            if (attachment->memory == VK_NULL_HANDLE || !attachment->lazilyAllocated)
+            {
+                continue;
+            }
+
+            VkDeviceSize committedBytes = 0;
+            vkGetDeviceMemoryCommitment(vulkanProgramInfo.GPUDevice, attachment->memory, &committedBytes);
+            std::cout << (attachment == &vulkanProgramInfo.depthAttachment ? "Depth" : "MSAA color")
+                      << " attachment: " << committedBytes << " of " << attachment->size
+                      << " bytes committed" << std::endl;
+        }
+    }
+
+    VkImageAspectFlags depthAspectMask() const
+    {
+        if (vulkanProgramInfo.depthFormat == VK_FORMAT_D24_UNORM_S8_UINT)
+        {
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        }
+        return VK_IMAGE_ASPECT_DEPTH_BIT;
+    }
+
+    /**
+     * Create vulkan swapchain for presentation
+     */
+    void createSwapchain()
+    {
+        VkSwapchainCreateInfoKHR swapchainCreateInfo{};
+        swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        swapchainCreateInfo.pNext = nullptr;
+        swapchainCreateInfo.surface = vulkanProgramInfo.vulkanSurface;
+
+        // -------------------------------------------------------------
+        // Get and fill image format and image colorspace information
+        uint32_t formatCount = 0;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(vulkanProgramInfo.chosenGPU,
+                                             vulkanProgramInfo.vulkanSurface,
+                                             &formatCount,
+                                             nullptr);
+
+
+        std::vector<VkSurfaceFormatKHR> surfaceFormats(formatCount);
+        vkGetPhysicalDeviceSurfaceFormatsKHR(vulkanProgramInfo.chosenGPU,
+                                             vulkanProgramInfo.vulkanSurface,
+                                             &formatCount,
+                                             surfaceFormats.data());
+
+        swapchainCreateInfo.imageFormat = surfaceFormats[0].format;
+        swapchainCreateInfo.imageColorSpace = surfaceFormats[0].colorSpace;
+
+        // Record swapchain format for later use in render pipeline
+        vulkanProgramInfo.vulkanSwapchainFormat = swapchainCreateInfo.imageFormat;
+        // ------------------------------------------
+        // Query for surface capabilities
+        VkSurfaceCapabilitiesKHR surfaceCapabilities{};
+
+        vkResult = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vulkanProgramInfo.chosenGPU,
+                                                             vulkanProgramInfo.vulkanSurface,
+                                                             &surfaceCapabilities);
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to get surface capabilities" << std::endl;
+            exit(-1);
+        }
+
+        // Every frame in flight may hold an image on top of the ones the presentation engine keeps, otherwise
+        // acquire has to wait for a present still queued behind it
+        swapchainCreateInfo.minImageCount = surfaceCapabilities.minImageCount + maxFramesInFlight;
+        if (surfaceCapabilities.maxImageCount != 0)
+        {
+            swapchainCreateInfo.minImageCount = std::min(swapchainCreateInfo.minImageCount,
+                                                         surfaceCapabilities.maxImageCount);
+        }
+
+        // Choose the extent of swapchain
+        VkExtent2D swapchainExtent{};
+
+        // Check what is the value of currentExtent
+        // If it is special value, choose any value fit for window
+        if (surfaceCapabilities.currentExtent.width == UINT32_MAX)
+        {
+            // Tracked from resize events, GLFW may only be queried on the main thread
+            swapchainExtent.width = (uint32_t) framebufferWidth;
+            swapchainExtent.height = (uint32_t) framebufferHeight;
+
+            swapchainExtent.width = std::max(surfaceCapabilities.minImageExtent.width,
+                                             std::min(surfaceCapabilities.maxImageExtent.width,
+                                                      swapchainExtent.width));
+
+            swapchainExtent.height = std::max(surfaceCapabilities.minImageExtent.height,
+                                              std::min(surfaceCapabilities.maxImageExtent.height,
+                                                       swapchainExtent.height));
+        }
+            // If it is specified, just follow whatever is specified
+        else
+        {
+            swapchainExtent = surfaceCapabilities.currentExtent;
+        }
+
+        vulkanProgramInfo.swapchainExtent = swapchainExtent;
+
+        swapchainCreateInfo.imageExtent = swapchainExtent;
+
+        // Other parameters
+        // Number of views
+        swapchainCreateInfo.imageArrayLayers = 1;
+
+        // Usage of images
+        swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+        // Readback copies the swapchain image into host memory
+        vulkanProgramInfo.readback = false;
+        if (options.readback || !options.recordPath.empty())
+        {
+            if ((surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) &&
+                PixelConversion::bytesPerPixel(swapchainCreateInfo.imageFormat) != 0)
+            {
+                swapchainCreateInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+                vulkanProgramInfo.readback = true;
+            } else
+            {
+                std::cout << "Readback: swapchain images cannot be copied, readback disabled" << std::endl;
+            }
+        }
+
+        // Dynamic resolution blits the scene into the swapchain image, from an image of the same format
+        if (vulkanProgramInfo.dynamicResolution)
+        {
+            VkFormatProperties formatProperties{};
+            vkGetPhysicalDeviceFormatProperties(vulkanProgramInfo.chosenGPU,
+                                                swapchainCreateInfo.imageFormat,
+                                                &formatProperties);
+            VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+
+            if ((surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) &&
+                (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures)
+            {
+                swapchainCreateInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+                vulkanProgramInfo.upscaleFilter =
+                        (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+                        ? VK_FILTER_LINEAR
+                        : VK_FILTER_NEAREST;
+            } else
+            {
+                std::cout << "Dynamic resolution: swapchain images cannot be blitted to, rendering at native "
+                             "resolution" << std::endl;
+                vulkanProgramInfo.dynamicResolution = false;
+            }
+        }
+
+        // Sharing mode
+        swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        // Orientation
+        swapchainCreateInfo.preTransform = surfaceCapabilities.currentTransform;
+
+        swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+        // Benchmarks measure frame time, not the refresh rate of the display. A paced frame rate must not be
+        // throttled by FIFO either, but should not tear.
+        swapchainCreateInfo.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        if (!options.benchmark.empty())
+        {
+            swapchainCreateInfo.presentMode = chooseUncappedPresentMode(vulkanProgramInfo.vulkanSurface, false);
+        } else if (options.targetFrameRate > 0.0)
+        {
+            swapchainCreateInfo.presentMode = chooseUncappedPresentMode(vulkanProgramInfo.vulkanSurface, true);
+        }
+        swapchainCreateInfo.clipped = VK_TRUE;
+
+        // Pass the previous swapchain (if any) so the driver can recycle its resources
+        VkSwapchainKHR oldSwapchain = vulkanProgramInfo.vulkanSwapchain;
+        swapchainCreateInfo.oldSwapchain = oldSwapchain;
+
+        // After create info is filled, create swapchain. The present watcher may be waiting on the old one.
+        {
+            std::lock_guard<std::mutex> swapchainLock(vulkanProgramInfo.swapchainMutex);
+            vkResult = vkCreateSwapchainKHR(vulkanProgramInfo.GPUDevice,
+                                            &swapchainCreateInfo,
+                                            vulkanProgramInfo.allocator,
+                                            &vulkanProgramInfo.vulkanSwapchain);
+            vulkanProgramInfo.presentWatcher.setSwapchain(vulkanProgramInfo.vulkanSwapchain);
+        }
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create swapchain" << std::endl;
+            exit(-1);
+        }
+
+        // Frames in flight may still present from the old swapchain
+        if (oldSwapchain != VK_NULL_HANDLE)
+        {
+            VkDevice device = vulkanProgramInfo.GPUDevice;
+            const VkAllocationCallbacks *allocator = vulkanProgramInfo.allocator;
+            retire([device, oldSwapchain, allocator]()
+                   {
+                       vkDestroySwapchainKHR(device, oldSwapchain, allocator);
+                   });
+        }
+
+        // Get access to vulkan images stored in swapchain
+        uint32_t swapchainImageCount = 0;
+        vkResult = vkGetSwapchainImagesKHR(vulkanProgramInfo.GPUDevice,
+                                           vulkanProgramInfo.vulkanSwapchain,
+                                           &swapchainImageCount,
+                                           nullptr);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to count number of swapchain images" << std::endl;
+            exit(-1);
+        }
+
+        vulkanProgramInfo.swapchainImages.resize(swapchainImageCount);
+
+        vkResult = vkGetSwapchainImagesKHR(vulkanProgramInfo.GPUDevice,
+                                           vulkanProgramInfo.vulkanSwapchain,
+                                           &swapchainImageCount,
+                                           vulkanProgramInfo.swapchainImages.data());
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to get swapchain images" << std::endl;
+            exit(-1);
+        }
+
+        // Create image views of images in swapchain
+        VkImageViewCreateInfo imageViewCreateInfo;
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.format = swapchainCreateInfo.imageFormat;
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+        imageViewCreateInfo.flags = 0;
+        imageViewCreateInfo.pNext = nullptr;
+
+        vulkanProgramInfo.imageViews.resize(vulkanProgramInfo.swapchainImages.size());
+        for (std::size_t i = 0; i < vulkanProgramInfo.imageViews.size(); i++)
+        {
+            imageViewCreateInfo.image = vulkanProgramInfo.swapchainImages[i];
+            vkResult = vkCreateImageView(vulkanProgramInfo.GPUDevice,
+                                         &imageViewCreateInfo,
+                                         vulkanProgramInfo.allocator,
+                                         &vulkanProgramInfo.imageViews[i]);
+
+            if (vkResult != VK_SUCCESS)
+            {
+                std::cout << "Failed to create vulkan image view [" << i << "]" << std::endl;
+                exit(-1);
+            }
+        }
+    }
+
+    /**
+     * Immediate or mailbox presentation if the surface supports either, FIFO otherwise.
+     * Mailbox comes first if <preferTearFree> is set.
+     */
+    VkPresentModeKHR chooseUncappedPresentMode(VkSurfaceKHR surface, bool preferTearFree) const
+    {
+        uint32_t presentModeCount = 0;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(vulkanProgramInfo.chosenGPU,
+                                                  surface,
+                                                  &presentModeCount,
+                                                  nullptr);
+
+        std::vector<VkPresentModeKHR> presentModes(presentModeCount);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(vulkanProgramInfo.chosenGPU,
+                                                  surface,
+                                                  &presentModeCount,
+                                                  presentModes.data());
+
+        VkPresentModeKHR immediateFirst[] = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR};
+        VkPresentModeKHR mailboxFirst[] = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+        for (VkPresentModeKHR preferredMode: preferTearFree ? mailboxFirst : immediateFirst)
+        {
+            if (std::find(presentModes.begin(), presentModes.end(), preferredMode) != presentModes.end())
+            {
+                return preferredMode;
+            }
+        }
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+
+    /**
+     * Create surface between vulkan instance and window created by glfw
+     */
+    void surfaceVulkanAndWindow()
+    {
+        vkResult = glfwCreateWindowSurface(vulkanProgramInfo.vulkanInstance,
+                                           window,
+                                           vulkanProgramInfo.allocator,
+                                           &vulkanProgramInfo.vulkanSurface);
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "failed to create surface between vulkan instance and glfw window" << std::endl;
+            exit(-1);
+        }
+
+        for (ExtraWindow &extra: extraWindows)
+        {
+            vkResult = glfwCreateWindowSurface(vulkanProgramInfo.vulkanInstance,
+                                               extra.window,
+                                               vulkanProgramInfo.allocator,
+                                               &extra.surface);
+            if (vkResult != VK_SUCCESS)
+            {
+                std::cout << "failed to create surface between vulkan instance and glfw window" << std::endl;
+                exit(-1);
+            }
+        }
+    }
+
+    /**
+     * Create a vulkan instance to start the whole vulkan program
+     */
+    void createVulkanInstance()
+    {
+        // Get a list of instance layer names for instance
+        //  Standard procedure for getting layer info
+        std::vector<VkLayerProperties> supportedLayers{};
+        uint32_t supportedLayerCount{};
+
+        vkEnumerateInstanceLayerProperties(&supportedLayerCount, nullptr);
+
+        supportedLayers.resize(supportedLayerCount);
+        vkEnumerateInstanceLayerProperties(&supportedLayerCount, supportedLayers.data());
+
+        // Check if required layer list is in the name list
+        if (!enabledLayersSupported(supportedLayers, vulkanProgramInfo.enabledLayers))
+        {
+            std::cout << "Error: some layers are not supported" << std::endl;
+            exit(-1);
+        }
+
+        // Get a list of instance extension names
+        std::vector<VkExtensionProperties> instanceExtensionPropertiesList{};
+        uint32_t instanceExtensionPropertiesCount{};
+
+        if (VK_SUCCESS == vkEnumerateInstanceExtensionProperties(nullptr,
+                                                                 &instanceExtensionPropertiesCount,
+                                                                 nullptr))
+        {
+            instanceExtensionPropertiesList.resize(instanceExtensionPropertiesCount);
+        } else
+        {
+            std::cout << "Failed to count number of instance extensions" << std::endl;
+            exit(-1);
+        }
+
+        if (VK_SUCCESS != vkEnumerateInstanceExtensionProperties(nullptr,
+                                                                 &instanceExtensionPropertiesCount,
+                                                                 instanceExtensionPropertiesList.data()))
+        {
+            std::cout << "Failed to get a list of instance extensions" << std::endl;
+            exit(-1);
+        }
+
+        // Check if every instance extension is supported
+        if (!checkEnabledExtensionsSupported(instanceExtensionPropertiesList,
+                                             vulkanProgramInfo.enabledInstanceExtensions))
+        {
+            std::cout << "Not all required instance extensions supported" << std::endl;
+            exit(-1);
+        }
+
+        // Optional instance extensions are enabled only if they are supported
+        for (const char *optionalExtension: vulkanProgramInfo.optionalInstanceExtensions)
+        {
+            if (checkEnabledExtensionsSupported(instanceExtensionPropertiesList, {optionalExtension}))
+            {
+                vulkanProgramInfo.enabledInstanceExtensions.push_back(optionalExtension);
+            }
+        }
+
+        // Create <VkDebugUtilsMessengerCreateInfoEXT>. This one is also going to be chained with instance create
+        // info so debug messenger can detect what is wrong with <VkCreateInstance> and <VkDestroyInstance>
+        VkDebugUtilsMessengerCreateInfoEXT debugMessengerCreateInfo{};
+
+        debugMessengerCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+        debugMessengerCreateInfo.pNext = nullptr;
+        debugMessengerCreateInfo.flags = 0;
+        debugMessengerCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT |
+                                                   VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+
+        debugMessengerCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+                                               VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+                                               VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+
+        debugMessengerCreateInfo.pfnUserCallback = debugMessengerCallback;
+        debugMessengerCreateInfo.pUserData = nullptr;
+
+        // Ask for Vulkan 1.2, or whatever lower version the loader implements. A 1.0 loader has no
+        // <vkEnumerateInstanceVersion> and fails instance creation for any apiVersion above 1.0
+        uint32_t loaderApiVersion = VK_API_VERSION_1_0;
+        auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(
+                nullptr,
+                "vkEnumerateInstanceVersion");
+        if (enumerateInstanceVersion != nullptr)
+        {
+            enumerateInstanceVersion(&loaderApiVersion);
+        }
+        vulkanProgramInfo.instanceApiVersion = std::min(loaderApiVersion, (uint32_t) VK_API_VERSION_1_2);
+
+        VkApplicationInfo applicationInfo{};
+
+        applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        applicationInfo.pNext = nullptr;
+        applicationInfo.pApplicationName = "VulkanTriangle";
+        applicationInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        applicationInfo.pEngineName = nullptr;
+        applicationInfo.engineVersion = 0;
+        applicationInfo.apiVersion = vulkanProgramInfo.instanceApiVersion;
+
+        // Now everything is supported and debug messenger is created start by creating <VkInstanceCreateInfo>
+        VkInstanceCreateInfo vulkanInstanceCreateInfo{};
+
+        vulkanInstanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        vulkanInstanceCreateInfo.pNext = &debugMessengerCreateInfo;
+        vulkanInstanceCreateInfo.flags = 0;
+        vulkanInstanceCreateInfo.pApplicationInfo = &applicationInfo;
+        vulkanInstanceCreateInfo.enabledLayerCount = (uint32_t) vulkanProgramInfo.enabledLayers.size();
+        vulkanInstanceCreateInfo.ppEnabledLayerNames = vulkanProgramInfo.enabledLayers.data();
+        vulkanInstanceCreateInfo.enabledExtensionCount = (uint32_t) vulkanProgramInfo.enabledInstanceExtensions.size();
+        vulkanInstanceCreateInfo.ppEnabledExtensionNames = vulkanProgramInfo.enabledInstanceExtensions.data();
+
+        // Create vulkan instance
+        if (VK_SUCCESS != vkCreateInstance(&vulkanInstanceCreateInfo,
+                                           vulkanProgramInfo.allocator,
+                                           &vulkanProgramInfo.vulkanInstance))
+        {
+            std::cout << "Failed to create vulkan instance" << std::endl;
+            exit(-1);
+        }
+
+        if (VK_SUCCESS != createDebugUtilsMessenger(vulkanProgramInfo.vulkanInstance,
+                                                    &debugMessengerCreateInfo,
+                                                    vulkanProgramInfo.allocator,
+                                                    &vulkanProgramInfo.debugMessenger))
+        {
+            std::cerr << "Failed to create debug utils messenger";
+        }
+    }
+
+    /**
+     * Create Logical device that abstracts chosen GPU device (physical device)
+     */
+    void createDevice()
+    {
+        uint32_t physicalDeviceNum{};
+        std::vector<VkPhysicalDevice> availablePhysicalDevices{};
+
+        vkResult = vkEnumeratePhysicalDevices(vulkanProgramInfo.vulkanInstance,
+                                              &physicalDeviceNum,
+                                              nullptr);
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cerr << "Failed to count physical device number" << std::endl;
+            exit(-1);
+        }
+
+        availablePhysicalDevices.resize(physicalDeviceNum);
+
+        vkResult = vkEnumeratePhysicalDevices(vulkanProgramInfo.vulkanInstance,
+                                              &physicalDeviceNum,
+                                              availablePhysicalDevices.data());
+
+        if (vkResult != VK_SUCCESS || physicalDeviceNum == 0)
+        {
+            std::cerr << "Failed to get a list of physical devices" << std::endl;
+            exit(-1);
+        }
+
+        // Pick the chosen GPU device
+        vulkanProgramInfo.chosenGPU = choosePhysicalDevice(availablePhysicalDevices);
+
+        vkGetPhysicalDeviceMemoryProperties(vulkanProgramInfo.chosenGPU,
+                                            &vulkanProgramInfo.memoryProperties);
+
+        // After a physical device is picked, choose the first queue family that supports graphics and presentation
+        uint32_t graphicsQueueFamilyIndex = -1;
+
+        if (!findGraphicsPresentQueueFamily(vulkanProgramInfo.chosenGPU, graphicsQueueFamilyIndex))
+        {
+            std::cout << "Failed to find queue that satisfy requirements" << std::endl;
+            exit(-1);
+        }
+        vulkanProgramInfo.graphicsQueueFamilyIndex = graphicsQueueFamilyIndex;
+
+        // Uploads go to a transfer only queue family when there is one
+        uint32_t transferQueueFamilyIndex = graphicsQueueFamilyIndex;
+        findTransferQueueFamily(vulkanProgramInfo.chosenGPU, graphicsQueueFamilyIndex, transferQueueFamilyIndex);
+        vulkanProgramInfo.transferQueueFamilyIndex = transferQueueFamilyIndex;
+
+        // Async compute goes to a compute family without graphics. If that is also the upload family, it gets
+        // a second queue of it when the family has one, otherwise both share queue 0.
+        uint32_t computeQueueFamilyIndex = graphicsQueueFamilyIndex;
+        uint32_t computeQueueIndex = 0;
+        if (options.asyncCompute)
+        {
+            findComputeQueueFamily(vulkanProgramInfo.chosenGPU,
+                                   graphicsQueueFamilyIndex,
+                                   transferQueueFamilyIndex,
+                                   computeQueueFamilyIndex);
+        }
+        vulkanProgramInfo.computeQueueFamilyIndex = computeQueueFamilyIndex;
+
+        float queuePriorities[] = {1.0f, 1.0f};
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{};
+
+        VkDeviceQueueCreateInfo queueCreateInfo{};
+        queueCreateInfo.queueFamilyIndex = graphicsQueueFamilyIndex;
+        queueCreateInfo.queueCount = 1;
+        queueCreateInfo.flags = 0;
+        queueCreateInfo.pNext = nullptr;
+        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfo.pQueuePriorities = queuePriorities;
+        queueCreateInfos.push_back(queueCreateInfo);
+
+        if (transferQueueFamilyIndex != graphicsQueueFamilyIndex)
+        {
+            queueCreateInfo.queueFamilyIndex = transferQueueFamilyIndex;
+            queueCreateInfos.push_back(queueCreateInfo);
+        }
+
+        if (computeQueueFamilyIndex != graphicsQueueFamilyIndex)
+        {
+            if (computeQueueFamilyIndex != transferQueueFamilyIndex)
+            {
+                queueCreateInfo.queueFamilyIndex = computeQueueFamilyIndex;
+                queueCreateInfos.push_back(queueCreateInfo);
+            } else if (getQueueFamilyProperties(vulkanProgramInfo.chosenGPU)[computeQueueFamilyIndex].queueCount >= 2)
+            {
+                queueCreateInfos.back().queueCount = 2;
+                computeQueueIndex = 1;
+            }
+        }
+
+        VkDeviceCreateInfo deviceCreateInfo{};
+
+        deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        deviceCreateInfo.pNext = nullptr;
+        deviceCreateInfo.flags = 0;
+        deviceCreateInfo.queueCreateInfoCount = (uint32_t) queueCreateInfos.size();
+        deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+        deviceCreateInfo.ppEnabledLayerNames = nullptr;
+        deviceCreateInfo.pEnabledFeatures = nullptr;
+        deviceCreateInfo.enabledLayerCount = 0;
+        deviceCreateInfo.ppEnabledLayerNames = nullptr;
+
+        // Enable device layers
+        uint32_t deviceExtensionCount = 0;
+        std::vector<VkExtensionProperties> availableDeviceExtensions{};
+
+        vkEnumerateDeviceExtensionProperties(vulkanProgramInfo.chosenGPU,
+                                             nullptr,
+                                             &deviceExtensionCount,
+                                             nullptr);
+
+        availableDeviceExtensions.resize(deviceExtensionCount);
+
+        vkResult = vkEnumerateDeviceExtensionProperties(vulkanProgramInfo.chosenGPU,
+                                                        nullptr,
+                                                        &deviceExtensionCount,
+                                                        availableDeviceExtensions.data());
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to get a list of device extensions" << std::endl;
+            exit(-1);
+        }
+
+        checkEnabledExtensionsSupported(availableDeviceExtensions,
+                                        vulkanProgramInfo.enabledDeviceExtensions);
+
+        // Feature negotiation. Every feature structure is first queried and then a fresh, zeroed copy with
+        // only the wanted bits set is chained into <VkDeviceCreateInfo>, so nothing the renderer does not use
+        // gets enabled. Structures are only chained when the device version or an extension makes them valid.
+        DeviceCapabilities &capabilities = vulkanProgramInfo.capabilities;
+
+        VkPhysicalDeviceProperties chosenGPUProperties{};
+        vkGetPhysicalDeviceProperties(vulkanProgramInfo.chosenGPU, &chosenGPUProperties);
+        capabilities.apiVersion = std::min(chosenGPUProperties.apiVersion, vulkanProgramInfo.instanceApiVersion);
+
+        bool core12 = capabilities.apiVersion >= VK_API_VERSION_1_2;
+
+        auto deviceExtensionSupported = [&availableDeviceExtensions](const char *extensionName)
+        {
+            return checkEnabledExtensionsSupported(availableDeviceExtensions, {extensionName});
+        };
+
+        // Dynamic rendering and the extensions it depends on. They are all core in 1.2
+        std::vector<const char *> dynamicRenderingExtensions{VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME};
+        if (!core12)
+        {
+            dynamicRenderingExtensions.insert(dynamicRenderingExtensions.end(),
+                                              {
+                                                      VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+                                                      VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+                                                      VK_KHR_MULTIVIEW_EXTENSION_NAME,
+                                                      VK_KHR_MAINTENANCE2_EXTENSION_NAME,
+                                              });
+        }
+
+        bool timelineSemaphoreExtensionSupported =
+                !core12 && deviceExtensionSupported(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+        bool drawIndirectCountExtensionSupported =
+                !core12 && deviceExtensionSupported(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        bool extendedDynamicStateExtensionSupported =
+                deviceExtensionSupported(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+        bool dynamicRenderingExtensionSupported =
+                checkEnabledExtensionsSupported(availableDeviceExtensions, dynamicRenderingExtensions);
+        bool synchronization2ExtensionSupported =
+                deviceExtensionSupported(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+        bool presentWaitExtensionsSupported =
+                checkEnabledExtensionsSupported(availableDeviceExtensions,
+                                                {VK_KHR_PRESENT_ID_EXTENSION_NAME, VK_KHR_PRESENT_WAIT_EXTENSION_NAME});
+
+        // Supported features
+        VkPhysicalDeviceVulkan11Features supportedVulkan11Features{};
+        supportedVulkan11Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+
+        VkPhysicalDeviceVulkan12Features supportedVulkan12Features{};
+        supportedVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR supportedTimelineSemaphoreFeatures{};
+        supportedTimelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+        VkPhysicalDeviceExtendedDynamicStateFeaturesEXT supportedExtendedDynamicStateFeatures{};
+        supportedExtendedDynamicStateFeatures.sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR supportedDynamicRenderingFeatures{};
+        supportedDynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+
+        VkPhysicalDeviceSynchronization2FeaturesKHR supportedSynchronization2Features{};
+        supportedSynchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+
+        VkPhysicalDevicePresentIdFeaturesKHR supportedPresentIdFeatures{};
+        supportedPresentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+
+        VkPhysicalDevicePresentWaitFeaturesKHR supportedPresentWaitFeatures{};
+        supportedPresentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+
+        VkPhysicalDeviceFeatures2 supportedFeatures2{};
+        supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+
+        void **supportedChainTail = &supportedFeatures2.pNext;
+        auto chainSupported = [&supportedChainTail](auto &featureStructure)
+        {
+            *supportedChainTail = &featureStructure;
+            supportedChainTail = &featureStructure.pNext;
+        };
+
+        if (core12)
+        {
+            chainSupported(supportedVulkan11Features);
+            chainSupported(supportedVulkan12Features);
+        }
+        if (timelineSemaphoreExtensionSupported)
+        {
+            chainSupported(supportedTimelineSemaphoreFeatures);
+        }
+        if (extendedDynamicStateExtensionSupported)
+        {
+            chainSupported(supportedExtendedDynamicStateFeatures);
+        }
+        if (dynamicRenderingExtensionSupported)
+        {
+            chainSupported(supportedDynamicRenderingFeatures);
+        }
+        if (synchronization2ExtensionSupported)
+        {
+            chainSupported(supportedSynchronization2Features);
+        }
+        if (presentWaitExtensionsSupported)
+        {
+            chainSupported(supportedPresentIdFeatures);
+            chainSupported(supportedPresentWaitFeatures);
+        }
+
+        // Core entry point on a 1.1+ instance, VK_KHR_get_physical_device_properties2 on a 1.0 one
+        auto getPhysicalDeviceFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2) vkGetInstanceProcAddr(
+                vulkanProgramInfo.vulkanInstance,
+                vulkanProgramInfo.instanceApiVersion >= VK_API_VERSION_1_1 ? "vkGetPhysicalDeviceFeatures2"
+                                                                           : "vkGetPhysicalDeviceFeatures2KHR");
+
+        if (getPhysicalDeviceFeatures2 != nullptr)
+        {
+            getPhysicalDeviceFeatures2(vulkanProgramInfo.chosenGPU, &supportedFeatures2);
+        } else
+        {
+            // Without the query no extension feature bit can be trusted
+            vkGetPhysicalDeviceFeatures(vulkanProgramInfo.chosenGPU, &supportedFeatures2.features);
+        }
+
+        // Enabled features
+        VkPhysicalDeviceVulkan12Features enabledVulkan12Features{};
+        enabledVulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR enabledTimelineSemaphoreFeatures{};
+        enabledTimelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+        VkPhysicalDeviceExtendedDynamicStateFeaturesEXT enabledExtendedDynamicStateFeatures{};
+        enabledExtendedDynamicStateFeatures.sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR enabledDynamicRenderingFeatures{};
+        enabledDynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+
+        VkPhysicalDeviceSynchronization2FeaturesKHR enabledSynchronization2Features{};
+        enabledSynchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+
+        VkPhysicalDevicePresentIdFeaturesKHR enabledPresentIdFeatures{};
+        enabledPresentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+
+        VkPhysicalDevicePresentWaitFeaturesKHR enabledPresentWaitFeatures{};
+        enabledPresentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+
+        VkPhysicalDeviceFeatures2 enabledFeatures2{};
+        enabledFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+
+        void **enabledChainTail = &enabledFeatures2.pNext;
+        auto chainEnabled = [&enabledChainTail](auto &featureStructure)
+        {
+            *enabledChainTail = &featureStructure;
+            enabledChainTail = &featureStructure.pNext;
+        };
+
+        // Timeline semaphores
+        if (core12 && supportedVulkan12Features.timelineSemaphore == VK_TRUE)
+        {
+            enabledVulkan12Features.timelineSemaphore = VK_TRUE;
+            capabilities.timelineSemaphore = true;
+        } else if (timelineSemaphoreExtensionSupported &&
+                   supportedTimelineSemaphoreFeatures.timelineSemaphore == VK_TRUE)
+        {
+            enabledTimelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+            vulkanProgramInfo.enabledDeviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+            chainEnabled(enabledTimelineSemaphoreFeatures);
+            capabilities.timelineSemaphore = true;
+        }
+
+        // Descriptor indexing, only the subset a bindless texture array needs
+        if (core12 &&
+            supportedVulkan12Features.descriptorIndexing == VK_TRUE &&
+            supportedVulkan12Features.runtimeDescriptorArray == VK_TRUE &&
+            supportedVulkan12Features.descriptorBindingPartiallyBound == VK_TRUE &&
+            supportedVulkan12Features.descriptorBindingVariableDescriptorCount == VK_TRUE &&
+            supportedVulkan12Features.shaderSampledImageArrayNonUniformIndexing == VK_TRUE)
+        {
+            enabledVulkan12Features.descriptorIndexing = VK_TRUE;
+            enabledVulkan12Features.runtimeDescriptorArray = VK_TRUE;
+            enabledVulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+            enabledVulkan12Features.descriptorBindingVariableDescriptorCount = VK_TRUE;
+            enabledVulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+            capabilities.descriptorIndexing = true;
+        }
+
+        // Buffer device address
+        if (core12 && supportedVulkan12Features.bufferDeviceAddress == VK_TRUE)
+        {
+            enabledVulkan12Features.bufferDeviceAddress = VK_TRUE;
+            capabilities.bufferDeviceAddress = true;
+        }
+
+        // Draw indirect count. The extension has no feature bit
+        if (core12 && supportedVulkan12Features.drawIndirectCount == VK_TRUE)
+        {
+            enabledVulkan12Features.drawIndirectCount = VK_TRUE;
+            capabilities.drawIndirectCount = true;
+        } else if (drawIndirectCountExtensionSupported)
+        {
+            vulkanProgramInfo.enabledDeviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+            capabilities.drawIndirectCount = true;
+        }
+
+        if (core12)
+        {
+            chainEnabled(enabledVulkan12Features);
+        }
+
+        if (extendedDynamicStateExtensionSupported &&
+            supportedExtendedDynamicStateFeatures.extendedDynamicState == VK_TRUE)
+        {
+            enabledExtendedDynamicStateFeatures.extendedDynamicState = VK_TRUE;
+            vulkanProgramInfo.enabledDeviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+            chainEnabled(enabledExtendedDynamicStateFeatures);
+            capabilities.extendedDynamicState = true;
+        }
+
+        if (!options.forceRenderPass &&
+            dynamicRenderingExtensionSupported &&
+            supportedDynamicRenderingFeatures.dynamicRendering == VK_TRUE)
+        {
+            enabledDynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+            vulkanProgramInfo.enabledDeviceExtensions.insert(vulkanProgramInfo.enabledDeviceExtensions.end(),
+                                                             dynamicRenderingExtensions.begin(),
+                                                             dynamicRenderingExtensions.end());
+            chainEnabled(enabledDynamicRenderingFeatures);
+            capabilities.dynamicRendering = true;
+        }
+
+        if (synchronization2ExtensionSupported &&
+            supportedSynchronization2Features.synchronization2 == VK_TRUE)
+        {
+            enabledSynchronization2Features.synchronization2 = VK_TRUE;
+            vulkanProgramInfo.enabledDeviceExtensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+            chainEnabled(enabledSynchronization2Features);
+            capabilities.synchronization2 = true;
+        }
+
+        if (presentWaitExtensionsSupported &&
+            supportedPresentIdFeatures.presentId == VK_TRUE &&
+            supportedPresentWaitFeatures.presentWait == VK_TRUE)
+        {
+            enabledPresentIdFeatures.presentId = VK_TRUE;
+            enabledPresentWaitFeatures.presentWait = VK_TRUE;
+            vulkanProgramInfo.enabledDeviceExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+            vulkanProgramInfo.enabledDeviceExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+            chainEnabled(enabledPresentIdFeatures);
+            chainEnabled(enabledPresentWaitFeatures);
+            capabilities.presentWait = true;
+        }
+
+        // <pEnabledFeatures> has to stay null when <VkPhysicalDeviceFeatures2> is chained. Without the query
+        // function the chain is only valid if it is empty
+        if (getPhysicalDeviceFeatures2 != nullptr)
+        {
+            deviceCreateInfo.pNext = &enabledFeatures2;
+        } else
+        {
+            deviceCreateInfo.pNext = enabledFeatures2.pNext;
+        }
+
+        deviceCreateInfo.ppEnabledExtensionNames = vulkanProgramInfo.enabledDeviceExtensions.data();
+        deviceCreateInfo.enabledExtensionCount = (uint32_t) vulkanProgramInfo.enabledDeviceExtensions.size();
+
+        vkResult = vkCreateDevice(vulkanProgramInfo.chosenGPU,
+                                  &deviceCreateInfo,
+                                  vulkanProgramInfo.allocator,
+                                  &vulkanProgramInfo.GPUDevice);
+
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create gpu device" << std::endl;
+            exit(-1);
+        }
+
+        if (!vulkanProgramInfo.dispatch.load(vulkanProgramInfo.GPUDevice,
+                                             capabilities.apiVersion,
+                                             vulkanProgramInfo.enabledDeviceExtensions))
+        {
+            std::cout << "Failed to load device commands" << std::endl;
+            exit(-1);
+        }
+
+        vulkanProgramInfo.dispatch.vkGetDeviceQueue(vulkanProgramInfo.GPUDevice,
+                                                    vulkanProgramInfo.graphicsQueueFamilyIndex,
+                                                    0,
+                                                    &vulkanProgramInfo.presentAndGraphicsQueue);
+        vulkanProgramInfo.dispatch.vkGetDeviceQueue(vulkanProgramInfo.GPUDevice,
+                                                    vulkanProgramInfo.transferQueueFamilyIndex,
+                                                    0,
+                                                    &vulkanProgramInfo.transferQueue);
+        vulkanProgramInfo.dispatch.vkGetDeviceQueue(vulkanProgramInfo.GPUDevice,
+                                                    vulkanProgramInfo.computeQueueFamilyIndex,
+                                                    computeQueueIndex,
+                                                    &vulkanProgramInfo.computeQueue);
+
+        std::cout << "Upload queue: family " << vulkanProgramInfo.transferQueueFamilyIndex
+                  << (vulkanProgramInfo.transferQueueFamilyIndex != vulkanProgramInfo.graphicsQueueFamilyIndex
+                      ? " (dedicated transfer)" : " (shared with graphics)") << std::endl;
+        std::cout << "Compute queue: family " << vulkanProgramInfo.computeQueueFamilyIndex
+                  << (vulkanProgramInfo.computeQueueFamilyIndex != vulkanProgramInfo.graphicsQueueFamilyIndex
+                      ? " (async compute)" : " (shared with graphics)") << std::endl;
+
+        printDeviceCapabilities();
+    }
+
+    /**
+     * Log the API version and the fast paths <createDevice> managed to enable
+     */
+    void printDeviceCapabilities() const
+    {
+        const DeviceCapabilities &capabilities = vulkanProgramInfo.capabilities;
+
+        auto state = [](bool enabled)
+        {
+            return enabled ? "enabled" : "not available";
+        };
+
+        std::cout << "Vulkan API: " << VK_VERSION_MAJOR(capabilities.apiVersion) << "."
+                  << VK_VERSION_MINOR(capabilities.apiVersion) << std::endl;
+        std::cout << "Rendering path: "
+                  << (capabilities.dynamicRendering ? "dynamic rendering" : "render pass") << std::endl;
+        std::cout << "Extended dynamic state: " << state(capabilities.extendedDynamicState) << std::endl;
+        std::cout << "Synchronization2: " << state(capabilities.synchronization2) << std::endl;
+        std::cout << "Timeline semaphores: " << state(capabilities.timelineSemaphore) << std::endl;
+        std::cout << "Descriptor indexing: " << state(capabilities.descriptorIndexing) << std::endl;
+        std::cout << "Buffer device address: " << state(capabilities.bufferDeviceAddress) << std::endl;
+        std::cout << "Draw indirect count: " << state(capabilities.drawIndirectCount) << std::endl;
+        std::cout << "Present timing: " << state(capabilities.presentWait) << std::endl;
+    }
+
+    /**
+     * A physical device with the score <choosePhysicalDevice> gave it and why
+     */
+    struct PhysicalDeviceCandidate
+    {
+        VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+        VkPhysicalDeviceProperties properties{};
+        uint8_t deviceUUID[VK_UUID_SIZE]{};
+
+        // Devices missing a hard requirement are never picked by score
+        bool suitable = true;
+        int64_t score = 0;
+        std::vector<std::string> reasons{};
+    };
+
+    /**
+     * Score every physical device and return the best one, or the one selected with --gpu=<index|name|uuid>.
+     * Hard requirements are a graphics queue that can present to our surface and the swapchain extension.
+     * The score favours device type first, then device local memory, dedicated transfer and compute queues
+     * and the optional features the renderer has fast paths for.
+     */
+    VkPhysicalDevice choosePhysicalDevice(const std::vector<VkPhysicalDevice> &physicalDevices) const
+    {
+        // Core since 1.1, the KHR extension is only enabled if an older instance has it
+        auto getPhysicalDeviceProperties2 = (PFN_vkGetPhysicalDeviceProperties2) vkGetInstanceProcAddr(
+                vulkanProgramInfo.vulkanInstance,
+                vulkanProgramInfo.instanceApiVersion >= VK_API_VERSION_1_1 ? "vkGetPhysicalDeviceProperties2"
+                                                                           : "vkGetPhysicalDeviceProperties2KHR");
+
+        std::vector<PhysicalDeviceCandidate> candidates(physicalDevices.size());
+
+        for (std::size_t deviceIndex = 0; deviceIndex < physicalDevices.size(); deviceIndex++)
+        {
+            PhysicalDeviceCandidate &candidate = candidates[deviceIndex];
+            candidate.physicalDevice = physicalDevices[deviceIndex];
+            vkGetPhysicalDeviceProperties(candidate.physicalDevice, &candidate.properties);
+
+            if (getPhysicalDeviceProperties2 != nullptr)
+            {
+                VkPhysicalDeviceIDProperties idProperties{};
+                idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+                VkPhysicalDeviceProperties2 properties2{};
+                properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+                properties2.pNext = &idProperties;
+                getPhysicalDeviceProperties2(candidate.physicalDevice, &properties2);
+
+                memcpy(candidate.deviceUUID, idProperties.deviceUUID, VK_UUID_SIZE);
+            }
+
+            scorePhysicalDevice(candidate);
+        }
+
+        std::cout << "Physical devices:" << std::endl;
+        for (std::size_t deviceIndex = 0; deviceIndex < candidates.size(); deviceIndex++)
+        {
+            const PhysicalDeviceCandidate &candidate = candidates[deviceIndex];
+            std::cout << "  [" << deviceIndex << "] " << candidate.properties.deviceName
+                      << " uuid=" << formatUUID(candidate.deviceUUID)
+                      << (candidate.suitable ? " score=" + std::to_string(candidate.score) : " unsuitable")
+                      << std::endl;
+
+            for (const std::string &reason: candidate.reasons)
+            {
+                std::cout << "      " << reason << std::endl;
+            }
+        }
+
+        // An explicit selection wins over the score, but never over the hard requirements
+        std::size_t chosenIndex = candidates.size();
+
+        if (!options.gpuSelection.empty())
+        {
+            chosenIndex = findSelectedPhysicalDevice(candidates);
+
+            if (chosenIndex == candidates.size())
+            {
+                std::cout << "No physical device matches --gpu=" << options.gpuSelection << std::endl;
+                exit(-1);
+            }
+
+            if (!candidates[chosenIndex].suitable)
+            {
+                std::cout << "Physical device selected by --gpu=" << options.gpuSelection
+                          << " cannot render to this window" << std::endl;
+                exit(-1);
+            }
+
+            std::cout << "Chosen physical device: [" << chosenIndex << "] "
+                      << candidates[chosenIndex].properties.deviceName
+                      << " (selected by --gpu=" << options.gpuSelection << ")" << std::endl;
+            return candidates[chosenIndex].physicalDevice;
+        }
+
+        for (std::size_t deviceIndex = 0; deviceIndex < candidates.size(); deviceIndex++)
+        {
+            if (candidates[deviceIndex].suitable &&
+                (chosenIndex == candidates.size() || candidates[deviceIndex].score > candidates[chosenIndex].score))
+            {
+                chosenIndex = deviceIndex;
+            }
+        }
+
+        if (chosenIndex == candidates.size())
+        {
+            std::cout << "No physical device can render to this window" << std::endl;
+            exit(-1);
+        }
+
+        std::cout << "Chosen physical device: [" << chosenIndex << "] "
+                  << candidates[chosenIndex].properties.deviceName
+                  << " (highest score " << candidates[chosenIndex].score << ")" << std::endl;
+        return candidates[chosenIndex].physicalDevice;
+    }
+
+    /**
+     * Fill in <candidate.score>, <candidate.suitable> and the reasons behind them
+     */
+    void scorePhysicalDevice(PhysicalDeviceCandidate &candidate) const
+    {
+        auto addScore = [&candidate](int64_t points, const std::string &reason)
+        {
+            candidate.score += points;
+            candidate.reasons.push_back((points >= 0 ? "+" : "") + std::to_string(points) + " " + reason);
+        };
+
+        switch (candidate.properties.deviceType)
+        {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+                addScore(10000, "discrete GPU");
+                break;
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+                addScore(5000, "integrated GPU");
+                break;
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+                addScore(2000, "virtual GPU");
+                break;
+            case VK_PHYSICAL_DEVICE_TYPE_CPU:
+                addScore(0, "software rasterizer");
+                break;
+            default:
+                addScore(0, "unknown device type");
+                break;
+        }
+
+        // Device local memory in 256 MiB steps, capped so memory never outweighs the device type
+        VkPhysicalDeviceMemoryProperties memoryProperties{};
+        vkGetPhysicalDeviceMemoryProperties(candidate.physicalDevice, &memoryProperties);
+
+        VkDeviceSize deviceLocalBytes = 0;
+        for (uint32_t heapIndex = 0; heapIndex < memoryProperties.memoryHeapCount; heapIndex++)
+        {
+            if (memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            {
+                deviceLocalBytes += memoryProperties.memoryHeaps[heapIndex].size;
+            }
+        }
+        addScore((int64_t) std::min<VkDeviceSize>(deviceLocalBytes / (256ull << 20), 64) * 50,
+                 std::to_string(deviceLocalBytes >> 20) + " MiB device local memory");
+
+        // Hard requirements
+        uint32_t graphicsQueueFamilyIndex = 0;
+        if (!findGraphicsPresentQueueFamily(candidate.physicalDevice, graphicsQueueFamilyIndex))
+        {
+            candidate.suitable = false;
+            candidate.reasons.emplace_back("no graphics queue that can present to the window surface");
+        }
+
+        std::vector<VkExtensionProperties> deviceExtensions = getDeviceExtensions(candidate.physicalDevice);
+        if (!checkEnabledExtensionsSupported(deviceExtensions, {VK_KHR_SWAPCHAIN_EXTENSION_NAME}))
+        {
+            candidate.suitable = false;
+            candidate.reasons.emplace_back("missing " VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        }
+
+        // Dedicated queues let uploads and compute run next to rendering
+        bool dedicatedTransfer = false;
+        bool dedicatedCompute = false;
+        for (const VkQueueFamilyProperties &queueFamily: getQueueFamilyProperties(candidate.physicalDevice))
+        {
+            if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+                !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+            {
+                dedicatedTransfer = true;
+            }
+            if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT))
+            {
+                dedicatedCompute = true;
+            }
+        }
+        if (dedicatedTransfer)
+        {
+            addScore(200, "dedicated transfer queue family");
+        }
+        if (dedicatedCompute)
+        {
+            addScore(200, "dedicated compute queue family");
+        }
+
+        // Optional extensions the renderer has fast paths for
+        for (const char *optionalExtension: {VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+                                             VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+                                             VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME})
+        {
+            if (checkEnabledExtensionsSupported(deviceExtensions, {optionalExtension}))
+            {
+                addScore(100, std::string("supports ") + optionalExtension);
+            }
+        }
+
+        addScore(VK_API_VERSION_MINOR(candidate.properties.apiVersion) * 100,
+                 "Vulkan " + std::to_string(VK_API_VERSION_MAJOR(candidate.properties.apiVersion)) + "." +
+                 std::to_string(VK_API_VERSION_MINOR(candidate.properties.apiVersion)));
+    }
+
+    /**
+     * Resolve --gpu=<index|name|uuid>. A plain number is an index, otherwise the value is compared against
+     * the device UUID (dashes optional) and then searched for in the device name, case-insensitively.
+     * Returns <candidates.size()> if nothing matches.
+     */
+    std::size_t findSelectedPhysicalDevice(const std::vector<PhysicalDeviceCandidate> &candidates) const
+    {
+        const std::string &selection = options.gpuSelection;
+
+        // <cctype> functions are undefined for negative char values
+        if (std::all_of(selection.begin(), selection.end(), [](unsigned char character)
+        {
+            return std::isdigit(character) != 0;
+        }))
+        {
+            // An index too large for std::size_t matches no device either
+            try
+            {
+                std::size_t selectedIndex = std::stoul(selection);
+                return selectedIndex < candidates.size() ? selectedIndex : candidates.size();
+            } catch (const std::out_of_range &)
+            {
+                return candidates.size();
+            }
+        }
+
+        auto normalize = [](std::string value, bool stripDashes)
+        {
+            if (stripDashes)
+            {
+                value.erase(std::remove(value.begin(), value.end(), '-'), value.end());
+            }
+            std::transform(value.begin(), value.end(), value.begin(), [](unsigned char character)
+            {
+                return (char) std::tolower(character);
+            });
+            return value;
+        };
+
+        for (std::size_t deviceIndex = 0; deviceIndex < candidates.size(); deviceIndex++)
+        {
+            if (normalize(formatUUID(candidates[deviceIndex].deviceUUID), true) == normalize(selection, true))
+            {
+                return deviceIndex;
+            }
+        }
+
+        for (std::size_t deviceIndex = 0; deviceIndex < candidates.size(); deviceIndex++)
+        {
+            if (normalize(candidates[deviceIndex].properties.deviceName, false)
+                        .find(normalize(selection, false)) != std::string::npos)
+            {
+                return deviceIndex;
+            }
+        }
+
+        return candidates.size();
+    }
+
+    static std::string formatUUID(const uint8_t uuid[VK_UUID_SIZE])
+    {
+        static const char hexDigits[] = "0123456789abcdef";
+        std::string formatted{};
+
+        for (uint32_t byteIndex = 0; byteIndex < VK_UUID_SIZE; byteIndex++)
+        {
+            if (byteIndex == 4 || byteIndex == 6 || byteIndex == 8 || byteIndex == 10)
+            {
+                formatted += '-';
+            }
+            formatted += hexDigits[uuid[byteIndex] >> 4];
+            formatted += hexDigits[uuid[byteIndex] & 0xF];
+        }
+
+        return formatted;
+    }
+
+    static std::vector<VkQueueFamilyProperties> getQueueFamilyProperties(VkPhysicalDevice physicalDevice)
+    {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+
+        std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyPropertiesList.data());
+
+        return queueFamilyPropertiesList;
+    }
+
+    static std::vector<VkExtensionProperties> getDeviceExtensions(VkPhysicalDevice physicalDevice)
+    {
+        uint32_t deviceExtensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &deviceExtensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> deviceExtensions(deviceExtensionCount);
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &deviceExtensionCount, deviceExtensions.data());
+
+        return deviceExtensions;
+    }
+
+    /**
+     * Find the first queue family of <physicalDevice> that supports graphics and presentation to our surface
+     */
+    bool findGraphicsPresentQueueFamily(VkPhysicalDevice physicalDevice, uint32_t &graphicsQueueFamilyIndex) const
+    {
+        std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList = getQueueFamilyProperties(physicalDevice);
+
+        for (uint32_t queueFamilyIndex = 0; queueFamilyIndex < queueFamilyPropertiesList.size(); queueFamilyIndex++)
+        {
+            VkBool32 presentationSupport = VK_FALSE;
+            vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice,
+                                                 queueFamilyIndex,
+                                                 vulkanProgramInfo.vulkanSurface,
+                                                 &presentationSupport);
+
+            if (queueFamilyPropertiesList[queueFamilyIndex].queueFlags & VK_QUEUE_GRAPHICS_BIT &&
+                presentationSupport == VK_TRUE)
+            {
+                graphicsQueueFamilyIndex = queueFamilyIndex;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Find a queue family for uploads other than <graphicsQueueFamilyIndex>. A family with transfer only is
+     * preferred, those map to the copy engines. Leaves <transferQueueFamilyIndex> untouched if there is none.
+     */
+    static bool findTransferQueueFamily(VkPhysicalDevice physicalDevice,
+                                        uint32_t graphicsQueueFamilyIndex,
+                                        uint32_t &transferQueueFamilyIndex)
+    {
+        std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList = getQueueFamilyProperties(physicalDevice);
+
+        bool found = false;
+        for (uint32_t queueFamilyIndex = 0; queueFamilyIndex < queueFamilyPropertiesList.size(); queueFamilyIndex++)
+        {
+            VkQueueFlags queueFlags = queueFamilyPropertiesList[queueFamilyIndex].queueFlags;
+
+            if (queueFamilyIndex == graphicsQueueFamilyIndex ||
+                !(queueFlags & VK_QUEUE_TRANSFER_BIT) ||
+                (queueFlags & VK_QUEUE_GRAPHICS_BIT))
+            {
+                continue;
+            }
+
+            if (!(queueFlags & VK_QUEUE_COMPUTE_BIT))
+            {
+                transferQueueFamilyIndex = queueFamilyIndex;
+                return true;
+            }
+
+            // An async compute family also copies, keep looking for a transfer only one
+            if (!found)
+            {
+                transferQueueFamilyIndex = queueFamilyIndex;
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    /**
+     * Find a compute queue family other than <graphicsQueueFamilyIndex>, preferring one that is not the upload
+     * family either. Leaves <computeQueueFamilyIndex> untouched if there is none.
+     */
+    static bool findComputeQueueFamily(VkPhysicalDevice physicalDevice,
+                                       uint32_t graphicsQueueFamilyIndex,
+                                       uint32_t transferQueueFamilyIndex,
+                                       uint32_t &computeQueueFamilyIndex)
+    {
+        std::vector<VkQueueFamilyProperties> queueFamilyPropertiesList = getQueueFamilyProperties(physicalDevice);
+
+        bool found = false;
+        for (uint32_t queueFamilyIndex = 0; queueFamilyIndex < queueFamilyPropertiesList.size(); queueFamilyIndex++)
+        {
+            VkQueueFlags queueFlags = queueFamilyPropertiesList[queueFamilyIndex].queueFlags;
+
+            if (queueFamilyIndex == graphicsQueueFamilyIndex ||
+                !(queueFlags & VK_QUEUE_COMPUTE_BIT) ||
+                (queueFlags & VK_QUEUE_GRAPHICS_BIT))
+            {
+                continue;
+            }
+
+            if (queueFamilyIndex != transferQueueFamilyIndex)
+            {
+                computeQueueFamilyIndex = queueFamilyIndex;
+                return true;
+            }
+
+            if (!found)
+            {
+                computeQueueFamilyIndex = queueFamilyIndex;
+                found = true;
+            }
+        }
+
+        return found;
+    }
+
+    /**
+     * Create the upload queue, then create the vertex buffer and upload the triangle into it
+     */
+    void createVertexBuffer()
+    {
+        bool created = vulkanProgramInfo.uploadQueue.create(
+                vulkanProgramInfo.GPUDevice,
+                &vulkanProgramInfo.dispatch,
+                vulkanProgramInfo.allocator,
+                &vulkanProgramInfo.scheduler,
+                vulkanProgramInfo.transferQueue,
+                vulkanProgramInfo.transferQueueFamilyIndex,
+                vulkanProgramInfo.graphicsTimeline,
+                vulkanProgramInfo.graphicsQueueFamilyIndex,
+                [this](uint32_t memoryTypeBits, VkMemoryPropertyFlags properties)
+                {
+                    return findMemoryType(memoryTypeBits, properties);
+                });
+
+        if (!created)
+        {
+            std::cout << "Failed to create upload queue" << std::endl;
+            exit(-1);
+        }
+
+        // Exclusive sharing, the upload queue moves ownership to the graphics family
+        VkBufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.size = sizeof(triangleVertices);
+        bufferCreateInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        vkResult = vkCreateBuffer(vulkanProgramInfo.GPUDevice,
+                                  &bufferCreateInfo,
+                                  vulkanProgramInfo.allocator,
+                                  &vulkanProgramInfo.vertexBuffer);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create vertex buffer" << std::endl;
+            exit(-1);
+        }
+
+        VkMemoryRequirements memoryRequirements{};
+        vkGetBufferMemoryRequirements(vulkanProgramInfo.GPUDevice, vulkanProgramInfo.vertexBuffer, &memoryRequirements);
+
+        VkMemoryAllocateInfo memoryAllocateInfo{};
+        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocateInfo.allocationSize = memoryRequirements.size;
+        memoryAllocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits,
+                                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        vkResult = vkAllocateMemory(vulkanProgramInfo.GPUDevice,
+                                    &memoryAllocateInfo,
+                                    vulkanProgramInfo.allocator,
+                                    &vulkanProgramInfo.vertexBufferMemory);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to allocate vertex buffer memory" << std::endl;
+            exit(-1);
+        }
+
+        vkBindBufferMemory(vulkanProgramInfo.GPUDevice,
+                           vulkanProgramInfo.vertexBuffer,
+                           vulkanProgramInfo.vertexBufferMemory,
+                           0);
+
+        bool uploaded = vulkanProgramInfo.uploadQueue.uploadBuffer(vulkanProgramInfo.vertexBuffer,
+                                                                   triangleVertices,
+                                                                   sizeof(triangleVertices),
+                                                                   VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                                                   VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+        if (!uploaded)
+        {
+            std::cout << "Failed to upload vertex buffer" << std::endl;
+            exit(-1);
+        }
+    }
+
+    /**
+     * Create the particle update compute pipeline. Its one storage buffer binding gets a descriptor set per
+     * swapchain image in <createParticleBuffers>, the animation time and particle count are push constants.
+     */
+    void createParticlePipeline()
+    {
+        VkDescriptorSetLayoutBinding storageBinding{};
+        storageBinding.binding = 0;
+        storageBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        storageBinding.descriptorCount = 1;
+        storageBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{};
+        setLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        setLayoutCreateInfo.bindingCount = 1;
+        setLayoutCreateInfo.pBindings = &storageBinding;
+
+        vkResult = vkCreateDescriptorSetLayout(vulkanProgramInfo.GPUDevice,
+                                               &setLayoutCreateInfo,
+                                               vulkanProgramInfo.allocator,
+                                               &vulkanProgramInfo.particleSetLayout);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create particle descriptor set layout" << std::endl;
+            exit(-1);
+        }
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(ParticleParameters);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCreateInfo.setLayoutCount = 1;
+        pipelineLayoutCreateInfo.pSetLayouts = &vulkanProgramInfo.particleSetLayout;
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+        vkResult = vkCreatePipelineLayout(vulkanProgramInfo.GPUDevice,
+                                          &pipelineLayoutCreateInfo,
+                                          vulkanProgramInfo.allocator,
+                                          &vulkanProgramInfo.particlePipelineLayout);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create particle pipeline layout" << std::endl;
+            exit(-1);
+        }
+
+        VkShaderModule compShaderModule = createShaderModule(readFile("../src/particles.spv"));
+
+        VkComputePipelineCreateInfo pipelineCreateInfo{};
+        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineCreateInfo.stage.module = compShaderModule;
+        pipelineCreateInfo.stage.pName = "main";
+        pipelineCreateInfo.layout = vulkanProgramInfo.particlePipelineLayout;
+
+        vkResult = vkCreateComputePipelines(vulkanProgramInfo.GPUDevice,
+                                            VK_NULL_HANDLE,
+                                            1,
+                                            &pipelineCreateInfo,
+                                            vulkanProgramInfo.allocator,
+                                            &vulkanProgramInfo.particlePipeline);
+
+        vkDestroyShaderModule(vulkanProgramInfo.GPUDevice, compShaderModule, vulkanProgramInfo.allocator);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create particle pipeline" << std::endl;
+            exit(-1);
+        }
+    }
+
+    /**
+     * Create one particle buffer and descriptor set per swapchain image. The buffers are shared concurrently by
+     * the graphics and compute families, so neither side needs a queue family ownership transfer every frame.
+     */
+    void createParticleBuffers()
+    {
+        std::size_t imageCount = vulkanProgramInfo.swapchainImages.size();
+
+        uint32_t queueFamilyIndices[] = {vulkanProgramInfo.graphicsQueueFamilyIndex,
+                                         vulkanProgramInfo.computeQueueFamilyIndex};
+        bool sharedFamilies = vulkanProgramInfo.computeQueueFamilyIndex != vulkanProgramInfo.graphicsQueueFamilyIndex;
+
+        VkBufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.size = sizeof(Vertex) * 3 * options.particleCount;
+        bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        bufferCreateInfo.sharingMode = sharedFamilies ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+        bufferCreateInfo.queueFamilyIndexCount = sharedFamilies ? 2 : 0;
+        bufferCreateInfo.pQueueFamilyIndices = sharedFamilies ? queueFamilyIndices : nullptr;
+
+        vulkanProgramInfo.particleBuffers.resize(imageCount);
+        vulkanProgramInfo.particleBufferMemories.resize(imageCount);
+
+        for (std::size_t i = 0; i < imageCount; i++)
+        {
+            vkResult = vkCreateBuffer(vulkanProgramInfo.GPUDevice,
+                                      &bufferCreateInfo,
+                                      vulkanProgramInfo.allocator,
+                                      &vulkanProgramInfo.particleBuffers[i]);
+
+            if (vkResult != VK_SUCCESS)
+            {
+                std::cout << "Failed to create particle buffer" << std::endl;
+                exit(-1);
+            }
+
+            VkMemoryRequirements memoryRequirements{};
+            vkGetBufferMemoryRequirements(vulkanProgramInfo.GPUDevice,
+                                          vulkanProgramInfo.particleBuffers[i],
+                                          &memoryRequirements);
+
+            VkMemoryAllocateInfo memoryAllocateInfo{};
+            memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            memoryAllocateInfo.allocationSize = memoryRequirements.size;
+            memoryAllocateInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits,
+                                                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+            vkResult = vkAllocateMemory(vulkanProgramInfo.GPUDevice,
+                                        &memoryAllocateInfo,
+                                        vulkanProgramInfo.allocator,
+                                        &vulkanProgramInfo.particleBufferMemories[i]);
+
+            if (vkResult != VK_SUCCESS)
+            {
+                std::cout << "Failed to allocate particle buffer memory" << std::endl;
+                exit(-1);
+            }
+
+            vkBindBufferMemory(vulkanProgramInfo.GPUDevice,
+                               vulkanProgramInfo.particleBuffers[i],
+                               vulkanProgramInfo.particleBufferMemories[i],
+                               0);
+        }
+
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize.descriptorCount = (uint32_t) imageCount;
+
+        VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{};
+        descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        descriptorPoolCreateInfo.maxSets = (uint32_t) imageCount;
+        descriptorPoolCreateInfo.poolSizeCount = 1;
+        descriptorPoolCreateInfo.pPoolSizes = &poolSize;
+
+        vkResult = vkCreateDescriptorPool(vulkanProgramInfo.GPUDevice,
+                                          &descriptorPoolCreateInfo,
+                                          vulkanProgramInfo.allocator,
+                                          &vulkanProgramInfo.particleDescriptorPool);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create particle descriptor pool" << std::endl;
+            exit(-1);
+        }
+
+        std::vector<VkDescriptorSetLayout> setLayouts(imageCount, vulkanProgramInfo.particleSetLayout);
+
+        VkDescriptorSetAllocateInfo setAllocateInfo{};
+        setAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        setAllocateInfo.descriptorPool = vulkanProgramInfo.particleDescriptorPool;
+        setAllocateInfo.descriptorSetCount = (uint32_t) imageCount;
+        setAllocateInfo.pSetLayouts = setLayouts.data();
+
+        vulkanProgramInfo.particleDescriptorSets.resize(imageCount);
+        vkResult = vkAllocateDescriptorSets(vulkanProgramInfo.GPUDevice,
+                                            &setAllocateInfo,
+                                            vulkanProgramInfo.particleDescriptorSets.data());
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to allocate particle descriptor sets" << std::endl;
+            exit(-1);
+        }
+
+        std::vector<VkDescriptorBufferInfo> bufferInfos(imageCount);
+        std::vector<VkWriteDescriptorSet> descriptorWrites(imageCount);
+        for (std::size_t i = 0; i < imageCount; i++)
+        {
+            bufferInfos[i].buffer = vulkanProgramInfo.particleBuffers[i];
+            bufferInfos[i].offset = 0;
+            bufferInfos[i].range = VK_WHOLE_SIZE;
+
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = vulkanProgramInfo.particleDescriptorSets[i];
+            descriptorWrites[i].dstBinding = 0;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+        }
+
+        vkUpdateDescriptorSets(vulkanProgramInfo.GPUDevice,
+                               (uint32_t) descriptorWrites.size(),
+                               descriptorWrites.data(),
+                               0,
+                               nullptr);
+    }
+
+    /**
+     * Create the command buffers and timeline semaphore the particle update is submitted with
+     */
+    void createAsyncCompute()
+    {
+        bool created = vulkanProgramInfo.asyncCompute.create(vulkanProgramInfo.GPUDevice,
+                                                             &vulkanProgramInfo.dispatch,
+                                                             vulkanProgramInfo.allocator,
+                                                             &vulkanProgramInfo.scheduler,
+                                                             vulkanProgramInfo.computeTimeline,
+                                                             vulkanProgramInfo.computeQueueFamilyIndex,
+                                                             vulkanProgramInfo.graphicsTimeline,
+                                                             vulkanProgramInfo.graphicsQueueFamilyIndex,
+                                                             maxFramesInFlight);
+
+        if (!created)
+        {
+            std::cout << "Failed to create async compute" << std::endl;
+            exit(-1);
+        }
+
+        std::cout << "Particle update: " << options.particleCount << " particle(s) on the "
+                  << (vulkanProgramInfo.asyncCompute.isAsync() ? "async compute" : "graphics") << " queue"
+                  << std::endl;
+
+        vulkanProgramInfo.startTime = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * Submit the particle update of swapchain image <imageIndex> at animation time <time> in seconds with the slot
+     * of the current frame. Returns the timeline value the graphics submission has to wait for at vertex input, 0
+     * if it needs no wait.
+     */
+    uint64_t submitParticleUpdate(uint32_t imageIndex, float time)
+    {
+        ParticleParameters parameters{};
+        parameters.time = time;
+        parameters.particleCount = options.particleCount;
+        parameters.iterations = options.computeLoad;
+
+        VkDescriptorSet descriptorSet = vulkanProgramInfo.particleDescriptorSets[imageIndex];
+        VkBuffer particleBuffer = vulkanProgramInfo.particleBuffers[imageIndex];
+
+        return vulkanProgramInfo.asyncCompute.submit(
+                vulkanProgramInfo.currentFrame,
+                [this, &parameters, descriptorSet, particleBuffer](VkCommandBuffer cmdBuffer, bool onGraphicsQueue)
+                {
+                    const DeviceDispatch &dispatch = vulkanProgramInfo.dispatch;
+
+                    dispatch.vkCmdBindPipeline(cmdBuffer,
+                                               VK_PIPELINE_BIND_POINT_COMPUTE,
+                                               vulkanProgramInfo.particlePipeline);
+                    dispatch.vkCmdBindDescriptorSets(cmdBuffer,
+                                                     VK_PIPELINE_BIND_POINT_COMPUTE,
+                                                     vulkanProgramInfo.particlePipelineLayout,
+                                                     0,
+                                                     1,
+                                                     &descriptorSet,
+                                                     0,
+                                                     nullptr);
+                    dispatch.vkCmdPushConstants(cmdBuffer,
+                                                vulkanProgramInfo.particlePipelineLayout,
+                                                VK_SHADER_STAGE_COMPUTE_BIT,
+                                                0,
+                                                sizeof(ParticleParameters),
+                                                &parameters);
+                    dispatch.vkCmdDispatch(cmdBuffer, (parameters.particleCount + 63) / 64, 1, 1);
+
+                    // The compute queue cannot name vertex input, its writes are handed over by the timeline wait
+                    if (onGraphicsQueue)
+                    {
+                        VkBufferMemoryBarrier bufferBarrier{};
+                        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                        bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+                        bufferBarrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+                        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                        bufferBarrier.buffer = particleBuffer;
+                        bufferBarrier.offset = 0;
+                        bufferBarrier.size = VK_WHOLE_SIZE;
+
+                        dispatch.vkCmdPipelineBarrier(cmdBuffer,
+                                                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                                      VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                                                      0,
+                                                      0,
+                                                      nullptr,
+                                                      1,
+                                                      &bufferBarrier,
+                                                      0,
+                                                      nullptr);
+                    }
+                });
+    }
+
+    /**
+     * With readback, create the ring the swapchain images are copied into. One slot more than frames in flight,
+     * so a copy is only dropped if the CPU polls late.
+     */
+    void createReadback()
+    {
+        if (!vulkanProgramInfo.readback)
+        {
+            return;
+        }
+
+        bool created = vulkanProgramInfo.readbackRing.create(vulkanProgramInfo.GPUDevice,
+                                                             &vulkanProgramInfo.dispatch,
+                                                             vulkanProgramInfo.allocator,
+                                                             vulkanProgramInfo.memoryProperties,
+                                                             &vulkanProgramInfo.scheduler,
+                                                             vulkanProgramInfo.graphicsTimeline,
+                                                             vulkanProgramInfo.graphicsQueueFamilyIndex,
+                                                             maxFramesInFlight + 1,
+                                                             [this](const ReadbackRing::Frame &frame)
+                                                             {
+                                                                 consumeReadback(frame);
+                                                             });
+        if (!created)
+        {
+            std::cout << "Failed to create readback ring" << std::endl;
+            exit(-1);
+        }
+
+        resizeReadback();
+        std::cout << "Readback: " << maxFramesInFlight + 1 << " slot(s) in "
+                  << (vulkanProgramInfo.readbackRing.isHostCached() ? "host cached" : "uncached") << " memory"
+                  << std::endl;
+        readbackReportStart = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * Size the readback buffers for the current swapchain
+     */
+    void resizeReadback()
+    {
+        if (!vulkanProgramInfo.readback)
+        {
+            return;
+        }
+
+        if (!vulkanProgramInfo.readbackRing.resize(vulkanProgramInfo.swapchainExtent.width,
+                                                   vulkanProgramInfo.swapchainExtent.height,
+                                                   vulkanProgramInfo.vulkanSwapchainFormat))
+        {
+            std::cout << "Failed to create readback buffers" << std::endl;
+            exit(-1);
+        }
+    }
+
+    /**
+     * Render thread: convert a frame that arrived in host memory straight from the mapped buffer, to RGB or into the
+     * recording, and report readback throughput and latency every five seconds
+     */
+    void consumeReadback(const ReadbackRing::Frame &frame)
+    {
+        auto conversionStart = std::chrono::steady_clock::now();
+        if (vulkanProgramInfo.recording)
+        {
+            recordFrame(frame);
+        } else
+        {
+            readbackPixels.resize((std::size_t) 3 * frame.width * frame.height);
+            for (uint32_t row = 0; row < frame.height; row++)
+            {
+                PixelConversion::toRgb(frame.format,
+                                       frame.pixels + (std::size_t) row * frame.rowPitch,
+                                       readbackPixels.data() + (std::size_t) 3 * row * frame.width,
+                                       frame.width);
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+
+        readbackFrameCount++;
+        readbackBytes += (uint64_t) frame.rowPitch * frame.height;
+        readbackConversionTime += std::chrono::duration<double>(now - conversionStart).count();
+        // Copies recorded after this one, how many frames behind the CPU the readback arrives
+        readbackLatencyFrames += vulkanProgramInfo.readbackRing.getCopyCount() - frame.copyNumber - 1;
+
+        if (now - readbackReportStart >= std::chrono::seconds(5))
+        {
+            reportReadback();
+            readbackReportStart = now;
+        }
+    }
+
+    void reportReadback()
+    {
+        if (readbackFrameCount == 0)
+        {
+            return;
+        }
+
+        std::cout << "Readback: " << readbackFrameCount << " frame(s) arrived "
+                  << (double) readbackLatencyFrames / readbackFrameCount << " frame(s) after submission, "
+                  << vulkanProgramInfo.readbackRing.getDroppedCount() << " dropped in total, conversion "
+                  << 1e3 * readbackConversionTime / readbackFrameCount << " ms per frame ("
+                  << readbackBytes / readbackConversionTime / 1e9 << " GB/s)" << std::endl;
+
+        readbackFrameCount = 0;
+        readbackBytes = 0;
+        readbackConversionTime = 0.0;
+        readbackLatencyFrames = 0;
+    }
+
+    /**
+     * With a record path, open the video at the swapchain extent. A recording has to keep every frame, so the
+     * readback ring waits for a free slot instead of dropping.
+     */
+    void startRecording()
+    {
+        if (options.recordPath.empty() || !vulkanProgramInfo.readback)
+        {
+            return;
+        }
+
+        const std::string rawSuffix = ".rgb";
+        bool raw = options.recordPath.size() >= rawSuffix.size() &&
+                   options.recordPath.compare(options.recordPath.size() - rawSuffix.size(),
+                                              rawSuffix.size(),
+                                              rawSuffix) == 0;
+        // The file declares a fixed rate, the paced rate if there is one
+        double frameRate = options.targetFrameRate > 0.0 ? options.targetFrameRate : 60.0;
+
+        if (!vulkanProgramInfo.videoWriter.start(options.recordPath,
+                                                 raw ? VideoWriter::Format::Rgb24 : VideoWriter::Format::Y4m,
+                                                 vulkanProgramInfo.swapchainExtent.width,
+                                                 vulkanProgramInfo.swapchainExtent.height,
+                                                 frameRate,
+                                                 recordQueueDepth))
+        {
+            std::cout << "Failed to open recording " << options.recordPath << std::endl;
+            exit(-1);
+        }
+        vulkanProgramInfo.readbackRing.setDropWhenFull(false);
+        vulkanProgramInfo.recording = true;
+        std::cout << "Recording " << vulkanProgramInfo.swapchainExtent.width << "x"
+                  << vulkanProgramInfo.swapchainExtent.height << " at " << frameRate << " fps as "
+                  << (raw ? "raw RGB24" : "Y4M") << std::endl;
+    }
+
+    /**
+     * Render thread: convert <frame> into the next buffer of the video writer, row pairs spread over the job system.
+     * The video keeps its first size, frames of another size are skipped.
+     */
+    void recordFrame(const ReadbackRing::Frame &frame)
+    {
+        VideoWriter &videoWriter = vulkanProgramInfo.videoWriter;
+        if (frame.width != videoWriter.getWidth() || frame.height != videoWriter.getHeight())
+        {
+            recordSkippedCount++;
+            return;
+        }
+
+        uint8_t *target = videoWriter.beginFrame();
+        if (videoWriter.getFormat() == VideoWriter::Format::Y4m)
+        {
+            std::size_t lumaSize = (std::size_t) frame.width * frame.height;
+            std::size_t chromaSize = (std::size_t) ((frame.width + 1) / 2) * ((frame.height + 1) / 2);
+            vulkanProgramInfo.jobs.parallelFor(0,
+                                               (frame.height + 1) / 2,
+                                               16,
+                                               [&frame, target, lumaSize, chromaSize](uint32_t first, uint32_t last)
+                                               {
+                                                   PixelConversion::toYuv420(frame.format,
+                                                                             frame.pixels,
+                                                                             frame.rowPitch,
+                                                                             frame.width,
+                                                                             frame.height,
+                                                                             first,
+                                                                             last,
+                                                                             target,
+                                                                             target + lumaSize,
+                                                                             target + lumaSize + chromaSize);
+                                               });
+        } else
+        {
+            vulkanProgramInfo.jobs.parallelFor(0,
+                                               frame.height,
+                                               32,
+                                               [&frame, target](uint32_t first, uint32_t last)
+                                               {
+                                                   for (uint32_t row = first; row < last; row++)
+                                                   {
+                                                       PixelConversion::toRgb(
+                                                               frame.format,
+                                                               frame.pixels + (std::size_t) row * frame.rowPitch,
+                                                               target + (std::size_t) 3 * row * frame.width,
+                                                               frame.width);
+                                                   }
+                                               });
+        }
+        videoWriter.endFrame();
+    }
+
+    /**
+     * Write the frames still queued and close the recording
+     */
+    void stopRecording()
+    {
+        VideoWriter &videoWriter = vulkanProgramInfo.videoWriter;
+        bool written = videoWriter.stop();
+        std::cout << "Recording: " << videoWriter.getWrittenCount() << " frame(s) written, " << recordSkippedCount
+                  << " skipped after a resize, " << videoWriter.getStallTime() * 1e3
+                  << " ms waiting for the output" << std::endl;
+        if (!written)
+        {
+            std::cout << "Failed to write recording " << options.recordPath << std::endl;
+        }
+    }
+
+    /**
+     * Create command pool where command buffers get allocated
+     */
+    void createCmdPool()
+    {
+        VkCommandPoolCreateInfo cmdPoolCreateInfo{};
+        cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolCreateInfo.pNext = nullptr;
+        // Dynamic resolution re-records the command buffer of a single image when the scale changes
+        cmdPoolCreateInfo.flags = vulkanProgramInfo.dynamicResolution ? VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+                                                                      : 0;
+        cmdPoolCreateInfo.queueFamilyIndex = vulkanProgramInfo.graphicsQueueFamilyIndex;
+
+        vkResult = vulkanProgramInfo.dispatch.vkCreateCommandPool(vulkanProgramInfo.GPUDevice,
+                                                                  &cmdPoolCreateInfo,
+                                                                  vulkanProgramInfo.allocator,
+                                                                  &vulkanProgramInfo.cmdPool);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create command pool" << std::endl;
+            exit(-1);
+        }
+
+        allocateCmdBuffers();
+        createTimestampQueries();
+        recordCmdBuffers();
+    }
+
+    /**
+     * Allocate one primary command buffer per swapchain image
+     */
+    void allocateCmdBuffers()
+    {
+		vulkanProgramInfo.cmdBuffers.resize(vulkanProgramInfo.swapchainImages.size());
+        vulkanProgramInfo.imageTimelineValues.assign(vulkanProgramInfo.swapchainImages.size(), 0);
+
+        VkCommandBufferAllocateInfo cmdBufferAllocateInfo{};
+        cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufferAllocateInfo.pNext = nullptr;
+        cmdBufferAllocateInfo.commandBufferCount = (uint32_t) vulkanProgramInfo.swapchainImages.size();
+        cmdBufferAllocateInfo.commandPool = vulkanProgramInfo.cmdPool;
+        cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+        vkResult = vulkanProgramInfo.dispatch.vkAllocateCommandBuffers(vulkanProgramInfo.GPUDevice,
+                                                                       &cmdBufferAllocateInfo,
+                                                                       vulkanProgramInfo.cmdBuffers.data());
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to allocate command buffers" << std::endl;
+            exit(-1);
+        }
+    }
+
+    /**
+     * With dynamic resolution, create a pair of timestamp queries for the command buffer of every swapchain image
+     */
+    void createTimestampQueries()
+    {
+        if (!vulkanProgramInfo.dynamicResolution)
+        {
+            return;
+        }
+
+        VkQueryPoolCreateInfo queryPoolCreateInfo{};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCreateInfo.queryCount = 2 * (uint32_t) vulkanProgramInfo.swapchainImages.size();
+
+        vkResult = vkCreateQueryPool(vulkanProgramInfo.GPUDevice,
+                                     &queryPoolCreateInfo,
+                                     vulkanProgramInfo.allocator,
+                                     &vulkanProgramInfo.timestampQueryPool);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create timestamp query pool" << std::endl;
+            exit(-1);
+        }
+
+        vulkanProgramInfo.recordedScales.assign(vulkanProgramInfo.swapchainImages.size(), 0.0);
+    }
+
+    /**
+     * Record the draw commands for every swapchain image
+     */
+    void recordCmdBuffers()
+    {
+        for (std::size_t i = 0; i < vulkanProgramInfo.cmdBuffers.size(); i++)
+        {
+            recordCmdBuffer(i);
+        }
+    }
+
+    /**
+     * Record the draw commands for swapchain image <imageIndex>, at the current dynamic resolution scale
+     */
+    void recordCmdBuffer(std::size_t imageIndex)
+    {
+        VkCommandBuffer cmdBuffer = vulkanProgramInfo.cmdBuffers[imageIndex];
+
+        VkCommandBufferBeginInfo bufferBeginInfo{};
+        bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+        vkResult = vulkanProgramInfo.dispatch.vkBeginCommandBuffer(cmdBuffer, &bufferBeginInfo);
+
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to begin command buffer" << std::endl;
+            exit(-1);
+        }
+
+        double scale = vulkanProgramInfo.dynamicResolution ? vulkanProgramInfo.resolutionScaler.getScale() : 1.0;
+        vulkanProgramInfo.renderExtent = getRenderExtent(scale);
+
+        VkQueryPool timestampQueryPool = vulkanProgramInfo.timestampQueryPool;
+        uint32_t firstQuery = 2 * (uint32_t) imageIndex;
+        if (timestampQueryPool != VK_NULL_HANDLE)
+        {
+            vulkanProgramInfo.dispatch.vkCmdResetQueryPool(cmdBuffer, timestampQueryPool, firstQuery, 2);
+            vulkanProgramInfo.dispatch.vkCmdWriteTimestamp(cmdBuffer,
+                                                           VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                                           timestampQueryPool,
+                                                           firstQuery);
+        }
+
+        if (vulkanProgramInfo.capabilities.dynamicRendering)
+        {
+            // The frame graph records the layout transitions around the passes
+            vulkanProgramInfo.frameGraph.bindImage(vulkanProgramInfo.backbufferResource,
+                                                   vulkanProgramInfo.swapchainImages[imageIndex],
+                                                   vulkanProgramInfo.imageViews[imageIndex]);
+            vulkanProgramInfo.frameGraph.bindBuffer(vulkanProgramInfo.particleResource,
+                                                    vulkanProgramInfo.particleBuffers[imageIndex]);
+            vulkanProgramInfo.frameGraph.record(cmdBuffer, vulkanProgramInfo.dispatch);
+        } else
+        {
+            beginRenderPass(cmdBuffer, imageIndex);
+            drawScene(cmdBuffer,
+                      vulkanProgramInfo.particleBuffers[imageIndex],
+                      options.particleCount,
+                      vulkanProgramInfo.renderExtent);
+            vulkanProgramInfo.dispatch.vkCmdEndRenderPass(cmdBuffer);
+        }
+
+        if (timestampQueryPool != VK_NULL_HANDLE)
+        {
+            vulkanProgramInfo.dispatch.vkCmdWriteTimestamp(cmdBuffer,
+                                                           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                                           timestampQueryPool,
+                                                           firstQuery + 1);
+        }
+
+        vkResult = vulkanProgramInfo.dispatch.vkEndCommandBuffer(cmdBuffer);
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to record command buffer" << std::endl;
+            exit(-1);
+        }
+
+        if (vulkanProgramInfo.dynamicResolution)
+        {
+            vulkanProgramInfo.recordedScales[imageIndex] = scale;
+        }
+    }
+
+    /**
+     * Legacy path: begin the render pass on the framebuffer of swapchain image <imageIndex>
+     */
+    void beginRenderPass(VkCommandBuffer cmdBuffer, std::size_t imageIndex) const
+    {
+        VkRenderPassBeginInfo renderPassBeginInfo{};
+        renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassBeginInfo.renderPass = vulkanProgramInfo.renderPass;
+        renderPassBeginInfo.framebuffer = vulkanProgramInfo.swapchainFramebuffers[imageIndex];
+        renderPassBeginInfo.renderArea.offset = {0, 0};
+        renderPassBeginInfo.renderArea.extent = vulkanProgramInfo.swapchainExtent;
+        // Indexed by attachment, the resolve attachment is not cleared
+        VkClearValue clearValues[3]{};
+        clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+        clearValues[1].depthStencil = {1.0f, 0};
+        renderPassBeginInfo.clearValueCount = 2;
+        renderPassBeginInfo.pClearValues = clearValues;
+
+        vulkanProgramInfo.dispatch.vkCmdBeginRenderPass(cmdBuffer,
+                                                        &renderPassBeginInfo,
+                                                        VK_SUBPASS_CONTENTS_INLINE);
+    }
+
+    /**
+     * Dynamic rendering path: build and compile the frame graph, then allocate its transient resources.
+     * The swapchain image enters undefined at the acquire semaphore wait stage and leaves ready for presentation,
+     * the image actually rendered to is bound per command buffer in <recordCmdBuffers>.
+     */
+    void buildFrameGraph()
+    {
+        RenderGraph &frameGraph = vulkanProgramInfo.frameGraph;
+        frameGraph = RenderGraph{};
+
+        RenderGraph::ResourceHandle backbuffer =
+                frameGraph.importImage("backbuffer",
+                                       vulkanProgramInfo.swapchainImages[0],
+                                       vulkanProgramInfo.imageViews[0],
+                                       VK_IMAGE_ASPECT_COLOR_BIT,
+                                       VK_IMAGE_LAYOUT_UNDEFINED,
+                                       VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR);
+        frameGraph.setFinalUsage(backbuffer, ResourceUsage::Present);
+        vulkanProgramInfo.backbufferResource = backbuffer;
+
+        // The transient attachments are discarded every frame, so they too start undefined. Their initial
+        // stages order this frame's clear after the previous frame's use.
+        bool multisampled = vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+        if (multisampled)
+        {
+            vulkanProgramInfo.msaaColorResource =
+                    frameGraph.importImage("msaaColor",
+                                           vulkanProgramInfo.msaaColorAttachment.image,
+                                           vulkanProgramInfo.msaaColorAttachment.imageView,
+                                           VK_IMAGE_ASPECT_COLOR_BIT,
+                                           VK_IMAGE_LAYOUT_UNDEFINED,
+                                           VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR);
+        }
+        vulkanProgramInfo.depthResource =
+                frameGraph.importImage("depth",
+                                       vulkanProgramInfo.depthAttachment.image,
+                                       vulkanProgramInfo.depthAttachment.imageView,
+                                       depthAspectMask(),
+                                       VK_IMAGE_LAYOUT_UNDEFINED,
+                                       VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR |
+                                       VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR);
+
+        // Written by the particle update outside the graph. The timeline semaphore wait, or the update's own
+        // barrier on the graphics queue, already made it visible to vertex input.
+        RenderGraph::ResourceHandle particles =
+                frameGraph.importBuffer("particles",
+                                        vulkanProgramInfo.particleBuffers[0],
+                                        VK_PIPELINE_STAGE_2_NONE_KHR);
+        vulkanProgramInfo.particleResource = particles;
+
+        RenderGraph::ResourceHandle msaaColor = vulkanProgramInfo.msaaColorResource;
+        RenderGraph::ResourceHandle depth = vulkanProgramInfo.depthResource;
+
+        // With dynamic resolution the scene goes to an offscreen target of the full swapchain extent, so a new
+        // scale only needs the command buffers re-recorded, never new memory
+        RenderGraph::ResourceHandle sceneColor = backbuffer;
+        if (vulkanProgramInfo.dynamicResolution)
+        {
+            VkImageCreateInfo sceneCreateInfo{};
+            sceneCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            sceneCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+            sceneCreateInfo.format = vulkanProgramInfo.vulkanSwapchainFormat;
+            sceneCreateInfo.extent = {vulkanProgramInfo.swapchainExtent.width,
+                                      vulkanProgramInfo.swapchainExtent.height,
+                                      1};
+            sceneCreateInfo.mipLevels = 1;
+            sceneCreateInfo.arrayLayers = 1;
+            sceneCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            sceneCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            sceneCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            sceneCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            sceneCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            sceneColor = frameGraph.createImage("scene", sceneCreateInfo, VK_IMAGE_ASPECT_COLOR_BIT);
+        }
+        vulkanProgramInfo.sceneResource = sceneColor;
+
+        RenderGraph::PassHandle trianglePass =
+                frameGraph.addPass("triangle",
+                                   [this, sceneColor, msaaColor, depth, particles, multisampled](
+                                           VkCommandBuffer cmdBuffer,
+                                           const RenderGraph &graph)
+                                   {
+                                       beginDynamicRendering(cmdBuffer,
+                                                             graph.getImageView(sceneColor),
+                                                             multisampled ? graph.getImageView(msaaColor)
+                                                                          : VK_NULL_HANDLE,
+                                                             graph.getImageView(depth),
+                                                             vulkanProgramInfo.renderExtent);
+                                       drawScene(cmdBuffer,
+                                                 graph.getBuffer(particles),
+                                                 options.particleCount,
+                                                 vulkanProgramInfo.renderExtent);
+                                       vulkanProgramInfo.dispatch.vkCmdEndRenderingKHR(cmdBuffer);
+                                   });
+        frameGraph.reads(trianglePass, particles, ResourceUsage::VertexBufferRead);
+        frameGraph.writes(trianglePass, sceneColor, ResourceUsage::ColorAttachmentWrite);
+        frameGraph.writes(trianglePass, depth, ResourceUsage::DepthStencilAttachmentWrite);
+        if (multisampled)
+        {
+            frameGraph.writes(trianglePass, msaaColor, ResourceUsage::ColorAttachmentWrite);
+        }
+
+        if (vulkanProgramInfo.dynamicResolution)
+        {
+            RenderGraph::PassHandle upscalePass =
+                    frameGraph.addPass("upscale",
+                                       [this, sceneColor, backbuffer](VkCommandBuffer cmdBuffer,
+                                                                      const RenderGraph &graph)
+                                       {
+                                           recordUpscale(cmdBuffer,
+                                                         graph.getImage(sceneColor),
+                                                         graph.getImage(backbuffer));
+                                       });
+            frameGraph.reads(upscalePass, sceneColor, ResourceUsage::TransferRead);
+            frameGraph.writes(upscalePass, backbuffer, ResourceUsage::TransferWrite);
+        }
+
+        frameGraph.compile();
+
+        VkPhysicalDeviceProperties physicalDeviceProperties{};
+        vkGetPhysicalDeviceProperties(vulkanProgramInfo.chosenGPU, &physicalDeviceProperties);
+        frameGraph.setBufferImageGranularity(physicalDeviceProperties.limits.bufferImageGranularity);
+
+        bool allocated = frameGraph.allocateTransients(
+                vulkanProgramInfo.GPUDevice,
+                vulkanProgramInfo.allocator,
+                [this](const VkMemoryRequirements &memoryRequirements)
+                {
+                    return findMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                });
+
+        if (!allocated)
+        {
+            std::cout << "Failed to allocate frame graph transient resources" << std::endl;
+            exit(-1);
+        }
 
-        vkGetPhysicalDeviceQueueFamilyProperties(vulkanProgramInfo.chosenGPU,
-                                                 &queueFamilyCount,
-                                                 queueFamilyPropertiesList.data());
+        const RenderGraph::MemoryReport &memoryReport = frameGraph.getMemoryReport();
+        std::cout << "Frame graph " << vulkanProgramInfo.swapchainExtent.width << "x"
+                  << vulkanProgramInfo.swapchainExtent.height << ": "
+                  << memoryReport.transientCount << " transient(s), "
+                  << memoryReport.naiveBytes << " bytes naive, "
+                  << memoryReport.aliasedBytes << " bytes aliased, "
+                  << (memoryReport.naiveBytes - memoryReport.aliasedBytes) << " bytes saved, "
+                  << memoryReport.aliasingBarrierCount << " aliasing barrier(s)" << std::endl;
+    }
 
-        uint32_t graphicsQueueFamilyIndex = -1;
-        // Choose the first queue family that supports graphics and presentation
-        VkBool32 presentationSupport = VK_FALSE;
-        bool foundQueue = false;
+    /**
+     * Print the latency percentiles of the timed presents and write every sample to <options.latencyCsvPath>
+     */
+    void reportPresentTiming() const
+    {
+        vulkanProgramInfo.presentWatcher.writeReport(std::cout);
 
-        for (uint32_t queueFamilyIndex = 0; queueFamilyIndex < queueFamilyPropertiesList.size(); queueFamilyIndex++)
+        if (!options.latencyCsvPath.empty() && !vulkanProgramInfo.presentWatcher.writeCsv(options.latencyCsvPath))
         {
-            vkGetPhysicalDeviceSurfaceSupportKHR(vulkanProgramInfo.chosenGPU,
-                                                 queueFamilyIndex,
-                                                 vulkanProgramInfo.vulkanSurface,
-                                                 &presentationSupport);
+            std::cout << "Failed to write " << options.latencyCsvPath << std::endl;
+        }
+    }
 
-            if (queueFamilyPropertiesList[queueFamilyIndex].queueFlags & VK_QUEUE_GRAPHICS_BIT &&
-                presentationSupport == VK_TRUE)
+    /**
+     * Write the compiled frame graph as DOT to <options.graphDumpPath>
+     */
+    void dumpFrameGraph() const
+    {
+        const RenderGraph &frameGraph = vulkanProgramInfo.frameGraph;
+
+        std::ofstream dotFile(options.graphDumpPath);
+        if (!dotFile.is_open())
+        {
+            std::cout << "Failed to open " << options.graphDumpPath << std::endl;
+            return;
+        }
+
+        frameGraph.writeDot(dotFile);
+        std::cout << "Frame graph written to " << options.graphDumpPath << " ("
+                  << frameGraph.getSchedule().size() << " pass(es), "
+                  << frameGraph.getBarrierCount() << " barrier(s))" << std::endl;
+    }
+
+    /**
+     * Dynamic rendering path: begin rendering the <renderArea> corner of <colorImageView>, or with MSAA render into
+     * <msaaImageView> and resolve into <colorImageView>. The images are already in attachment layouts.
+     */
+    void beginDynamicRendering(VkCommandBuffer cmdBuffer,
+                               VkImageView colorImageView,
+                               VkImageView msaaImageView,
+                               VkImageView depthImageView,
+                               VkExtent2D renderArea) const
+    {
+        VkRenderingAttachmentInfoKHR colorAttachment{};
+        colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.clearValue = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+
+        if (msaaImageView != VK_NULL_HANDLE)
+        {
+            colorAttachment.imageView = msaaImageView;
+            colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+            colorAttachment.resolveImageView = colorImageView;
+            colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        } else
+        {
+            colorAttachment.imageView = colorImageView;
+            colorAttachment.resolveMode = VK_RESOLVE_MODE_NONE;
+            colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        }
+
+        VkRenderingAttachmentInfoKHR depthAttachment{};
+        depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+        depthAttachment.imageView = depthImageView;
+        depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depthAttachment.resolveMode = VK_RESOLVE_MODE_NONE;
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment.clearValue.depthStencil = {1.0f, 0};
+
+        VkRenderingInfoKHR renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+        renderingInfo.renderArea.offset = {0, 0};
+        renderingInfo.renderArea.extent = renderArea;
+        renderingInfo.layerCount = 1;
+        renderingInfo.colorAttachmentCount = 1;
+        renderingInfo.pColorAttachments = &colorAttachment;
+        renderingInfo.pDepthAttachment = &depthAttachment;
+
+        vulkanProgramInfo.dispatch.vkCmdBeginRenderingKHR(cmdBuffer, &renderingInfo);
+    }
+
+    /**
+     * Bind the graphics pipeline and draw the triangle and the first <particleCount> particles in <particleBuffer>
+     * over <extent> inside the current render pass or rendering scope, with every vertex moved by <transform>
+     */
+    void drawScene(VkCommandBuffer cmdBuffer,
+                   VkBuffer particleBuffer,
+                   uint32_t particleCount,
+                   VkExtent2D extent,
+                   const SceneTransform &transform = SceneTransform{{1.0f, 1.0f}, {0.0f, 0.0f}}) const
+    {
+        vulkanProgramInfo.dispatch.vkCmdBindPipeline(cmdBuffer,
+                                                     VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                                     vulkanProgramInfo.graphicsPipeline);
+
+        setDynamicStates(cmdBuffer, extent);
+        vulkanProgramInfo.dispatch.vkCmdPushConstants(cmdBuffer,
+                                                      vulkanProgramInfo.pipelineLayout,
+                                                      VK_SHADER_STAGE_VERTEX_BIT,
+                                                      0,
+                                                      sizeof(SceneTransform),
+                                                      &transform);
+
+        VkDeviceSize vertexBufferOffset = 0;
+        vulkanProgramInfo.dispatch.vkCmdBindVertexBuffers(cmdBuffer,
+                                                          0,
+                                                          1,
+                                                          &vulkanProgramInfo.vertexBuffer,
+                                                          &vertexBufferOffset);
+
+        vulkanProgramInfo.dispatch.vkCmdDraw(cmdBuffer,
+                                             3,
+                                             1,
+                                             0,
+                                             0);
+        if (particleCount == 0)
+        {
+            return;
+        }
+
+        // Same vertex layout, the particle update writes whole triangles
+        vulkanProgramInfo.dispatch.vkCmdBindVertexBuffers(cmdBuffer,
+                                                          0,
+                                                          1,
+                                                          &particleBuffer,
+                                                          &vertexBufferOffset);
+
+        vulkanProgramInfo.dispatch.vkCmdDraw(cmdBuffer,
+                                             3 * particleCount,
+                                             1,
+                                             0,
+                                             0);
+    }
+
+    /**
+     * Set the states the graphics pipeline left dynamic, viewport and scissor covering <extent>. Must follow
+     * <vkCmdBindPipeline>.
+     */
+    void setDynamicStates(VkCommandBuffer cmdBuffer, VkExtent2D extent) const
+    {
+        VkViewport viewport{};
+        viewport.width = (float) extent.width;
+        viewport.height = (float) extent.height;
+        viewport.x = 0;
+        viewport.y = 0;
+        viewport.maxDepth = 1.0f;
+        viewport.minDepth = 0.0f;
+
+        VkRect2D scissor{};
+        scissor.offset = {0, 0};
+        scissor.extent = extent;
+
+        if (vulkanProgramInfo.capabilities.extendedDynamicState)
+        {
+            // Viewport count is dynamic too, so multi-viewport rendering does not need another pipeline
+            vulkanProgramInfo.dispatch.vkCmdSetViewportWithCountEXT(cmdBuffer, 1, &viewport);
+            vulkanProgramInfo.dispatch.vkCmdSetScissorWithCountEXT(cmdBuffer, 1, &scissor);
+            vulkanProgramInfo.dispatch.vkCmdSetCullModeEXT(cmdBuffer, VK_CULL_MODE_NONE);
+            vulkanProgramInfo.dispatch.vkCmdSetFrontFaceEXT(cmdBuffer, VK_FRONT_FACE_CLOCKWISE);
+            vulkanProgramInfo.dispatch.vkCmdSetPrimitiveTopologyEXT(cmdBuffer, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        } else
+        {
+            vulkanProgramInfo.dispatch.vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+            vulkanProgramInfo.dispatch.vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+        }
+    }
+
+    /**
+     * Blit the <renderExtent> corner of <sceneImage> over the whole of <swapchainImage>
+     */
+    void recordUpscale(VkCommandBuffer cmdBuffer, VkImage sceneImage, VkImage swapchainImage) const
+    {
+        VkImageBlit region{};
+        region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.srcOffsets[1] = {(int32_t) vulkanProgramInfo.renderExtent.width,
+                                (int32_t) vulkanProgramInfo.renderExtent.height,
+                                1};
+        region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.dstOffsets[1] = {(int32_t) vulkanProgramInfo.swapchainExtent.width,
+                                (int32_t) vulkanProgramInfo.swapchainExtent.height,
+                                1};
+
+        vulkanProgramInfo.dispatch.vkCmdBlitImage(cmdBuffer,
+                                                  sceneImage,
+                                                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                                  swapchainImage,
+                                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                                  1,
+                                                  &region,
+                                                  vulkanProgramInfo.upscaleFilter);
+    }
+
+    /**
+     * Swapchain extent scaled by <scale>, at least one pixel
+     */
+    VkExtent2D getRenderExtent(double scale) const
+    {
+        const VkExtent2D &swapchainExtent = vulkanProgramInfo.swapchainExtent;
+        return {std::max(1u, (uint32_t) std::lround(scale * swapchainExtent.width)),
+                std::max(1u, (uint32_t) std::lround(scale * swapchainExtent.height))};
+    }
+
+    /**
+     * Poster mode, render thread: render one <options.posterWidth> x <options.posterHeight> image with
+     * <renderTiledImage> and report how long it took
+     */
+    void renderPoster()
+    {
+        if (!canRenderTiled())
+        {
+            std::cout << "Poster: needs dynamic rendering and an 8-bit RGBA or BGRA swapchain format" << std::endl;
+            return;
+        }
+        createTileRenderer();
+
+        float time = std::chrono::duration<float>(std::chrono::steady_clock::now() -
+                                                  vulkanProgramInfo.startTime).count();
+        auto posterStart = std::chrono::steady_clock::now();
+        bool written = renderTiledImage(options.posterPath,
+                                        options.posterWidth,
+                                        options.posterHeight,
+                                        options.particleCount,
+                                        time);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - posterStart).count();
+
+        std::cout << "Poster: " << options.posterWidth << "x" << options.posterHeight << " in " << seconds * 1e3
+                  << " ms, " << (double) options.posterWidth * options.posterHeight / seconds / 1e6
+                  << " Mpixel/s, host memory " << tiledImage.band.capacity() / 1024 / 1024 << " MiB of tile rows and "
+                  << tileReadbackSize() / 1024 / 1024 << " MiB of readback slots" << std::endl;
+        if (!written)
+        {
+            std::cout << "Failed to write " << options.posterPath << std::endl;
+        }
+
+        destroyTileRenderer();
+    }
+
+    /**
+     * Batch service mode, render thread: render the jobs dropped into the spool directory <options.servePath> one
+     * after the other, with the device, pipelines and tile renderer of this process, until the window is closed or
+     * a file named "stop" appears in the spool directory.
+     *
+     * A job is a text file ending in ".job" with one key=value per line: width, height, output, optionally frames
+     * (1), fps (60) and scene (particles or triangle). Clients should write it under another name and rename it,
+     * so it is never read half written. The service renames it to ".running" while it renders and to ".done" or
+     * ".failed" after, and appends a line with its timing to timings.csv in the spool directory.
+     */
+    void runBatchService()
+    {
+        const std::filesystem::path spoolDirectory(options.servePath);
+        std::error_code error{};
+        if (!std::filesystem::is_directory(spoolDirectory, error))
+        {
+            std::cout << "Batch service: " << options.servePath << " is not a directory" << std::endl;
+            return;
+        }
+        if (!canRenderTiled())
+        {
+            std::cout << "Batch service: needs dynamic rendering and an 8-bit RGBA or BGRA swapchain format"
+                      << std::endl;
+            return;
+        }
+
+        createTileRenderer();
+        std::cout << "Batch service: waiting for jobs in " << options.servePath << std::endl;
+
+        uint64_t jobCount = 0;
+        while (processRenderEvents())
+        {
+            if (std::filesystem::remove(spoolDirectory / "stop", error))
             {
-                graphicsQueueFamilyIndex = queueFamilyIndex;
-                foundQueue = true;
                 break;
             }
+
+            // Jobs run in name order
+            std::vector<std::filesystem::path> jobFiles{};
+            for (const std::filesystem::directory_entry &entry:
+                    std::filesystem::directory_iterator(spoolDirectory, error))
+            {
+                if (entry.is_regular_file(error) && entry.path().extension() == ".job")
+                {
+                    jobFiles.push_back(entry.path());
+                }
+            }
+            if (jobFiles.empty())
+            {
+                waitForRenderEvents(std::chrono::milliseconds(250));
+                continue;
+            }
+
+            std::sort(jobFiles.begin(), jobFiles.end());
+            runBatchJob(jobFiles.front());
+            jobCount++;
         }
 
-        if (!foundQueue)
+        destroyTileRenderer();
+        std::cout << "Batch service: " << jobCount << " job(s) run" << std::endl;
+    }
+
+    /**
+     * A job of the batch service as read from its job file
+     */
+    struct BatchJob
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t frameCount = 1;
+        double frameRate = 60.0;
+        std::string scene = "particles";
+        std::filesystem::path outputPath{};
+    };
+
+    /**
+     * Read the job in <jobFile>, output paths relative to the spool directory and never leaving it. Returns an error
+     * message naming the offending key and value, empty if the job is valid.
+     */
+    std::string readBatchJob(const std::filesystem::path &jobFile, BatchJob &job) const
+    {
+        std::ifstream file(jobFile);
+        if (!file)
         {
-            std::cout << "Failed to find queue that satisfy requirements" << std::endl;
+            return "cannot read job file";
+        }
+
+        std::string line{};
+        while (std::getline(file, line))
+        {
+            std::size_t separator = line.find('=');
+            if (line.empty() || line[0] == '#' || separator == std::string::npos)
+            {
+                continue;
+            }
+            std::string key = line.substr(0, separator);
+            std::string value = line.substr(separator + 1);
+            bool parsed = true;
+            if (key == "width")
+            {
+                parsed = parseJobInteger(value, job.width);
+            } else if (key == "height")
+            {
+                parsed = parseJobInteger(value, job.height);
+            } else if (key == "frames")
+            {
+                parsed = parseJobInteger(value, job.frameCount);
+            } else if (key == "fps")
+            {
+                parsed = parseJobNumber(value, job.frameRate);
+            } else if (key == "scene")
+            {
+                job.scene = value;
+            } else if (key == "output")
+            {
+                // Jobs may only write into the spool directory
+                std::filesystem::path output(value);
+                if (output.has_root_path() ||
+                    std::any_of(output.begin(), output.end(), [](const std::filesystem::path &segment)
+                    {
+                        return segment == "..";
+                    }))
+                {
+                    return "output " + value + " is outside the spool directory";
+                }
+                job.outputPath = jobFile.parent_path() / output;
+            } else
+            {
+                return "unknown key " + key;
+            }
+
+            if (!parsed)
+            {
+                return "invalid " + key + " " + value;
+            }
+        }
+
+        if (job.width == 0 || job.height == 0 || job.frameCount == 0 || job.frameRate <= 0.0)
+        {
+            return "width, height, frames and fps have to be positive";
+        }
+        if (job.scene != "particles" && job.scene != "triangle")
+        {
+            return "unknown scene " + job.scene;
+        }
+        if (job.outputPath.empty() || !job.outputPath.has_filename())
+        {
+            return "no output file";
+        }
+
+        // Checked before anything is allocated, an oversized job fails instead of taking the service down
+        std::string sizeError = checkTiledImageSize(job.outputPath.string(), job.width, job.height);
+        if (!sizeError.empty())
+        {
+            return "invalid size " + std::to_string(job.width) + "x" + std::to_string(job.height) + ", " + sizeError;
+        }
+        return {};
+    }
+
+    /**
+     * Parse all of <value> as a decimal unsigned integer that fits <result>
+     */
+    static bool parseJobInteger(const std::string &value, uint32_t &result)
+    {
+        const char *end = value.data() + value.size();
+        std::from_chars_result parsed = std::from_chars(value.data(), end, result);
+        return parsed.ec == std::errc() && parsed.ptr == end;
+    }
+
+    /**
+     * Parse all of <value> as a finite floating point number
+     */
+    static bool parseJobNumber(const std::string &value, double &result)
+    {
+        if (value.empty() || std::isspace((unsigned char) value[0]))
+        {
+            return false;
+        }
+        char *end = nullptr;
+        errno = 0;
+        result = std::strtod(value.c_str(), &end);
+        return errno == 0 && end == value.c_str() + value.size() && std::isfinite(result);
+    }
+
+    /**
+     * <field> as a CSV field, quoted with embedded quotes doubled if it holds a comma, quote or line break
+     */
+    static std::string csvField(const std::string &field)
+    {
+        if (field.find_first_of(",\"\r\n") == std::string::npos)
+        {
+            return field;
+        }
+        std::string quoted = "\"";
+        for (char character: field)
+        {
+            quoted += character;
+            if (character == '"')
+            {
+                quoted += '"';
+            }
+        }
+        return quoted + "\"";
+    }
+
+    /**
+     * Claim, render and retire the job in <jobFile>, and append its timing to timings.csv
+     */
+    void runBatchJob(const std::filesystem::path &jobFile)
+    {
+        std::filesystem::path runningFile = jobFile;
+        runningFile.replace_extension(".running");
+        std::error_code renameError{};
+        std::filesystem::rename(jobFile, runningFile, renameError);
+        if (renameError)
+        {
+            // Unclaimable, drop it from the spool rather than retrying it forever
+            std::filesystem::remove(jobFile, renameError);
+            return;
+        }
+
+        std::string name = jobFile.stem().string();
+        BatchJob job{};
+        std::string error = readBatchJob(runningFile, job);
+        std::cout << "Batch service: job " << name << std::endl;
+
+        auto jobStart = std::chrono::steady_clock::now();
+        uint32_t framesWritten = 0;
+        for (uint32_t frame = 0; frame < job.frameCount && error.empty(); frame++)
+        {
+            // Several frames go to numbered files, out.png becomes out_0000.png, out_0001.png, ...
+            std::filesystem::path framePath = job.outputPath;
+            if (job.frameCount > 1)
+            {
+                std::string number = std::to_string(frame);
+                number.insert(0, number.size() < 4 ? 4 - number.size() : 0, '0');
+                framePath.replace_filename(job.outputPath.stem().string() + "_" + number +
+                                           job.outputPath.extension().string());
+            }
+
+            if (!renderTiledImage(framePath.string(),
+                                  job.width,
+                                  job.height,
+                                  job.scene == "particles" ? options.particleCount : 0,
+                                  (float) (frame / job.frameRate)))
+            {
+                error = "failed to write " + framePath.string();
+                break;
+            }
+            framesWritten++;
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                         jobStart).count();
+
+        std::filesystem::path retiredFile = jobFile;
+        retiredFile.replace_extension(error.empty() ? ".done" : ".failed");
+        std::filesystem::rename(runningFile, retiredFile, renameError);
+
+        std::filesystem::path timingPath = jobFile.parent_path() / "timings.csv";
+        bool newTimingFile = !std::filesystem::exists(timingPath, renameError);
+        std::ofstream timingFile(timingPath, std::ios::app);
+        if (newTimingFile)
+        {
+            timingFile << "job,status,width,height,frames,total_ms,ms_per_frame,mpixels_per_s,error" << std::endl;
+        }
+        double pixels = (double) job.width * job.height * framesWritten;
+        timingFile << csvField(name) << "," << (error.empty() ? "done" : "failed") << "," << job.width << ","
+                   << job.height
+                   << "," << framesWritten << "," << milliseconds << ","
+                   << (framesWritten != 0 ? milliseconds / framesWritten : 0.0) << ","
+                   << (milliseconds > 0.0 ? pixels / milliseconds / 1e3 : 0.0) << "," << csvField(error) << std::endl;
+
+        std::cout << "Batch service: job " << name << " " << (error.empty() ? "done" : "failed: " + error) << ", "
+                  << framesWritten << " frame(s) in " << milliseconds << " ms" << std::endl;
+    }
+
+    /**
+     * Tiles are drawn with dynamic rendering and read back through <PixelConversion>
+     */
+    bool canRenderTiled() const
+    {
+        return vulkanProgramInfo.capabilities.dynamicRendering &&
+               PixelConversion::bytesPerPixel(vulkanProgramInfo.vulkanSwapchainFormat) != 0;
+    }
+
+    /**
+     * Create what <renderTiledImage> renders with: the largest tile target, its readback ring and one command
+     * buffer per readback slot. All of it is reused by every image.
+     */
+    void createTileRenderer()
+    {
+        VkPhysicalDeviceProperties physicalDeviceProperties{};
+        vkGetPhysicalDeviceProperties(vulkanProgramInfo.chosenGPU, &physicalDeviceProperties);
+        uint32_t maxDimension = physicalDeviceProperties.limits.maxImageDimension2D;
+        tileTarget = createTileTarget({std::min(posterTileWidth, maxDimension),
+                                       std::min(posterTileHeight, maxDimension)});
+
+        uint32_t slotCount = maxFramesInFlight + 1;
+        bool created = tileReadback.create(vulkanProgramInfo.GPUDevice,
+                                           &vulkanProgramInfo.dispatch,
+                                           vulkanProgramInfo.allocator,
+                                           vulkanProgramInfo.memoryProperties,
+                                           &vulkanProgramInfo.scheduler,
+                                           vulkanProgramInfo.graphicsTimeline,
+                                           vulkanProgramInfo.graphicsQueueFamilyIndex,
+                                           slotCount,
+                                           [this](const ReadbackRing::Frame &frame)
+                                           {
+                                               storeTile(frame);
+                                           });
+        if (!created)
+        {
+            std::cout << "Failed to create tile readback" << std::endl;
             exit(-1);
         }
-        vulkanProgramInfo.graphicsQueueFamilyIndex = graphicsQueueFamilyIndex;
+        tileReadback.setDropWhenFull(false);
+        tileReadbackExtent = {};
 
-        VkDeviceQueueCreateInfo queueCreateInfo{};
-        queueCreateInfo.queueFamilyIndex = graphicsQueueFamilyIndex;
-        queueCreateInfo.queueCount = 1;
-        queueCreateInfo.flags = 0;
-        queueCreateInfo.pNext = nullptr;
-        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        VkCommandPoolCreateInfo cmdPoolCreateInfo{};
+        cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        cmdPoolCreateInfo.queueFamilyIndex = vulkanProgramInfo.graphicsQueueFamilyIndex;
+
+        vkResult = vulkanProgramInfo.dispatch.vkCreateCommandPool(vulkanProgramInfo.GPUDevice,
+                                                                  &cmdPoolCreateInfo,
+                                                                  vulkanProgramInfo.allocator,
+                                                                  &tileCmdPool);
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to create tile command pool" << std::endl;
+            exit(-1);
+        }
 
-        float queuePriority = 1.0f;
-        queueCreateInfo.pQueuePriorities = &queuePriority;
+        tileCmdBuffers.resize(slotCount);
+        tileValues.assign(slotCount, 0);
+        VkCommandBufferAllocateInfo cmdBufferAllocateInfo{};
+        cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        cmdBufferAllocateInfo.commandPool = tileCmdPool;
+        cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdBufferAllocateInfo.commandBufferCount = slotCount;
+        vkResult = vulkanProgramInfo.dispatch.vkAllocateCommandBuffers(vulkanProgramInfo.GPUDevice,
+                                                                       &cmdBufferAllocateInfo,
+                                                                       tileCmdBuffers.data());
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to allocate tile command buffers" << std::endl;
+            exit(-1);
+        }
+    }
 
-        VkDeviceCreateInfo deviceCreateInfo{};
+    /**
+     * Free the tile renderer, nothing of it may still be in flight
+     */
+    void destroyTileRenderer()
+    {
+        vulkanProgramInfo.dispatch.vkDestroyCommandPool(vulkanProgramInfo.GPUDevice,
+                                                        tileCmdPool,
+                                                        vulkanProgramInfo.allocator);
+        tileCmdPool = VK_NULL_HANDLE;
+        tileCmdBuffers.clear();
+        destroyTileTarget(tileTarget);
+        tileReadback.destroy();
+        tiledImage = TiledImage{};
+    }
+
+    /**
+     * Host memory of the readback slots
+     */
+    std::size_t tileReadbackSize() const
+    {
+        return (std::size_t) tileCmdBuffers.size() * 4 * tileReadbackExtent.width * tileReadbackExtent.height;
+    }
+
+    /**
+     * Render a <width> x <height> image of the scene, with <particleCount> particles at animation time <time>, tile
+     * by tile into the tile target and stream it to <path>. Returns once the file is complete, false if it could
+     * not be written.
+     *
+     * Every tile draws the whole scene with a transform that maps the tile's part of the image onto the target, so
+     * the image may exceed maxImageDimension2D and the viewport limits. Tiles are read back asynchronously while the
+     * next ones render. A row of tiles is assembled in host memory and written once its last tile arrived, so host
+     * memory stays at one row of tiles plus the readback slots however tall the image is.
+     */
+    bool renderTiledImage(const std::string &path, uint32_t width, uint32_t height, uint32_t particleCount, float time)
+    {
+        VkExtent2D tileExtent{std::min(width, tileTarget.extent.width), std::min(height, tileTarget.extent.height)};
+        uint32_t columnCount = (uint32_t) (((uint64_t) width + tileExtent.width - 1) / tileExtent.width);
+        uint32_t tileRowCount = (uint32_t) (((uint64_t) height + tileExtent.height - 1) / tileExtent.height);
+        uint64_t tileCount = (uint64_t) columnCount * tileRowCount;
+
+        // Only a different tile size needs new readback buffers
+        if (tileExtent.width != tileReadbackExtent.width || tileExtent.height != tileReadbackExtent.height)
+        {
+            if (!tileReadback.resize(tileExtent.width, tileExtent.height, vulkanProgramInfo.vulkanSwapchainFormat))
+            {
+                std::cout << "Failed to create tile readback buffers" << std::endl;
+                exit(-1);
+            }
+            tileReadbackExtent = tileExtent;
+        }
+
+        tiledImage.width = width;
+        tiledImage.height = height;
+        tiledImage.tileExtent = tileExtent;
+        tiledImage.columnCount = columnCount;
+        tiledImage.firstCopy = tileReadback.getCopyCount();
+        tiledImage.band.resize((std::size_t) 3 * width * tileExtent.height);
+        tiledImage.written = tiledImage.writer.start(path, ImageStreamWriter::formatOf(path), width, height);
+        if (!tiledImage.written)
+        {
+            return false;
+        }
+
+        uint64_t particleTimelineValue = submitParticleUpdate(0, time);
+        TimelineScheduler::Wait particleWait{vulkanProgramInfo.asyncCompute.getTimeline(),
+                                             particleTimelineValue,
+                                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT};
+
+        // A command buffer is reused once the tile submitted with it a ring of tiles ago completed
+        uint64_t tileValue = 0;
+        for (uint64_t tile = 0; tile < tileCount; tile++)
+        {
+            uint32_t slot = (uint32_t) (tile % tileCmdBuffers.size());
+            vulkanProgramInfo.scheduler.waitUntil(vulkanProgramInfo.graphicsTimeline, tileValues[slot]);
+
+            // Pixel (x, y) of the image lands on pixel (x - tileX, y - tileY) of the target
+            double tileX = (double) (tile % columnCount) * tileExtent.width;
+            double tileY = (double) (tile / columnCount) * tileExtent.height;
+            SceneTransform transform{};
+            transform.scale[0] = (float) ((double) width / tileExtent.width);
+            transform.scale[1] = (float) ((double) height / tileExtent.height);
+            transform.offset[0] = (float) ((width - 2.0 * tileX - tileExtent.width) / tileExtent.width);
+            transform.offset[1] = (float) ((height - 2.0 * tileY - tileExtent.height) / tileExtent.height);
+
+            VkCommandBuffer cmdBuffers[2] = {tileCmdBuffers[slot], VK_NULL_HANDLE};
+            recordTile(cmdBuffers[0],
+                       tileExtent,
+                       transform,
+                       vulkanProgramInfo.particleBuffers[0],
+                       particleCount);
+            cmdBuffers[1] = tileReadback.recordCopy(tileTarget.color.image,
+                                                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                                    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                                    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+            if (cmdBuffers[1] == VK_NULL_HANDLE)
+            {
+                std::cout << "Failed to record tile readback" << std::endl;
+                exit(-1);
+            }
+
+            tileValue = vulkanProgramInfo.scheduler.submit(vulkanProgramInfo.graphicsTimeline,
+                                                           2,
+                                                           cmdBuffers,
+                                                           particleTimelineValue != 0 ? 1 : 0,
+                                                           &particleWait);
+            if (tileValue == 0)
+            {
+                std::cout << "Failed to submit tile" << std::endl;
+                exit(-1);
+            }
+            tileValues[slot] = tileValue;
+            tileReadback.submitted(tileValue);
+        }
+
+        // Delivers the last tiles. The particle buffer is free for the next image after this.
+        vulkanProgramInfo.scheduler.waitUntil(vulkanProgramInfo.graphicsTimeline, tileValue);
+        return tiledImage.writer.finish() && tiledImage.written;
+    }
 
-        deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        deviceCreateInfo.pNext = nullptr;
-        deviceCreateInfo.flags = 0;
-        deviceCreateInfo.queueCreateInfoCount = 1;
-        deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-        deviceCreateInfo.ppEnabledLayerNames = nullptr;
-        deviceCreateInfo.pEnabledFeatures = nullptr;
-        deviceCreateInfo.enabledLayerCount = 0;
-        deviceCreateInfo.ppEnabledLayerNames = nullptr;
+    /**
+     * Render thread, from the readback ring: convert a tile of <tiledImage> into its row of tiles and write the row
+     * once its last tile arrived. Copies arrive in submission order.
+     */
+    void storeTile(const ReadbackRing::Frame &frame)
+    {
+        TiledImage &image = tiledImage;
+        uint64_t tile = frame.copyNumber - image.firstCopy;
+        uint32_t column = (uint32_t) (tile % image.columnCount);
+        uint32_t tileRow = (uint32_t) (tile / image.columnCount);
+        uint32_t x = column * image.tileExtent.width;
+        uint32_t width = std::min(image.tileExtent.width, image.width - x);
+        uint32_t rowCount = std::min(image.tileExtent.height, image.height - tileRow * image.tileExtent.height);
+
+        vulkanProgramInfo.jobs.parallelFor(0,
+                                           rowCount,
+                                           32,
+                                           [&frame, &image, x, width](uint32_t first, uint32_t last)
+                                           {
+                                               for (uint32_t row = first; row < last; row++)
+                                               {
+                                                   PixelConversion::toRgb(
+                                                           frame.format,
+                                                           frame.pixels + (std::size_t) row * frame.rowPitch,
+                                                           image.band.data() + (std::size_t) 3 * row * image.width +
+                                                           (std::size_t) 3 * x,
+                                                           width);
+                                               }
+                                           });
+
+        if (column == image.columnCount - 1)
+        {
+            image.written = image.writer.writeRows(image.band.data(), rowCount) && image.written;
+        }
+    }
 
-        // Enable device layers
-        uint32_t deviceExtensionCount = 0;
-        std::vector<VkExtensionProperties> availableDeviceExtensions{};
+    /**
+     * Attachments of a tile target of <extent>. The color image tiles are read back from is single sampled.
+     */
+    TileTarget createTileTarget(VkExtent2D extent)
+    {
+        TileTarget target{};
+        target.extent = extent;
+        target.color = createAttachmentImage(vulkanProgramInfo.vulkanSwapchainFormat,
+                                             VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                                             VK_IMAGE_ASPECT_COLOR_BIT,
+                                             extent,
+                                             VK_SAMPLE_COUNT_1_BIT);
+        if (vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+        {
+            target.msaaColor = createAttachmentImage(vulkanProgramInfo.vulkanSwapchainFormat,
+                                                     VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+                                                     VK_IMAGE_ASPECT_COLOR_BIT,
+                                                     extent,
+                                                     vulkanProgramInfo.msaaSamples);
+        }
+        target.depth = createAttachmentImage(vulkanProgramInfo.depthFormat,
+                                             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+                                             depthAspectMask(),
+                                             extent,
+                                             vulkanProgramInfo.msaaSamples);
+        return target;
+    }
 
-        vkEnumerateDeviceExtensionProperties(vulkanProgramInfo.chosenGPU,
-                                             nullptr,
-                                             &deviceExtensionCount,
-                                             nullptr);
+    void destroyTileTarget(TileTarget &target) const
+    {
+        destroyAttachmentImage(target.color);
+        if (target.msaaColor.image != VK_NULL_HANDLE)
+        {
+            destroyAttachmentImage(target.msaaColor);
+        }
+        destroyAttachmentImage(target.depth);
+    }
 
-        availableDeviceExtensions.resize(deviceExtensionCount);
+    /**
+     * Move <colorImage>, <msaaColorImage> unless it is null, and <depthImage> into attachment layouts, discarding their
+     * contents. Orders the writes after earlier copies from and attachment writes to the same images.
+     */
+    void discardAttachments(VkCommandBuffer cmdBuffer, VkImage colorImage, VkImage msaaColorImage, VkImage depthImage)
+    {
+        VkImageMemoryBarrier imageBarriers[3]{};
+        uint32_t barrierCount = 0;
+        auto discardInto = [&imageBarriers, &barrierCount](VkImage image,
+                                                           VkImageLayout layout,
+                                                           VkAccessFlags accessMask,
+                                                           VkImageAspectFlags aspectMask)
+        {
+            VkImageMemoryBarrier &imageBarrier = imageBarriers[barrierCount++];
+            imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageBarrier.srcAccessMask = 0;
+            imageBarrier.dstAccessMask = accessMask;
+            imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageBarrier.newLayout = layout;
+            imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarrier.image = image;
+            imageBarrier.subresourceRange = {aspectMask, 0, 1, 0, 1};
+        };
+        discardInto(colorImage,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    VK_IMAGE_ASPECT_COLOR_BIT);
+        if (msaaColorImage != VK_NULL_HANDLE)
+        {
+            discardInto(msaaColorImage,
+                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                        VK_IMAGE_ASPECT_COLOR_BIT);
+        }
+        discardInto(depthImage,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                    depthAspectMask());
+
+        // Waits for earlier copies and attachment writes, the old contents are discarded
+        vulkanProgramInfo.dispatch.vkCmdPipelineBarrier(cmdBuffer,
+                                                        VK_PIPELINE_STAGE_TRANSFER_BIT |
+                                                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                                        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                                                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                                        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+                                                        0,
+                                                        0, nullptr,
+                                                        0, nullptr,
+                                                        barrierCount, imageBarriers);
+    }
 
-        vkResult = vkEnumerateDeviceExtensionProperties(vulkanProgramInfo.chosenGPU,
-                                                        nullptr,
-                                                        &deviceExtensionCount,
-                                                        availableDeviceExtensions.data());
+    /**
+     * Record the scene drawn with <transform> into the <extent> corner of the tile target. Nothing in the target is
+     * kept from the previous tile, the previous tile's readback only has to finish before its image is cleared.
+     */
+    void recordTile(VkCommandBuffer cmdBuffer,
+                    VkExtent2D extent,
+                    const SceneTransform &transform,
+                    VkBuffer particleBuffer,
+                    uint32_t particleCount)
+    {
+        VkCommandBufferBeginInfo bufferBeginInfo{};
+        bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkResult = vulkanProgramInfo.dispatch.vkBeginCommandBuffer(cmdBuffer, &bufferBeginInfo);
         if (vkResult != VK_SUCCESS)
         {
-            std::cout << "Failed to get a list of device extensions" << std::endl;
+            std::cout << "Failed to begin command buffer" << std::endl;
             exit(-1);
         }
 
-        checkEnabledExtensionsSupported(availableDeviceExtensions,
-                                        vulkanProgramInfo.enabledDeviceExtensions);
-        deviceCreateInfo.ppEnabledExtensionNames = vulkanProgramInfo.enabledDeviceExtensions.data();
-        deviceCreateInfo.enabledExtensionCount = (uint32_t) vulkanProgramInfo.enabledDeviceExtensions.size();
-
-        vkResult = vkCreateDevice(vulkanProgramInfo.chosenGPU,
-                                  &deviceCreateInfo,
-                                  nullptr,
-                                  &vulkanProgramInfo.GPUDevice);
+        discardAttachments(cmdBuffer, tileTarget.color.image, tileTarget.msaaColor.image, tileTarget.depth.image);
 
+        beginDynamicRendering(cmdBuffer,
+                              tileTarget.color.imageView,
+                              tileTarget.msaaColor.imageView,
+                              tileTarget.depth.imageView,
+                              extent);
+        drawScene(cmdBuffer, particleBuffer, particleCount, extent, transform);
+        vulkanProgramInfo.dispatch.vkCmdEndRenderingKHR(cmdBuffer);
 
+        vkResult = vulkanProgramInfo.dispatch.vkEndCommandBuffer(cmdBuffer);
         if (vkResult != VK_SUCCESS)
         {
-            std::cout << "Failed to create gpu device" << std::endl;
+            std::cout << "Failed to record command buffer" << std::endl;
             exit(-1);
         }
+    }
 
+    /**
+     * Run the microbenchmark named by <options.benchmark>
+     */
+    void runBenchmark()
+    {
+        if (options.benchmark == "dispatch")
+        {
+            runDispatchBenchmark();
+        } else if (options.benchmark == "async-compute")
+        {
+            runAsyncComputeBenchmark();
+        } else
+        {
+            std::cout << "Unknown benchmark: " << options.benchmark << std::endl;
+        }
     }
 
     /**
-     * Create command pool where command buffers get allocated
+     * Record thousands of draws into one command buffer, once through the loader exports and once through
+     * <vulkanProgramInfo.dispatch>, and report the recording cost per draw. Nothing is ever submitted.
      */
-    void createCmdPool()
+    void runDispatchBenchmark()
     {
+        const uint32_t drawCount = 10000;
+        const int roundCount = 50;
+
         VkCommandPoolCreateInfo cmdPoolCreateInfo{};
         cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        cmdPoolCreateInfo.pNext = nullptr;
-        cmdPoolCreateInfo.flags = 0;
+        cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
         cmdPoolCreateInfo.queueFamilyIndex = vulkanProgramInfo.graphicsQueueFamilyIndex;
 
-        vkResult = vkCreateCommandPool(vulkanProgramInfo.GPUDevice,
-                                       &cmdPoolCreateInfo,
-                                       nullptr,
-                                       &vulkanProgramInfo.cmdPool);
-
+        VkCommandPool benchmarkPool = VK_NULL_HANDLE;
+        vkResult = vulkanProgramInfo.dispatch.vkCreateCommandPool(vulkanProgramInfo.GPUDevice,
+                                                                  &cmdPoolCreateInfo,
+                                                                  vulkanProgramInfo.allocator,
+                                                                  &benchmarkPool);
         if (vkResult != VK_SUCCESS)
         {
-            std::cout << "Failed to create command pool" << std::endl;
+            std::cout << "Failed to create benchmark command pool" << std::endl;
             exit(-1);
         }
 
-		vulkanProgramInfo.cmdBuffers.resize(vulkanProgramInfo.swapchainFramebuffers.size());
-
         VkCommandBufferAllocateInfo cmdBufferAllocateInfo{};
         cmdBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        cmdBufferAllocateInfo.pNext = nullptr;
-        cmdBufferAllocateInfo.commandBufferCount = (uint32_t) vulkanProgramInfo.swapchainFramebuffers.size();
-        cmdBufferAllocateInfo.commandPool = vulkanProgramInfo.cmdPool;
+        cmdBufferAllocateInfo.commandPool = benchmarkPool;
         cmdBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdBufferAllocateInfo.commandBufferCount = 1;
 
-        vkResult = vkAllocateCommandBuffers(vulkanProgramInfo.GPUDevice,
-                                            &cmdBufferAllocateInfo,
-                                            vulkanProgramInfo.cmdBuffers.data());
+        VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+        vkResult = vulkanProgramInfo.dispatch.vkAllocateCommandBuffers(vulkanProgramInfo.GPUDevice,
+                                                                       &cmdBufferAllocateInfo,
+                                                                       &cmdBuffer);
+        if (vkResult != VK_SUCCESS)
+        {
+            std::cout << "Failed to allocate benchmark command buffer" << std::endl;
+            exit(-1);
+        }
 
-        for (std::size_t i = 0; i < vulkanProgramInfo.cmdBuffers.size(); i++)
+        // Alternate the two variants so both see the same cache and clock conditions, keep the best round
+        double loaderNanoseconds = 1e300;
+        double dispatchNanoseconds = 1e300;
+        for (int round = 0; round < roundCount; round++)
+        {
+            loaderNanoseconds = std::min(loaderNanoseconds,
+                                         timeDrawRecording(benchmarkPool, cmdBuffer, &::vkCmdDraw, drawCount));
+            dispatchNanoseconds = std::min(dispatchNanoseconds,
+                                           timeDrawRecording(benchmarkPool,
+                                                             cmdBuffer,
+                                                             vulkanProgramInfo.dispatch.vkCmdDraw,
+                                                             drawCount));
+        }
+
+        vulkanProgramInfo.dispatch.vkDestroyCommandPool(vulkanProgramInfo.GPUDevice,
+                                                        benchmarkPool,
+                                                        vulkanProgramInfo.allocator);
+
+        double loaderPerDraw = loaderNanoseconds / drawCount;
+        double dispatchPerDraw = dispatchNanoseconds / drawCount;
+        std::cout << "Recording " << drawCount << " draws, best of " << roundCount << " rounds" << std::endl;
+        std::cout << "  loader trampoline: " << loaderPerDraw << " ns/draw" << std::endl;
+        std::cout << "  device dispatch:   " << dispatchPerDraw << " ns/draw" << std::endl;
+        std::cout << "  saved:             " << (loaderPerDraw - dispatchPerDraw) << " ns/draw ("
+                  << 100.0 * (loaderPerDraw - dispatchPerDraw) / loaderPerDraw << "%)" << std::endl;
+    }
+
+    /**
+     * Render the same frames with the particle update inline on the graphics queue and on the async compute
+     * queue, and report the average frame time of both
+     */
+    void runAsyncComputeBenchmark()
+    {
+        AsyncCompute &asyncCompute = vulkanProgramInfo.asyncCompute;
+        if (!asyncCompute.isAvailable())
+        {
+            std::cout << "Async compute needs a compute only queue family and timeline semaphores" << std::endl;
+            return;
+        }
+
+        const int warmupFrameCount = 60;
+        const int measuredFrameCount = 600;
+
+        // The graphics queue waits for the compute queue, so its newest value covers both
+        TimelineScheduler &scheduler = vulkanProgramInfo.scheduler;
+        auto waitForSubmittedFrames = [this, &scheduler]()
         {
-            VkCommandBufferBeginInfo bufferBeginInfo{};
-            bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            scheduler.waitUntil(vulkanProgramInfo.graphicsTimeline,
+                                scheduler.getSubmittedValue(vulkanProgramInfo.graphicsTimeline));
+        };
 
-            vkResult = vkBeginCommandBuffer(vulkanProgramInfo.cmdBuffers[i],
-                                            &bufferBeginInfo);
+        auto averageFrameMilliseconds = [this, &asyncCompute, &waitForSubmittedFrames](bool async)
+        {
+            asyncCompute.setAsync(async);
+            for (int frame = 0; frame < warmupFrameCount; frame++)
+            {
+                processRenderEvents();
+                drawFrame();
+            }
+            waitForSubmittedFrames();
 
-            if (vkResult != VK_SUCCESS)
+            auto start = std::chrono::steady_clock::now();
+            for (int frame = 0; frame < measuredFrameCount; frame++)
             {
-                std::cout << "Failed to begin command buffer" << std::endl;
-                exit(-1);
+                processRenderEvents();
+                drawFrame();
             }
+            waitForSubmittedFrames();
+            auto end = std::chrono::steady_clock::now();
 
-            // Begin render passes
-            VkRenderPassBeginInfo renderPassBeginInfo{};
-            renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassBeginInfo.renderPass = vulkanProgramInfo.renderPass;
-            renderPassBeginInfo.framebuffer = vulkanProgramInfo.swapchainFramebuffers[i];
-            renderPassBeginInfo.renderArea.offset = {0, 0};
-            renderPassBeginInfo.renderArea.extent = vulkanProgramInfo.swapchainExtent;
-            VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-            renderPassBeginInfo.clearValueCount = 1;
-            renderPassBeginInfo.pClearValues = &clearColor;
+            return std::chrono::duration<double, std::milli>(end - start).count() / measuredFrameCount;
+        };
 
-            vkCmdBeginRenderPass(vulkanProgramInfo.cmdBuffers[i],
-                                 &renderPassBeginInfo,
-                                 VK_SUBPASS_CONTENTS_INLINE);
+        double graphicsMilliseconds = averageFrameMilliseconds(false);
+        double asyncMilliseconds = averageFrameMilliseconds(true);
 
-            vkCmdBindPipeline(vulkanProgramInfo.cmdBuffers[i],
-                              VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              vulkanProgramInfo.graphicsPipeline);
+        std::cout << "Rendering " << measuredFrameCount << " frames, " << options.particleCount
+                  << " particle(s), compute load " << options.computeLoad << std::endl;
+        std::cout << "  graphics queue:      " << graphicsMilliseconds << " ms/frame" << std::endl;
+        std::cout << "  async compute queue: " << asyncMilliseconds << " ms/frame" << std::endl;
+        std::cout << "  saved:               " << (graphicsMilliseconds - asyncMilliseconds) << " ms/frame ("
+                  << 100.0 * (graphicsMilliseconds - asyncMilliseconds) / graphicsMilliseconds << "%)" << std::endl;
+    }
 
-            vkCmdDraw(vulkanProgramInfo.cmdBuffers[i],
-                      3,
-                      1,
-                      0,
-                      0);
+    /**
+     * Record one command buffer of <drawCount> draws issued through <drawCommand>.
+     * Returns the nanoseconds spent in the draw loop only.
+     */
+    double timeDrawRecording(VkCommandPool cmdPool,
+                             VkCommandBuffer cmdBuffer,
+                             PFN_vkCmdDraw drawCommand,
+                             uint32_t drawCount)
+    {
+        vulkanProgramInfo.dispatch.vkResetCommandPool(vulkanProgramInfo.GPUDevice, cmdPool, 0);
 
-            vkCmdEndRenderPass(vulkanProgramInfo.cmdBuffers[i]);
+        VkCommandBufferBeginInfo bufferBeginInfo{};
+        bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        bufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vulkanProgramInfo.dispatch.vkBeginCommandBuffer(cmdBuffer, &bufferBeginInfo);
 
-            vkResult = vkEndCommandBuffer(vulkanProgramInfo.cmdBuffers[i]);
-            if (vkResult != VK_SUCCESS)
-            {
-                std::cout << "Failed to record command buffer" << std::endl;
-                exit(-1);
-            }
+        if (vulkanProgramInfo.capabilities.dynamicRendering)
+        {
+            beginDynamicRendering(cmdBuffer,
+                                  vulkanProgramInfo.imageViews[0],
+                                  vulkanProgramInfo.msaaColorAttachment.imageView,
+                                  vulkanProgramInfo.depthAttachment.imageView,
+                                  vulkanProgramInfo.renderExtent);
+        } else
+        {
+            beginRenderPass(cmdBuffer, 0);
+        }
+
+        vulkanProgramInfo.dispatch.vkCmdBindPipeline(cmdBuffer,
+                                                     VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                                     vulkanProgramInfo.graphicsPipeline);
+        setDynamicStates(cmdBuffer, vulkanProgramInfo.renderExtent);
+
+        VkDeviceSize vertexBufferOffset = 0;
+        vulkanProgramInfo.dispatch.vkCmdBindVertexBuffers(cmdBuffer,
+                                                          0,
+                                                          1,
+                                                          &vulkanProgramInfo.vertexBuffer,
+                                                          &vertexBufferOffset);
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t draw = 0; draw < drawCount; draw++)
+        {
+            drawCommand(cmdBuffer, 3, 1, 0, draw);
         }
+        auto end = std::chrono::steady_clock::now();
+
+        if (vulkanProgramInfo.capabilities.dynamicRendering)
+        {
+            vulkanProgramInfo.dispatch.vkCmdEndRenderingKHR(cmdBuffer);
+        } else
+        {
+            vulkanProgramInfo.dispatch.vkCmdEndRenderPass(cmdBuffer);
+        }
+        vulkanProgramInfo.dispatch.vkEndCommandBuffer(cmdBuffer);
+
+        return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
     }
 
     /**
@@ -807,12 +5436,27 @@ private:
         VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
         // Vertex input
+        VkVertexInputBindingDescription vertexBindingDescription{};
+        vertexBindingDescription.binding = 0;
+        vertexBindingDescription.stride = sizeof(Vertex);
+        vertexBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        VkVertexInputAttributeDescription vertexAttributeDescriptions[2]{};
+        vertexAttributeDescriptions[0].location = 0;
+        vertexAttributeDescriptions[0].binding = 0;
+        vertexAttributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+        vertexAttributeDescriptions[0].offset = offsetof(Vertex, position);
+        vertexAttributeDescriptions[1].location = 1;
+        vertexAttributeDescriptions[1].binding = 0;
+        vertexAttributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+        vertexAttributeDescriptions[1].offset = offsetof(Vertex, color);
+
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount = 0;
-        vertexInputInfo.pVertexBindingDescriptions = nullptr; // Optional
-        vertexInputInfo.vertexAttributeDescriptionCount = 0;
-        vertexInputInfo.pVertexAttributeDescriptions = nullptr; // Optional
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.pVertexBindingDescriptions = &vertexBindingDescription;
+        vertexInputInfo.vertexAttributeDescriptionCount = 2;
+        vertexInputInfo.pVertexAttributeDescriptions = vertexAttributeDescriptions;
 
         // How vertices should be assembled
         VkPipelineInputAssemblyStateCreateInfo assemblyInfo{};
@@ -822,27 +5466,14 @@ private:
         assemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         assemblyInfo.primitiveRestartEnable = VK_FALSE;
 
-        // Set up viewport
-        VkViewport viewport{};
-        viewport.width = (float) vulkanProgramInfo.swapchainExtent.width;
-        viewport.height = (float) vulkanProgramInfo.swapchainExtent.height;
-        viewport.x = 0;
-        viewport.y = 0;
-        viewport.maxDepth = 1.0f;
-        viewport.minDepth = 0.0f;
-
-        // Scissor
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = vulkanProgramInfo.swapchainExtent;
-
-        // Viewport create info
+        // Viewport create info. Viewport and scissor are dynamic and set in <setDynamicStates>,
+        // with extended dynamic state even their count is left to record time.
         VkPipelineViewportStateCreateInfo viewportState{};
         viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
-        viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
+        viewportState.viewportCount = vulkanProgramInfo.capabilities.extendedDynamicState ? 0 : 1;
+        viewportState.pViewports = nullptr;
+        viewportState.scissorCount = vulkanProgramInfo.capabilities.extendedDynamicState ? 0 : 1;
+        viewportState.pScissors = nullptr;
 
         // Set up rasterization stage
         VkPipelineRasterizationStateCreateInfo rasterizer{};
@@ -862,7 +5493,7 @@ private:
         VkPipelineMultisampleStateCreateInfo multisampling{};
         multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
         multisampling.sampleShadingEnable = VK_FALSE;
-        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        multisampling.rasterizationSamples = vulkanProgramInfo.msaaSamples;
         multisampling.minSampleShading = 1.0f; // Optional
         multisampling.pSampleMask = nullptr; // Optional
         multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
@@ -876,21 +5507,59 @@ private:
                                               VK_COLOR_COMPONENT_A_BIT;
         colorBlendAttachment.blendEnable = VK_FALSE;
 
+        // Depth test against the transient depth attachment
+        VkPipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
+
         VkPipelineColorBlendStateCreateInfo colorBlending{};
         colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
         colorBlending.logicOpEnable = VK_FALSE;
         colorBlending.attachmentCount = 1;
         colorBlending.pAttachments = &colorBlendAttachment;
 
-        // No dynamic states
+        // Dynamic states
+        std::vector<VkDynamicState> dynamicStates{};
+        if (vulkanProgramInfo.capabilities.extendedDynamicState)
+        {
+            dynamicStates = {
+                    VK_DYNAMIC_STATE_VIEWPORT_WITH_COUNT_EXT,
+                    VK_DYNAMIC_STATE_SCISSOR_WITH_COUNT_EXT,
+                    VK_DYNAMIC_STATE_CULL_MODE_EXT,
+                    VK_DYNAMIC_STATE_FRONT_FACE_EXT,
+                    VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT,
+            };
+        } else
+        {
+            dynamicStates = {
+                    VK_DYNAMIC_STATE_VIEWPORT,
+                    VK_DYNAMIC_STATE_SCISSOR,
+            };
+        }
+
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = (uint32_t) dynamicStates.size();
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        // Set up pipeline layout, the scene transform is the only push constant
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(SceneTransform);
 
-        // Set up pipeline layout
         VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
         pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
         vkResult = vkCreatePipelineLayout(vulkanProgramInfo.GPUDevice,
                                           &pipelineLayoutInfo,
-                                          nullptr,
+                                          vulkanProgramInfo.allocator,
                                           &vulkanProgramInfo.pipelineLayout);
 
         if (vkResult != VK_SUCCESS)
@@ -899,8 +5568,17 @@ private:
             exit(-1);
         }
 
+        // With dynamic rendering the pipeline describes its attachment formats instead of a render pass
+        VkPipelineRenderingCreateInfoKHR pipelineRenderingCreateInfo{};
+        pipelineRenderingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+        pipelineRenderingCreateInfo.colorAttachmentCount = 1;
+        pipelineRenderingCreateInfo.pColorAttachmentFormats = &vulkanProgramInfo.vulkanSwapchainFormat;
+        pipelineRenderingCreateInfo.depthAttachmentFormat = vulkanProgramInfo.depthFormat;
+
 		VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo{};
 		graphicsPipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		graphicsPipelineCreateInfo.pNext = vulkanProgramInfo.capabilities.dynamicRendering ? &pipelineRenderingCreateInfo
+																					  : nullptr;
 		graphicsPipelineCreateInfo.stageCount = 2;
 		graphicsPipelineCreateInfo.pStages = shaderStages;
 		graphicsPipelineCreateInfo.pVertexInputState = &vertexInputInfo;
@@ -908,8 +5586,9 @@ private:
 		graphicsPipelineCreateInfo.pViewportState = &viewportState;
 		graphicsPipelineCreateInfo.pRasterizationState = &rasterizer;
 		graphicsPipelineCreateInfo.pMultisampleState = &multisampling;
+		graphicsPipelineCreateInfo.pDepthStencilState = &depthStencil;
 		graphicsPipelineCreateInfo.pColorBlendState = &colorBlending;
-		graphicsPipelineCreateInfo.pDynamicState = nullptr;
+		graphicsPipelineCreateInfo.pDynamicState = &dynamicState;
 		graphicsPipelineCreateInfo.layout = vulkanProgramInfo.pipelineLayout;
 		graphicsPipelineCreateInfo.renderPass = vulkanProgramInfo.renderPass;
 		graphicsPipelineCreateInfo.subpass = 0;
@@ -918,7 +5597,7 @@ private:
 											 VK_NULL_HANDLE,
 											 1,
 											 &graphicsPipelineCreateInfo,
-											 nullptr,
+											 vulkanProgramInfo.allocator,
 											 &vulkanProgramInfo.graphicsPipeline);
 
 		if (vkResult != VK_SUCCESS)
@@ -929,11 +5608,11 @@ private:
 
         vkDestroyShaderModule(vulkanProgramInfo.GPUDevice,
                               vulkanProgramInfo.fragShaderModule,
-                              nullptr);
+                              vulkanProgramInfo.allocator);
 
         vkDestroyShaderModule(vulkanProgramInfo.GPUDevice,
                               vulkanProgramInfo.vertShaderModule,
-                              nullptr);
+                              vulkanProgramInfo.allocator);
     }
 
     /**
@@ -941,40 +5620,85 @@ private:
      */
     void createGraphicsPipeline()
     {
-        // set up attachment description
-        VkAttachmentDescription attachmentDescription{};
+        bool multisampled = vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
+        // Attachment 0 is the color target: the swapchain image, or with MSAA a transient multisampled image
+        // that is never stored. Attachment 1 is the transient depth buffer. With MSAA attachment 2 is the
+        // swapchain image the subpass resolves into.
+        std::vector<VkAttachmentDescription> attachmentDescriptions(multisampled ? 3 : 2);
+
+        VkAttachmentDescription &attachmentDescription = attachmentDescriptions[0];
         attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         attachmentDescription.format = vulkanProgramInfo.vulkanSwapchainFormat;
-        attachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
+        attachmentDescription.samples = vulkanProgramInfo.msaaSamples;
         attachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        attachmentDescription.storeOp = multisampled ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+                                                     : VK_ATTACHMENT_STORE_OP_STORE;
         attachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        attachmentDescription.finalLayout = multisampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+                                                         : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentDescription &depthAttachmentDescription = attachmentDescriptions[1];
+        depthAttachmentDescription.format = vulkanProgramInfo.depthFormat;
+        depthAttachmentDescription.samples = vulkanProgramInfo.msaaSamples;
+        depthAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        if (multisampled)
+        {
+            VkAttachmentDescription &resolveAttachmentDescription = attachmentDescriptions[2];
+            resolveAttachmentDescription.format = vulkanProgramInfo.vulkanSwapchainFormat;
+            resolveAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
+            resolveAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            resolveAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            resolveAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            resolveAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            resolveAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            resolveAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        }
 
         // Attachment reference for subpasses
         VkAttachmentReference colorAttachmentRef{};
         colorAttachmentRef.attachment = 0;
         colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+        VkAttachmentReference depthAttachmentRef{};
+        depthAttachmentRef.attachment = 1;
+        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentReference resolveAttachmentRef{};
+        resolveAttachmentRef.attachment = 2;
+        resolveAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
 		// Subpass that exist in a render pass
 		VkSubpassDescription subpassDescription{};
 		subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 		subpassDescription.colorAttachmentCount = 1;
 		subpassDescription.pColorAttachments = &colorAttachmentRef;
+		subpassDescription.pDepthStencilAttachment = &depthAttachmentRef;
+		subpassDescription.pResolveAttachments = multisampled ? &resolveAttachmentRef : nullptr;
 
+        // Also orders the depth clear after the depth tests of the previous frame
         VkSubpassDependency dependency{};
         dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
         dependency.dstSubpass = 0;
-        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.srcAccessMask = 0;
-        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                  VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                  VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                   VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
 		VkRenderPassCreateInfo renderPassCreateInfo{};
 		renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassCreateInfo.attachmentCount = 1;
-		renderPassCreateInfo.pAttachments = &attachmentDescription;
+		renderPassCreateInfo.attachmentCount = (uint32_t) attachmentDescriptions.size();
+		renderPassCreateInfo.pAttachments = attachmentDescriptions.data();
 		renderPassCreateInfo.subpassCount = 1;
 		renderPassCreateInfo.pSubpasses = &subpassDescription;
         renderPassCreateInfo.dependencyCount = 1;
@@ -982,7 +5706,7 @@ private:
 
 		vkResult = vkCreateRenderPass(vulkanProgramInfo.GPUDevice,
 									  &renderPassCreateInfo,
-									  nullptr,
+									  vulkanProgramInfo.allocator,
 									  &vulkanProgramInfo.renderPass);
 		if (vkResult != VK_SUCCESS)
 		{
@@ -996,24 +5720,32 @@ private:
 		vulkanProgramInfo.swapchainFramebuffers.resize(vulkanProgramInfo.imageViews.size());
 		for (size_t i = 0; i < vulkanProgramInfo.imageViews.size(); i++)
 		{
-			VkImageView attachment[] =
+			// Same attachment order as in <createGraphicsPipeline>
+			std::vector<VkImageView> attachment{};
+			if (vulkanProgramInfo.msaaSamples != VK_SAMPLE_COUNT_1_BIT)
 			{
-				vulkanProgramInfo.imageViews[i]
-			};
+				attachment = {vulkanProgramInfo.msaaColorAttachment.imageView,
+							  vulkanProgramInfo.depthAttachment.imageView,
+							  vulkanProgramInfo.imageViews[i]};
+			} else
+			{
+				attachment = {vulkanProgramInfo.imageViews[i],
+							  vulkanProgramInfo.depthAttachment.imageView};
+			}
 
 			VkFramebufferCreateInfo framebufferCreatInfo{};
 			framebufferCreatInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 			framebufferCreatInfo.renderPass = vulkanProgramInfo.renderPass;
-			framebufferCreatInfo.attachmentCount = 1;
+			framebufferCreatInfo.attachmentCount = (uint32_t) attachment.size();
 			framebufferCreatInfo.height = vulkanProgramInfo.swapchainExtent.height;
 			framebufferCreatInfo.width = vulkanProgramInfo.swapchainExtent.width;
-			framebufferCreatInfo.pAttachments = attachment;
+			framebufferCreatInfo.pAttachments = attachment.data();
 			framebufferCreatInfo.layers = 1;
 
 			// Create swapchain framebuffers
 			vkResult = vkCreateFramebuffer(vulkanProgramInfo.GPUDevice,
 										  &framebufferCreatInfo,
-										  nullptr,
+										  vulkanProgramInfo.allocator,
 										  &vulkanProgramInfo.swapchainFramebuffers[i]);
 			if (vkResult != VK_SUCCESS)
 			{
@@ -1026,63 +5758,134 @@ private:
     /**
      * Janitor to free up any created or allocated memory
      */
-    void cleanup() const
+    void cleanup()
     {
-        vkDestroySemaphore(vulkanProgramInfo.GPUDevice,
-                           vulkanProgramInfo.imageAvailableSemaphore,
-                           nullptr);
+        reportAttachmentCommitment();
 
-        vkDestroySemaphore(vulkanProgramInfo.GPUDevice,
-                           vulkanProgramInfo.renderFinishedSemaphore,
-                           nullptr);
+        // The device is idle, nothing retired can still be in use
+        vulkanProgramInfo.scheduler.flush();
+        vulkanProgramInfo.uploadQueue.destroy();
+        if (vulkanProgramInfo.readback)
+        {
+            reportReadback();
+            vulkanProgramInfo.readbackRing.destroy();
+        }
+        if (vulkanProgramInfo.recording)
+        {
+            stopRecording();
+        }
+
+        vkDestroyBuffer(vulkanProgramInfo.GPUDevice, vulkanProgramInfo.vertexBuffer, vulkanProgramInfo.allocator);
+        vkFreeMemory(vulkanProgramInfo.GPUDevice, vulkanProgramInfo.vertexBufferMemory, vulkanProgramInfo.allocator);
+
+        vulkanProgramInfo.asyncCompute.destroy();
+        for (std::size_t i = 0; i < vulkanProgramInfo.particleBuffers.size(); i++)
+        {
+            vkDestroyBuffer(vulkanProgramInfo.GPUDevice,
+                            vulkanProgramInfo.particleBuffers[i],
+                            vulkanProgramInfo.allocator);
+            vkFreeMemory(vulkanProgramInfo.GPUDevice,
+                         vulkanProgramInfo.particleBufferMemories[i],
+                         vulkanProgramInfo.allocator);
+        }
+        vkDestroyDescriptorPool(vulkanProgramInfo.GPUDevice,
+                                vulkanProgramInfo.particleDescriptorPool,
+                                vulkanProgramInfo.allocator);
+        vkDestroyPipeline(vulkanProgramInfo.GPUDevice,
+                          vulkanProgramInfo.particlePipeline,
+                          vulkanProgramInfo.allocator);
+        vkDestroyPipelineLayout(vulkanProgramInfo.GPUDevice,
+                                vulkanProgramInfo.particlePipelineLayout,
+                                vulkanProgramInfo.allocator);
+        vkDestroyDescriptorSetLayout(vulkanProgramInfo.GPUDevice,
+                                     vulkanProgramInfo.particleSetLayout,
+                                     vulkanProgramInfo.allocator);
+
+        vulkanProgramInfo.frameGraph.releaseTransients(vulkanProgramInfo.GPUDevice, vulkanProgramInfo.allocator);
+        destroyAttachmentImage(vulkanProgramInfo.msaaColorAttachment);
+        destroyAttachmentImage(vulkanProgramInfo.depthAttachment);
+        destroyExtraWindows();
+
+        for (const FrameSync &frame: vulkanProgramInfo.frames)
+        {
+            vkDestroySemaphore(vulkanProgramInfo.GPUDevice,
+                               frame.imageAvailableSemaphore,
+                               vulkanProgramInfo.allocator);
+
+            vkDestroySemaphore(vulkanProgramInfo.GPUDevice,
+                               frame.renderFinishedSemaphore,
+                               vulkanProgramInfo.allocator);
+        }
+        vulkanProgramInfo.scheduler.destroy();
 
 		for (const VkFramebuffer& framebuffer : vulkanProgramInfo.swapchainFramebuffers)
 		{
 			vkDestroyFramebuffer(vulkanProgramInfo.GPUDevice,
 								 framebuffer,
-								 nullptr);
+								 vulkanProgramInfo.allocator);
 		}
 
         for (const VkImageView &imageView: vulkanProgramInfo.imageViews)
         {
             vkDestroyImageView(vulkanProgramInfo.GPUDevice,
                                imageView,
-                               nullptr);
+                               vulkanProgramInfo.allocator);
         }
 
         vkDestroySwapchainKHR(vulkanProgramInfo.GPUDevice,
                               vulkanProgramInfo.vulkanSwapchain,
-                              nullptr);
+                              vulkanProgramInfo.allocator);
 
         vkDestroyCommandPool(vulkanProgramInfo.GPUDevice,
                              vulkanProgramInfo.cmdPool,
-                             nullptr);
+                             vulkanProgramInfo.allocator);
+
+        vkDestroyQueryPool(vulkanProgramInfo.GPUDevice,
+                           vulkanProgramInfo.timestampQueryPool,
+                           vulkanProgramInfo.allocator);
 
 		vkDestroyPipeline(vulkanProgramInfo.GPUDevice,
 						  vulkanProgramInfo.graphicsPipeline,
-						  nullptr);
+						  vulkanProgramInfo.allocator);
 
         vkDestroyPipelineLayout(vulkanProgramInfo.GPUDevice,
                                 vulkanProgramInfo.pipelineLayout,
-                                nullptr);
+                                vulkanProgramInfo.allocator);
 
 		vkDestroyRenderPass(vulkanProgramInfo.GPUDevice,
 							vulkanProgramInfo.renderPass,
-							nullptr);
+							vulkanProgramInfo.allocator);
 
 
-        vkDestroyDevice(vulkanProgramInfo.GPUDevice, nullptr);
+        vkDestroyDevice(vulkanProgramInfo.GPUDevice, vulkanProgramInfo.allocator);
 
         destroyDebugUtilsMessenger(vulkanProgramInfo.vulkanInstance,
                                    vulkanProgramInfo.debugMessenger,
-                                   nullptr);
+                                   vulkanProgramInfo.allocator);
 
         vkDestroySurfaceKHR(vulkanProgramInfo.vulkanInstance,
                             vulkanProgramInfo.vulkanSurface,
-                            nullptr);
+                            vulkanProgramInfo.allocator);
+        for (const ExtraWindow &extra: extraWindows)
+        {
+            vkDestroySurfaceKHR(vulkanProgramInfo.vulkanInstance, extra.surface, vulkanProgramInfo.allocator);
+        }
 
-        vkDestroyInstance(vulkanProgramInfo.vulkanInstance, nullptr);
+        vkDestroyInstance(vulkanProgramInfo.vulkanInstance, vulkanProgramInfo.allocator);
 
+        // Everything created through the callbacks is gone now, whatever is still live leaked
+        hostAllocator.writeReport(std::cout);
+        if (hostAllocator.hasLeaks())
+        {
+            std::cout << "Warning: host memory still allocated after vkDestroyInstance" << std::endl;
+        }
+
+        vulkanProgramInfo.jobs.stop();
+
+        for (const ExtraWindow &extra: extraWindows)
+        {
+            glfwDestroyWindow(extra.window);
+        }
         glfwDestroyWindow(window);
         glfwTerminate();
 
@@ -1108,7 +5911,7 @@ private:
         VkShaderModule shaderModule;
         if (vkCreateShaderModule(vulkanProgramInfo.GPUDevice,
                                  &createInfo,
-                                 nullptr,
+                                 vulkanProgramInfo.allocator,
                                  &shaderModule) != VK_SUCCESS)
         {
             throw std::runtime_error("failed to create shader module!");
@@ -1117,6 +5920,38 @@ private:
         return shaderModule;
     }
 
+    /**
+     * Find a memory type allowed by <typeBits> that has all of <properties>. Returns false if there is none.
+     */
+    bool findOptionalMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties, uint32_t &memoryTypeIndex) const
+    {
+        const VkPhysicalDeviceMemoryProperties &memoryProperties = vulkanProgramInfo.memoryProperties;
+
+        for (memoryTypeIndex = 0; memoryTypeIndex < memoryProperties.memoryTypeCount; memoryTypeIndex++)
+        {
+            if ((typeBits & (1u << memoryTypeIndex)) &&
+                (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & properties) == properties)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Find a memory type allowed by <typeBits> that has all of <properties>, exits if there is none
+     */
+    uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const
+    {
+        uint32_t memoryTypeIndex = 0;
+        if (!findOptionalMemoryType(typeBits, properties, memoryTypeIndex))
+        {
+            std::cout << "Failed to find a suitable memory type" << std::endl;
+            exit(-1);
+        }
+        return memoryTypeIndex;
+    }
+
     static std::vector<char> readFile(const std::string &filename)
     {
         std::ifstream file(filename, std::ios::ate | std::ios::binary);
@@ -1138,6 +5973,51 @@ private:
         return buffer;
     }
 
+    /**
+     * GLFW callback flagging that the swapchain has to follow the new framebuffer size
+     */
+    static void framebufferResizeCallback(GLFWwindow *resizedWindow, int width, int height)
+    {
+        auto program = reinterpret_cast<VulkanProgram *>(glfwGetWindowUserPointer(resizedWindow));
+        RenderEvent event{RenderEvent::Type::FramebufferResize, width, height};
+        for (std::size_t i = 0; i < program->extraWindows.size(); i++)
+        {
+            if (program->extraWindows[i].window == resizedWindow)
+            {
+                event.windowIndex = (uint32_t) i + 1;
+            }
+        }
+        program->pushRenderEvent(event);
+    }
+
+    /**
+     * Closing any window ends the program, the main loop only watches the primary one
+     */
+    static void extraWindowCloseCallback(GLFWwindow *closedWindow)
+    {
+        auto program = reinterpret_cast<VulkanProgram *>(glfwGetWindowUserPointer(closedWindow));
+        glfwSetWindowShouldClose(program->window, GLFW_TRUE);
+    }
+
+    static void windowRefreshCallback(GLFWwindow *exposedWindow)
+    {
+        auto program = reinterpret_cast<VulkanProgram *>(glfwGetWindowUserPointer(exposedWindow));
+        program->pushRenderEvent({RenderEvent::Type::Expose});
+    }
+
+    static void keyCallback(GLFWwindow *keyWindow,
+                            int key,
+                            __attribute__((unused)) int scancode,
+                            int action,
+                            __attribute__((unused)) int mods)
+    {
+        if (action == GLFW_PRESS)
+        {
+            auto program = reinterpret_cast<VulkanProgram *>(glfwGetWindowUserPointer(keyWindow));
+            program->pushRenderEvent({RenderEvent::Type::KeyPress, 0, 0, key});
+        }
+    }
+
     /**
      * A callback for debug messenger
      */
@@ -1157,10 +6037,12 @@ private:
     static bool checkEnabledExtensionsSupported(const std::vector<VkExtensionProperties> &supportedExtensions,
                                                 const std::vector<const char *> &enabledExtensions)
     {
-        bool currExtensionSupported = false;
+        bool currExtensionSupported;
 
         for (const char *const &enabledExtension: enabledExtensions)
         {
+            currExtensionSupported = false;
+
             for (const VkExtensionProperties &supportedExtension: supportedExtensions)
             {
                 if (strcmp(supportedExtension.extensionName, enabledExtension) == 0)
@@ -1216,9 +6098,156 @@ private:
 
 };
 
-int main()
+int main(int argc, char **argv)
 {
-    VulkanProgram vulkanProgram{};
+    ProgramOptions programOptions{};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--render-pass") == 0)
+        {
+            programOptions.forceRenderPass = true;
+        } else if (strcmp(argv[i], "--self-test") == 0)
+        {
+            // CPU only, runs before any window or device exists
+            return RenderGraphSelfTest::run() ? 0 : 1;
+        } else if (strncmp(argv[i], "--dump-graph=", strlen("--dump-graph=")) == 0)
+        {
+            programOptions.graphDumpPath = argv[i] + strlen("--dump-graph=");
+        } else if (strncmp(argv[i], "--msaa=", strlen("--msaa=")) == 0)
+        {
+            programOptions.msaaSamples = (uint32_t) std::max(1, atoi(argv[i] + strlen("--msaa=")));
+        } else if (strncmp(argv[i], "--gpu=", strlen("--gpu=")) == 0)
+        {
+            programOptions.gpuSelection = argv[i] + strlen("--gpu=");
+        } else if (strncmp(argv[i], "--bench=", strlen("--bench=")) == 0)
+        {
+            programOptions.benchmark = argv[i] + strlen("--bench=");
+        } else if (strcmp(argv[i], "--host-allocator=system") == 0)
+        {
+            programOptions.hostAllocatorMode = HostAllocator::Mode::System;
+        } else if (strcmp(argv[i], "--host-allocator=tracking") == 0)
+        {
+            programOptions.hostAllocatorMode = HostAllocator::Mode::Tracking;
+        } else if (strcmp(argv[i], "--host-allocator=pool") == 0)
+        {
+            programOptions.hostAllocatorMode = HostAllocator::Mode::Pool;
+        } else if (strcmp(argv[i], "--async-compute=on") == 0)
+        {
+            programOptions.asyncCompute = true;
+        } else if (strcmp(argv[i], "--async-compute=off") == 0)
+        {
+            programOptions.asyncCompute = false;
+        } else if (strcmp(argv[i], "--submit-thread=on") == 0)
+        {
+            programOptions.submitThread = true;
+        } else if (strcmp(argv[i], "--submit-thread=off") == 0)
+        {
+            programOptions.submitThread = false;
+        } else if (strncmp(argv[i], "--fps=", strlen("--fps=")) == 0)
+        {
+            programOptions.targetFrameRate = std::max(0.0, atof(argv[i] + strlen("--fps=")));
+        } else if (strcmp(argv[i], "--late-input=on") == 0)
+        {
+            programOptions.lateInputSampling = true;
+        } else if (strcmp(argv[i], "--late-input=off") == 0)
+        {
+            programOptions.lateInputSampling = false;
+        } else if (strncmp(argv[i], "--latency-csv=", strlen("--latency-csv=")) == 0)
+        {
+            programOptions.latencyCsvPath = argv[i] + strlen("--latency-csv=");
+        } else if (strncmp(argv[i], "--dynamic-resolution=", strlen("--dynamic-resolution=")) == 0)
+        {
+            programOptions.frameBudget = std::max(0.0, atof(argv[i] + strlen("--dynamic-resolution=")));
+        } else if (strcmp(argv[i], "--readback") == 0)
+        {
+            programOptions.readback = true;
+        } else if (strncmp(argv[i], "--record=", strlen("--record=")) == 0)
+        {
+            programOptions.recordPath = argv[i] + strlen("--record=");
+        } else if (strncmp(argv[i], "--poster=", strlen("--poster=")) == 0)
+        {
+            // <width>x<height>:<file>, sizes that do not fit 32 bits are rejected rather than wrapped
+            const char *spec = argv[i] + strlen("--poster=");
+            const char *specEnd = spec + strlen(spec);
+            std::from_chars_result widthParsed = std::from_chars(spec, specEnd, programOptions.posterWidth);
+            bool validSpec = widthParsed.ec == std::errc() && widthParsed.ptr != specEnd && *widthParsed.ptr == 'x';
+            std::from_chars_result heightParsed{};
+            if (validSpec)
+            {
+                heightParsed = std::from_chars(widthParsed.ptr + 1, specEnd, programOptions.posterHeight);
+                validSpec = heightParsed.ec == std::errc() && heightParsed.ptr != specEnd &&
+                            *heightParsed.ptr == ':' && heightParsed.ptr + 1 != specEnd;
+            }
+            if (!validSpec)
+            {
+                std::cout << "Expected --poster=<width>x<height>:<file>" << std::endl;
+                return -1;
+            }
+            programOptions.posterPath = heightParsed.ptr + 1;
+
+            std::string sizeError = VulkanProgram::checkTiledImageSize(programOptions.posterPath,
+                                                                       programOptions.posterWidth,
+                                                                       programOptions.posterHeight);
+            if (!sizeError.empty())
+            {
+                std::cout << "Invalid --poster size: " << sizeError << std::endl;
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--serve=", strlen("--serve=")) == 0)
+        {
+            programOptions.servePath = argv[i] + strlen("--serve=");
+        } else if (strncmp(argv[i], "--windows=", strlen("--windows=")) == 0)
+        {
+            programOptions.windowCount = std::min(SubmitThread::maxSwapchains,
+                                                  (uint32_t) std::max(1, atoi(argv[i] + strlen("--windows="))));
+        } else if (strcmp(argv[i], "--on-demand") == 0)
+        {
+            programOptions.onDemand = true;
+        } else if (strncmp(argv[i], "--particles=", strlen("--particles=")) == 0)
+        {
+            programOptions.particleCount = (uint32_t) std::max(1, atoi(argv[i] + strlen("--particles=")));
+        } else if (strncmp(argv[i], "--compute-load=", strlen("--compute-load=")) == 0)
+        {
+            programOptions.computeLoad = (uint32_t) std::max(0, atoi(argv[i] + strlen("--compute-load=")));
+        } else
+        {
+            std::cout << "Unknown argument: " << argv[i] << std::endl;
+            std::cout << "Usage: " << argv[0] << " [--self-test] [--render-pass] [--dump-graph=<file.dot>]"
+                      << " [--msaa=<samples>] [--gpu=<index|name|uuid>] [--bench=dispatch|async-compute|jobs]"
+                      << " [--host-allocator=system|tracking|pool] [--async-compute=on|off]"
+                      << " [--submit-thread=on|off] [--on-demand] [--fps=<rate>] [--late-input=on|off]"
+                      << " [--latency-csv=<file.csv>] [--dynamic-resolution=<budget ms>] [--particles=<count>]"
+                      << " [--compute-load=<iterations>] [--readback] [--record=<file.y4m|file.rgb|->]"
+                      << " [--poster=<width>x<height>:<file.png|file.ppm|file.rgb>] [--serve=<spool directory>]"
+                      << " [--windows=<count>]" << std::endl;
+            return -1;
+        }
+    }
+
+    // Only the render loop presents, benchmarks, posters and the batch service keep to one window
+    if (programOptions.windowCount > 1 &&
+        (!programOptions.benchmark.empty() || !programOptions.posterPath.empty() ||
+         !programOptions.servePath.empty()))
+    {
+        std::cout << "--windows only applies to the render loop, using one window" << std::endl;
+        programOptions.windowCount = 1;
+    }
+
+    // Recording to standard output owns it, messages go to standard error instead
+    if (programOptions.recordPath == "-")
+    {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+
+    // CPU only like --self-test, so it also runs on machines without a display
+    if (programOptions.benchmark == "jobs")
+    {
+        JobSystemBenchmark::run(programOptions.computeLoad);
+        return 0;
+    }
+
+    VulkanProgram vulkanProgram{programOptions};
     vulkanProgram.run();
     return 0;
 }